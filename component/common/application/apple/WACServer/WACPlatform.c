@@ -7,6 +7,7 @@
 #include <lwip/netif.h>
 #include "webserver.h"
 #include <phytrex_homekit_flow.h>
+#include "kv_store.h"
 
 extern struct netif xnetif[];
 #ifdef PHYTREX
@@ -50,12 +51,7 @@ void WACPlatformNotify(WACNotify_t notify)
 // called when WAC configuration for network connection validated
 void WACPlatformSaveConfig(WACPersistentConfig_t *config)
 {
-	uint8_t *flash_buffer = (uint8_t *) malloc(FLASH_DATA_LEN);
-	flash_stream_read(&flash, FLASH_DATA_ADDR, FLASH_DATA_LEN, flash_buffer);
-	flash_erase_sector(&flash, FLASH_DATA_ADDR);
-	memcpy(flash_buffer + WAC_FLASH_OFFSET, config, sizeof(WACPersistentConfig_t));
-	flash_stream_write(&flash, FLASH_DATA_ADDR, FLASH_DATA_LEN, flash_buffer);
-	free(flash_buffer);
+	FlashKVWrite(KV_WAC_CONFIG, config, sizeof(WACPersistentConfig_t));
 }
 
 // Mandatory function to get SSID for WAC Soft AP
@@ -79,5 +75,5 @@ char *WACPlatformSWAPName(void)
 // Example to read WAC configuration from persistent storage
 void WACPlatformReadConfig(WACPersistentConfig_t *config)
 {
-	flash_stream_read(&flash, FLASH_DATA_ADDR + WAC_FLASH_OFFSET , sizeof(WACPersistentConfig_t), config);
+	FlashKVRead(KV_WAC_CONFIG, config, sizeof(WACPersistentConfig_t));
 }
@@ -147,5 +147,8 @@ int AccessoryPlatformInitialize(void);
 cJSON *AccessoryDatabaseSetup(HAPParameter_t *param);
 int AccessoryOperationHandler(int aid, int iid, cJSON *valueJSObject);
 
+// HAPPlatform.c, c# for the database with this layout hash
+uint32_t HAPPlatformConfigNumber(uint32_t db_hash);
+
 #endif	/* __HAP_ACCESSORY_H__ */
 
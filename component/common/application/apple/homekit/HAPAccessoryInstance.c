@@ -146,6 +146,8 @@ cJSON *AccessoryDatabaseSetup(HAPParameter_t *param)
 #endif
 
 	HAPRefreshDatabase(database);
+	HAPBuildDescIndex(database);
+	param->config_number = HAPPlatformConfigNumber(HAPDatabaseHash(database));
 
 	return database;
 }
@@ -155,11 +157,13 @@ cJSON *AccessoryDatabaseSetup(HAPParameter_t *param)
 int AccessoryOperationHandler(int aid, int iid, cJSON *valueJSObject)
 {
         int status = kHAPStatus_InvalidValue;
+#if MODEL == 0 || MODEL == 1
 	cJSON *accessoryJSObject, *serviceJSObject, *characteristicJSObject;
 
 	accessoryJSObject = HAPSearchDatabaseAID(database, aid);
 	characteristicJSObject = HAPSearchDatabaseIID(database, accessoryJSObject, iid);
 	serviceJSObject = HAPSearchCharacteristicService(database, characteristicJSObject);
+#endif
 
 #if MODEL == 0
 	// Handle for Lightbulb
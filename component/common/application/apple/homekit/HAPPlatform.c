@@ -7,10 +7,12 @@
 
 #include <platform_stdlib.h>
 #include <homekit/HAP.h>
+#include <WACServer/WAC.h>
 #include <flash_api.h>
 #include <model.h>
 #include "phytrex_model.h"
 #include "phytrex_homekit_flow.h"
+#include "kv_store.h"
 
 /* An example of WAC/HAP data offset in one block. It can be modified based on requirement.
  * For flash data at 0xFF000 block
@@ -23,6 +25,139 @@
 #define FLASH_SETUPCODE_OFFSET      0x930*/
 
 extern PhytrexParameter_t ex_param;
+extern MyVersion cur_ver;
+
+typedef struct {
+	uint8_t   code[16];
+	uint32_t  len;
+} PersistentSetupcode_t;
+
+typedef struct {
+	uint32_t  db_hash;
+	uint32_t  config_number;
+} PersistentConfig_t;
+
+typedef struct {
+	uint32_t  marked;     // FLASH_KV_MARK was programmed and read back
+} PersistentLegacy_t;
+
+#define KV_LEGACY_PAIRINGS  ((FLASH_SETUPCODE_OFFSET - HAP_FLASH_PAIRING_OFFSET) / sizeof(HAPPersistentPairing_t))
+
+static void kv_import(uint16_t key, uint32_t offset, uint32_t len)
+{
+	uint8_t buf[sizeof(HAPPersistentPairing_t)];
+	uint32_t i;
+
+	if(len > sizeof(buf))
+		return;
+	flash_stream_read(&flash, FLASH_DATA_ADDR + offset, len, buf);
+	for(i = 0; i < len; i++) {
+		if(buf[i] != 0xFF) {
+			FlashKVWrite(key, buf, len);
+			break;
+		}
+	}
+}
+
+static uint32_t kv_legacy_mark_read(void)
+{
+	uint32_t mark;
+
+	flash_cached_read(&flash, FLASH_DATA_ADDR + FLASH_KV_MARK_OFFSET, sizeof(mark), (uint8_t *) &mark);
+	return mark;
+}
+
+// Program the mark into a blank word and read it back, the result is kept in the store
+static void kv_legacy_mark(void)
+{
+	PersistentLegacy_t legacy;
+	uint32_t mark = FLASH_KV_MARK;
+
+	if(kv_legacy_mark_read() == 0xFFFFFFFF)
+		flash_stream_write(&flash, FLASH_DATA_ADDR + FLASH_KV_MARK_OFFSET, sizeof(mark), (uint8_t *) &mark);
+	legacy.marked = (kv_legacy_mark_read() == FLASH_KV_MARK);
+	if(!legacy.marked)
+		printf("\r\n[%s] mark not written, erases of the old sector are not seen\r\n", __func__);
+	FlashKVWrite(KV_LEGACY, &legacy, sizeof(legacy));
+}
+
+// A blank mark word after a good mark means the old sector was erased (phytrex_reset(),
+// factory reset). Only the keys imported from that sector are dropped, then the mark is set
+// again, so anything saved after the erase (the setup code kept by a factory reset) stays.
+static void kv_legacy_check(void)
+{
+	PersistentLegacy_t legacy;
+	uint32_t mark = kv_legacy_mark_read();
+	int i;
+
+	if(mark == FLASH_KV_MARK)
+		return;
+	if((mark == 0xFFFFFFFF) && (kv_get(KV_LEGACY, &legacy, sizeof(legacy)) == sizeof(legacy)) && legacy.marked) {
+		kv_delete(KV_WAC_CONFIG);
+		kv_delete(KV_HAP_KEYPAIR);
+		for(i = 0; i < KV_LEGACY_PAIRINGS; i++)
+			kv_delete(KV_HAP_PAIRING + i);
+		kv_delete(KV_SETUPCODE);
+		printf("\r\n[%s] old sector erased, WAC/HAP data dropped\r\n", __func__);
+	}
+	if(mark == 0xFFFFFFFF)
+		kv_legacy_mark();
+}
+
+// The WAC/HAP data lives in the kv store, so an update appends a record instead of erasing the
+// whole FLASH_DATA_ADDR sector. That sector is imported once, the KV_LEGACY record says so.
+// The store is mounted on the first access only. An erase of the old sector is seen there, the
+// resets in lib_phytrex reboot afterwards, and code erasing it at run time calls FlashKVErased().
+void FlashKVOpen(void)
+{
+	static int opened = 0;
+	PersistentLegacy_t legacy;
+	int i;
+
+	if(opened)
+		return;
+	opened = 1;
+
+	kv_init();
+	if(kv_get(KV_LEGACY, &legacy, sizeof(legacy)) == sizeof(legacy)) {
+		kv_legacy_check();
+		return;
+	}
+	// a marked sector was imported already, its data may be older than the store
+	if(kv_legacy_mark_read() != FLASH_KV_MARK) {
+		kv_import(KV_WAC_CONFIG, WAC_FLASH_OFFSET, sizeof(WACPersistentConfig_t));
+		kv_import(KV_HAP_KEYPAIR, HAP_FLASH_KEYPAIR_OFFSET, sizeof(HAPPersistentKeypair_t));
+		for(i = 0; i < KV_LEGACY_PAIRINGS; i++)
+			kv_import(KV_HAP_PAIRING + i, HAP_FLASH_PAIRING_OFFSET + i * sizeof(HAPPersistentPairing_t), sizeof(HAPPersistentPairing_t));
+		kv_import(KV_SETUPCODE, FLASH_SETUPCODE_OFFSET, sizeof(PersistentSetupcode_t));
+		printf("\r\n[%s] imported the WAC/HAP data\r\n", __func__);
+	}
+	kv_legacy_mark();
+}
+
+// Drop the keys imported from the old sector after it was erased, see kv_legacy_check()
+void FlashKVErased(void)
+{
+	FlashKVOpen();
+	kv_legacy_check();
+}
+
+void FlashKVRead(uint16_t key, void *buf, uint32_t len)
+{
+	FlashKVOpen();
+	if(kv_get(key, buf, len) != (int) len)
+		memset(buf, 0xFF, len);
+}
+
+int FlashKVWrite(uint16_t key, const void *buf, uint32_t len)
+{
+	FlashKVOpen();
+	if((len > KV_MAX_LEN) || (kv_set(key, buf, len) < 0)) {
+		printf("\r\n[%s] key %04x (%u bytes) not saved\r\n", __func__, key, len);
+		return -1;
+	}
+	return 0;
+}
 
 /*-----------------------------------------------------------------------
  * Mandatory functions
@@ -46,38 +181,35 @@ void HAPPlatformNotify(HAPNotify_t notify)
 // called when HAP accessory key pair generation
 void HAPPlatformSaveKeypair(HAPPersistentKeypair_t *keypair)
 {
-	uint8_t *flash_buffer = (uint8_t *) malloc(FLASH_DATA_LEN);
-	flash_stream_read(&flash, FLASH_DATA_ADDR, FLASH_DATA_LEN, flash_buffer);
-	flash_erase_sector(&flash, FLASH_DATA_ADDR);
-	memcpy(flash_buffer + HAP_FLASH_KEYPAIR_OFFSET, keypair, sizeof(HAPPersistentKeypair_t));
-	flash_stream_write(&flash, FLASH_DATA_ADDR, FLASH_DATA_LEN, flash_buffer);
-	free(flash_buffer);
+	FlashKVWrite(KV_HAP_KEYPAIR, keypair, sizeof(HAPPersistentKeypair_t));
 }
 
 // Mandatory function to load accessory key pair from persistent storage
 // called when HAP initialization
 void HAPPlatformLoadKeypair(HAPPersistentKeypair_t *keypair)
 {
-	flash_stream_read(&flash, FLASH_DATA_ADDR + HAP_FLASH_KEYPAIR_OFFSET , sizeof(HAPPersistentKeypair_t), keypair);
+	FlashKVRead(KV_HAP_KEYPAIR, keypair, sizeof(HAPPersistentKeypair_t));
 }
 
 // Mandatory function to save controller pairing to persistent storage
 // called when HAP controller pairing update
+// one record per pairing, the unchanged ones are not written again
 void HAPPlatformSavePairings(HAPPersistentPairing_t *pairing, int num)
 {
-	uint8_t *flash_buffer = (uint8_t *) malloc(FLASH_DATA_LEN);
-	flash_stream_read(&flash, FLASH_DATA_ADDR, FLASH_DATA_LEN, flash_buffer);
-	flash_erase_sector(&flash, FLASH_DATA_ADDR);
-	memcpy(flash_buffer + HAP_FLASH_PAIRING_OFFSET, pairing, sizeof(HAPPersistentPairing_t) * num);
-	flash_stream_write(&flash, FLASH_DATA_ADDR, FLASH_DATA_LEN, flash_buffer);
-	free(flash_buffer);
+	int i;
+
+	for(i = 0; i < num; i++)
+		FlashKVWrite(KV_HAP_PAIRING + i, &pairing[i], sizeof(HAPPersistentPairing_t));
 }
 
 // Mandatory function to load controller pairing from persistent storage
 // called when HAP initialization
 void HAPPlatformLoadPairings(HAPPersistentPairing_t *pairing, int num)
 {
-	flash_stream_read(&flash, FLASH_DATA_ADDR + HAP_FLASH_PAIRING_OFFSET , sizeof(HAPPersistentPairing_t) * num, pairing);
+	int i;
+
+	for(i = 0; i < num; i++)
+		FlashKVRead(KV_HAP_PAIRING + i, &pairing[i], sizeof(HAPPersistentPairing_t));
 }
 
 // Mandatory function to save HAP state number to persistent storage
@@ -85,6 +217,7 @@ void HAPPlatformLoadPairings(HAPPersistentPairing_t *pairing, int num)
 void HAPPlatformSaveStateNumber(uint32_t state_number)
 {
 	printf("\nUpdate s#=%u\n", state_number);
+	FlashKVWrite(KV_HAP_STATE, &state_number, sizeof(state_number));
 }
 
 // Mandatory function to load HAP state number from persistent storage
@@ -93,11 +226,41 @@ uint32_t HAPPlatformLoadStateNumber(void)
 {
 	uint32_t state_number;
 
-	state_number = 1;
+	FlashKVRead(KV_HAP_STATE, &state_number, sizeof(state_number));
+	if((state_number == 0) || (state_number == 0xFFFFFFFF))
+		state_number = 1;
 
 	return state_number;
 }
 
+// c# only moves when the accessory database layout or the firmware changes, so controllers keep
+// their cached copy across reboots. Called after HAPRefreshDatabase(), before the bonjour record is
+// published. Without a record the firmware used to publish c#=1, so the first stored value is 2
+uint32_t HAPPlatformConfigNumber(uint32_t db_hash)
+{
+	PersistentConfig_t config;
+	const uint8_t *ver = (const uint8_t *) &cur_ver;
+	int i;
+
+	// the layout hash leaves the values out, Firmware Revision included, so add the image version
+	for(i = 0; i < sizeof(cur_ver); i++)
+		db_hash = (db_hash ^ ver[i]) * 16777619UL;
+
+	FlashKVOpen();
+	if(kv_get(KV_HAP_CONFIG, &config, sizeof(config)) != sizeof(config))
+		config.config_number = 1;
+	else if(config.db_hash == db_hash)
+		return config.config_number;
+
+	config.db_hash = db_hash;
+	if((++ config.config_number > 65535) || (config.config_number == 0))	// c# is 1..65535
+		config.config_number = 1;
+	FlashKVWrite(KV_HAP_CONFIG, &config, sizeof(config));
+	printf("\nUpdate c#=%u (database %08x)\n", config.config_number, db_hash);
+
+	return config.config_number;
+}
+
 void HAPPlatformLoadDeviceID(char *id_str_buf)
 {
 	phytrex_FlashDataRead(&ex_param, sizeof(ex_param));
@@ -127,15 +290,10 @@ void random_setupcode(char *buf)
 	                                   rbytes[4] % 10, rbytes[5] % 10, rbytes[6] % 10, rbytes[7] % 10);
 }
 
-typedef struct {
-	uint8_t   code[16];
-	uint32_t  len;
-} PersistentSetupcode_t;
-
 void FlashSetupcodeRead(char *buf)
 {
 	PersistentSetupcode_t setupcode;
-	flash_stream_read(&flash, FLASH_DATA_ADDR + FLASH_SETUPCODE_OFFSET , sizeof(PersistentSetupcode_t), &setupcode);
+	FlashKVRead(KV_SETUPCODE, &setupcode, sizeof(PersistentSetupcode_t));
 
 	if(setupcode.len == 10)
 		strcpy(buf, setupcode.code);
@@ -151,11 +309,6 @@ void FlashSetupcodeWrite(char *code)
 		setupcode.len = 10;
 		strcpy(setupcode.code, code);
 
-		uint8_t *flash_buffer = (uint8_t *) malloc(FLASH_DATA_LEN);
-		flash_stream_read(&flash, FLASH_DATA_ADDR, FLASH_DATA_LEN, flash_buffer);
-		flash_erase_sector(&flash, FLASH_DATA_ADDR);
-		memcpy(flash_buffer + FLASH_SETUPCODE_OFFSET, &setupcode, sizeof(PersistentSetupcode_t));
-		flash_stream_write(&flash, FLASH_DATA_ADDR, FLASH_DATA_LEN, flash_buffer);
-		free(flash_buffer);
+		FlashKVWrite(KV_SETUPCODE, &setupcode, sizeof(PersistentSetupcode_t));
 	}
 }
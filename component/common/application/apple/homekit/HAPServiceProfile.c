@@ -5,8 +5,13 @@
  *  possession or use of this module requires written permission of RealTek.
  */
 
+#include <stddef.h>
+#include <platform_stdlib.h>
+#include "FreeRTOS.h"
+#include "task.h"
 #include <homekit/HAPAccessory.h>
 #include <homekit/HAPServiceProfile.h>
+#include <homekit/HAPAccessoryAPI.h>
 #include <cJSON.h>
 #include "model.h"
 
@@ -573,294 +578,82 @@ cJSON *HAPCreateOutletService(HAPOutletService_t *service)
 
 	return serviceJSObject;
 }
-cJSON *ES_HAPCreateOutletService(HAPOutletService_t *service)
-{
-	cJSON *serviceJSObject = NULL;
-	cJSON *characteristicJSArray, *characteristicJSObject, *chaJSObject;
-	char *rPerms[1] = {kCharacteristicPermission_PairedRead};
-	char *rePerms[2] = {kCharacteristicPermission_PairedRead, kCharacteristicPermission_Events};
-	char *rwePerms[3] = {kCharacteristicPermission_PairedRead, kCharacteristicPermission_PairedWrite, kCharacteristicPermission_Events};
-       char *wPerms[1] = {kCharacteristicPermission_PairedWrite};
-	if((serviceJSObject = cJSON_CreateObject()) != NULL) {
-		cJSON_AddItemToObject(serviceJSObject, kServiceObject_Type, cJSON_CreateString(kServiceUUID_Outlet));
-		cJSON_AddItemToObject(serviceJSObject, kServiceObject_InstanceID, cJSON_CreateNull());
-		characteristicJSArray = cJSON_CreateArray();
-		cJSON_AddItemToObject(serviceJSObject, kServiceObject_Characteristics, characteristicJSArray);
+#define OUTLET_OFS(field)    offsetof(outlet_state, field)
+
+static const HAPCharacteristicDesc_t ES_OutletChars[] = {
+	// public.hap.characteristic.on (required)
+	{kCharacteristicUUID_On, kCharacteristicFormat_Boolean, NULL, kHAPDescPerm_PR | kHAPDescPerm_PW | kHAPDescPerm_EV, 0, OUTLET_CHA_ON, OUTLET_OFS(on), ON_STATE},
+	// public.hap.characteristic.outlet-in-use (required)
+	{kCharacteristicUUID_OutletInUse, kCharacteristicFormat_Boolean, NULL, kHAPDescPerm_PR | kHAPDescPerm_EV, 0, OUTLET_CHA_INUSE, OUTLET_OFS(inuse), OUTLET_IN_USE_STATE},
+#if !FIRST_VERSION
+	//custom.esoft.hap.characteristic.ohd.month
+	{kChaUUID_Month_Data, kChaFormat_Data, NULL, kHAPDescPerm_PR | kHAPDescPerm_EV, 0, OUTLET_CHA_MONTHDATA, kHAPDescNoOffset},
+	//custom.esoft.hap.characteristic.timer
+	{kChaUUID_Timing_On, kChaFormat_Data, NULL, kHAPDescPerm_PR | kHAPDescPerm_PW | kHAPDescPerm_EV, 0, OUTLET_CHA_TIMING, kHAPDescNoOffset},
+	//custom.esoft.hap.characteristic.meterage.quantity
+	{kChaUUID_Met_Total_Quantity, kChaFormat_Float, NULL, kHAPDescPerm_PR | kHAPDescPerm_EV, kHAPDescFlag_RateLimit, OUTLET_CHA_METQUA, OUTLET_OFS(metqua), 0},
+	//custom.esoft.hap.characteristic.meterage.voltage
+	{kChaUUID_Met_Voltage, kChaFormat_Float, NULL, kHAPDescPerm_PR | kHAPDescPerm_EV, kHAPDescFlag_RateLimit, OUTLET_CHA_METVOL, OUTLET_OFS(metvol), 0},
+	//custom.esoft.hap.characteristic.meterage.current
+	{kChaUUID_Met_Current, kChaFormat_Float, NULL, kHAPDescPerm_PR | kHAPDescPerm_EV, kHAPDescFlag_RateLimit, OUTLET_CHA_METCUR, OUTLET_OFS(metcur), 0},
+	//custom.esoft.hap.characteristic.meterage.power
+	{kChaUUID_Met_Power, kChaFormat_Float, NULL, kHAPDescPerm_PR | kHAPDescPerm_EV, kHAPDescFlag_RateLimit, OUTLET_CHA_METPOW, OUTLET_OFS(metpow), 0},
+	//custom.esoft.hap.characteristic.threshold.voltage
+	{kChaUUID_Thr_overVoltage, kChaFormat_Float, NULL, kHAPDescPerm_PR | kHAPDescPerm_PW | kHAPDescPerm_EV, kHAPDescFlag_Range, OUTLET_CHA_THRVOL_OVER, OUTLET_OFS(thrvol_over), 220, 176, 264, Quantity_Step},
+	//custom.esoft.hap.characteristic.threshold.voltage
+	{kChaUUID_Thr_underVoltage, kChaFormat_Float, NULL, kHAPDescPerm_PR | kHAPDescPerm_PW | kHAPDescPerm_EV, kHAPDescFlag_Range, OUTLET_CHA_THRVOL_UNDER, OUTLET_OFS(thrvol_under), 220, 176, 264, Quantity_Step},
+	//custom.esoft.hap.characteristic.threshold.current
+	{kChaUUID_Thr_Current, kChaFormat_Float, NULL, kHAPDescPerm_PR | kHAPDescPerm_PW | kHAPDescPerm_EV, kHAPDescFlag_Range, OUTLET_CHA_THRCUR, OUTLET_OFS(thrcur), 10, 0, 10, Quantity_Step},
+	//custom.esoft.hap.characteristic.threshold.power
+	{kChaUUID_Thr_Power, kChaFormat_Float, NULL, kHAPDescPerm_PR | kHAPDescPerm_PW | kHAPDescPerm_EV, kHAPDescFlag_Range, OUTLET_CHA_THRPOW, OUTLET_OFS(thrpow), 2.2, 0, 2.2, Quantity_Step},
+	//custom.esoft.hap.characteristic.firstHistory.data ... eighthHistory.data
+	{kChaUUID_1st_Hisdata, kChaFormat_Data, NULL, kHAPDescPerm_PR | kHAPDescPerm_EV, 0, OUTLET_CHA_HISDATA1, kHAPDescNoOffset},
+	{kChaUUID_2nd_Hisdata, kChaFormat_Data, NULL, kHAPDescPerm_PR | kHAPDescPerm_EV, 0, OUTLET_CHA_HISDATA2, kHAPDescNoOffset},
+	{kChaUUID_3rd_Hisdata, kChaFormat_Data, NULL, kHAPDescPerm_PR | kHAPDescPerm_EV, 0, OUTLET_CHA_HISDATA3, kHAPDescNoOffset},
+	{kChaUUID_4th_Hisdata, kChaFormat_Data, NULL, kHAPDescPerm_PR | kHAPDescPerm_EV, 0, OUTLET_CHA_HISDATA4, kHAPDescNoOffset},
+	{kChaUUID_5th_Hisdata, kChaFormat_Data, NULL, kHAPDescPerm_PR | kHAPDescPerm_EV, 0, OUTLET_CHA_HISDATA5, kHAPDescNoOffset},
+	{kChaUUID_6th_Hisdata, kChaFormat_Data, NULL, kHAPDescPerm_PR | kHAPDescPerm_EV, 0, OUTLET_CHA_HISDATA6, kHAPDescNoOffset},
+	{kChaUUID_7th_Hisdata, kChaFormat_Data, NULL, kHAPDescPerm_PR | kHAPDescPerm_EV, 0, OUTLET_CHA_HISDATA7, kHAPDescNoOffset},
+	{kChaUUID_8th_Hisdata, kChaFormat_Data, NULL, kHAPDescPerm_PR | kHAPDescPerm_EV, 0, OUTLET_CHA_HISDATA8, kHAPDescNoOffset},
+#endif
+};
 
-		// public.hap.characteristic.on (required)
-		characteristicJSObject = cJSON_CreateObject();
-		cJSON_AddItemToArray(characteristicJSArray, characteristicJSObject);
-		cJSON_AddItemToObject(characteristicJSObject, kCharacteristicObject_Type, cJSON_CreateString(kCharacteristicUUID_On));
-		cJSON_AddItemToObject(characteristicJSObject, kCharacteristicObject_InstanceID, cJSON_CreateNull());
-		cJSON_AddItemToObject(characteristicJSObject, kCharacteristicObject_Value, (service->on) ? cJSON_CreateBool(cJSON_True) : cJSON_CreateBool(cJSON_False));
-		cJSON_AddItemToObject(characteristicJSObject, kCharacteristicObject_Permissions, cJSON_CreateStringArray(rwePerms, 3));
-		cJSON_AddItemToObject(characteristicJSObject, kCharacteristicObject_Format, cJSON_CreateString(kCharacteristicFormat_Boolean));
+const HAPServiceDesc_t ES_OutletServiceDesc = {
+	kServiceUUID_Outlet, ES_OutletChars, sizeof(ES_OutletChars) / sizeof(ES_OutletChars[0])
+};
 
-		// public.hap.characteristic.outlet-in-use (required)
-		characteristicJSObject = cJSON_CreateObject();
-		cJSON_AddItemToArray(characteristicJSArray, characteristicJSObject);
-		cJSON_AddItemToObject(characteristicJSObject, kCharacteristicObject_Type, cJSON_CreateString(kCharacteristicUUID_OutletInUse));
-		cJSON_AddItemToObject(characteristicJSObject, kCharacteristicObject_InstanceID, cJSON_CreateNull());
-		cJSON_AddItemToObject(characteristicJSObject, kCharacteristicObject_Value, (service->outlet_in_use) ? cJSON_CreateBool(cJSON_True) : cJSON_CreateBool(cJSON_False));
-		cJSON_AddItemToObject(characteristicJSObject, kCharacteristicObject_Permissions, cJSON_CreateStringArray(rePerms, 2));
-		cJSON_AddItemToObject(characteristicJSObject, kCharacteristicObject_Format, cJSON_CreateString(kCharacteristicFormat_Boolean));
-#if !FIRST_VERSION       
-            //custom.esoft.hap.characteristic.ohd.month
-            chaJSObject = cJSON_CreateObject();
-            cJSON_AddItemToArray(characteristicJSArray, chaJSObject);
-            cJSON_AddStringToObject(chaJSObject, kChaObj_Type, kChaUUID_Month_Data);
-            cJSON_AddItemToObject(chaJSObject, kChaObj_IID, cJSON_CreateNull());
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Val, cJSON_CreateString(""));
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Perms, cJSON_CreateStringArray(rePerms, 2));
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Format, cJSON_CreateString(kChaFormat_Data));
-            
-            //custom.esoft.hap.characteristic.timer
-            chaJSObject = cJSON_CreateObject();
-            cJSON_AddItemToArray(characteristicJSArray, chaJSObject);
-            cJSON_AddStringToObject(chaJSObject, kChaObj_Type, kChaUUID_Timing_On);
-            cJSON_AddItemToObject(chaJSObject, kChaObj_IID, cJSON_CreateNull());
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Val, cJSON_CreateString(""));
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Perms, cJSON_CreateStringArray(rwePerms, 3));
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Format, cJSON_CreateString(kChaFormat_Data));
-      
-            //custom.esoft.hap.characteristic.meterage.quantity
-            chaJSObject = cJSON_CreateObject();
-            cJSON_AddItemToArray(characteristicJSArray, chaJSObject);
-            cJSON_AddStringToObject(chaJSObject, kChaObj_Type, kChaUUID_Met_Total_Quantity);
-            cJSON_AddItemToObject(chaJSObject, kChaObj_IID, cJSON_CreateNull());
-            cJSON_AddNumberToObject(chaJSObject, kChaObj_Val, 0);
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Perms, cJSON_CreateStringArray(rePerms, 2));
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Format, cJSON_CreateString(kChaFormat_Float));
-            
-            //custom.esoft.hap.characteristic.meterage.voltage
-            chaJSObject = cJSON_CreateObject();
-            cJSON_AddItemToArray(characteristicJSArray, chaJSObject);
-            cJSON_AddStringToObject(chaJSObject, kChaObj_Type, kChaUUID_Met_Voltage);
-            cJSON_AddItemToObject(chaJSObject, kChaObj_IID, cJSON_CreateNull());
-            cJSON_AddNumberToObject(chaJSObject, kChaObj_Val, 0);
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Perms, cJSON_CreateStringArray(rePerms, 2));
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Format, cJSON_CreateString(kChaFormat_Float));
-            
-            //custom.esoft.hap.characteristic.meterage.current
-            chaJSObject = cJSON_CreateObject();
-            cJSON_AddItemToArray(characteristicJSArray, chaJSObject);
-            cJSON_AddStringToObject(chaJSObject, kChaObj_Type, kChaUUID_Met_Current);
-            cJSON_AddItemToObject(chaJSObject, kChaObj_IID, cJSON_CreateNull());
-            cJSON_AddNumberToObject(chaJSObject, kChaObj_Val, 0);
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Perms, cJSON_CreateStringArray(rePerms, 2));
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Format, cJSON_CreateString(kChaFormat_Float));
-            
-            //custom.esoft.hap.characteristic.meterage.power
-            chaJSObject = cJSON_CreateObject();
-            cJSON_AddItemToArray(characteristicJSArray, chaJSObject);
-            cJSON_AddStringToObject(chaJSObject, kChaObj_Type, kChaUUID_Met_Power);
-            cJSON_AddItemToObject(chaJSObject, kChaObj_IID, cJSON_CreateNull());
-            cJSON_AddNumberToObject(chaJSObject, kChaObj_Val, 0);
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Perms, cJSON_CreateStringArray(rePerms, 2));
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Format, cJSON_CreateString(kChaFormat_Float));
-            
-            //custom.esoft.hap.characteristic.threshold.voltage
-            chaJSObject = cJSON_CreateObject();
-            cJSON_AddItemToArray(characteristicJSArray, chaJSObject);
-            cJSON_AddStringToObject(chaJSObject, kChaObj_Type, kChaUUID_Thr_overVoltage);
-            cJSON_AddItemToObject(chaJSObject, kChaObj_IID, cJSON_CreateNull());
-            cJSON_AddNumberToObject(chaJSObject, kChaObj_Val, 220);
-            cJSON_AddNumberToObject(chaJSObject, kChaObj_MinVal, 176);
-            cJSON_AddNumberToObject(chaJSObject, kChaObj_MaxVal, 264);
-            cJSON_AddNumberToObject(chaJSObject, kChaObj_StepVal, Quantity_Step);
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Perms, cJSON_CreateStringArray(rwePerms, 3));
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Format, cJSON_CreateString(kChaFormat_Float));
-
-            //custom.esoft.hap.characteristic.threshold.voltage
-            chaJSObject = cJSON_CreateObject();
-            cJSON_AddItemToArray(characteristicJSArray, chaJSObject);
-            cJSON_AddStringToObject(chaJSObject, kChaObj_Type, kChaUUID_Thr_underVoltage);
-            cJSON_AddItemToObject(chaJSObject, kChaObj_IID, cJSON_CreateNull());
-            cJSON_AddNumberToObject(chaJSObject, kChaObj_Val, 220);
-            cJSON_AddNumberToObject(chaJSObject, kChaObj_MinVal, 176);
-            cJSON_AddNumberToObject(chaJSObject, kChaObj_MaxVal, 264);
-            cJSON_AddNumberToObject(chaJSObject, kChaObj_StepVal, Quantity_Step);
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Perms, cJSON_CreateStringArray(rwePerms, 3));
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Format, cJSON_CreateString(kChaFormat_Float));
-            
-            //custom.esoft.hap.characteristic.threshold.current
-            chaJSObject = cJSON_CreateObject();
-            cJSON_AddItemToArray(characteristicJSArray, chaJSObject);
-            cJSON_AddStringToObject(chaJSObject, kChaObj_Type, kChaUUID_Thr_Current);
-            cJSON_AddItemToObject(chaJSObject, kChaObj_IID, cJSON_CreateNull());
-            cJSON_AddNumberToObject(chaJSObject, kChaObj_Val, 10);
-            cJSON_AddNumberToObject(chaJSObject, kChaObj_MinVal, 0);
-            cJSON_AddNumberToObject(chaJSObject, kChaObj_MaxVal, 10);
-            cJSON_AddNumberToObject(chaJSObject, kChaObj_StepVal, Quantity_Step);
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Perms, cJSON_CreateStringArray(rwePerms, 3));
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Format, cJSON_CreateString(kChaFormat_Float));
-            
-            //custom.esoft.hap.characteristic.threshold.power
-            chaJSObject = cJSON_CreateObject();
-            cJSON_AddItemToArray(characteristicJSArray, chaJSObject);
-            cJSON_AddStringToObject(chaJSObject, kChaObj_Type, kChaUUID_Thr_Power);
-            cJSON_AddItemToObject(chaJSObject, kChaObj_IID, cJSON_CreateNull());
-            cJSON_AddNumberToObject(chaJSObject, kChaObj_Val, 2.2);
-            cJSON_AddNumberToObject(chaJSObject, kChaObj_MinVal, 0);
-            cJSON_AddNumberToObject(chaJSObject, kChaObj_MaxVal, 2.2);
-            cJSON_AddNumberToObject(chaJSObject, kChaObj_StepVal, Quantity_Step);
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Perms, cJSON_CreateStringArray(rwePerms, 3));
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Format, cJSON_CreateString(kChaFormat_Float));
-            
-            //custom.esoft.hap.characteristic.firstHistory.data
-            chaJSObject = cJSON_CreateObject();
-            cJSON_AddItemToArray(characteristicJSArray, chaJSObject);
-            cJSON_AddStringToObject(chaJSObject, kChaObj_Type, kChaUUID_1st_Hisdata);
-            cJSON_AddItemToObject(chaJSObject, kChaObj_IID, cJSON_CreateNull());
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Val, cJSON_CreateString(""));
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Perms, cJSON_CreateStringArray(rePerms, 2));
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Format, cJSON_CreateString(kChaFormat_Data));
-            
-            //custom.esoft.hap.characteristic.secondHistory.data
-            chaJSObject = cJSON_CreateObject();
-            cJSON_AddItemToArray(characteristicJSArray, chaJSObject);
-            cJSON_AddStringToObject(chaJSObject, kChaObj_Type, kChaUUID_2nd_Hisdata);
-            cJSON_AddItemToObject(chaJSObject, kChaObj_IID, cJSON_CreateNull());
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Val, cJSON_CreateString(""));
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Perms, cJSON_CreateStringArray(rePerms, 2));
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Format, cJSON_CreateString(kChaFormat_Data));
-            
-            //custom.esoft.hap.characteristic.thirdHistory.data
-            chaJSObject = cJSON_CreateObject();
-            cJSON_AddItemToArray(characteristicJSArray, chaJSObject);
-            cJSON_AddStringToObject(chaJSObject, kChaObj_Type, kChaUUID_3rd_Hisdata);
-            cJSON_AddItemToObject(chaJSObject, kChaObj_IID, cJSON_CreateNull());
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Val, cJSON_CreateString(""));
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Perms, cJSON_CreateStringArray(rePerms, 2));
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Format, cJSON_CreateString(kChaFormat_Data));
-
-            //custom.esoft.hap.characteristic.fourthHistory.data
-            chaJSObject = cJSON_CreateObject();
-            cJSON_AddItemToArray(characteristicJSArray, chaJSObject);
-            cJSON_AddStringToObject(chaJSObject, kChaObj_Type, kChaUUID_4th_Hisdata);
-            cJSON_AddItemToObject(chaJSObject, kChaObj_IID, cJSON_CreateNull());
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Val, cJSON_CreateString(""));
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Perms, cJSON_CreateStringArray(rePerms, 2));
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Format, cJSON_CreateString(kChaFormat_Data));
-
-            //custom.esoft.hap.characteristic.fifthHistory.data
-            chaJSObject = cJSON_CreateObject();
-            cJSON_AddItemToArray(characteristicJSArray, chaJSObject);
-            cJSON_AddStringToObject(chaJSObject, kChaObj_Type, kChaUUID_5th_Hisdata);
-            cJSON_AddItemToObject(chaJSObject, kChaObj_IID, cJSON_CreateNull());
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Val, cJSON_CreateString(""));
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Perms, cJSON_CreateStringArray(rePerms, 2));
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Format, cJSON_CreateString(kChaFormat_Data));
-
-            //custom.esoft.hap.characteristic.sixthHistory.data
-            chaJSObject = cJSON_CreateObject();
-            cJSON_AddItemToArray(characteristicJSArray, chaJSObject);
-            cJSON_AddStringToObject(chaJSObject, kChaObj_Type, kChaUUID_6th_Hisdata);
-            cJSON_AddItemToObject(chaJSObject, kChaObj_IID, cJSON_CreateNull());
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Val, cJSON_CreateString(""));
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Perms, cJSON_CreateStringArray(rePerms, 2));
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Format, cJSON_CreateString(kChaFormat_Data));
-
-            //custom.esoft.hap.characteristic.seventhHistory.data
-            chaJSObject = cJSON_CreateObject();
-            cJSON_AddItemToArray(characteristicJSArray, chaJSObject);
-            cJSON_AddStringToObject(chaJSObject, kChaObj_Type, kChaUUID_7th_Hisdata);
-            cJSON_AddItemToObject(chaJSObject, kChaObj_IID, cJSON_CreateNull());
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Val, cJSON_CreateString(""));
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Perms, cJSON_CreateStringArray(rePerms, 2));
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Format, cJSON_CreateString(kChaFormat_Data));
-
-            //custom.esoft.hap.characteristic.eighthHistory.data
-            chaJSObject = cJSON_CreateObject();
-            cJSON_AddItemToArray(characteristicJSArray, chaJSObject);
-            cJSON_AddStringToObject(chaJSObject, kChaObj_Type, kChaUUID_8th_Hisdata);
-            cJSON_AddItemToObject(chaJSObject, kChaObj_IID, cJSON_CreateNull());
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Val, cJSON_CreateString(""));
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Perms, cJSON_CreateStringArray(rePerms, 2));
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Format, cJSON_CreateString(kChaFormat_Data));       
-#endif
-		// public.hap.characteristic.name (optional)
-		if(service->name) {
-			characteristicJSObject = cJSON_CreateObject();
-			cJSON_AddItemToArray(characteristicJSArray, characteristicJSObject);
-			cJSON_AddItemToObject(characteristicJSObject, kCharacteristicObject_Type, cJSON_CreateString(kCharacteristicUUID_Name));
-			cJSON_AddItemToObject(characteristicJSObject, kCharacteristicObject_InstanceID, cJSON_CreateNull());
-			cJSON_AddItemToObject(characteristicJSObject, kCharacteristicObject_Value, cJSON_CreateString(service->name));
-			cJSON_AddItemToObject(characteristicJSObject, kCharacteristicObject_Permissions, cJSON_CreateStringArray(rPerms, 1));
-			cJSON_AddItemToObject(characteristicJSObject, kCharacteristicObject_Format, cJSON_CreateString(kCharacteristicFormat_String));
-		}
+cJSON *ES_HAPCreateOutletService(HAPOutletService_t *service)
+{
+	cJSON *serviceJSObject = HAPCreateServiceFromDesc(&ES_OutletServiceDesc, service->name);
+
+	// initial state differs from table default
+	if(serviceJSObject != NULL) {
+		if((service->on != 0) != (ON_STATE != 0))
+			HAPGetServiceCharacteristicValue(serviceJSObject, kCharacteristicUUID_On)->type = (service->on) ? cJSON_True : cJSON_False;
+		if((service->outlet_in_use != 0) != (OUTLET_IN_USE_STATE != 0))
+			HAPGetServiceCharacteristicValue(serviceJSObject, kCharacteristicUUID_OutletInUse)->type = (service->outlet_in_use) ? cJSON_True : cJSON_False;
 	}
 
 	return serviceJSObject;
 }
 
 #if FIRST_VERSION 
+static const HAPCharacteristicDesc_t ES_MeterChars[] = {
+	//custom.esoft.hap.characteristic.meterage.voltage
+	{kChaUUID_FV_Met_Voltage, kChaFormat_Float, "volt", kHAPDescPerm_PR, kHAPDescFlag_Range, OUTLET_CHA_METVOL, OUTLET_OFS(metvol), 0, 0, 300, 0.1},
+	//custom.esoft.hap.characteristic.meterage.current
+	{kChaUUID_FV_Met_Current, kChaFormat_Float, "amp", kHAPDescPerm_PR, kHAPDescFlag_Range, OUTLET_CHA_METCUR, OUTLET_OFS(metcur), 0, 0, 15, 0.1},
+	//custom.esoft.hap.characteristic.meterage.power
+	{kChaUUID_FV_Met_Power, kChaFormat_Float, "watt", kHAPDescPerm_PR, kHAPDescFlag_Range, OUTLET_CHA_METPOW, OUTLET_OFS(metpow), 0, 0, 2000, 0.1},
+};
+
+const HAPServiceDesc_t ES_MeterServiceDesc = {
+	kServUUID_FV_Meter, ES_MeterChars, sizeof(ES_MeterChars) / sizeof(ES_MeterChars[0])
+};
+
 cJSON *ES_HAPCreateMeterService(HAPOutletService_t *service)
 {
-	cJSON *serviceJSObject = NULL;
-	cJSON *characteristicJSArray, *characteristicJSObject, *chaJSObject;
-	char *rPerms[1] = {kCharacteristicPermission_PairedRead};
-	char *rePerms[2] = {kCharacteristicPermission_PairedRead, kCharacteristicPermission_Events};
-	char *rwePerms[3] = {kCharacteristicPermission_PairedRead, kCharacteristicPermission_PairedWrite, kCharacteristicPermission_Events};
-       char *wPerms[1] = {kCharacteristicPermission_PairedWrite};
-	if((serviceJSObject = cJSON_CreateObject()) != NULL) {
-		cJSON_AddItemToObject(serviceJSObject, kServiceObject_Type, cJSON_CreateString(kServUUID_FV_Meter));
-		cJSON_AddItemToObject(serviceJSObject, kServiceObject_InstanceID, cJSON_CreateNull());
-		characteristicJSArray = cJSON_CreateArray();
-		cJSON_AddItemToObject(serviceJSObject, kServiceObject_Characteristics, characteristicJSArray);
-            
-            //custom.esoft.hap.characteristic.meterage.voltage
-            chaJSObject = cJSON_CreateObject();
-            cJSON_AddItemToArray(characteristicJSArray, chaJSObject);
-            cJSON_AddStringToObject(chaJSObject, kChaObj_Type, kChaUUID_FV_Met_Voltage);
-            cJSON_AddItemToObject(chaJSObject, kChaObj_IID, cJSON_CreateNull());
-            cJSON_AddNumberToObject(chaJSObject, kChaObj_Val, 0);
-            cJSON_AddNumberToObject(chaJSObject, kChaObj_MinVal, 0);
-            cJSON_AddNumberToObject(chaJSObject, kChaObj_MaxVal, 300);
-            cJSON_AddNumberToObject(chaJSObject, kChaObj_StepVal, 0.1);
-            cJSON_AddStringToObject(chaJSObject, kChaObj_Unit, "volt");
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Perms, cJSON_CreateStringArray(rPerms, 1));
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Format, cJSON_CreateString(kChaFormat_Float));
-            
-            //custom.esoft.hap.characteristic.meterage.current
-            chaJSObject = cJSON_CreateObject();
-            cJSON_AddItemToArray(characteristicJSArray, chaJSObject);
-            cJSON_AddStringToObject(chaJSObject, kChaObj_Type, kChaUUID_FV_Met_Current);
-            cJSON_AddItemToObject(chaJSObject, kChaObj_IID, cJSON_CreateNull());
-            cJSON_AddNumberToObject(chaJSObject, kChaObj_Val, 0);
-            cJSON_AddNumberToObject(chaJSObject, kChaObj_MinVal, 0);
-            cJSON_AddNumberToObject(chaJSObject, kChaObj_MaxVal, 15);
-            cJSON_AddNumberToObject(chaJSObject, kChaObj_StepVal, 0.1);
-            cJSON_AddStringToObject(chaJSObject, kChaObj_Unit, "amp");
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Perms, cJSON_CreateStringArray(rPerms, 1));
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Format, cJSON_CreateString(kChaFormat_Float));
-            
-            //custom.esoft.hap.characteristic.meterage.power
-            chaJSObject = cJSON_CreateObject();
-            cJSON_AddItemToArray(characteristicJSArray, chaJSObject);
-            cJSON_AddStringToObject(chaJSObject, kChaObj_Type, kChaUUID_FV_Met_Power);
-            cJSON_AddItemToObject(chaJSObject, kChaObj_IID, cJSON_CreateNull());
-            cJSON_AddNumberToObject(chaJSObject, kChaObj_Val, 0);
-            cJSON_AddNumberToObject(chaJSObject, kChaObj_MinVal, 0);
-            cJSON_AddNumberToObject(chaJSObject, kChaObj_MaxVal, 2000);
-            cJSON_AddNumberToObject(chaJSObject, kChaObj_StepVal, 0.1);
-            cJSON_AddStringToObject(chaJSObject, kChaObj_Unit, "watt");
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Perms, cJSON_CreateStringArray(rPerms, 1));
-            cJSON_AddItemToObject(chaJSObject, kChaObj_Format, cJSON_CreateString(kChaFormat_Float));
-
-		// public.hap.characteristic.name (optional)
-		if(service->name) {
-			characteristicJSObject = cJSON_CreateObject();
-			cJSON_AddItemToArray(characteristicJSArray, characteristicJSObject);
-			cJSON_AddItemToObject(characteristicJSObject, kCharacteristicObject_Type, cJSON_CreateString(kCharacteristicUUID_Name));
-			cJSON_AddItemToObject(characteristicJSObject, kCharacteristicObject_InstanceID, cJSON_CreateNull());
-			cJSON_AddItemToObject(characteristicJSObject, kCharacteristicObject_Value, cJSON_CreateString(service->name));
-			cJSON_AddItemToObject(characteristicJSObject, kCharacteristicObject_Permissions, cJSON_CreateStringArray(rPerms, 1));
-			cJSON_AddItemToObject(characteristicJSObject, kCharacteristicObject_Format, cJSON_CreateString(kCharacteristicFormat_String));
-		}
-	}
-
-	return serviceJSObject;
+	return HAPCreateServiceFromDesc(&ES_MeterServiceDesc, service->name);
 }
 #endif
 
@@ -1073,3 +866,379 @@ cJSON *HAPCreateThermostatService(HAPThermostatService_t *service)
 
 	return serviceJSObject;
 }
+
+/*-----------------------------------------------------------------------
+ * Compiled service profile
+ *-----------------------------------------------------------------------*/
+
+static struct {
+	cJSON *service;
+	const HAPServiceDesc_t *serv_desc;
+	uint8_t instance;
+	const void *block;                       // model value block for notification
+	uint32_t dirty;                          // bit i : serv_desc->chars[i] changed
+	uint32_t since;                          // time of first mark in current window
+	uint32_t last;                           // time of last rate limited event
+} desc_services[HAP_DESC_MAX_SERVICES];
+static int desc_service_num = 0;
+
+static HAPDescEntry_t *desc_entries = NULL;                           // sized to the database
+static uint8_t desc_slot[HAP_DESC_MAX_AID][HAP_DESC_MAX_IID + 1];    // iid -> entry index + 1
+
+static cJSON *desc_create_perms(uint8_t perms)
+{
+	const char *strings[3];
+	int count = 0;
+
+	if(perms & kHAPDescPerm_PR) strings[count ++] = kCharacteristicPermission_PairedRead;
+	if(perms & kHAPDescPerm_PW) strings[count ++] = kCharacteristicPermission_PairedWrite;
+	if(perms & kHAPDescPerm_EV) strings[count ++] = kCharacteristicPermission_Events;
+
+	return cJSON_CreateStringArray(strings, count);
+}
+
+static cJSON *desc_create_initial(const HAPCharacteristicDesc_t *desc)
+{
+	if(strcmp(desc->format, kCharacteristicFormat_Boolean) == 0)
+		return cJSON_CreateBool(desc->init != 0);
+	if(strcmp(desc->format, kCharacteristicFormat_String) == 0 || strcmp(desc->format, kCharacteristicFormat_Base64Data) == 0 ||
+	   strcmp(desc->format, kCharacteristicFormat_Base64TLV8) == 0)
+		return cJSON_CreateString("");
+
+	return cJSON_CreateNumber(desc->init);
+}
+
+// Generate cJSON service from a const service table and remember it for HAPBuildDescIndex()
+cJSON *HAPCreateServiceFromDesc(const HAPServiceDesc_t *serv_desc, const char *name)
+{
+	cJSON *serviceJSObject = NULL;
+	cJSON *characteristicJSArray, *characteristicJSObject;
+	const HAPCharacteristicDesc_t *desc;
+	int i, instance = 0;
+
+	if((desc_service_num >= HAP_DESC_MAX_SERVICES) || (serv_desc->num_chars > HAP_DESC_MAX_CHARS)) {
+		printf("\n%s: too many services or characteristics\n", __FUNCTION__);
+		return NULL;
+	}
+
+	if((serviceJSObject = cJSON_CreateObject()) != NULL) {
+		cJSON_AddItemToObject(serviceJSObject, kServiceObject_Type, cJSON_CreateString(serv_desc->type));
+		cJSON_AddItemToObject(serviceJSObject, kServiceObject_InstanceID, cJSON_CreateNull());
+		characteristicJSArray = cJSON_CreateArray();
+		cJSON_AddItemToObject(serviceJSObject, kServiceObject_Characteristics, characteristicJSArray);
+
+		for(i = 0; i < serv_desc->num_chars; i ++) {
+			desc = &serv_desc->chars[i];
+			characteristicJSObject = cJSON_CreateObject();
+			cJSON_AddItemToArray(characteristicJSArray, characteristicJSObject);
+			cJSON_AddItemToObject(characteristicJSObject, kCharacteristicObject_Type, cJSON_CreateString(desc->type));
+			cJSON_AddItemToObject(characteristicJSObject, kCharacteristicObject_InstanceID, cJSON_CreateNull());
+			if(!(desc->flags & kHAPDescFlag_NoValue))
+				cJSON_AddItemToObject(characteristicJSObject, kCharacteristicObject_Value, desc_create_initial(desc));
+			if(desc->flags & kHAPDescFlag_Range) {
+				cJSON_AddItemToObject(characteristicJSObject, kCharacteristicObject_MinimumValue, cJSON_CreateNumber(desc->min));
+				cJSON_AddItemToObject(characteristicJSObject, kCharacteristicObject_MaximumValue, cJSON_CreateNumber(desc->max));
+				cJSON_AddItemToObject(characteristicJSObject, kCharacteristicObject_StepValue, cJSON_CreateNumber(desc->step));
+			}
+			if(desc->unit)
+				cJSON_AddItemToObject(characteristicJSObject, kCharacteristicObject_Unit, cJSON_CreateString(desc->unit));
+			cJSON_AddItemToObject(characteristicJSObject, kCharacteristicObject_Permissions, desc_create_perms(desc->perms));
+			cJSON_AddItemToObject(characteristicJSObject, kCharacteristicObject_Format, cJSON_CreateString(desc->format));
+		}
+
+		// public.hap.characteristic.name (optional)
+		if(name) {
+			characteristicJSObject = cJSON_CreateObject();
+			cJSON_AddItemToArray(characteristicJSArray, characteristicJSObject);
+			cJSON_AddItemToObject(characteristicJSObject, kCharacteristicObject_Type, cJSON_CreateString(kCharacteristicUUID_Name));
+			cJSON_AddItemToObject(characteristicJSObject, kCharacteristicObject_InstanceID, cJSON_CreateNull());
+			cJSON_AddItemToObject(characteristicJSObject, kCharacteristicObject_Value, cJSON_CreateString(name));
+			cJSON_AddItemToObject(characteristicJSObject, kCharacteristicObject_Permissions, desc_create_perms(kHAPDescPerm_PR));
+			cJSON_AddItemToObject(characteristicJSObject, kCharacteristicObject_Format, cJSON_CreateString(kCharacteristicFormat_String));
+		}
+
+		for(i = 0; i < desc_service_num; i ++)
+			if(desc_services[i].serv_desc == serv_desc) instance ++;
+
+		memset(&desc_services[desc_service_num], 0, sizeof(desc_services[0]));
+		desc_services[desc_service_num].service = serviceJSObject;
+		desc_services[desc_service_num].serv_desc = serv_desc;
+		desc_services[desc_service_num].instance = instance;
+		desc_service_num ++;
+	}
+
+	return serviceJSObject;
+}
+
+// Forget services created from tables, called before the database is generated again
+void HAPResetServiceDesc(void)
+{
+	desc_service_num = 0;
+	memset(desc_slot, 0, sizeof(desc_slot));
+}
+
+// Walk the indexed characteristics of the database, fill entries and desc_slot when entries is not NULL
+static int desc_index_walk(cJSON *database, HAPDescEntry_t *entries)
+{
+	cJSON *accessoryJSObject, *serviceJSObject, *characteristicJSObject, *iidJSObject;
+	const HAPServiceDesc_t *serv_desc;
+	int aid, iid, i, num = 0;
+	uint8_t instance;
+
+	accessoryJSObject = cJSON_GetObjectItem(database, kDatabase_Accessories)->child;
+	for(; accessoryJSObject; accessoryJSObject = accessoryJSObject->next) {
+		aid = cJSON_GetObjectItem(accessoryJSObject, kAccessoryObject_InstanceID)->valueint;
+		if((aid < 1) || (aid > HAP_DESC_MAX_AID)) continue;
+
+		serviceJSObject = cJSON_GetObjectItem(accessoryJSObject, kAccessoryObject_Services)->child;
+		for(; serviceJSObject; serviceJSObject = serviceJSObject->next) {
+			serv_desc = NULL;
+			instance = 0;
+			for(i = 0; i < desc_service_num; i ++) {
+				if(desc_services[i].service == serviceJSObject) {
+					serv_desc = desc_services[i].serv_desc;
+					instance = desc_services[i].instance;
+					break;
+				}
+			}
+
+			characteristicJSObject = cJSON_GetObjectItem(serviceJSObject, kServiceObject_Characteristics)->child;
+			for(i = 0; characteristicJSObject; characteristicJSObject = characteristicJSObject->next, i ++) {
+				iidJSObject = cJSON_GetObjectItem(characteristicJSObject, kCharacteristicObject_InstanceID);
+				if((iidJSObject == NULL) || (iidJSObject->type != cJSON_Number)) continue;
+				iid = iidJSObject->valueint;
+				if((iid < 1) || (iid > HAP_DESC_MAX_IID) || (num >= 255)) {
+					if(entries) printf("\n%s: aid=%d iid=%d not indexed\n", __FUNCTION__, aid, iid);
+					continue;
+				}
+
+				if(entries) {
+					entries[num].service = serviceJSObject;
+					entries[num].characteristic = characteristicJSObject;
+					entries[num].serv_desc = serv_desc;
+					entries[num].desc = (serv_desc && (i < serv_desc->num_chars)) ? &serv_desc->chars[i] : NULL;
+					entries[num].instance = instance;
+					desc_slot[aid - 1][iid] = num + 1;
+				}
+				num ++;
+			}
+		}
+	}
+
+	return num;
+}
+
+// Map every (aid, iid) of the refreshed database to its service/characteristic and table entry
+// Must be called after HAPRefreshDatabase() which assigns iid
+int HAPBuildDescIndex(cJSON *database)
+{
+	int num;
+
+	memset(desc_slot, 0, sizeof(desc_slot));
+	if(desc_entries) {
+		free(desc_entries);
+		desc_entries = NULL;
+	}
+
+	if((num = desc_index_walk(database, NULL)) == 0) return 0;
+	if((desc_entries = (HAPDescEntry_t *) malloc(num * sizeof(HAPDescEntry_t))) == NULL) {
+		printf("\n%s: malloc failed\n", __FUNCTION__);
+		return 0;
+	}
+
+	return desc_index_walk(database, desc_entries);
+}
+
+// O(1) resolve of (aid, iid), NULL if not in database
+const HAPDescEntry_t *HAPLookupDescEntry(int aid, int iid)
+{
+	uint8_t slot;
+
+	if((aid < 1) || (aid > HAP_DESC_MAX_AID) || (iid < 1) || (iid > HAP_DESC_MAX_IID)) return NULL;
+	if((slot = desc_slot[aid - 1][iid]) == 0) return NULL;
+
+	return &desc_entries[slot - 1];
+}
+
+static uint32_t db_hash_bytes(uint32_t hash, const void *data, size_t len)
+{
+	const uint8_t *p = (const uint8_t *) data;
+
+	while(len --) {
+		hash ^= *p ++;
+		hash *= 16777619UL;
+	}
+
+	return hash;
+}
+
+static uint32_t db_hash_items(uint32_t hash, cJSON *item)
+{
+	uint8_t type;
+
+	for(; item; item = item->next) {
+		if(item->string) {
+			if(strcmp(item->string, kCharacteristicObject_Value) == 0) continue;
+			hash = db_hash_bytes(hash, item->string, strlen(item->string) + 1);
+		}
+
+		type = item->type & 0xFF;
+		hash = db_hash_bytes(hash, &type, 1);
+		if(type == cJSON_String)
+			hash = db_hash_bytes(hash, item->valuestring, strlen(item->valuestring) + 1);
+		else if(type == cJSON_Number)
+			hash = db_hash_bytes(hash, &item->valuedouble, sizeof(item->valuedouble));
+		else if((type == cJSON_Array) || (type == cJSON_Object)) {
+			hash = db_hash_items(hash, item->child);
+			hash = db_hash_bytes(hash, &type, 1);    // close the level
+		}
+	}
+
+	return hash;
+}
+
+// FNV-1a of the database layout: aids, services, characteristics, iids and their metadata.
+// Characteristic values are left out, so the hash only moves when the schema changes.
+// Must be called after HAPRefreshDatabase() which assigns iid
+uint32_t HAPDatabaseHash(cJSON *database)
+{
+	return db_hash_items(2166136261UL, database ? database->child : NULL);
+}
+
+// Create value object from model value block at desc->offset
+cJSON *HAPCreateDescValue(const HAPCharacteristicDesc_t *desc, const void *block)
+{
+	const uint8_t *value;
+
+	if((desc == NULL) || (block == NULL) || (desc->offset == kHAPDescNoOffset)) return NULL;
+
+	value = (const uint8_t *) block + desc->offset;
+	if(strcmp(desc->format, kCharacteristicFormat_Boolean) == 0)
+		return cJSON_CreateBool(*value);
+	if(strcmp(desc->format, kCharacteristicFormat_Float) == 0)
+		return cJSON_CreateNumber(*(const float *) value);
+
+	return cJSON_CreateNumber(*value);
+}
+
+// Bind the model value block that notifications of this service read from
+void HAPSetServiceDescBlock(cJSON *service, const void *block)
+{
+	int i;
+
+	for(i = 0; i < desc_service_num; i ++)
+		if(desc_services[i].service == service) desc_services[i].block = block;
+}
+
+// Mark characteristic id of the instance-th service built from serv_desc as changed, callable from any task
+void HAPNotifyMark(const HAPServiceDesc_t *serv_desc, int instance, int id)
+{
+	int i, j;
+	uint32_t now = xTaskGetTickCount() * portTICK_RATE_MS;
+
+	for(i = 0; i < desc_service_num; i ++) {
+		if((desc_services[i].serv_desc != serv_desc) || (desc_services[i].instance != instance)) continue;
+
+		for(j = 0; j < serv_desc->num_chars; j ++) {
+			if(serv_desc->chars[j].id != id) continue;
+
+			taskENTER_CRITICAL();
+			if(desc_services[i].dirty == 0) desc_services[i].since = now;
+			desc_services[i].dirty |= (1UL << j);
+			taskEXIT_CRITICAL();
+			return;
+		}
+	}
+}
+
+static int desc_value_equal(cJSON *a, cJSON *b)
+{
+	if((a->type == cJSON_True) || (a->type == cJSON_False) || (b->type == cJSON_True) || (b->type == cJSON_False)) {
+		int va = (a->type == cJSON_Number) ? (a->valueint != 0) : (a->type == cJSON_True);
+		int vb = (b->type == cJSON_Number) ? (b->valueint != 0) : (b->type == cJSON_True);
+		return (va == vb);
+	}
+
+	return (a->type == b->type) && (a->valuedouble == b->valuedouble);
+}
+
+// Mark bit j of service i dirty again so the next flush picks it up
+static void desc_remark(int i, int j, uint32_t since)
+{
+	taskENTER_CRITICAL();
+	if(desc_services[i].dirty == 0) desc_services[i].since = since;
+	desc_services[i].dirty |= (1UL << j);
+	taskEXIT_CRITICAL();
+}
+
+// Send pending changes, returns ms until the next call is needed or HAP_NOTIFY_IDLE
+// The changed values of every service are collected first and handed to the HAP engine back to back,
+// so the events it queues for a session between two of its runs go out in one EVENT message
+uint32_t HAPNotifyFlush(uint32_t now_ms)
+{
+	struct {
+		cJSON *service;
+		const HAPCharacteristicDesc_t *desc;
+		cJSON *value;
+	} batch[HAP_NOTIFY_BATCH];
+	const HAPCharacteristicDesc_t *desc;
+	cJSON *value, *current;
+	uint32_t dirty, wait, next = HAP_NOTIFY_IDLE;
+	int i, j, rate_sent, num = 0;
+
+	for(i = 0; i < desc_service_num; i ++) {
+		if(desc_services[i].dirty == 0) continue;
+
+		if((wait = now_ms - desc_services[i].since) < HAP_NOTIFY_WINDOW_MS) {
+			if(HAP_NOTIFY_WINDOW_MS - wait < next) next = HAP_NOTIFY_WINDOW_MS - wait;
+			continue;
+		}
+
+		taskENTER_CRITICAL();
+		dirty = desc_services[i].dirty;
+		desc_services[i].dirty = 0;
+		taskEXIT_CRITICAL();
+
+		rate_sent = 0;
+		for(j = 0; dirty; j ++, dirty >>= 1) {
+			if(!(dirty & 1)) continue;
+			desc = &desc_services[i].serv_desc->chars[j];
+			if(!(desc->perms & kHAPDescPerm_EV)) continue;
+
+			if((desc->flags & kHAPDescFlag_RateLimit) &&
+			   ((wait = now_ms - desc_services[i].last) < HAP_NOTIFY_RATE_MS)) {
+				// keep it dirty, the latest value goes out when the interval ends
+				desc_remark(i, j, now_ms - HAP_NOTIFY_WINDOW_MS);
+				if(HAP_NOTIFY_RATE_MS - wait < next) next = HAP_NOTIFY_RATE_MS - wait;
+				continue;
+			}
+
+			if(num >= HAP_NOTIFY_BATCH) {
+				// batch full, sent by the flush right after this one
+				desc_remark(i, j, now_ms - HAP_NOTIFY_WINDOW_MS);
+				next = 0;
+				continue;
+			}
+
+			if((value = HAPCreateDescValue(desc, desc_services[i].block)) == NULL) continue;
+			current = HAPGetServiceCharacteristicValue(desc_services[i].service, (char *) desc->type);
+			if(current && desc_value_equal(current, value)) {
+				cJSON_Delete(value);
+				continue;
+			}
+
+			batch[num].service = desc_services[i].service;
+			batch[num].desc = desc;
+			batch[num].value = value;
+			num ++;
+			if(desc->flags & kHAPDescFlag_RateLimit) rate_sent = 1;
+		}
+		// rate limited characteristics of a service share the interval and go out together
+		if(rate_sent) desc_services[i].last = now_ms;
+	}
+
+	for(i = 0; i < num; i ++)
+		HAPUpdateServiceCharacteristic(batch[i].service, (char *) batch[i].desc->type, batch[i].value);
+
+	return next;
+}
@@ -130,4 +130,81 @@ typedef struct {
 cJSON *HAPCreateThermostatService(HAPThermostatService_t *service);
 cJSON *ES_HAPCreateOutletService(HAPOutletService_t *service);
 cJSON *ES_HAPCreateMeterService(HAPOutletService_t *service);
+
+/* Compiled service profile
+ * Services described by const tables are kept in flash. The cJSON service
+ * required by the HAP engine is generated from the table, and after
+ * HAPRefreshDatabase() the assigned iids are mapped back to the table so
+ * that (aid, iid) resolves with an array lookup instead of a tree walk.
+ * The cJSON tree stays as the HAP engine serves it; the index adds one
+ * entry per characteristic, allocated to the size of the database.
+ */
+#define kHAPDescPerm_PR          0x01
+#define kHAPDescPerm_PW          0x02
+#define kHAPDescPerm_EV          0x04
+
+#define kHAPDescFlag_Range       0x01        // add minValue/maxValue/minStep
+#define kHAPDescFlag_NoValue     0x02        // no initial value in database
+#define kHAPDescFlag_RateLimit   0x04        // at most one event per HAP_NOTIFY_RATE_MS
+
+#define kHAPDescNoOffset         0xFF        // not kept in model value block
+
+#define HAP_DESC_MAX_SERVICES    8
+#define HAP_DESC_MAX_AID         1
+#define HAP_DESC_MAX_IID         127
+#define HAP_DESC_MAX_CHARS       24          // characteristics per table, bounded by the dirty bitmap
+
+#define HAP_NOTIFY_WINDOW_MS     50          // changes marked within the window go out together
+#define HAP_NOTIFY_RATE_MS       5000        // for kHAPDescFlag_RateLimit characteristics
+#define HAP_NOTIFY_IDLE          0xFFFFFFFF  // nothing pending
+#define HAP_NOTIFY_BATCH         24          // changes handed to the HAP engine per flush
+
+typedef struct {
+	const char *type;          // characteristic type UUID
+	const char *format;        // characteristic format
+	const char *unit;          // optional unit
+	uint8_t     perms;         // kHAPDescPerm_*
+	uint8_t     flags;         // kHAPDescFlag_*
+	uint8_t     id;            // model defined characteristic id
+	uint8_t     offset;        // value offset in model value block
+	float       init;          // initial value of bool/number formats
+	float       min;
+	float       max;
+	float       step;
+} HAPCharacteristicDesc_t;
+
+typedef struct {
+	const char *type;                        // service type UUID
+	const HAPCharacteristicDesc_t *chars;
+	uint8_t     num_chars;
+} HAPServiceDesc_t;
+
+typedef struct {
+	cJSON *service;
+	cJSON *characteristic;
+	const HAPServiceDesc_t *serv_desc;       // NULL for services not built from table
+	const HAPCharacteristicDesc_t *desc;     // NULL for name or undescribed characteristic
+	uint8_t instance;                        // n-th service built from serv_desc
+} HAPDescEntry_t;
+
+cJSON *HAPCreateServiceFromDesc(const HAPServiceDesc_t *serv_desc, const char *name);
+void HAPResetServiceDesc(void);
+int HAPBuildDescIndex(cJSON *database);
+const HAPDescEntry_t *HAPLookupDescEntry(int aid, int iid);
+uint32_t HAPDatabaseHash(cJSON *database);
+cJSON *HAPCreateDescValue(const HAPCharacteristicDesc_t *desc, const void *block);
+
+/* Coalesced notification
+ * The model marks changed characteristics dirty. HAPNotifyFlush() sends
+ * every dirty characteristic with ev permission whose value differs from
+ * the database, once the window since the first mark has passed. The
+ * changes of all services are collected and handed over back to back, so
+ * a burst of changes costs one pass and one event message per session.
+ */
+void HAPSetServiceDescBlock(cJSON *service, const void *block);
+void HAPNotifyMark(const HAPServiceDesc_t *serv_desc, int instance, int id);
+uint32_t HAPNotifyFlush(uint32_t now_ms);
+
+extern const HAPServiceDesc_t ES_OutletServiceDesc;
+extern const HAPServiceDesc_t ES_MeterServiceDesc;
 #endif  /* _HAP_SERVICE_PROFILE_H */
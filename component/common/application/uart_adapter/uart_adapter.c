@@ -68,18 +68,9 @@ static void uartadapter_uart_irq(uint32_t id, SerialIrq event)
 	ua_socket_t *ua_socket = (ua_socket_t *)id;
 
 	if(event == RxIrq) {
-		ua_socket->uart.recv_buf[ua_socket->uart.pwrite++] = serial_getc(&ua_socket->uart.uart_sobj);
+		rx_ring_put(&ua_socket->uart.rx, serial_getc(&ua_socket->uart.uart_sobj));	//dropped and counted when full
 		RtlUpSemaFromISR(&ua_socket->uart.action_sema);	//up action semaphore 
 		
-		if(ua_socket->uart.pwrite > (UA_UART_RECV_BUFFER_LEN -1)){	//restart from  head if  reach tail
-			ua_socket->uart.pwrite = 0;
-			ua_socket->uart.overlap = 1;		
-		}
-		
-		if(ua_socket->uart.overlap && (ua_socket->uart.pwrite > ua_socket->uart.pread) ){
- 		       ua_socket->uart.miss_cnt ++;
-			ua_socket->uart.pread = ua_socket->uart.pwrite;		//if pwrite overhead pread ,pread is always flow rwrite 					
-		}
 		ua_socket->uart.tick_last_update =  xTaskGetTickCountFromISR();	// update tick everytime recved data
 		ua_socket->uart.rx_cnt ++;
 	}
@@ -94,11 +85,7 @@ static int uartadapter_uart_recv_data(ua_socket_t *ua_socket)
 	ua_socket->uart.tick_current = xTaskGetTickCount();
 	while((ua_socket->uart.tick_current -ua_socket->uart.tick_last_update) < (UA_UART_MAX_DELAY_TIME/portTICK_RATE_MS) 
 	|| ua_socket->uart.tick_current <= ua_socket->uart.tick_last_update){
-        	if(!ua_socket->uart.overlap){
-        		uart_recv_len = ua_socket->uart.pwrite - ua_socket->uart.pread;
-        	}else{
-        		uart_recv_len = (UA_UART_RECV_BUFFER_LEN - ua_socket->uart.pread) + ua_socket->uart.pwrite;
-        	}
+        	uart_recv_len = rx_ring_count(&ua_socket->uart.rx);
 
         	if(uart_recv_len >= UA_UART_FRAME_LEN){      	
 			return 2;
@@ -114,8 +101,6 @@ int uartadapter_uart_read(ua_socket_t *ua_socket, void *read_buf, size_t size)
 {
 	int ret = 0;
 	int read_bytes;
-	int pread_local,pwrite_local;
-	char *ptr;
 	
 	ua_printf(UA_DEBUG, "==>uart adapter read uart");
 
@@ -127,16 +112,8 @@ int uartadapter_uart_read(ua_socket_t *ua_socket, void *read_buf, size_t size)
 		return ret;
 	}
 	
-	pread_local = ua_socket->uart.pread;
-	pwrite_local = ua_socket->uart.pwrite;
-	ptr = (char *)read_buf;
-	
 	/*calculate how much data not read */
-	if(!ua_socket->uart.overlap){
-		ua_socket->uart.recv_bytes = pwrite_local - pread_local;
-	}else{
-		ua_socket->uart.recv_bytes = (UA_UART_RECV_BUFFER_LEN - pread_local) + pwrite_local;
-	}
+	ua_socket->uart.recv_bytes = rx_ring_count(&ua_socket->uart.rx);
 	
 	/*decide how much data shoule copy to application*/
 	if(size >=  ua_socket->uart.recv_bytes ){
@@ -147,25 +124,8 @@ int uartadapter_uart_read(ua_socket_t *ua_socket, void *read_buf, size_t size)
 		ret = size;
 	}	
 
-	if(!ua_socket->uart.overlap){
-		memcpy(ptr, (ua_socket->uart.recv_buf+ pread_local), read_bytes );
-	}else {
-		ua_printf(UA_DEBUG, "uart recv buf is write overlap!!");
-		if((pread_local + read_bytes) > UA_UART_RECV_BUFFER_LEN){
-			memcpy(ptr,(ua_socket->uart.recv_buf+ pread_local),(UA_UART_RECV_BUFFER_LEN-pread_local));
-			memcpy(ptr+(UA_UART_RECV_BUFFER_LEN-pread_local), ua_socket->uart.recv_buf,read_bytes-(UA_UART_RECV_BUFFER_LEN- pread_local));
-		}else{
-			memcpy(ptr,(ua_socket->uart.recv_buf+ pread_local),read_bytes);
-		}
-	}
-	
+	rx_ring_read(&ua_socket->uart.rx, read_buf, read_bytes);
 	ua_socket->uart.recv_bytes = 0;
-	if((pread_local + read_bytes) >= UA_UART_RECV_BUFFER_LEN){		//update pread
-		ua_socket->uart.pread = (pread_local + read_bytes) - UA_UART_RECV_BUFFER_LEN;
-		ua_socket->uart.overlap = 0;		//clean overlap flags
-	}else{
-		ua_socket->uart.pread = pread_local + read_bytes;		
-	}
 	
 	return ret;
 }
@@ -405,18 +365,12 @@ int uartadapter_flashwrite(int flashadd, char *pbuf, int len)
 		ret = -1;
 		return ret;
 	}
-	else	//as 8711am only canbe r/w in words.so make len is 4-bytes aligmented.
-		len += 4 - ((len%4)==0 ? 4 : (len%4));
-	
-	while(len){
-		if(flash_write_word(&flash, flashadd, *(unsigned int *)pbuf) !=1 ){
-			ua_printf(UA_ERROR, "write flash error!");
-			ret = -1;
-			return ret;
-		}
-		len -= 4;
-		pbuf += 4;
-		flashadd += 4;
+
+	//page programs, the unaligned head and tail are merged with the old content
+	if(flash_stream_write(&flash, flashadd, len, (uint8_t *)pbuf) !=1 ){
+		ua_printf(UA_ERROR, "write flash error!");
+		ret = -1;
+		return ret;
 	}
 
 	return ret;
@@ -1897,14 +1851,11 @@ ua_socket_t* uartadapter_socket_init()
 	}
 	
 	ua_socket->uart.rcv_ch = 0;
-	ua_socket->uart.overlap = 0;
 	ua_socket->uart.recv_bytes = 0;
-	ua_socket->uart.pread = 0;
-	ua_socket->uart.pwrite = 0;
+	rx_ring_init(&ua_socket->uart.rx, (u8 *)ua_socket->uart.recv_buf, UA_UART_RECV_BUFFER_LEN);
 	ua_socket->uart.tick_last_update = 0;
 	ua_socket->uart.tick_current = 0;
 	ua_socket->uart.rx_cnt = 0;
-	ua_socket->uart.miss_cnt = 0;
 	ua_socket->uart.tx_busy = 0;	
 	RtlInitSema(&ua_socket->uart.action_sema, 0);	
 	RtlInitSema(&ua_socket->uart.dma_tx, 1);		
@@ -2007,18 +1958,20 @@ void example_uart_adapter_init()
 #define _________CMD__RELATED________________________
 void uartadapter_print_irq_rx_count(ua_socket_t *ua_socket)
 {
+	rx_ring_stats ring;
+
 	UA_SOCKET_CHECK(ua_socket);	
 
 	ua_printf(UA_INFO, "ua_tick_last_update: %d!\n", ua_socket->uart.tick_last_update);
 	ua_printf(UA_INFO, "ua_tick_current: %d!\n", ua_socket->uart.tick_current);	
 	ua_printf(UA_INFO, "ua current tick: %d!\n", xTaskGetTickCount());	
-	ua_printf(UA_INFO, "ua_pwrite: %d!\n", ua_socket->uart.pwrite);	
-	ua_printf(UA_INFO, "ua_pread: %d!\n", ua_socket->uart.pread);	
-	ua_printf(UA_INFO, "ua_overlap: %d!\n", ua_socket->uart.overlap);	
+	rx_ring_get_stats(&ua_socket->uart.rx, &ring);
+	ua_printf(UA_INFO, "ua_ring_count: %d/%d!\n", ring.count, ring.size);	
+	ua_printf(UA_INFO, "ua_ring_peak: %d!\n", ring.peak);	
 	ua_printf(UA_INFO, "ua_rcv_ch: %d!\n", ua_socket->uart.rcv_ch);	
 	ua_printf(UA_INFO, "ua_uart_recv_bytes: %d!\n", ua_socket->uart.recv_bytes);	
 	ua_printf(UA_INFO, "irq_rx_cnt: %d!\n", ua_socket->uart.rx_cnt);
-	ua_printf(UA_INFO, "irq_miss_cnt: %d!\n", ua_socket->uart.miss_cnt);		
+	ua_printf(UA_INFO, "irq_miss_cnt: %d!\n", ring.dropped);		
 	ua_printf(UA_INFO, "tcp_tx_cnt: %d!\n", ua_socket->tcp.tx_cnt);
 	ua_printf(UA_INFO, "tcp_rx_cnt: %d!\n", ua_socket->tcp.rx_cnt);		
 	ua_printf(UA_INFO, "tcp_send_flag: %d!\n", ua_socket->tcp.send_flag);
@@ -2038,7 +1991,7 @@ void uartadapter_reset_irq_rx_count(ua_socket_t *ua_socket)
 	UA_SOCKET_CHECK(ua_socket);	
 
 	ua_socket->uart.rx_cnt = 0;
-	ua_socket->uart.miss_cnt = 0;	
+	rx_ring_reset_stats(&ua_socket->uart.rx);
 	ua_socket->tcp.rx_cnt = 0;
 	ua_socket->tcp.tx_cnt = 0;	
 }
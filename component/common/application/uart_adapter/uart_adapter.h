@@ -1,5 +1,6 @@
 #include "osdep_api.h"
 #include "serial_api.h"
+#include "rx_ring.h"
 #include <timer_api.h>
 #include "freertos_pmu.h"
 #include <mDNS/mDNS.h>
@@ -19,7 +20,7 @@
 #define	UA_TCP_SERVER_FD_NUM	1
 #define   UA_TCP_CLIENT_FD_NUM	       1
 
-#define 	UA_UART_RECV_BUFFER_LEN	8196
+#define 	UA_UART_RECV_BUFFER_LEN	8192	//power of two, see rx_ring.h
 #define 	UA_UART_FRAME_LEN	       1400
 #define	UA_UART_MAX_DELAY_TIME   100
 
@@ -143,10 +144,8 @@ typedef struct _ua_uart_socket_t
 {
 	int 			fd;
 	char	 		rcv_ch;
-	volatile char 	overlap;
 	int 			recv_bytes;
-	volatile int 	pread;
-	volatile int 	pwrite;
+	rx_ring_t		rx;
 	
 	volatile unsigned int 	tick_last_update;
 	unsigned int 			tick_current;
@@ -159,7 +158,6 @@ typedef struct _ua_uart_socket_t
 	char recv_buf[UA_UART_RECV_BUFFER_LEN];
 
 	long rx_cnt;
-	long miss_cnt;	
 
 	serial_t uart_sobj;	
 	ua_uart_param_t uart_param;
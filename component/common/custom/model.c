@@ -6,6 +6,7 @@
 #include <phytrex_homekit_flow.h>
 #include <homekit/HAPAccessory.h>
 #include <homekit/HAPAccessoryAPI.h>
+#include <homekit/HAPServiceProfile.h>
 #include "phytrex_model.h"
 #include "phytrex_update.h"
 #endif
@@ -476,18 +477,36 @@ void HAPCreatePhytrexServiceGroup(cJSON *pAccessory)
 #endif
 }
 
+/* cJSON_StreamPrint sink for the console: each window is terminated in place and printed */
+static int phytrex_json_console(void *ctx, const char *buf, int len)
+{
+	((char *) ctx)[len] = 0;
+	printf("%s", (char *) ctx);
+	return 0;
+}
+
+/* Dump a cJSON tree without allocating the rendered string */
+void phytrex_PrintJSON(cJSON *item)
+{
+	char window[64 + 1];
+	cJSON_Stream stream;
+
+	cJSON_StreamInit(&stream, window, sizeof(window) - 1, phytrex_json_console, window);
+	cJSON_StreamPrint(item, 1, &stream);
+}
+
 int phytrex_OtaHandler(cJSON *pDB, cJSON *pAccessory, int aid, int iid, cJSON *valueJSObject)
 {
 	int status = kHAPStatus_InvalidValue;
 #if CONFIG_OTA
-    cJSON *accessoryJSObject, *serviceJSObject, *characteristicJSObject;
-    
-    accessoryJSObject = HAPSearchDatabaseAID(pDB, aid);
-    characteristicJSObject = HAPSearchDatabaseIID(pDB, accessoryJSObject, iid);
-    serviceJSObject = HAPSearchCharacteristicService(pDB, characteristicJSObject);
+    cJSON *serviceJSObject, *characteristicJSObject;
+    const HAPDescEntry_t *entry = HAPLookupDescEntry(aid, iid);
+
+    if(entry == NULL) return status;
+    serviceJSObject = entry->service;
+    characteristicJSObject = entry->characteristic;
 
-    if((accessoryJSObject == pAccessory) &&
-       (serviceJSObject == MyOtaService)) {
+    if(serviceJSObject == MyOtaService) {
 		char *characteristic_type = cJSON_GetObjectItem(characteristicJSObject, kCharacteristicObject_Type)->valuestring;
 		if(serviceJSObject == MyOtaService) {
 			printf("\nOta::");
@@ -556,23 +575,23 @@ int phytrex_SystemHandler(cJSON *pDB, cJSON *pAccessory, int aid, int iid, cJSON
 {
 	int status = kHAPStatus_InvalidValue;
 #if CONFIG_SYSTEM
-    cJSON *accessoryJSObject, *serviceJSObject, *characteristicJSObject;
-    
-    accessoryJSObject = HAPSearchDatabaseAID(pDB, aid);
-    characteristicJSObject = HAPSearchDatabaseIID(pDB, accessoryJSObject, iid);
-    serviceJSObject = HAPSearchCharacteristicService(pDB, characteristicJSObject);
+    cJSON *serviceJSObject, *characteristicJSObject;
+    const HAPDescEntry_t *entry = HAPLookupDescEntry(aid, iid);
+
+    if(entry == NULL) return status;
+    serviceJSObject = entry->service;
+    characteristicJSObject = entry->characteristic;
 
-    if((accessoryJSObject == pAccessory) &&
-       (serviceJSObject == MySysService)) {
+    if(serviceJSObject == MySysService) {
 		char *characteristic_type = cJSON_GetObjectItem(characteristicJSObject, kCharacteristicObject_Type)->valuestring;
 		if(serviceJSObject == MySysService) {
 		printf("\nSystem::");
 		if(strcmp(characteristic_type, kCharacteristicUUID_SysAlarmSetting) == 0) {
 			printf("AlarmSetting::");
 			if(valueJSObject != NULL) {
-				char *str = cJSON_Print(valueJSObject);
-				printf("\n\r%s\n\r", str);
-				free(str);
+				printf("\n\r");
+				phytrex_PrintJSON(valueJSObject);
+				printf("\n\r");
 #if CONFIG_ALARM
 				PhytrexClockAlarm CA[ALARM_COUNT] = {0};
 				Parse_Alarm_JSON(CA, sizeof(CA), valueJSObject);
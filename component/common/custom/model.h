@@ -70,6 +70,7 @@ cJSON *HAPCreateOtaService();
 cJSON *HAPCreateSystemService();
 cJSON *ES_HAPCreateOtaService();
 cJSON *ES_HAPCreateSystemService();
+void phytrex_PrintJSON(cJSON *item);
 int phytrex_OtherHandler(cJSON *pDB, cJSON *pAccessory, int aid, int iid, cJSON *valueJSObject);
 void HAPCreatePhytrexServiceGroup(cJSON *pAccessory);
 void HAPUpdateReset(int value);
@@ -2,6 +2,8 @@
 #if MODEL == OUTLET
 #include "FreeRTOS.h"
 #include "task.h"
+#include "queue.h"
+#include "semphr.h"
 #include "diag.h"
 #include "main.h"
 #include "gpio_api.h"   // mbed
@@ -11,6 +13,7 @@
 #include "serial_api.h"
 #include "sleep_ex_api.h"
 #include <homekit/HAPServiceProfile.h>
+#include <cJSON_pool.h>
 #include <wifi/wifi_conf.h> //alexyi
 #include <lwip_netconf.h>
 #include <phytrex_homekit_flow.h>
@@ -23,8 +26,9 @@
 #include <polarssl/ssl.h>
 #include "flash_api.h"
 #include "uart_socket.h"
-#include "smart_plc.h"
+#include "protocol.h"
 #include "update.h"
+#include "outlet_hislog.h"
 
 
 
@@ -81,7 +85,6 @@ outlet_state outletstateB;
 outlet_state outletstateA_app;
 outlet_state outletstateB_app;
 extern uart_socket_t *uart_socket;
-static char Hisdata[HISDATABASE64LEN];
 
 gtimer_t ledTmr;
 gtimer_t btnTmr;
@@ -97,6 +100,9 @@ gpio_t OlInUse1;
 gpio_t OlInUse2;
 gpio_irq_t gpio_oiu1;
 gpio_irq_t gpio_oiu2;
+static uint8 oiu_armed_high[2];
+static xQueueHandle outlet_evt_queue = NULL;
+static volatile uint8 outlet_idle = 0;
 int led_timecnt;
 extern HomekitFlow_t hk_flow;
 extern PhytrexParameter_t ex_param;
@@ -371,34 +377,42 @@ void HAPstatusNotify()
     printf("\n=====PhytrexHomekitNotifyHapStart====\n");
 }
 
+static outlet_state * const outlet_states[2] = {&outletstateA, &outletstateB};
+static outlet_state * const outlet_states_app[2] = {&outletstateA_app, &outletstateB_app};
+
+// Mark a characteristic of channel 1/2 changed, HAPNotifyFlush() sends it
+void outlet_notify(uint8 channel, int id)
+{
+    if ((channel < 1) || (channel > 2)) return;
+    HAPNotifyMark(&ES_OutletServiceDesc, channel - 1, id);
+#if FIRST_VERSION
+    HAPNotifyMark(&ES_MeterServiceDesc, channel - 1, id);
+#endif
+    outlet_post_event(OUTLET_EVT_NOTIFY, channel);
+}
+
 void HAPoiu1Notify(int value)
 {
-    cJSON *current_valueJSObject = HAPGetServiceCharacteristicValue(MyOutletService1, kCharacteristicUUID_OutletInUse);
-    current_valueJSObject->valueint = value;
-    HAPUpdateServiceCharacteristic(MyOutletService1, kCharacteristicUUID_OutletInUse, cJSON_CreateNumber(current_valueJSObject->valueint));
-    printf("notify:%d\n",value);
+    outletstateA.inuse = value;
+    outlet_notify(1, OUTLET_CHA_INUSE);
 }
 
 void HAPoiu2Notify(int value)
 {
-    cJSON *current_valueJSObject = HAPGetServiceCharacteristicValue(MyOutletService2, kCharacteristicUUID_OutletInUse);
-    current_valueJSObject->valueint = value;
-    HAPUpdateServiceCharacteristic(MyOutletService2, kCharacteristicUUID_OutletInUse, cJSON_CreateNumber(current_valueJSObject->valueint));
-    printf("notify:%d\n",value);
+    outletstateB.inuse = value;
+    outlet_notify(2, OUTLET_CHA_INUSE);
 }
 
 void HAPmsw1Notify(int value)
 {
-    cJSON *current_valueJSObject = HAPGetServiceCharacteristicValue(MyOutletService1, kCharacteristicUUID_On);
-    current_valueJSObject->valueint = value;
-    HAPUpdateServiceCharacteristic(MyOutletService1, kCharacteristicUUID_On, cJSON_CreateBool(current_valueJSObject->valueint));
+    outletstateA.on = value;
+    outlet_notify(1, OUTLET_CHA_ON);
 }
 
 void HAPmsw2Notify(int value)
 {
-    cJSON *current_valueJSObject = HAPGetServiceCharacteristicValue(MyOutletService2, kCharacteristicUUID_On);
-    current_valueJSObject->valueint = value;
-    HAPUpdateServiceCharacteristic(MyOutletService2, kCharacteristicUUID_On, cJSON_CreateBool(current_valueJSObject->valueint));
+    outletstateB.on = value;
+    outlet_notify(2, OUTLET_CHA_ON);
 }
 
 #if 0
@@ -473,161 +487,60 @@ int phytrex_MainHandler(cJSON *pDB, cJSON *pAccessory, int aid, int iid, cJSON *
 
 void HAPoutletNotify(int channel, int value)
 {
-    int ret;
-    cJSON *current_service = NULL;
-    if (1 == channel){
-        current_service = MyOutletService1;
-    }else if (2 == channel){
-        current_service = MyOutletService2;
-    }else{
-        return;
-    }
-    
-    cJSON *current_valueJSObject = HAPGetServiceCharacteristicValue(current_service, kCharacteristicUUID_On);
-    current_valueJSObject->valueint = value;
-    printf("notify\n");
-    ret = HAPUpdateServiceCharacteristic(current_service, kCharacteristicUUID_On, cJSON_CreateNumber(current_valueJSObject->valueint));
-    //ret = HAPUpdateServiceCharacteristic(current_service, kCharacteristicUUID_On, current_valueJSObject);
-    printf("notify:%d\n",ret);
+    if ((channel < 1) || (channel > 2)) return;
+    outlet_states[channel - 1]->on = value;
+    outlet_notify(channel, OUTLET_CHA_ON);
 }
 
 void HAPmetquaNotify(int channel, double value)
 {
-    int ret;
-    cJSON *current_service = NULL;
-    if (1 == channel){
-        current_service = MyOutletService1;
-    }else if (2 == channel){
-        current_service = MyOutletService2;
-    }else{
-        return;
-    }
-    
-    cJSON *current_valueJSObject = HAPGetServiceCharacteristicValue(current_service, kChaUUID_Met_Total_Quantity);
-    current_valueJSObject->valuedouble = value;
-    printf("notify\n");
-    ret = HAPUpdateServiceCharacteristic(current_service, kChaUUID_Met_Total_Quantity, cJSON_CreateNumber(current_valueJSObject->valuedouble));
-    printf("notify:%d\n",ret);
+    if ((channel < 1) || (channel > 2)) return;
+    outlet_states[channel - 1]->metqua = value;
+    outlet_notify(channel, OUTLET_CHA_METQUA);
 }
 
 void HAPthrpowNotify(int channel, double value)
 {
-    int ret;
-    cJSON *current_service = NULL;
-    if (1 == channel){
-        current_service = MyOutletService1;
-    }else if (2 == channel){
-        current_service = MyOutletService2;
-    }else{
-        return;
-    }
-    
-    cJSON *current_valueJSObject = HAPGetServiceCharacteristicValue(current_service, kChaUUID_Thr_Power);
-    current_valueJSObject->valuedouble = value;
-    printf("notify\n");
-    ret = HAPUpdateServiceCharacteristic(current_service, kChaUUID_Thr_Power, cJSON_CreateNumber(current_valueJSObject->valuedouble));
-    printf("notify:%d\n",ret);
+    if ((channel < 1) || (channel > 2)) return;
+    outlet_states[channel - 1]->thrpow = value;
+    outlet_notify(channel, OUTLET_CHA_THRPOW);
 }
 
 void HAPthrcurNotify(int channel, double value)
 {
-    int ret;
-    cJSON *current_service = NULL;
-    if (1 == channel){
-        current_service = MyOutletService1;
-    }else if (2 == channel){
-        current_service = MyOutletService2;
-    }else{
-        return;
-    }
-    
-    cJSON *current_valueJSObject = HAPGetServiceCharacteristicValue(current_service, kChaUUID_Thr_Current);
-    current_valueJSObject->valuedouble = value;
-    printf("notify\n");
-    ret = HAPUpdateServiceCharacteristic(current_service, kChaUUID_Thr_Current, cJSON_CreateNumber(current_valueJSObject->valuedouble));
-    printf("notify:%d\n",ret);
+    if ((channel < 1) || (channel > 2)) return;
+    outlet_states[channel - 1]->thrcur = value;
+    outlet_notify(channel, OUTLET_CHA_THRCUR);
 }
 
 void HAPthrvolNotify(int channel, double overvol, double undervol)
 {
-    int ret;
-    cJSON *current_service = NULL;
-    if (1 == channel){
-        current_service = MyOutletService1;
-    }else if (2 == channel){
-        current_service = MyOutletService2;
-    }else{
-        return;
-    }
-    
-    cJSON *current_valueJSObject = HAPGetServiceCharacteristicValue(current_service, kChaUUID_Thr_overVoltage);
-    current_valueJSObject->valuedouble = overvol;
-    printf("notify\n");
-    ret = HAPUpdateServiceCharacteristic(current_service, kChaUUID_Thr_overVoltage, cJSON_CreateNumber(current_valueJSObject->valuedouble));
-    printf("notify:%d\n",ret);
-
-    current_valueJSObject = HAPGetServiceCharacteristicValue(current_service, kChaUUID_Thr_underVoltage);
-    current_valueJSObject->valuedouble = undervol;
-    printf("notify\n");
-    ret = HAPUpdateServiceCharacteristic(current_service, kChaUUID_Thr_underVoltage, cJSON_CreateNumber(current_valueJSObject->valuedouble));
-    printf("notify:%d\n",ret);
+    if ((channel < 1) || (channel > 2)) return;
+    outlet_states[channel - 1]->thrvol_over = overvol;
+    outlet_states[channel - 1]->thrvol_under = undervol;
+    outlet_notify(channel, OUTLET_CHA_THRVOL_OVER);
+    outlet_notify(channel, OUTLET_CHA_THRVOL_UNDER);
 }
 
 void HAPmetvolNotify(int channel, double value)
 {
-    int ret;
-    cJSON *current_service = NULL;
-    if (1 == channel){
-        current_service = MyOutletService1;
-    }else if (2 == channel){
-        current_service = MyOutletService2;
-    }else{
-        return;
-    }
-    
-    cJSON *current_valueJSObject = HAPGetServiceCharacteristicValue(current_service, kChaUUID_Met_Voltage);
-    current_valueJSObject->valuedouble = value;
-    printf("notify\n");
-    ret = HAPUpdateServiceCharacteristic(current_service, kChaUUID_Met_Voltage, cJSON_CreateNumber(current_valueJSObject->valuedouble));
-    printf("notify:%d\n",ret);
+    if ((channel < 1) || (channel > 2)) return;
+    outlet_states[channel - 1]->metvol = value;
+    outlet_notify(channel, OUTLET_CHA_METVOL);
 }
 
 void HAPmetcurNotify(int channel, double value)
 {
-    int ret;
-    cJSON *current_service = NULL;
-    if (1 == channel){
-        current_service = MyOutletService1;
-    }else if (2 == channel){
-        current_service = MyOutletService2;
-    }else{
-        return;
-    }
-    
-    cJSON *current_valueJSObject = HAPGetServiceCharacteristicValue(current_service, kChaUUID_Met_Current);
-    current_valueJSObject->valuedouble = value;
-    printf("notify\n");
-    ret = HAPUpdateServiceCharacteristic(current_service, kChaUUID_Met_Current, cJSON_CreateNumber(current_valueJSObject->valuedouble));
-    printf("notify:%d\n",ret);
+    if ((channel < 1) || (channel > 2)) return;
+    outlet_states[channel - 1]->metcur = value;
+    outlet_notify(channel, OUTLET_CHA_METCUR);
 }
 
 void HAPmetpowNotify(int channel, double value)
 {
-    int ret;
-    cJSON *current_service = NULL;
-    if (1 == channel){
-        current_service = MyOutletService1;
-    }else if (2 == channel){
-        current_service = MyOutletService2;
-    }else{
-        return;
-    }
-    
-    cJSON *current_valueJSObject = HAPGetServiceCharacteristicValue(current_service, kChaUUID_Met_Power);
-    current_valueJSObject->valuedouble = value;
-    printf("notify\n");
-    ret = HAPUpdateServiceCharacteristic(current_service, kChaUUID_Met_Power, cJSON_CreateNumber(current_valueJSObject->valuedouble));
-    printf("notify:%d\n",ret);
+    if ((channel < 1) || (channel > 2)) return;
+    outlet_states[channel - 1]->metpow = value;
+    outlet_notify(channel, OUTLET_CHA_METPOW);
 }
 
 int write_timerdata(outlet_state *outletstate, cJSON *valJSObj)
@@ -667,100 +580,84 @@ int write_timerdata(outlet_state *outletstate, cJSON *valJSObj)
     flash_erase_sector(&flash, timeraddr);
     flash_stream_write(&flash, timeraddr, OUTLET_TIMER_TWOLEN, timerdatabuf);
     //flash_stream_write(&flash, timeraddr+OUTLET_TIMER_TWOLEN, sizeof(t), &t);
+    outlet_timer_changed(1);
     return 0;
 }
 
-int write_OutletA_handler(const char *cha_type, cJSON *valJSObj)
+static const struct outlet_cmd
 {
-    if (strcmp(cha_type, kCharacteristicUUID_On) == 0)
-    {
-        if(valJSObj->valueint == 0)
-        {
-            outletstateA.on = 0;
-            outletstateA_app.on = outletstateA.on;
-            app_handle(OUTLET_A_OFF, NULL);
-        }
-        else if(valJSObj->valueint == 1)
-        {
-            outletstateA.on = 1;
-            outletstateA_app.on = outletstateA.on;
-            app_handle(OUTLET_A_ON, NULL);
-        }
-        //HAPoutletNotify(1,outletstateA_app.on);
-        // Update target characteristic value
-        HAPUpdateServiceCharacteristic(MyOutletService1, cha_type, cJSON_Duplicate(valJSObj, 0));
-    }
-    else if (strcmp(cha_type, kChaUUID_Timing_On) == 0)
-    {
-        printf("Timing_On_Data : len : %d : %s\n", strlen(valJSObj->valuestring), valJSObj->valuestring);
-        write_timerdata(&outletstateA, valJSObj);
-    }
-    else if (strcmp(cha_type, kChaUUID_Thr_overVoltage) == 0)
-    {
-        printf("Thr_Voltage : type : %d : val : %f\n", valJSObj->type, valJSObj->valuedouble);
-        app_handle(OUTLET_A_OVERVOL, &(valJSObj->valuedouble));
-    }
-    else if (strcmp(cha_type, kChaUUID_Thr_underVoltage) == 0)
-    {
-        printf("Thr_Voltage : type : %d : val : %f\n", valJSObj->type, valJSObj->valuedouble);
-        app_handle(OUTLET_A_UNDERVOL, &(valJSObj->valuedouble));
-    }
-    else if (strcmp(cha_type, kChaUUID_Thr_Current) == 0)
-    {
-        printf("Thr_Current : type : %d : val : %f\n", valJSObj->type, valJSObj->valuedouble);
-        app_handle(OUTLET_A_CUR, &(valJSObj->valuedouble));
-    }
-    else if (strcmp(cha_type, kChaUUID_Thr_Power) == 0)
-    {
-        printf("Thr_Power : type : %d : val : %f\n", valJSObj->type, valJSObj->valuedouble);
-        app_handle(OUTLET_A_POW, &(valJSObj->valuedouble));
-    }
-    return kHAPStatus_Success;
+    uint8 on;
+    uint8 off;
+    uint8 overvol;
+    uint8 undervol;
+    uint8 cur;
+    uint8 pow;
+} outlet_cmds[2] =
+{
+    {OUTLET_A_ON, OUTLET_A_OFF, OUTLET_A_OVERVOL, OUTLET_A_UNDERVOL, OUTLET_A_CUR, OUTLET_A_POW},
+    {OUTLET_B_ON, OUTLET_B_OFF, OUTLET_B_OVERVOL, OUTLET_B_UNDERVOL, OUTLET_B_CUR, OUTLET_B_POW},
+};
+
+static int outlet_cha_id(const HAPDescEntry_t *entry)
+{
+    return (entry->desc != NULL) ? entry->desc->id : OUTLET_CHA_NONE;
+}
+
+static int is_outlet_entry(const HAPDescEntry_t *entry)
+{
+    if (entry->instance > 1) return 0;
+    return (entry->serv_desc == &ES_OutletServiceDesc
+    #if FIRST_VERSION
+        || entry->serv_desc == &ES_MeterServiceDesc
+    #endif
+        );
 }
 
-int write_OutletB_handler(const char *cha_type, cJSON *valJSObj)
+int write_Outlet_handler(const HAPDescEntry_t *entry, cJSON *valJSObj)
 {
-    if (strcmp(cha_type, kCharacteristicUUID_On) == 0)
+    const struct outlet_cmd *cmd = &outlet_cmds[entry->instance];
+    outlet_state *outletstate = outlet_states[entry->instance];
+
+    switch (outlet_cha_id(entry))
     {
+    case OUTLET_CHA_ON:
         if(valJSObj->valueint == 0)
         {
-            outletstateB.on = 0;
-            outletstateB_app.on = outletstateB.on;
-            app_handle(OUTLET_B_OFF, NULL);
+            outletstate->on = 0;
+            outlet_states_app[entry->instance]->on = outletstate->on;
+            app_handle(cmd->off, NULL);
         }
         else if(valJSObj->valueint == 1)
         {
-            outletstateB.on = 1;
-            outletstateB_app.on = outletstateB.on;
-            app_handle(OUTLET_B_ON, NULL);
+            outletstate->on = 1;
+            outlet_states_app[entry->instance]->on = outletstate->on;
+            app_handle(cmd->on, NULL);
         }
         // Update target characteristic value
-        HAPUpdateServiceCharacteristic(MyOutletService2, cha_type, cJSON_Duplicate(valJSObj, 0));
-    }
-    else if (strcmp(cha_type, kChaUUID_Timing_On) == 0)
-    {
+        HAPUpdateServiceCharacteristic(entry->service, (char *)entry->desc->type, cJSON_Duplicate(valJSObj, 0));
+        break;
+    case OUTLET_CHA_TIMING:
         printf("Timing_On_Data : len : %d : %s\n", strlen(valJSObj->valuestring), valJSObj->valuestring);
-        write_timerdata(&outletstateB, valJSObj);
-    }
-    else if (strcmp(cha_type, kChaUUID_Thr_overVoltage) == 0)
-    {
+        write_timerdata(outletstate, valJSObj);
+        break;
+    case OUTLET_CHA_THRVOL_OVER:
         printf("Thr_Voltage : type : %d : val : %f\n", valJSObj->type, valJSObj->valuedouble);
-        app_handle(OUTLET_B_OVERVOL, &(valJSObj->valuedouble));
-    }
-    else if (strcmp(cha_type, kChaUUID_Thr_underVoltage) == 0)
-    {
+        app_handle(cmd->overvol, &(valJSObj->valuedouble));
+        break;
+    case OUTLET_CHA_THRVOL_UNDER:
         printf("Thr_Voltage : type : %d : val : %f\n", valJSObj->type, valJSObj->valuedouble);
-        app_handle(OUTLET_B_UNDERVOL, &(valJSObj->valuedouble));
-    }
-    else if (strcmp(cha_type, kChaUUID_Thr_Current) == 0)
-    {
+        app_handle(cmd->undervol, &(valJSObj->valuedouble));
+        break;
+    case OUTLET_CHA_THRCUR:
         printf("Thr_Current : type : %d : val : %f\n", valJSObj->type, valJSObj->valuedouble);
-        app_handle(OUTLET_B_CUR, &(valJSObj->valuedouble));
-    }
-    else if (strcmp(cha_type, kChaUUID_Thr_Power) == 0)
-    {
+        app_handle(cmd->cur, &(valJSObj->valuedouble));
+        break;
+    case OUTLET_CHA_THRPOW:
         printf("Thr_Power : type : %d : val : %f\n", valJSObj->type, valJSObj->valuedouble);
-        app_handle(OUTLET_B_POW, &(valJSObj->valuedouble));
+        app_handle(cmd->pow, &(valJSObj->valuedouble));
+        break;
+    default:
+        break;
     }
     return kHAPStatus_Success;
 }
@@ -806,29 +703,20 @@ int write_System_handler(const char *cha_type, cJSON *valJSObj)
 int ES_phytrex_MainHandler(cJSON *pDB, cJSON *pAccessory, int aid, int iid, cJSON *valueJSObject)
 {
     int status = kHAPStatus_InvalidValue;
-    cJSON *accessoryJSObject, *serviceJSObject, *chaJSObj;
+    const HAPDescEntry_t *entry = HAPLookupDescEntry(aid, iid);
+    
+    if (entry == NULL) return status;
     
-    accessoryJSObject = HAPSearchDatabaseAID(pDB, aid);
-    chaJSObj = HAPSearchDatabaseIID(pDB, accessoryJSObject, iid);
-    serviceJSObject = HAPSearchCharacteristicService(pDB, chaJSObj);
-        
     // Handle for Outlet
-    if ((accessoryJSObject == pAccessory) &&
-       (serviceJSObject == MyOutletService1 || 
-        serviceJSObject == MyOutletService2 ||
-        serviceJSObject == MyOtaService||
-        serviceJSObject == MySysService))
+    if (entry->serv_desc == &ES_OutletServiceDesc && entry->instance <= 1)
     {
-        char *cha_type = cJSON_GetObjectItem(chaJSObj, kChaObj_Type)->valuestring;
-        if (serviceJSObject == MyOutletService1)
-        {
-            write_OutletA_handler(cha_type, valueJSObject);
-        }
-        if (serviceJSObject == MyOutletService2)
-        {
-            write_OutletB_handler(cha_type, valueJSObject);
-        }
-        if (serviceJSObject == MyOtaService)
+        write_Outlet_handler(entry, valueJSObject);
+        status = kHAPStatus_Success;
+    }
+    else if (entry->service == MyOtaService || entry->service == MySysService)
+    {
+        char *cha_type = cJSON_GetObjectItem(entry->characteristic, kChaObj_Type)->valuestring;
+        if (entry->service == MyOtaService)
         {
             #if FIRST_VERSION
             return status;
@@ -836,7 +724,7 @@ int ES_phytrex_MainHandler(cJSON *pDB, cJSON *pAccessory, int aid, int iid, cJSO
             write_Ota_handler(cha_type, valueJSObject);
             #endif
         }
-        if (serviceJSObject == MySysService)
+        if (entry->service == MySysService)
         {
             write_System_handler(cha_type, valueJSObject);
         }
@@ -858,168 +746,182 @@ int phytrex_AccessoryOperationHandler(int aid, int iid, cJSON *valueJSObject)
 
 int read_handler(int aid, int iid, cJSON **outValue)
 {
-    static int number=0;
-    cJSON *accessoryJSObject, *serviceJSObject, *characteristicJSObject;
+    const HAPDescEntry_t *entry = HAPLookupDescEntry(aid, iid);
     
-    accessoryJSObject = HAPSearchDatabaseAID(MyDB, aid);
-    characteristicJSObject = HAPSearchDatabaseIID(MyDB, accessoryJSObject, iid);
-    serviceJSObject = HAPSearchCharacteristicService(MyDB, characteristicJSObject);
-    cJSON *value = cJSON_GetObjectItem(characteristicJSObject, kCharacteristicObject_Value);
-    
-    if((accessoryJSObject == MyAccessory) &&
-       (serviceJSObject == MyOutletService1 ||
-        serviceJSObject == MyOutletService2)) {
-        char *characteristic_type = cJSON_GetObjectItem(characteristicJSObject, kCharacteristicObject_Type)->valuestring;
-        if(serviceJSObject == MyOutletService1) {
-            //printf("\nOutlet1:");
-        }
-        else if(serviceJSObject == MyOutletService2) {
-            //printf("\nOutlet2:");
-        }
-    }
-    *outValue = cJSON_Duplicate(value, 0);
-exit:
+    if (entry == NULL) return kHAPStatus_Success;
+    *outValue = cJSON_Duplicate(cJSON_GetObjectItem(entry->characteristic, kCharacteristicObject_Value), 0);
     return kHAPStatus_Success;
 }
 
-int checkdatanum(char *characteristic_type)
+#if HISDATA_15_MIN
+/* Encoded block of the current days of each channel, the one the samples land in, rebuilt after
+   a sample does. Older blocks are built on every read, so the cache holds at most one
+   HISDATA_B64LEN buffer per channel */
+typedef struct hisdata_block {
+    uint32 key;             // HISLOG_STAMP(year, mon, block, 0), 0 when stale
+    uint32 first;           // log start it was built from, the ring drops the oldest samples
+    uint32 gen;             // bumped by every drop, a build that raced one is not kept
+    char *b64;
+} hisdata_block;
+
+static hisdata_block hisdata_cache[2];
+static xSemaphoreHandle hisdata_mutex = NULL;
+
+static void hisdata_lock(void)
+{
+    if (hisdata_mutex != NULL) xSemaphoreTake(hisdata_mutex, portMAX_DELAY);
+}
+
+static void hisdata_unlock(void)
 {
-    if(strcmp(characteristic_type, kChaUUID_1st_Hisdata) == 0) return 1;
-    if(strcmp(characteristic_type, kChaUUID_2nd_Hisdata) == 0) return 2;
-    if(strcmp(characteristic_type, kChaUUID_3rd_Hisdata) == 0) return 3;
-    if(strcmp(characteristic_type, kChaUUID_4th_Hisdata) == 0) return 4;
-    if(strcmp(characteristic_type, kChaUUID_5th_Hisdata) == 0) return 5;
-    if(strcmp(characteristic_type, kChaUUID_6th_Hisdata) == 0) return 6;
-    if(strcmp(characteristic_type, kChaUUID_7th_Hisdata) == 0) return 7;
-    if(strcmp(characteristic_type, kChaUUID_8th_Hisdata) == 0) return 8;
-    return 0;
+    if (hisdata_mutex != NULL) xSemaphoreGive(hisdata_mutex);
 }
 
-#if HISDATA_15_MIN
-int read_hisdata(cJSON *serviceJSObject, char *characteristic_type)
+void hisdata_cache_init(void)
 {
-    int datanum, outlen2;
-    int outlen = HISDATALEN;
-    flash_t flash;
-    int hisaddr,offset;
-    uint8 hisdatabuf[HISDATALEN];
-    struct tm *timeinfo;
-    int tm_year,tm_mon;
-    uint8_t data[3];
-    int addstate = 0;
+    if (hisdata_mutex == NULL) hisdata_mutex = xSemaphoreCreateMutex();
+}
 
-    read_locoltime(timeinfo);
-    tm_year = timeinfo->tm_year;
-    tm_mon = timeinfo->tm_mon;
-    
-    datanum = checkdatanum(characteristic_type);
-    if ((datanum == 0) || (tm_year < 2000)) return -1;
-    hisaddr = (serviceJSObject == MyOutletService1) ? (OUTLET_A_HISADDR) : (OUTLET_B_HISADDR);
-    flash_stream_read(&flash, hisaddr+4096-1, 1, data);
-    if (data[0] != 0x5A)
+static void hisdata_cache_drop(uint8 channel, uint8 year, uint8 mon, uint8 day)
+{
+    hisdata_block *blk;
+    uint32 key = HISLOG_STAMP(year, mon, day/8, 0);
+
+    if ((channel < 1) || (channel > 2)) return;
+    hisdata_lock();
+    blk = &hisdata_cache[channel - 1];
+    if (blk->key == key) blk->key = 0;
+    blk->gen++;
+    hisdata_unlock();
+}
+
+// blocks 1-4 hold the previous month, 5-8 the current one, *current is set for today's block
+static int hisdata_block_of(int datanum, uint8 *year, uint8 *mon, uint8 *block, int *current)
+{
+    struct tm timeinfo;
+
+    read_locoltime(&timeinfo);
+    if ((datanum < 1) || (datanum > HISDATA_BLOCKS) || (timeinfo.tm_year < 2000)) return -1;
+
+    *year = timeinfo.tm_year % 100;
+    *mon = timeinfo.tm_mon;
+    if (datanum < 5)
     {
-        flash_stream_read(&flash, hisaddr+2*4096-1, 1, data);
-        if (data[0] == 0x5A)
+        if (*mon == 1)
         {
-            hisaddr += 4096;
-            addstate = 1;
+            *mon = 12;
+            *year = (*year + 99) % 100;
         }
         else
         {
-            return -1;
+            (*mon)--;
         }
     }
-    
-    if (datanum<5)
-    {
-        if (addstate)
-        {
-            hisaddr -= 4096;
-        }
-        else
+    *block = (datanum - 1) % 4;
+    *current = (datanum >= 5) && (*block == timeinfo.tm_mday/8);
+    return 0;
+}
+
+// block b takes the days with day/8 == b, at (day-1)%8 within the block
+static void build_hisdata(uint8 channel, uint8 year, uint8 mon, uint8 block, uint8 *hisdatabuf)
+{
+    hislog_rec recs[HISDATA_FETCH];
+    uint8 day_lo = block ? block*8 : 1;
+    uint32 seq, next, stamp;
+    uint32 end = HISLOG_STAMP(year, mon, block*8 + 7, 0xFF);
+    int n, i;
+
+    memset(hisdatabuf, 0xFF, HISDATALEN);
+    hisdatabuf[0] = year;
+    hisdatabuf[1] = mon;
+    hisdatabuf[2] = block*8 + 1;
+    hislog_range(NULL, &next, NULL);
+    for (seq = hislog_seek(HISLOG_STAMP(year, mon, day_lo, 0)); seq < next; seq += n)
+    {
+        n = hislog_fetch(seq, recs, HISDATA_FETCH);
+        if (n == 0) break;
+        for (i = 0; i < n; i++)
         {
-            hisaddr += 4096;
+            if ((recs[i].channel < 1) || (recs[i].channel > 2)) continue;
+            stamp = HISLOG_STAMP(recs[i].year, recs[i].mon, recs[i].day, recs[i].slot);
+            if (stamp > end) return;
+            if ((recs[i].channel != channel + 1) || (recs[i].day < day_lo)) continue;
+            hisdatabuf[3 + (recs[i].day - 1)%8*96 + recs[i].slot] = recs[i].quantity & 0x7F;
         }
     }
-    offset = (datanum - 1)%4*1024;
-    hisaddr += offset;
-    memset(hisdatabuf, 0, HISDATALEN);
-    flash_stream_read(&flash, hisaddr, HISDATALEN, hisdatabuf);
-    print_data(hisdatabuf,HISDATALEN);
-    for (int i=3;i<HISDATALEN;i++)
-    {
-        if (hisdatabuf[i] != 0xFF) hisdatabuf[i] &= 0x7F;
-    }
-    print_data(hisdatabuf,HISDATALEN);
-    memset(Hisdata, 0, HISDATABASE64LEN);
-    outlen2 = HISDATABASE64LEN;
-    base64_encode(Hisdata, &outlen2, hisdatabuf, outlen);
-    //printf("read Hisdata len : %d : %s\n", outlen2, Hisdata);
-    return 0;
 }
-#endif
-#if 0
-int read_hisdata(cJSON *serviceJSObject, char *characteristic_type)
+
+cJSON *read_hisdata(uint8 channel, int datanum)
 {
-    int datanum, outlen2;
-    int outlen = HISDATALEN;
-    flash_t flash;
-    int hisaddr,offset;
+    hisdata_block *blk;
     uint8 hisdatabuf[HISDATALEN];
-    struct tm *timeinfo;
-    int tm_year,tm_mon;
-
-    read_locoltime(timeinfo);
-    tm_year = timeinfo->tm_year;
-    tm_mon = timeinfo->tm_mon;
-    
-    datanum = checkdatanum(characteristic_type);
-    if ((datanum != 0) && (tm_year > 2000))
-    {
-        hisaddr = (serviceJSObject == MyOutletService1) ? (OUTLET_A_HISADDR) : (OUTLET_B_HISADDR);
-        offset = (tm_mon-1)*1024;
-        offset -=(8-datanum)*1024;
-        hisaddr += offset;
-        if (offset < 0)
-        {  
-            hisaddr += 4096*3;
-        }
-        memset(hisdatabuf, 0, HISDATALEN);
-        flash_stream_read(&flash, hisaddr, HISDATALEN, hisdatabuf);
-        print_data(hisdatabuf,HISDATALEN);
-        memset(Hisdata, 0, HISDATABASE64LEN);
-        outlen2 = HISDATABASE64LEN;
-        base64_encode(Hisdata, &outlen2, hisdatabuf, outlen);
-        //printf("read Hisdata len : %d : %s\n", outlen2, Hisdata);
-        return 0;
-    }
-    return -1;
+    uint8 year, mon, block;
+    uint32 key, first, gen;
+    cJSON *value = NULL;
+    char *b64;
+    int outlen, current;
+
+    if (hisdata_block_of(datanum, &year, &mon, &block, &current) < 0) return NULL;
+    if (!current)
+    {
+        build_hisdata(channel, year, mon, block, hisdatabuf);
+        b64 = malloc(HISDATA_B64LEN);
+        if (b64 == NULL) return NULL;
+        outlen = HISDATA_B64LEN;
+        base64_encode(b64, &outlen, hisdatabuf, HISDATALEN);
+        value = cJSON_CreateString(b64);
+        free(b64);
+        return value;
+    }
+    key = HISLOG_STAMP(year, mon, block, 0);
+    hislog_range(&first, NULL, NULL);
+    blk = &hisdata_cache[channel];
+
+    hisdata_lock();
+    if ((blk->b64 != NULL) && (blk->key == key) && (blk->first == first))
+    {
+        value = cJSON_CreateString(blk->b64);
+    }
+    gen = blk->gen;
+    hisdata_unlock();
+    if (value != NULL) return value;
+
+    build_hisdata(channel, year, mon, block, hisdatabuf);
+
+    hisdata_lock();
+    if (blk->b64 == NULL) blk->b64 = malloc(HISDATA_B64LEN);
+    if (blk->b64 != NULL)
+    {
+        outlen = HISDATA_B64LEN;
+        base64_encode(blk->b64, &outlen, hisdatabuf, HISDATALEN);
+        blk->key = (blk->gen == gen) ? key : 0;
+        blk->first = first;
+        value = cJSON_CreateString(blk->b64);
+    }
+    hisdata_unlock();
+    return value;
 }
 #endif
 
-int read_monthdata()
+cJSON *read_monthdata(void)
 {
-    int datanum, outlen2;
-    int outlen = 72;
+    int outlen2;
     flash_t flash;
-    int hisaddr;
-    char hisdatabuf[72];
+    uint8 hisdatabuf[OUTLET_MONTHLEN];
+    char b64[BASE64_LEN(OUTLET_MONTHLEN)];
     
-    hisaddr = OUTLET_MON_HISADDR;
-    memset(hisdatabuf, 0, outlen);
-    flash_stream_read(&flash, hisaddr, outlen, hisdatabuf);
-    memset(Hisdata, 0, HISDATABASE64LEN);
-    outlen2 = HISDATABASE64LEN;
-    base64_encode(Hisdata, &outlen2, hisdatabuf, outlen);
-    printf("read monthdata len : %d : %s\n", outlen2, Hisdata);
-    return 0;
+    memset(hisdatabuf, 0, OUTLET_MONTHLEN);
+    flash_cached_read(&flash, OUTLET_MON_HISADDR, OUTLET_MONTHLEN, hisdatabuf);
+    outlen2 = sizeof(b64);
+    base64_encode(b64, &outlen2, hisdatabuf, OUTLET_MONTHLEN);
+    return cJSON_CreateString(b64);
 }
 
 int timerdatalen(const unsigned char *timerdata)
 {
     int len = 0;
     int i;
-    for (i=0; i<300; i++)
+    for (i=0; i<OUTLET_TIMER_READLEN; i++)
     {
         //printf("%x", timerdata[i]);
         if (timerdata[i] == 0xff) 
@@ -1028,149 +930,51 @@ int timerdatalen(const unsigned char *timerdata)
             break;
         }
     }
-    if (i == 300) return 300;
+    if (i == OUTLET_TIMER_READLEN) return OUTLET_TIMER_READLEN;
     return len;
 }
 
-int read_timerdata(outlet_state *outletstate)
+cJSON *read_timerdata(outlet_state *outletstate)
 {
-    int datanum, outlen2, timerlen, i;
-    int outlen = OUTLET_TIMER_TWOLEN;
+    int outlen2, timerlen;
     flash_t flash;
-    int hisaddr;
-    char hisdatabuf[OUTLET_TIMER_TWOLEN];
-    
-    hisaddr = OUTLET_TIMER_ADDR;
-    memset(hisdatabuf, 0, outlen);
-    flash_stream_read(&flash, hisaddr, outlen, hisdatabuf);
-
-//    printf("\r\n");
-//    for (i=0; i<600; i++)
-//    {
-//        printf("%x",hisdatabuf[i]);
-//    }
-//    printf("\r\n");
+    int timeraddr;
+    uint8 timerdatabuf[OUTLET_TIMER_READLEN];
+    char b64[BASE64_LEN(OUTLET_TIMER_READLEN)];
     
-    memset(Hisdata, 0, HISDATABASE64LEN);
-    outlen2 = HISDATABASE64LEN;
-    if (outletstate == (&outletstateA))
-    {
-        timerlen = timerdatalen(hisdatabuf);
-        printf("timerlen : %d \n", timerlen);
-        base64_encode(Hisdata, &outlen2, hisdatabuf, timerlen);
-    }
-    else
+    timeraddr = OUTLET_TIMER_ADDR;
+    if (outletstate != (&outletstateA))
     {
-        timerlen = timerdatalen(hisdatabuf+OUTLET_TIMER_ONELEN);
-        printf("timerlen : %d \n", timerlen);
-        base64_encode(Hisdata, &outlen2, hisdatabuf+OUTLET_TIMER_ONELEN, timerlen);
+        timeraddr += OUTLET_TIMER_ONELEN;
     }
-    printf("read timerdata len : %d : %s\n", outlen2, Hisdata);
-    return 0;
+    memset(timerdatabuf, 0, OUTLET_TIMER_READLEN);
+    flash_stream_read(&flash, timeraddr, OUTLET_TIMER_READLEN, timerdatabuf);
+    timerlen = timerdatalen(timerdatabuf);
+    outlen2 = sizeof(b64);
+    base64_encode(b64, &outlen2, timerdatabuf, timerlen);
+    return cJSON_CreateString(b64);
 }
 
-cJSON *read_Outlet_handler(cJSON *serviceJSObject, const char *cha_type, cJSON *charJSObj)
-{//print_data(cha_type, 10);
-    //char *cha_type = cJSON_GetObjectItem(charJSObj, kChaObj_Type)->valuestring;
-    //printf("read : %s\n",cha_type);
-    outlet_state *outletstate;
-    if (serviceJSObject == MyOutletService1
-    #if FIRST_VERSION
-    ||serviceJSObject == MyMeterService1
-    #endif
-    ){
-        outletstate = &outletstateA;
-        //printf("read 1\n");
-    }
-    else if (serviceJSObject == MyOutletService2
-    #if FIRST_VERSION
-    ||serviceJSObject == MyMeterService2
-    #endif
-    ){
-        outletstate = &outletstateB;
-        //printf("read 2\n");
-    }
-    else{
-        return NULL;
-    }
+cJSON *read_Outlet_handler(const HAPDescEntry_t *entry)
+{
+    outlet_state *outletstate = outlet_states[entry->instance];
+    int id = outlet_cha_id(entry);
     
-    if (0 == read_hisdata(serviceJSObject, cha_type))
-    {
-        return cJSON_CreateString(Hisdata);
-    }
-    else if (strcmp(cha_type, kCharacteristicUUID_On) == 0)
-    {
-        //printf("read on\n");
-        return cJSON_CreateBool(outletstate->on);
-    }
-    else if (strcmp(cha_type, kCharacteristicUUID_OutletInUse) == 0)
-    {
-        //printf("read in use :%d\n",outletstate->inuse);
-        return cJSON_CreateBool(outletstate->inuse);
-    }
-    else if (strcmp(cha_type, kChaUUID_Month_Data) == 0)
-    {
-        read_monthdata();
-        return cJSON_CreateString(Hisdata);
-    }
-    else if (strcmp(cha_type, kChaUUID_Timing_On) == 0)
-    {
-        read_timerdata(outletstate);
-        return cJSON_CreateString(Hisdata);
-    }
-    else if (strcmp(cha_type, kChaUUID_Met_Total_Quantity) == 0)
-    {
-        return cJSON_CreateNumber(outletstate->metqua);
-    }
-    else if (strcmp(cha_type, kChaUUID_Met_Voltage) == 0)
-    {
-        return cJSON_CreateNumber(outletstate->metvol);
-    }
-    else if (strcmp(cha_type, kChaUUID_Met_Current) == 0)
-    {
-        return cJSON_CreateNumber(outletstate->metcur);
-    }
-    else if (strcmp(cha_type, kChaUUID_Met_Power) == 0)
-    {
-        return cJSON_CreateNumber(outletstate->metpow);
-    }
-    else if (strcmp(cha_type, kChaUUID_Thr_overVoltage) == 0)
-    {
-        return cJSON_CreateNumber(outletstate->thrvol_over);
-    }
-    else if (strcmp(cha_type, kChaUUID_Thr_underVoltage) == 0)
-    {
-        return cJSON_CreateNumber(outletstate->thrvol_under);
-    }
-    else if (strcmp(cha_type, kChaUUID_Thr_Current) == 0)
-    {
-        return cJSON_CreateNumber(outletstate->thrcur);
-    }
-    else if (strcmp(cha_type, kChaUUID_Thr_Power) == 0)
-    {
-        return cJSON_CreateNumber(outletstate->thrpow);
-    }
-    #if FIRST_VERSION
-    else if (strcmp(cha_type, kChaUUID_FV_Met_Voltage) == 0)
-    {
-        //printf("read kChaUUID_FV_Met_Voltage\n");
-        printf("read vol\n");
-        printf("%4.2f\n",outletstate->metvol);
-        return cJSON_CreateNumber(outletstate->metvol);
-    }
-    else if (strcmp(cha_type, kChaUUID_FV_Met_Current) == 0)
-    {
-        printf("read cur\n");
-        return cJSON_CreateNumber(outletstate->metcur);
-    }
-    else if (strcmp(cha_type, kChaUUID_FV_Met_Power) == 0)
-    {
-        printf("read pow\n");
-        return cJSON_CreateNumber(outletstate->metpow);
+    switch (id)
+    {
+    case OUTLET_CHA_MONTHDATA:
+        return read_monthdata();
+    case OUTLET_CHA_TIMING:
+        return read_timerdata(outletstate);
+    case OUTLET_CHA_HISDATA1: case OUTLET_CHA_HISDATA2:
+    case OUTLET_CHA_HISDATA3: case OUTLET_CHA_HISDATA4:
+    case OUTLET_CHA_HISDATA5: case OUTLET_CHA_HISDATA6:
+    case OUTLET_CHA_HISDATA7: case OUTLET_CHA_HISDATA8:
+        return read_hisdata(entry->instance, id - OUTLET_CHA_HISDATA1 + 1);
+    default:
+        // on, in use, meterage and thresholds are kept in outlet_state
+        return HAPCreateDescValue(entry->desc, outletstate);
     }
-    #endif
-    
-    return NULL;
 }
 
 cJSON *read_Ota_handler(const char *cha_type)
@@ -1216,39 +1020,21 @@ cJSON *read_System_handler(const char *cha_type)
 
 int ES_read_handler(int aid, int iid, cJSON **outValue)
 {
-    static int number = 0;
-    cJSON *accesJSObj, *servJSObj, *charJSObj;
+    const HAPDescEntry_t *entry = HAPLookupDescEntry(aid, iid);
+    
+    if (entry == NULL) return kHAPStatus_Success;
     
-    accesJSObj = HAPSearchDatabaseAID(MyDB, aid);
-    charJSObj = HAPSearchDatabaseIID(MyDB, accesJSObj, iid);
-    servJSObj = HAPSearchCharacteristicService(MyDB, charJSObj);
-    if ((accesJSObj == MyAccessory) &&
-       (servJSObj == MyOutletService1 ||
-        servJSObj == MyOutletService2 ||
-        servJSObj == MyOtaService||
-        servJSObj == MySysService
-        #if FIRST_VERSION
-        ||servJSObj == MyMeterService1 ||servJSObj == MyMeterService2
-        #endif
-        ))
+    if (is_outlet_entry(entry))
     {
-        char *cha_type = cJSON_GetObjectItem(charJSObj, kChaObj_Type)->valuestring;
-        if (servJSObj == MyOutletService1 || servJSObj == MyOutletService2
-        #if FIRST_VERSION
-        || servJSObj == MyMeterService1 ||servJSObj == MyMeterService2
-        #endif
-        )
-        {
-            *outValue = read_Outlet_handler(servJSObj, cha_type, charJSObj);
-        }
-        else if (servJSObj == MyOtaService )
-        {
-            *outValue = read_Ota_handler(cha_type);
-        }
-        else if (servJSObj == MySysService )
-        {
-            *outValue = read_System_handler(cha_type);
-        }
+        *outValue = read_Outlet_handler(entry);
+    }
+    else if (entry->service == MyOtaService)
+    {
+        *outValue = read_Ota_handler(cJSON_GetObjectItem(entry->characteristic, kChaObj_Type)->valuestring);
+    }
+    else if (entry->service == MySysService)
+    {
+        *outValue = read_System_handler(cJSON_GetObjectItem(entry->characteristic, kChaObj_Type)->valuestring);
     }
     return kHAPStatus_Success;
 }
@@ -1279,9 +1065,8 @@ void Parse_Alarm_JSON(PhytrexClockAlarm *pArray, int len, cJSON *AlarmGroup)
     for(int i=0; i<size; i++) {
         cJSON *object = cJSON_GetArrayItem(array, i);
         if(object != NULL) {
-            char *str = cJSON_Print(object);
-            printf("%s\n\r", str);
-            free(str);
+            phytrex_PrintJSON(object);
+            printf("\n\r");
         }
         /*memset(&ca, 0, sizeof(ca));
         ca.t;
@@ -1315,7 +1100,10 @@ cJSON *phytrex_AccessoryDatabaseSetup(HAPParameter_t *param)
     HAPInformationService_t info;
     HAPOutletService_t outlet;
 
+    // Database nodes come from the fixed cJSON pools, not the shared heap
+    cJSON_PoolBegin();
     // Generate an accessory with information
+    HAPResetServiceDesc();
     MyDB = HAPCreateAccessoryDatabase();
     memset(&info, 0, sizeof(HAPInformationService_t));
     info.manufacturer = hk_flow.Wac.manufacturer;
@@ -1351,10 +1139,19 @@ cJSON *phytrex_AccessoryDatabaseSetup(HAPParameter_t *param)
     
     HAPCreatePhytrexServiceGroup(MyAccessory);
     
+    // Notifications read the changed values from the outlet state
+    HAPSetServiceDescBlock(MyOutletService1, &outletstateA);
+    HAPSetServiceDescBlock(MyOutletService2, &outletstateB);
+#if FIRST_VERSION
+    HAPSetServiceDescBlock(MyMeterService1, &outletstateA);
+    HAPSetServiceDescBlock(MyMeterService2, &outletstateB);
+#endif
+    
     HAPSetAccessoryCategory(kAccessoryCategory_Outlet);
     
     HAPSetCharacteristicReader(ES_read_handler);
     
+    cJSON_PoolEnd();
     return MyDB;
 }
 
@@ -1426,6 +1223,46 @@ void phytrex_HAPPlatformNotify(HAPNotify_t notify)
 	}
 }
 
+// Wake HAPNotifyHandle, callable from any task
+void outlet_post_event(uint8 type, uint8 channel)
+{
+    outlet_event evt = {type, channel};
+    
+    if (outlet_evt_queue != NULL)
+    {
+        xQueueSend(outlet_evt_queue, &evt, 0);
+    }
+}
+
+// Level interrupt on the in-use inputs, rearmed on the opposite level so each change fires once
+static void oiu_irq_handler(uint32_t id, gpio_irq_event event)
+{
+    gpio_irq_t *irq = (gpio_irq_t *)id;
+    uint8 channel = (irq == &gpio_oiu1) ? 1 : 2;
+    outlet_event evt = {OUTLET_EVT_INUSE, channel};
+    portBASE_TYPE woken = pdFALSE;
+    
+    gpio_irq_disable(irq);
+    oiu_armed_high[channel - 1] = !oiu_armed_high[channel - 1];
+    gpio_irq_set(irq, (gpio_irq_event)(oiu_armed_high[channel - 1] ? IRQ_HIGH : IRQ_LOW), 1);
+    gpio_irq_enable(irq);
+    
+    if (outlet_evt_queue != NULL)
+    {
+        xQueueSendFromISR(outlet_evt_queue, &evt, &woken);
+        portEND_SWITCHING_ISR(woken);
+    }
+}
+
+static void init_oiu_irq(gpio_irq_t *irq, PinName pin, gpio_t *gpio, uint8 channel)
+{
+    // arm for the level the input is not at now
+    oiu_armed_high[channel - 1] = !gpio_read(gpio);
+    gpio_irq_init(irq, pin, oiu_irq_handler, (uint32_t)irq);
+    gpio_irq_set(irq, (gpio_irq_event)(oiu_armed_high[channel - 1] ? IRQ_HIGH : IRQ_LOW), 1);
+    gpio_irq_enable(irq);
+}
+
 void init_gpio(void)
 {
     int i;
@@ -1447,6 +1284,18 @@ void init_gpio(void)
         gpio_init(&OlInUse2, GPIO_OLINUSE2);
         gpio_dir(&OlInUse2, PIN_INPUT);
         gpio_mode(&OlInUse2, PullUp);
+        //in-use changes are delivered to HAPNotifyHandle through the event queue
+        if (outlet_evt_queue == NULL)
+        {
+            outlet_evt_queue = xQueueCreate(OUTLET_EVT_QUEUE_LEN, sizeof(outlet_event));
+        }
+        //history log is mounted before the uart task can append samples
+        hislog_init();
+#if HISDATA_15_MIN
+        hisdata_cache_init();
+#endif
+        init_oiu_irq(&gpio_oiu1, GPIO_OLINUSE1, &OlInUse1, 1);
+        init_oiu_irq(&gpio_oiu2, GPIO_OLINUSE2, &OlInUse2, 2);
   //      gpio_write(&identy_led, 1); //turn on identify led at first
 
         //Initial LED timer
@@ -1481,6 +1330,7 @@ void write_locoltime(struct tm *ptm)
     t = mktime(ptm);
     t -= 8*60*60;
     rtc_write(t);
+    outlet_timer_changed(0);
 }
 
 void set_locoltime(char *time)
@@ -1510,193 +1360,26 @@ void set_locoltime(char *time)
     write_locoltime(timeinfo);
     //difftime
 }
-int chech_sector_writable(uint32 begin, uint32 end)
-{
-    int i;
-    flash_t flash;
-    uint8 data;
-    
-    for (i=begin;i<end;i++)
-    {
-        flash_stream_read(&flash, i, 1, &data);
-        if (data != 0xFF) return 0;
-    }
-    return 1;
-}
-
-#if HISDATA_15_MIN
 void wirte_hisdata2flash(hisdata_state report_hisdata)
 {
-    uint32 his_sector,offset;
-    //uint32 mon_addr,lastmon_addr,data_addr,hour_addr;
-    flash_t flash;
-    uint8 channel, year,mon,day,hour,min,quantity;
-    uint8 data[3];
-    uint8 sector_mon;
-    int addstate = 0;
-    
-    channel = report_hisdata.channel;
-    year = report_hisdata.year;
-    mon = report_hisdata.mon;
-    day = report_hisdata.day;
-    hour = report_hisdata.hour;
-    min = report_hisdata.min;
-    quantity = report_hisdata.quantity;
-    if ((mon>12)||(mon<1)||(day<1)||(day>31)||(hour>23)||(min>59)) return;
-    
-    his_sector = (channel == 1) ? (OUTLET_A_HISADDR) : (OUTLET_B_HISADDR);
-    
-    flash_stream_read(&flash, his_sector+4096-1, 1, data);
-    if (data[0] != 0x5A)
-    {
-        flash_stream_read(&flash, his_sector+2*4096-1, 1, data);
-        if (data[0] == 0x5A)
-        {
-            his_sector += 4096;
-            addstate = 1;
-        }
-        else
-        {
-            goto exit_erase_flash;
-        }
-    }
-    
-    flash_stream_read(&flash, his_sector, 2, data);
-    printf("year,mon:%d,%d\n",data[0],data[1]);
-    if ((data[0] == year) && (data[1] == mon))
-    {
-        goto exit_write_data;
-    }
-
-    data[0] = 0x00;
-    flash_stream_write(&flash, his_sector+4096-1, 1, data);
-    
-    if (addstate)
-    {
-        his_sector -= 4096;
-    }
-    else
-    {
-        his_sector += 4096;
-    }
-    
-exit_erase_flash:
-    printf("[%s] exit_erase_flash\n", __FUNCTION__);
-    flash_erase_sector(&flash, his_sector);
-    data[0] = 0x5A;
-    flash_stream_write(&flash, his_sector+4096-1, 1, data);
+    uint8 slot;
 
-    
-exit_write_mon:
-    printf("[%s] exit_write_mon : %d   %d\n", __FUNCTION__,year,mon);
-    data[0] = year;
-    data[1] = mon;
-    data[2] = 1;
-    flash_stream_write(&flash, his_sector, 3, data);
-    data[2] = 9;
-    flash_stream_write(&flash, his_sector+1024, 3, data);
-    data[2] = 17;
-    flash_stream_write(&flash, his_sector+2*1024, 3, data);
-    data[2] = 25;
-    flash_stream_write(&flash, his_sector+3*1024, 3, data);
-    
-exit_write_data:
-    printf("[%s] exit_write_data : %d\n", __FUNCTION__,quantity);
-    offset = day/8*1024+3+(day-1)%8*96+hour*4+min/15;
-    flash_stream_read(&flash, his_sector+offset, 1, data);
-    if (data[0] == 0xFF)
-    {
-        data[0] = quantity | 0x80;    //bit7 means haven't reported to Iot
-        flash_stream_write(&flash, his_sector+offset, 1, data);
-    }
-    
-    uint8 checkdata[1024];
-    for(int i=0;i<2;i++)
-    {
-    flash_stream_read(&flash, OUTLET_A_HISADDR+i*4096+1024*3, 1024, checkdata);
-    printf("%d : ",i+1);
-    printf("%d ",checkdata[0]);
-    printf("%d ",checkdata[1]);
-    printf("%d \n",checkdata[2]);
-    print_data(checkdata+3, 1024-3);
-    }
-    
-}
+    if ((report_hisdata.mon>12)||(report_hisdata.mon<1)||(report_hisdata.day<1)||(report_hisdata.day>31)||
+        (report_hisdata.hour>23)) return;
+#if HISDATA_15_MIN
+    if (report_hisdata.min>59) return;
+    slot = report_hisdata.hour*4 + report_hisdata.min/15;
+#else
+    slot = report_hisdata.hour*4;
 #endif
-#if 0
-void wirte_hisdata2flash(hisdata_state report_hisdata)
-{
-    uint32 his_sector;
-    uint32 mon_addr,lastmon_addr,data_addr,hour_addr;
-    flash_t flash;
-    uint8 channel, year,mon,day,hour,quantity;
-    uint8 data[2];
-    uint8 sector_mon;
-    
-    channel = report_hisdata.channel;
-    year = report_hisdata.year;
-    mon = report_hisdata.mon;
-    day = report_hisdata.day;
-    hour = report_hisdata.hour;
-    quantity = report_hisdata.quantity;
-    if ((mon>12)||(mon<1)||(day<1)||(day>31)||(hour>23)) return;
-    
-    his_sector = (channel == 1) ? (OUTLET_A_HISADDR) : (OUTLET_B_HISADDR);
-    his_sector += (mon-1)/4*4096;
-    mon_addr = his_sector+((mon-1)%4)*1024;
-    data_addr = mon_addr+2;
-    hour_addr = data_addr+(day-1)*24+hour;
-    
-    flash_stream_read(&flash, mon_addr, 2, data);
-    printf("year,mon:%d,%d\n",data[0],data[1]);
-    if ((data[0] == year) && (data[1] == mon))
-    {
-        goto exit_write_data;
-    }
-
-    if ((data[0] == 0xFF) && (data[1] == 0xFF))
-    {
-        if(chech_sector_writable(mon_addr,his_sector+4096))
-        {
-            goto exit_write_mon;
-        }
-    }
-    
-exit_erase_flash:
-    printf("[%s] exit_erase_flash\n", __FUNCTION__);
-    flash_erase_sector(&flash, his_sector);
-
-exit_write_mon:
-    printf("[%s] exit_write_mon : %d   %d\n", __FUNCTION__,year,mon);
-    data[0] = year;
-    data[1] = mon;
-    flash_stream_write(&flash, mon_addr, 2, data);
-    
-exit_write_data:
-    printf("[%s] exit_write_data : %d\n", __FUNCTION__,quantity);
-    flash_stream_read(&flash, hour_addr, 1, data);
-    if (data[0] == 0xFF)
+    if (hislog_append(report_hisdata.channel, report_hisdata.year, report_hisdata.mon, report_hisdata.day,
+                      slot, report_hisdata.quantity) == 0)
     {
-        data[0] = quantity;
-        flash_stream_write(&flash, hour_addr, 1, data);
-    }
-}
+#if HISDATA_15_MIN
+        hisdata_cache_drop(report_hisdata.channel, report_hisdata.year, report_hisdata.mon, report_hisdata.day);
 #endif
-void init_outletstate(uint8 cc)
-{
-    //wait_ms(1000);
-    getMCU_meterage(cc);
-    vTaskDelay(1000);
-    //wait_ms(1000);
-    getMCU_thrpow(cc);
-    vTaskDelay(1000);
-    //wait_ms(1000);
-    getMCU_thrcur(cc);
-    vTaskDelay(1000);
-    //wait_ms(1000);
-    getMCU_thrvol(cc);
-    vTaskDelay(1000);
-    //wait_ms(1000);
+        printf("[%s] %d : %d\n", __FUNCTION__, report_hisdata.channel, report_hisdata.quantity);
+    }
 }
 
 void print_outletstate(outlet_state outletstate)
@@ -1718,18 +1401,18 @@ void getMCU_state()
 
 void getMCU_synch()
 {
-    //init_outletstate(0x01);
-    //init_outletstate(0x02);
-    getMCU_onoff_meter();
+    if (mcu_cmd_wait(getMCU_onoff_meter(MCU_WAIT)) < 0)
+    {
+        printf("[%s] no reply from MCU\n", __FUNCTION__);
+    }
 }
 
 void MCU_meterage_synch()
 {
-    //getMCU_onoff(0x01);
-    //getMCU_onoff(0x02);
-    //getMCU_meterage(0x01);
-    //getMCU_meterage(0x02);
-    getMCU_onoff_meter();
+    // thresholds only change through our own set commands, the refresh reads the live values
+    static const uint16 dids[] = {DID_ONOFF, DID_METER, DID_METQUA};
+
+    getMCU_batch(dids, ARRAY_SIZE(dids), CHANNEL_ALL, MCU_NOWAIT);
 }
 int init_time()
 {
@@ -1752,9 +1435,11 @@ int init_time()
     return 0;
 }
 
+// Run on OUTLET_EVT_ALARM, and by OUTLET_JOB_ALARM while a report of channel A has to be retried
 void alarm_handle()
 {
     static uint8 alarmA,alarmB;
+    outlet_job *job = &outlet_jobs[OUTLET_JOB_ALARM];
     int ret = -1;
 
     if ((alarmA != outletstateA.alarm))
@@ -1795,6 +1480,9 @@ void alarm_handle()
             report_alarm_to_iot(&outletstateB);
         }
     }
+
+    job->period = (alarmA != outletstateA.alarm) ? OUTLET_ALARM_RETRY : 0;
+    job->due = xTaskGetTickCount() * portTICK_RATE_MS + job->period;
 }
 
 void set_outlet_timer(struct outlet_timer *timer,uint8_t *data)
@@ -1807,165 +1495,272 @@ void set_outlet_timer(struct outlet_timer *timer,uint8_t *data)
     timer->weekday = data[2]&0x7f;
 }
 
-void outlet_timer_handle(uint8_t * timerdata,struct tm timeinfo,uint8_t cc)
+// Timers decoded from flash, kept sorted by minute of the day for the next-fire search
+static struct outlet_timer_slot timer_sched[OUTLET_TIMER_MAX];
+static int timer_sched_num;
+static volatile uint8 timer_sched_dirty = 1;
+static int timer_fired = -1;                // minute of the week handled last
+
+static int load_timer_channel(uint8_t *timerdata, uint8_t cc, int num)
 {
     struct outlet_timer timer;
-    uint8_t* data;    
-    time_t t1,t2;
-    uint8_t repeat;
-    t2 = rtc_read();
-
-    for (int i=0;i<OUTLET_TIMER_ONELEN;i+=7)
-    {
-        data = timerdata+i;
-        if (data[0] == 0xff) return;
-        set_outlet_timer(&timer,data);
-        memcpy(&t1, &data[3], 4);
-        //printf("t1 : %d ; t2 : %d ; t2-t1 : %d\n",t1,t2,t2-t1);
-         if ((t2-t1)>7*24*60*60)
+    struct outlet_timer_slot slot;
+    uint8_t *data;
+    int i, j;
+
+    for (i = 0; i < OUTLET_TIMER_ONELEN; i += OUTLET_TIMER_RECLEN)
+    {
+        data = timerdata + i;
+        if (data[0] == 0xff) break;
+        set_outlet_timer(&timer, data);
+        slot.minute = timer.hour*60 + timer.min;
+        slot.channel = cc;
+        slot.onoff = timer.onoff;
+        slot.repeat = timer.repeat;
+        slot.weekday = timer.weekday;
+        memcpy(&slot.created, &data[3], 4);
+
+        for (j = num; (j > 0) && (timer_sched[j-1].minute > slot.minute); j--)
         {
-            repeat = 0;
-        }
-        else
-        {
-            repeat = 1;
-        }
-        
-        //printf("%02x  %02x  %02x\n",data[0],data[1],data[2]);
-        //printf("repeat:%d onoff:%d  hour:%d  min:%d  enable:%d  week:%02x\n",
-            //timer.repeat,timer.onoff,timer.hour,timer.min,timer.enable,timer.weekday);
-        //printf("weekday : %d , \n0x01<<(7-weekday) : 0x%02x  \n&  setweek : %02x\n=0x%02x\n",
-            //timeinfo.tm_wday,0x01<<(7-timeinfo.tm_wday),timer.weekday,(0x01<<(7-timeinfo.tm_wday))&timer.weekday);
-        
-        //if (timer.enable == 0) continue;
-        if ((timer.hour != timeinfo.tm_hour)||(timer.min != timeinfo.tm_min)) continue;
-        
-        
-        if ((0x01<<(7-timeinfo.tm_wday))&timer.weekday)
-        {
-            if(timer.repeat|repeat)
-            {
-                setOutlet_onoff(cc, timer.onoff);
-            }
+            timer_sched[j] = timer_sched[j-1];
         }
+        timer_sched[j] = slot;
+        num++;
     }
+    return num;
 }
 
-void timer_handle()
+static void outlet_timer_load(void)
 {
-    int outlen = OUTLET_TIMER_TWOLEN;
     flash_t flash;
-    int addr;
     uint8_t timerdatabuf[OUTLET_TIMER_TWOLEN];
-    static int minute = -1;
 
+    memset(timerdatabuf, 0, OUTLET_TIMER_TWOLEN);
+    flash_stream_read(&flash, OUTLET_TIMER_ADDR, OUTLET_TIMER_TWOLEN, timerdatabuf);
+    timer_sched_num = load_timer_channel(&timerdatabuf[0], 0x01, 0);
+    timer_sched_num = load_timer_channel(&timerdatabuf[OUTLET_TIMER_ONELEN], 0x02, timer_sched_num);
+    timer_fired = -1;
+    printf("timer schedule : %d\n", timer_sched_num);
+}
+
+// Day bit is 0x80>>tm_wday, same test as the old per-minute scan
+static int timer_on_day(const struct outlet_timer_slot *slot, int wday)
+{
+    return (0x01<<(7-wday)) & slot->weekday;
+}
+
+// One-shot timers stay armed for a week after they were set, not before it if the clock went back
+static int timer_armed(const struct outlet_timer_slot *slot, uint32 now)
+{
+    if (slot->repeat) return 1;
+    return (now >= slot->created) && ((now - slot->created) <= OUTLET_TIMER_ONESHOT);
+}
+
+// Timers are re-read from flash on the next pass of HAPNotifyHandle
+void outlet_timer_changed(uint8 reload)
+{
+    if (reload) timer_sched_dirty = 1;
+    outlet_post_event(OUTLET_EVT_TIMER, 0);
+}
+
+static void outlet_timer_job(void)
+{
     struct tm timeinfo;
+    uint32 t, ms;
+    int cur, wday, i, d, next = -1;
+
+    if (timer_sched_dirty)
+    {
+        timer_sched_dirty = 0;
+        outlet_timer_load();
+    }
     if (!rtc_isenabled())  return;
     read_locoltime(&timeinfo);
     if (timeinfo.tm_year < 2000)  return;
-    if (minute != timeinfo.tm_min)
+
+    t = rtc_read();
+    cur = timeinfo.tm_hour*60 + timeinfo.tm_min;
+    if (timer_fired != timeinfo.tm_wday*24*60 + cur)
     {
-        minute = timeinfo.tm_min;
-        printf("minute : %d\n",minute);
-        addr = OUTLET_TIMER_ADDR;
-        memset(timerdatabuf, 0, outlen);
-        flash_stream_read(&flash, addr, outlen, timerdatabuf);
-        outlet_timer_handle(&timerdatabuf[0],timeinfo,0x01);
-        outlet_timer_handle(&timerdatabuf[OUTLET_TIMER_ONELEN],timeinfo,0x02);
+        timer_fired = timeinfo.tm_wday*24*60 + cur;
+        for (i = 0; i < timer_sched_num; i++)
+        {
+            if (timer_sched[i].minute < cur) continue;
+            if (timer_sched[i].minute > cur) break;
+            if (timer_on_day(&timer_sched[i], timeinfo.tm_wday) && timer_armed(&timer_sched[i], t))
+            {
+                setOutlet_onoff(timer_sched[i].channel, timer_sched[i].onoff);
+            }
+        }
+    }
+
+    // first timer after this minute, today or on one of the next seven days
+    for (d = 0; (d <= 7) && (next < 0); d++)
+    {
+        wday = (timeinfo.tm_wday + d) % 7;
+        for (i = 0; i < timer_sched_num; i++)
+        {
+            if ((d == 0) && (timer_sched[i].minute <= cur)) continue;
+            if (timer_on_day(&timer_sched[i], wday) && timer_armed(&timer_sched[i], t))
+            {
+                next = d*24*60 + timer_sched[i].minute;
+                break;
+            }
+        }
     }
+    if (next < 0) return;
 
+    // wake on the minute it is due, the RTC is re-read at least every period
+    ms = ((next - cur)*60 - timeinfo.tm_sec) * 1000;
+    if (ms < outlet_jobs[OUTLET_JOB_TIMER].period)
+    {
+        outlet_jobs[OUTLET_JOB_TIMER].due = xTaskGetTickCount() * portTICK_RATE_MS + ms;
+    }
 }
 
-void hisdata2iot_handle()
+// Unreported slots from the log cursor on, both channels of a slot go into one sample. As before
+// the log, only slots both channels reported are uploaded: an older slot missing one is skipped,
+// the running one waits. *end is where the cursor moves once all the samples are delivered.
+static int hisdata_collect(hisdata_sample *samples, uint32 *end, uint32 now)
 {
-    static int minute = -1;
-    
-    if (!rtc_isenabled())  return;
-    struct tm timeinfo;
-    read_locoltime(&timeinfo);
-    if (timeinfo.tm_year < 2000)  return;
-    //if ((timeinfo.tm_min)%15 != 2) return;
-    if (minute == timeinfo.tm_min) return;
-    minute = timeinfo.tm_min;
-    printf("hisdata2iot_handle\n");
-    int outlen = HISDATALEN;
-    flash_t flash;
-    int hisaddr1,hisaddr2,offset,ret;
-
-    uint8_t data[3];
-    uint8_t data1[3],data2[3];
-    uint8 year,mon,day,hour,min,quantity;
-
-    year = timeinfo.tm_year;
-    mon = timeinfo.tm_mon;
-    day = timeinfo.tm_mday;
-    hour = timeinfo.tm_hour;
-    min = timeinfo.tm_min;
-
-    hisaddr1 = OUTLET_A_HISADDR;
-    flash_stream_read(&flash, hisaddr1+4096-1, 1, data);
-    printf("data:0x%x\n",data[0]);
-    if (data[0] != 0x5A)
+    hislog_rec recs[HISDATA_FETCH];
+    hisdata_sample cur;
+    uint32 seq, next, stamp, cur_stamp = 0;
+    int num = 0, open = 0, n, i;
+
+    hislog_range(NULL, &next, &seq);
+    *end = seq;
+    while (seq < next)
     {
-        flash_stream_read(&flash, hisaddr1+2*4096-1, 1, data);
-        printf("data:0x%x\n",data[0]);
-        if (data[0] == 0x5A)
-        {
-            hisaddr1 += 4096;
-            //addstate = 1;
-        }
-        else
+        n = hislog_fetch(seq, recs, HISDATA_FETCH);
+        if (n == 0) break;
+        for (i = 0; i < n; i++, seq++)
         {
-            return;
+            if ((recs[i].channel < 1) || (recs[i].channel > 2)) continue;
+            stamp = HISLOG_STAMP(recs[i].year, recs[i].mon, recs[i].day, recs[i].slot);
+            if (open && (stamp != cur_stamp))
+            {
+                // the slot ends here
+                if ((cur.quantity[0] != 0xFF) && (cur.quantity[1] != 0xFF))
+                {
+                    if (num == HISDATA_BATCH) return num;
+                    cur.end = seq;
+                    samples[num++] = cur;
+                }
+                *end = seq;
+                open = 0;
+            }
+            if (!open)
+            {
+                open = 1;
+                cur_stamp = stamp;
+                cur.year = recs[i].year;
+                cur.mon = recs[i].mon;
+                cur.day = recs[i].day;
+                cur.slot = recs[i].slot;
+                cur.quantity[0] = cur.quantity[1] = 0xFF;
+            }
+            cur.quantity[recs[i].channel - 1] = recs[i].quantity & 0x7F;
         }
     }
-    offset = day/8*1024+3+(day-1)%8*96+hour*4+min/15;
-    flash_stream_read(&flash, hisaddr1+offset, 1, data1);
 
-    hisaddr2 = OUTLET_B_HISADDR;
-    flash_stream_read(&flash, hisaddr2+4096-1, 1, data);
-    printf("data:0x%x\n",data[0]);
-    if (data[0] != 0x5A)
+    if (open)
     {
-        flash_stream_read(&flash, hisaddr2+2*4096-1, 1, data);
-        printf("data:0x%x\n",data[0]);
-        if (data[0] == 0x5A)
+        if ((cur.quantity[0] != 0xFF) && (cur.quantity[1] != 0xFF))
         {
-            hisaddr2 += 4096;
-            //addstate = 1;
+            if (num == HISDATA_BATCH) return num;
+            cur.end = seq;
+            samples[num++] = cur;
+            *end = seq;
         }
-        else
+        else if (cur_stamp < now)
         {
-            return;
+            *end = seq;
         }
     }
-    offset = day/8*1024+3+(day-1)%8*96+hour*4+min/15;    
-    flash_stream_read(&flash, hisaddr2+offset, 1, data2);
+    return num;
+}
 
-    printf("data1:0x%x  data2:0x%x\n",data1[0],data2[0]);
-    
-    if ((data1[0]&0x80)&&(data1[0] != 0xFF)&&(data2[0]&0x80)&&(data2[0] != 0xFF))
+// Returns 1 while a backlog is left for the next pass
+static int hisdata2iot_handle(struct tm *timeinfo)
+{
+    hisdata_sample samples[HISDATA_BATCH];
+    uint32 end;
+    int num, done = 0;
+
+    num = hisdata_collect(samples, &end, HISLOG_STAMP(timeinfo->tm_year%100, timeinfo->tm_mon,
+                          timeinfo->tm_mday, timeinfo->tm_hour*4 + timeinfo->tm_min/15));
+    if (num > 0)
     {
-        ret = report_hisdata_to_iot(data1[0]&0x7F, data2[0]&0x7F, timeinfo);
-        if (ret == 1)
-        {
-            data1[0] &=0x7F;
-            data2[0] &=0x7F;
-            flash_stream_write(&flash, hisaddr1+offset, 1, data1);
-            flash_stream_write(&flash, hisaddr2+offset, 1, data2);
-        }
+        printf("hisdata2iot_handle : %d\n", num);
+        done = report_hisbatch_to_iot(samples, num);
+    }
+    // one cursor record per pass, resumed from there after a reboot
+    if (done == num) hislog_commit(end);
+    else if (done > 0) hislog_commit(samples[done - 1].end);
+    return (done == HISDATA_BATCH);
+}
+
+static void outlet_ntp_job(void)
+{
+    if (init_time())
+    {
+        // time is kept by the RTC from now on
+        outlet_jobs[OUTLET_JOB_NTP].period = 0;
+        outlet_timer_changed(0);
+    }
+}
+
+// A backlog drains on the next pass, otherwise the job wakes just after the next minute starts
+static void outlet_hisdata_job(void)
+{
+    struct tm timeinfo;
+
+    if (!rtc_isenabled())  return;
+    read_locoltime(&timeinfo);
+    if (timeinfo.tm_year < 2000)  return;
+    if (hisdata2iot_handle(&timeinfo))
+    {
+        outlet_jobs[OUTLET_JOB_HISDATA].due = xTaskGetTickCount() * portTICK_RATE_MS;
+        return;
     }
+    read_locoltime(&timeinfo);
+    outlet_jobs[OUTLET_JOB_HISDATA].due = xTaskGetTickCount() * portTICK_RATE_MS + (60 - timeinfo.tm_sec)*1000 + 500;
+}
+
+outlet_job outlet_jobs[OUTLET_JOB_NUM] =
+{
+    {OUTLET_SYNCH_PERIOD, 0, MCU_meterage_synch},
+    {OUTLET_NTP_PERIOD, 0, outlet_ntp_job},
+    {OUTLET_HISDATA_PERIOD, 0, outlet_hisdata_job},
+    {0, 0, alarm_handle},
+    {OUTLET_TIMER_PERIOD, 0, outlet_timer_job},
+};
 
+int outlet_task_idle(void)
+{
+    return outlet_idle;
+}
+
+static void outlet_inuse_event(uint8 channel)
+{
+    outlet_state *outletstate = outlet_states[channel - 1];
+    int level = gpio_read((channel == 1) ? &OlInUse1 : &OlInUse2);
+    
+    if (outletstate->inuse != level)
+    {
+        if (channel == 1) HAPoiu1Notify(level);
+        else HAPoiu2Notify(level);
+        printf("OIU%d status = %d\r\n", channel, level);
+    }
 }
 
 void HAPNotifyHandle(void *param)
 {
     xSemaphoreHandle *sema = param;
-    static int count_synch = 0;
-    static int count_ntp = 0;
-    static int count_basic = 0;
-    static int count_hap = 0;
-    static int ntp_done = 0;
+    outlet_event evt;
+    uint32 now, wait, notify_wait = HAP_NOTIFY_IDLE;
+    int i, ret;
 
     
     /*outletstateA.on = 1;
@@ -1976,76 +1771,73 @@ void HAPNotifyHandle(void *param)
     outletstateA.inuse = gpio_read(&OlInUse1);
     outletstateB.inuse = gpio_read(&OlInUse2);
 
-    vTaskDelay(1000);
-    //init_outletstate(0x01);
-    //init_outletstate(0x02);
+    // waits for the reply, the request is retried while the MCU is still starting up
     getMCU_synch();
 
     outletstateA_app.on = outletstateA.on;
     outletstateB_app.on = outletstateB.on;
     
+    now = xTaskGetTickCount() * portTICK_RATE_MS;
+    for (i = 0; i < OUTLET_JOB_NUM; i++)
+    {
+        outlet_jobs[i].due = now + outlet_jobs[i].period;
+    }
+    
     while(1)
     {
         xSemaphoreGive(*sema);
-        vTaskDelay(500);
-        //gpio_write(&identy_led, 0);
-        //gpio_write(&identy_led, !gpio_read(&identy_led));
         
-        //printf("LED status = %d\r\n", gpio_read(&identy_led));
+        // sleep until an event arrives or the nearest deadline
+        now = xTaskGetTickCount() * portTICK_RATE_MS;
+        wait = notify_wait;
+        if (timer_sched_dirty) outlet_jobs[OUTLET_JOB_TIMER].due = now;
+        for (i = 0; i < OUTLET_JOB_NUM; i++)
+        {
+            if (outlet_jobs[i].period == 0) continue;
+            if ((int32)(outlet_jobs[i].due - now) <= 0) wait = 0;
+            else if (outlet_jobs[i].due - now < wait) wait = outlet_jobs[i].due - now;
+        }
+        
+        outlet_idle = 1;
+        ret = xQueueReceive(outlet_evt_queue, &evt, (wait == HAP_NOTIFY_IDLE) ? portMAX_DELAY : wait / portTICK_RATE_MS);
+        outlet_idle = 0;
+        if (ret == pdTRUE)
+        {
+            do
+            {
+                if (evt.type == OUTLET_EVT_INUSE) outlet_inuse_event(evt.channel);
+                else if (evt.type == OUTLET_EVT_TIMER) outlet_jobs[OUTLET_JOB_TIMER].due = now;
+                else if (evt.type == OUTLET_EVT_ALARM)
+                {
+                    // alarm_handle() turns the job off again unless a report has to be retried
+                    outlet_jobs[OUTLET_JOB_ALARM].period = OUTLET_ALARM_RETRY;
+                    outlet_jobs[OUTLET_JOB_ALARM].due = now;
+                }
+            } while (xQueueReceive(outlet_evt_queue, &evt, 0) == pdTRUE);
+        }
+        
         if (outletstateA_app.on != outletstateA.on)
         {
             outletstateA_app.on = outletstateA.on;
-            HAPoutletNotify(1,outletstateA_app.on);
+            outlet_notify(1, OUTLET_CHA_ON);
         }
         if (outletstateB_app.on != outletstateB.on)
         {
             outletstateB_app.on = outletstateB.on;
-            HAPoutletNotify(2,outletstateB_app.on);
-        }
-
-        if (outletstateA.inuse != gpio_read(&OlInUse1))
-        {
-            outletstateA.inuse = gpio_read(&OlInUse1);
-            printf("OIU1 status = %d\r\n", outletstateA.inuse);
-            HAPoiu1Notify(outletstateA.inuse);
+            outlet_notify(2, OUTLET_CHA_ON);
         }
-        if (outletstateB.inuse != gpio_read(&OlInUse2))
-        {
-            outletstateB.inuse = gpio_read(&OlInUse2);
-            printf("OIU2 status = %d\r\n", outletstateB.inuse);
-            HAPoiu2Notify(outletstateB.inuse);
-        }   
         
-        count_synch++;
-        if (count_synch > 30*2*4){
-            count_synch = 0;
-            MCU_meterage_synch();
-        }
-
-        count_ntp++;
-        if (count_ntp > 10*4){
-            count_ntp = 0;
-            if (ntp_done == 0){
-                if (init_time()){
-                    ntp_done = 1;
-                }
-            }
-        }
-
-        count_basic++;
-         if (count_basic > 4){
-            count_basic = 0;
-
-            alarm_handle();
-
-            timer_handle();
-
-            hisdata2iot_handle();
+        now = xTaskGetTickCount() * portTICK_RATE_MS;
+        for (i = 0; i < OUTLET_JOB_NUM; i++)
+        {
+            if ((outlet_jobs[i].period == 0) || ((int32)(outlet_jobs[i].due - now) > 0)) continue;
+            outlet_jobs[i].due = now + outlet_jobs[i].period;
+            outlet_jobs[i].run();
         }
         
+        // everything marked since the last pass goes out together
+        notify_wait = HAPNotifyFlush(xTaskGetTickCount() * portTICK_RATE_MS);
     }
-Exit:
-    vTaskDelete(NULL);
 }
 
 void led_timer_handler(uint32_t id)
@@ -184,7 +184,11 @@
 #define HISDATA_MONTH_LEN               0x400
 #define HISDATA_PEROUTLET_LEN        0x2000
 #define HISDATALEN                              771
-#define HISDATABASE64LEN                   1500   
+#define HISDATABASE64LEN                   1500
+#define BASE64_LEN(n)                       (((n) + 2) / 3 * 4 + 1)
+#define HISDATA_B64LEN                      BASE64_LEN(HISDATALEN)
+#define HISDATA_BLOCKS                      8       // HISDATA1..8 characteristics per channel
+#define HISDATA_FETCH                          16      // log records read per flash access   
 //extension structure
 //can add user data structure
 /*typedef struct {
@@ -213,15 +217,104 @@ typedef struct hisdata_state {
     uint8 quantity;			
 } hisdata_state;
 
+/* History upload, one connection carries up to HISDATA_BATCH slots, each in its own publish */
+#define HISDATA_BATCH                   16
+#define HISDATA_MQTT_BUFLEN             256     // connect or one slot's publish, about 150 bytes
+
+typedef struct hisdata_sample {
+    uint8 year;
+    uint8 mon;
+    uint8 day;
+    uint8 slot;                 // hour*4 + min/15
+    uint8 quantity[2];
+    uint32 end;                 // log cursor once this slot is reported
+} hisdata_sample;
+
+// Number of slots from the front that are done
+int report_hisbatch_to_iot(const hisdata_sample *samples, int num);
+
+/* Characteristic id of the compiled outlet/meter service tables */
+enum {
+    OUTLET_CHA_NONE = 0,
+    OUTLET_CHA_ON,
+    OUTLET_CHA_INUSE,
+    OUTLET_CHA_MONTHDATA,
+    OUTLET_CHA_TIMING,
+    OUTLET_CHA_METQUA,
+    OUTLET_CHA_METVOL,
+    OUTLET_CHA_METCUR,
+    OUTLET_CHA_METPOW,
+    OUTLET_CHA_THRVOL_OVER,
+    OUTLET_CHA_THRVOL_UNDER,
+    OUTLET_CHA_THRCUR,
+    OUTLET_CHA_THRPOW,
+    OUTLET_CHA_HISDATA1,
+    OUTLET_CHA_HISDATA2,
+    OUTLET_CHA_HISDATA3,
+    OUTLET_CHA_HISDATA4,
+    OUTLET_CHA_HISDATA5,
+    OUTLET_CHA_HISDATA6,
+    OUTLET_CHA_HISDATA7,
+    OUTLET_CHA_HISDATA8,
+};
+
+void outlet_notify(uint8 channel, int id);
+
+/* HAPNotifyHandle events */
+#define OUTLET_EVT_QUEUE_LEN    8
+#define OUTLET_EVT_INUSE        1       // in-use input changed
+#define OUTLET_EVT_NOTIFY       2       // characteristic marked for notification
+#define OUTLET_EVT_TIMER        3       // timers or RTC changed, reschedule
+#define OUTLET_EVT_ALARM        4       // MCU reported new alarm bits
+
+typedef struct outlet_event {
+    uint8 type;
+    uint8 channel;
+} outlet_event;
+
+void outlet_post_event(uint8 type, uint8 channel);
+// HAPNotifyHandle sleeps until an event or its next deadline, the uart_start_h watchdog leaves it alone
+int outlet_task_idle(void);
+
+/* Jobs of HAPNotifyHandle, period 0 disables a job. A job may move its own due time */
+#define OUTLET_SYNCH_PERIOD     (120*1000)  // meterage synch with MCU
+#define OUTLET_NTP_PERIOD       (20*1000)   // retry until time is set
+#define OUTLET_HISDATA_PERIOD   (60*1000)   // history upload, run just after each minute starts
+#define OUTLET_ALARM_RETRY      (10*1000)   // only while an alarm report failed
+#define OUTLET_TIMER_PERIOD     (60*60*1000)// longest sleep of the timer schedule
+
+enum {
+    OUTLET_JOB_SYNCH = 0,
+    OUTLET_JOB_NTP,
+    OUTLET_JOB_HISDATA,
+    OUTLET_JOB_ALARM,
+    OUTLET_JOB_TIMER,
+    OUTLET_JOB_NUM
+};
+
+typedef struct outlet_job {
+    uint32 period;                          // ms
+    uint32 due;                             // tick time in ms
+    void (*run)(void);
+} outlet_job;
+
+extern outlet_job outlet_jobs[OUTLET_JOB_NUM];
+
 #define OUTLET_A_HISADDR    FLASH_USER_ADDR
 #define OUTLET_B_HISADDR    OUTLET_A_HISADDR+0x3000
 #define OUTLET_MON_HISADDR    OUTLET_B_HISADDR+0x3000
 #define OUTLET_TIMER_ADDR    OUTLET_MON_HISADDR+0x1000
 #define MCU_OTA_ADDR             OUTLET_TIMER_ADDR+0x1000
 #define MCU_OTA_DATA_ADDR   MCU_OTA_ADDR+sizeof(struct UPDATE_FILE)
+#define MCU_OTA_SIZE        0x8000          // 8 sectors, erased by ES_mcu_ota_task()
 
 #define OUTLET_TIMER_ONELEN    700
 #define OUTLET_TIMER_TWOLEN    1400
+#define OUTLET_TIMER_READLEN   300         // longest timer list reported to the app
+#define OUTLET_MONTHLEN        72
+#define OUTLET_TIMER_RECLEN    7
+#define OUTLET_TIMER_MAX       (OUTLET_TIMER_TWOLEN/OUTLET_TIMER_RECLEN)
+#define OUTLET_TIMER_ONESHOT   (7*24*60*60)
 
 #define HISDATA_15_MIN    1
 
@@ -235,6 +328,18 @@ struct outlet_timer
     uint8_t    weekday;
 };
 
+struct outlet_timer_slot
+{
+    uint16_t   minute;      // minute of the day
+    uint8_t    channel;
+    uint8_t    onoff;
+    uint8_t    repeat;
+    uint8_t    weekday;
+    uint32_t   created;     // rtc time the timer was set
+};
+
+void outlet_timer_changed(uint8 reload);
+
 struct read_handle 
 {
     char* cha_type;
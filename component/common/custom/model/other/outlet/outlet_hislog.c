@@ -0,0 +1,308 @@
+#include <stddef.h>
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include "flash_api.h"
+#include "comfunc.h"
+#include "outlet_hislog.h"
+
+static struct {
+    uint32 first;
+    uint32 next;
+    uint32 cursor;
+    uint32 ready;                   // first seq of the sector opened last
+    uint32 erases;
+    uint32 last[2];                 // stamp of the newest sample per channel
+    uint16 erase[HISLOG_SECTORS];
+} hislog;
+static xSemaphoreHandle hislog_mutex = NULL;
+
+static void hislog_lock(void)
+{
+    if (hislog_mutex != NULL) xSemaphoreTake(hislog_mutex, portMAX_DELAY);
+}
+
+static void hislog_unlock(void)
+{
+    if (hislog_mutex != NULL) xSemaphoreGive(hislog_mutex);
+}
+
+static uint32 sector_addr(uint32 seq)
+{
+    return HISLOG_ADDR + (seq / HISLOG_PER_SECTOR % HISLOG_SECTORS) * HISLOG_SECTOR_SIZE;
+}
+
+static uint32 seq_addr(uint32 seq)
+{
+    return sector_addr(seq) + (seq % HISLOG_PER_SECTOR + HISLOG_HDR_SLOTS) * HISLOG_REC_SIZE;
+}
+
+static uint16 rec_crc(uint32 seq, const hislog_rec *rec)
+{
+    uint16 crc;
+
+    crc = sp_crc16_with_init(0xFFFF, (const uint8 *)&seq, sizeof(seq));
+    return sp_crc16_with_init(crc, (const uint8 *)rec, offsetof(hislog_rec, crc));
+}
+
+static int rec_blank(const hislog_rec *rec)
+{
+    const uint8 *p = (const uint8 *)rec;
+    int i;
+
+    for (i = 0; i < sizeof(hislog_rec); i++)
+    {
+        if (p[i] != 0xFF) return 0;
+    }
+    return 1;
+}
+
+// 0 sample, 1 cursor, -1 blank or damaged
+static int rec_check(uint32 seq, const hislog_rec *rec)
+{
+    if (rec_blank(rec) || (rec->crc != rec_crc(seq, rec))) return -1;
+    return (rec->channel == HISLOG_CURSOR) ? 1 : 0;
+}
+
+static int read_rec(uint32 seq, hislog_rec *rec)
+{
+    flash_t flash;
+
+    flash_stream_read(&flash, seq_addr(seq), sizeof(hislog_rec), (uint8 *)rec);
+    return rec_check(seq, rec);
+}
+
+static void open_sector(uint32 base)
+{
+    flash_t flash;
+    hislog_hdr hdr;
+    int s = base / HISLOG_PER_SECTOR % HISLOG_SECTORS;
+
+    hdr.magic = HISLOG_MAGIC;
+    hdr.erase = hislog.erase[s] + 1;
+    hdr.seq = base;
+    hdr.cursor = hislog.cursor;
+    hdr.last[0] = hislog.last[0];
+    hdr.last[1] = hislog.last[1];
+    flash_erase_sector(&flash, sector_addr(base));
+    flash_stream_write(&flash, sector_addr(base), sizeof(hdr), (uint8 *)&hdr);
+    hislog.erase[s] = hdr.erase;
+    hislog.erases++;
+    hislog.ready = base;
+
+    // the records of the previous lap in this sector are gone
+    if ((base >= (HISLOG_SECTORS-1)*HISLOG_PER_SECTOR) &&
+        (hislog.first < base - (HISLOG_SECTORS-1)*HISLOG_PER_SECTOR))
+    {
+        hislog.first = base - (HISLOG_SECTORS-1)*HISLOG_PER_SECTOR;
+    }
+    if (hislog.cursor < hislog.first) hislog.cursor = hislog.first;
+}
+
+static void append_rec(hislog_rec *rec)
+{
+    flash_t flash;
+    uint32 seq = hislog.next;
+
+    if ((seq % HISLOG_PER_SECTOR == 0) && (seq != hislog.ready)) open_sector(seq);
+    rec->crc = rec_crc(seq, rec);
+    flash_stream_write(&flash, seq_addr(seq), sizeof(hislog_rec), (uint8 *)rec);
+    hislog.next++;
+}
+
+void hislog_init(void)
+{
+    flash_t flash;
+    hislog_hdr hdr, head_hdr;
+    hislog_rec rec, recs[16];
+    uint32 lo, hi, mid, seq;
+    int i, n, head = -1;
+
+    memset(&hislog, 0, sizeof(hislog));
+    for (i = 0; i < HISLOG_SECTORS; i++)
+    {
+        flash_stream_read(&flash, HISLOG_ADDR + i*HISLOG_SECTOR_SIZE, sizeof(hdr), (uint8 *)&hdr);
+        if ((hdr.magic != HISLOG_MAGIC) || (hdr.seq % HISLOG_PER_SECTOR) ||
+            (hdr.seq / HISLOG_PER_SECTOR % HISLOG_SECTORS != i)) continue;
+        hislog.erase[i] = hdr.erase;
+        if ((head < 0) || (hdr.seq > hislog.ready))
+        {
+            hislog.ready = hdr.seq;
+            head_hdr = hdr;
+        }
+        if ((head < 0) || (hdr.seq < hislog.first)) hislog.first = hdr.seq;
+        head = i;
+    }
+    if (head < 0)
+    {
+        printf("[%s] format\n", __FUNCTION__);
+        open_sector(0);
+        head_hdr.cursor = head_hdr.last[0] = head_hdr.last[1] = 0;
+    }
+    else
+    {
+        if (hislog.ready - hislog.first > (HISLOG_SECTORS-1)*HISLOG_PER_SECTOR)
+        {
+            hislog.first = hislog.ready - (HISLOG_SECTORS-1)*HISLOG_PER_SECTOR;
+        }
+        // the head sector is filled from the front, find its first blank slot
+        lo = 0;
+        hi = HISLOG_PER_SECTOR;
+        while (lo < hi)
+        {
+            mid = (lo + hi) / 2;
+            flash_stream_read(&flash, seq_addr(hislog.ready + mid), sizeof(rec), (uint8 *)&rec);
+            if (rec_blank(&rec)) hi = mid;
+            else lo = mid + 1;
+        }
+        hislog.next = hislog.ready + lo;
+    }
+
+    // start from the snapshot of the head sector and replay the records appended since
+    hislog.cursor = head_hdr.cursor;
+    hislog.last[0] = head_hdr.last[0];
+    hislog.last[1] = head_hdr.last[1];
+    for (seq = hislog.ready; seq < hislog.next; seq += n)
+    {
+        if ((n = hislog_fetch(seq, recs, ARRAY_SIZE(recs))) == 0) break;
+        for (i = 0; i < n; i++)
+        {
+            if (recs[i].channel == HISLOG_CURSOR)
+            {
+                memcpy(&hislog.cursor, &recs[i], sizeof(uint32));
+            }
+            else if ((recs[i].channel >= 1) && (recs[i].channel <= 2))
+            {
+                hislog.last[recs[i].channel - 1] = HISLOG_STAMP(recs[i].year, recs[i].mon, recs[i].day, recs[i].slot);
+            }
+        }
+    }
+    if (hislog.cursor < hislog.first) hislog.cursor = hislog.first;
+    if (hislog.cursor > hislog.next) hislog.cursor = hislog.next;
+
+    if (hislog_mutex == NULL) hislog_mutex = xSemaphoreCreateMutex();
+    printf("[%s] seq %lu ~ %lu, cursor %lu\n", __FUNCTION__, hislog.first, hislog.next, hislog.cursor);
+}
+
+int hislog_append(uint8 channel, uint8 year, uint8 mon, uint8 day, uint8 slot, uint8 quantity)
+{
+    hislog_rec rec;
+    uint32 stamp = HISLOG_STAMP(year, mon, day, slot);
+
+    if ((channel < 1) || (channel > 2) || (slot >= 96)) return -1;
+
+    hislog_lock();
+    if (hislog.last[channel - 1] == stamp)
+    {
+        hislog_unlock();
+        return 1;
+    }
+    rec.year = year;
+    rec.mon = mon;
+    rec.day = day;
+    rec.slot = slot;
+    rec.channel = channel;
+    rec.quantity = quantity;
+    append_rec(&rec);
+    hislog.last[channel - 1] = stamp;
+    hislog_unlock();
+    return 0;
+}
+
+int hislog_read(uint32 seq, hislog_rec *rec)
+{
+    int ret = -1;
+
+    hislog_lock();
+    if ((seq >= hislog.first) && (seq < hislog.next)) ret = read_rec(seq, rec);
+    hislog_unlock();
+    return ret;
+}
+
+int hislog_fetch(uint32 seq, hislog_rec *recs, int n)
+{
+    flash_t flash;
+    int i;
+
+    hislog_lock();
+    if ((seq < hislog.first) || (seq >= hislog.next))
+    {
+        hislog_unlock();
+        return 0;
+    }
+    if (n > hislog.next - seq) n = hislog.next - seq;
+    if (n > HISLOG_PER_SECTOR - seq % HISLOG_PER_SECTOR) n = HISLOG_PER_SECTOR - seq % HISLOG_PER_SECTOR;
+    flash_stream_read(&flash, seq_addr(seq), n * sizeof(hislog_rec), (uint8 *)recs);
+    hislog_unlock();
+
+    for (i = 0; i < n; i++)
+    {
+        if (rec_check(seq + i, &recs[i]) < 0) recs[i].channel = 0;
+    }
+    return n;
+}
+
+uint32 hislog_seek(uint32 stamp)
+{
+    hislog_rec rec;
+    uint32 lo, hi, mid, seq;
+
+    hislog_lock();
+    lo = hislog.first;
+    hi = hislog.next;
+    while (lo < hi)
+    {
+        // samples are appended in time order, cursor and damaged records are stepped over
+        mid = lo + (hi - lo) / 2;
+        for (seq = mid; (seq < hi) && (read_rec(seq, &rec) != 0); seq++);
+        if ((seq < hi) && (HISLOG_STAMP(rec.year, rec.mon, rec.day, rec.slot) < stamp)) lo = seq + 1;
+        else hi = mid;
+    }
+    hislog_unlock();
+    return lo;
+}
+
+int hislog_commit(uint32 cursor)
+{
+    hislog_rec rec;
+
+    hislog_lock();
+    if ((cursor <= hislog.cursor) || (cursor > hislog.next))
+    {
+        hislog_unlock();
+        return -1;
+    }
+    memset(&rec, 0, sizeof(rec));
+    memcpy(&rec, &cursor, sizeof(uint32));
+    rec.channel = HISLOG_CURSOR;
+    append_rec(&rec);
+    hislog.cursor = cursor;
+    hislog_unlock();
+    return 0;
+}
+
+void hislog_range(uint32 *first, uint32 *next, uint32 *cursor)
+{
+    hislog_lock();
+    if (first) *first = hislog.first;
+    if (next) *next = hislog.next;
+    if (cursor) *cursor = hislog.cursor;
+    hislog_unlock();
+}
+
+void hislog_get_stats(hislog_stats *stats)
+{
+    int i;
+
+    hislog_lock();
+    stats->first = hislog.first;
+    stats->next = hislog.next;
+    stats->cursor = hislog.cursor;
+    stats->erases = hislog.erases;
+    stats->erase_min = stats->erase_max = hislog.erase[0];
+    for (i = 1; i < HISLOG_SECTORS; i++)
+    {
+        if (hislog.erase[i] < stats->erase_min) stats->erase_min = hislog.erase[i];
+        if (hislog.erase[i] > stats->erase_max) stats->erase_max = hislog.erase[i];
+    }
+    hislog_unlock();
+}
@@ -0,0 +1,69 @@
+#ifndef OUTLET_HISLOG_H
+#define OUTLET_HISLOG_H
+
+#include "outlet.h"
+
+/* Append-only log of the 15 minute energy samples in a ring of flash sectors.
+ *
+ * Each sector starts with a header that holds its erase count, the sequence number of its
+ * first record and a snapshot of the upload cursor and the newest stamp per channel taken when
+ * the sector was opened, so mounting only replays the head sector. The sectors are filled in order, so record n is always in sector
+ * (n / HISLOG_PER_SECTOR) % HISLOG_SECTORS and any sequence number can be located without a scan.
+ * When the head moves on, the oldest sector is erased, so every sector is erased equally often.
+ * Upload progress is stored as an appended cursor record. Samples are never rewritten in place. */
+
+#define HISLOG_ADDR             FLASH_LOG_ADDR
+#define HISLOG_SECTORS          32
+#define HISLOG_SECTOR_SIZE      0x1000
+#define HISLOG_REC_SIZE         8
+#define HISLOG_HDR_SLOTS        3                                       // record slots taken by the header
+#define HISLOG_PER_SECTOR       (HISLOG_SECTOR_SIZE/HISLOG_REC_SIZE - HISLOG_HDR_SLOTS)
+#define HISLOG_MAGIC            0x4C49                                  // "IL", header with snapshot
+#define HISLOG_CURSOR           0xFE                                    // channel of a cursor record
+
+#define HISLOG_STAMP(year, mon, day, slot) \
+    (((uint32)(year)<<24) | ((uint32)(mon)<<16) | ((uint32)(day)<<8) | (uint32)(slot))
+
+typedef struct hislog_rec {
+    uint8 year;         // two digits, as sent by the MCU
+    uint8 mon;
+    uint8 day;
+    uint8 slot;         // hour*4 + min/15
+    uint8 channel;      // 1, 2 or HISLOG_CURSOR, 0 when hislog_fetch found it damaged
+    uint8 quantity;
+    uint16 crc;         // CRC16 over the sequence number and the bytes above
+} hislog_rec;
+
+typedef struct hislog_hdr {
+    uint16 magic;
+    uint16 erase;       // times this sector has been erased
+    uint32 seq;         // sequence number of the first record
+    uint32 cursor;      // upload cursor when the sector was opened
+    uint32 last[2];     // newest sample stamp per channel when the sector was opened
+} hislog_hdr;
+
+typedef struct hislog_stats {
+    uint32 first;       // oldest sequence number still kept
+    uint32 next;        // sequence number of the next append
+    uint32 cursor;      // first sample not reported to the cloud
+    uint32 erases;      // sector erases since boot
+    uint16 erase_min;
+    uint16 erase_max;
+} hislog_stats;
+
+// Mount the ring, formatting it when no valid sector is found
+void hislog_init(void);
+// 0 appended, 1 duplicate of the newest sample of the channel, -1 rejected
+int hislog_append(uint8 channel, uint8 year, uint8 mon, uint8 day, uint8 slot, uint8 quantity);
+// 0 sample, 1 cursor record, -1 blank, damaged or out of range
+int hislog_read(uint32 seq, hislog_rec *rec);
+// Read up to n records from seq on with one flash read, stops at the sector end, returns the count
+int hislog_fetch(uint32 seq, hislog_rec *recs, int n);
+// Where to start scanning forward for the first sample at or after stamp
+uint32 hislog_seek(uint32 stamp);
+// Mark everything before cursor as reported with one record write
+int hislog_commit(uint32 cursor);
+void hislog_range(uint32 *first, uint32 *next, uint32 *cursor);
+void hislog_get_stats(hislog_stats *stats);
+
+#endif
@@ -571,118 +571,139 @@ void print_time(char *timebuf)
 #define MQTT_DOMAIN "56QXIADEK"
 #define MQTT_TOPIC "56QXIADEK/topic1"
 
-int report_hisdata_to_iot(uint8_t data1, uint8_t data2, struct tm timeinfo)
+static int iot_wait_reply(int server_fd, uint8_t *recvbuf, int len)
 {
-      int server_fd = -1, ret,result = -1;
-      uint8_t recvbuf[100];
-      fd_set pending_data;
-      struct timeval block_time;
-      char name[40] = MQTT_USER_NAME;
-      char pwd[20] = MQTT_USER_PWD;
-      char clentid[32];
-      get_pushid(clentid);
-      
-      printf("report_hisdata_to_iot!\n");
-
-	if((ret = net_connect(&server_fd, ESIOT_URL, ESIOT_PORT)) != 0) {
-		printf("ERROR: net_connect ret(%d)\n", ret);
-		goto exit;
-	}
-
-	//ret = net_send(&server_fd, "hello", 6);
-	//printf("net_send ret(%d)\n", ret);
-
-	mqtt_connection_t con;
-	u8 buf[200];
-	mqtt_connect_info_t info;
-
-       memset(buf,0,200);
-	con.buffer = buf;
-	con.buffer_length = sizeof(buf);
-	con.message_id = 0xffff;
-
-	info.client_id = clentid;
-	info.username = name;
-	info.password = pwd;
-	info.will_topic = NULL;
-	info.will_message = NULL;
-	info.keepalive = 60;
-	info.will_qos = 0;
-	info.will_retain = 0;
-	info.clean_session = 0;
+    fd_set pending_data;
+    struct timeval block_time;
+    int ret;
 
-	mqtt_msg_connect(&con, &info);
-	if(0 == con.message.length) {
-		printf("Mqtt fail to frame the connect\n");
-	}
+    block_time.tv_sec = 3;
+    block_time.tv_usec = 0;
+    FD_ZERO(&pending_data);
+    FD_SET(server_fd, &pending_data);
+    if (select(server_fd + 1, &pending_data, NULL, NULL, &block_time) <= 0)
+    {
+        printf("net_recv timeout\n");
+        return -1;
+    }
+    ret = net_recv(&server_fd, recvbuf, len);
+    print_recv_data(recvbuf, ret);
+    return ret;
+}
 
-	ret = net_send(&server_fd, con.message.data, con.message.length);
-	printf("net_send ret(%d)\n", ret);
-	block_time.tv_sec=3;
-       block_time.tv_usec=0;
-       FD_ZERO(&pending_data);
-       FD_SET(server_fd, &pending_data);
+// One slot in the schema the server takes, {"UUID":..,"time":..,"data1":..,"data2":..}.
+// 1 delivered, 0 the publish does not fit the buffer (it never will), -1 link error
+static int iot_publish_hisdata(mqtt_connection_t *con, int server_fd, const char *uuid, const hisdata_sample *sample)
+{
+    uint8_t recvbuf[100];
+    char timebuf[] = "1970-01-01 01:01:00";
+    char vel[10];
+    uint16_t msgid = 0xffff;
+    char *payload;
+    cJSON *root;
+    int ret;
+
+    root = cJSON_CreateObject();
+    if (root == NULL) return -1;
+    cJSON_AddStringToObject(root, "UUID", uuid);
+    sprintf(timebuf, "%04d-%02d-%02d %02d:%02d:00", 2000 + sample->year, sample->mon,
+        sample->day, sample->slot/4, sample->slot%4*15);
+    cJSON_AddStringToObject(root, "time", timebuf);
+    sprintf(vel, "%1.2f", (double)sample->quantity[0]/100.0);
+    cJSON_AddStringToObject(root, "data1", vel);
+    sprintf(vel, "%1.2f", (double)sample->quantity[1]/100.0);
+    cJSON_AddStringToObject(root, "data2", vel);
+    payload = cJSON_Print(root);
+    cJSON_Delete(root);
+    if (payload == NULL) return -1;
 
-       if (select(server_fd + 1, &pending_data, NULL, NULL, &block_time) > 0){
-        	ret = net_recv(&server_fd, recvbuf, 100);
-        	print_recv_data(recvbuf, ret);
-        	if ((ret != 4)||(recvbuf[3] != 0x00)||(recvbuf[0] != 0x20)){
-        	    goto exit;
-        	}
-	}
-	else {
-	    printf("net_recv timeout\n", ret, recvbuf);
-	    goto exit;
-	}
+    mqtt_msg_publish(con, MQTT_TOPIC, payload, strlen(payload), 1, 0, &msgid);
+    free(payload);
+    if (0 == con->message.length) {
+        printf("Mqtt fail to frame the publish\n");
+        return 0;
+    }
+    printf("msgid : %d\n", msgid);
+    net_send(&server_fd, con->message.data, con->message.length);
+    ret = iot_wait_reply(server_fd, recvbuf, sizeof(recvbuf));
+    return ((ret == 4) && (recvbuf[0] == 0x40)) ? 1 : -1;
+}
 
-       uint16_t msgid = 0xffff;
-       char *payload;
-       cJSON *root = cJSON_CreateObject();  
+// Up to num slots over one connection, one publish each. Returns how many from the front are done,
+// a slot that cannot be framed counts as done so it is not retried forever
+int report_hisbatch_to_iot(const hisdata_sample *samples, int num)
+{
+    int server_fd = -1, ret, done = 0;
+    uint8_t recvbuf[100];
+    char name[40] = MQTT_USER_NAME;
+    char pwd[20] = MQTT_USER_PWD;
+    char clentid[32];
+    mqtt_connection_t con;
+    mqtt_connect_info_t info;
+    u8 *buf;
+
+    printf("report_hisdata_to_iot : %d\n", num);
+    buf = malloc(HISDATA_MQTT_BUFLEN);
+    if (buf == NULL) return 0;
+    get_pushid(clentid);
+
+    if ((ret = net_connect(&server_fd, ESIOT_URL, ESIOT_PORT)) != 0) {
+        printf("ERROR: net_connect ret(%d)\n", ret);
+        goto exit;
+    }
 
-       char pushid[32];
-	get_pushid(pushid);
-	cJSON_AddStringToObject(root,"UUID",pushid);
-       
-       char timebuf[] = "1970-01-01 01:01:00";
-       sprintf(timebuf, "%04d-%02d-%02d %02d:%02d:00", timeinfo.tm_year,timeinfo.tm_mon,
-        timeinfo.tm_mday,timeinfo.tm_hour,timeinfo.tm_min/15*15);
-       cJSON_AddStringToObject(root,"time",timebuf);
+    memset(buf, 0, HISDATA_MQTT_BUFLEN);
+    con.buffer = buf;
+    con.buffer_length = HISDATA_MQTT_BUFLEN;
+    con.message_id = 0xffff;
+
+    info.client_id = clentid;
+    info.username = name;
+    info.password = pwd;
+    info.will_topic = NULL;
+    info.will_message = NULL;
+    info.keepalive = 60;
+    info.will_qos = 0;
+    info.will_retain = 0;
+    info.clean_session = 0;
+
+    mqtt_msg_connect(&con, &info);
+    if (0 == con.message.length) {
+        printf("Mqtt fail to frame the connect\n");
+        goto exit;
+    }
+    net_send(&server_fd, con.message.data, con.message.length);
+    ret = iot_wait_reply(server_fd, recvbuf, sizeof(recvbuf));
+    if ((ret != 4) || (recvbuf[3] != 0x00) || (recvbuf[0] != 0x20)) {
+        goto exit;
+    }
 
-	char vel[10];
-	sprintf(vel, "%1.2f", (double)data1/100.0);
-       cJSON_AddStringToObject(root,"data1",vel);
+    for (done = 0; done < num; done++)
+    {
+        if (iot_publish_hisdata(&con, server_fd, clentid, &samples[done]) < 0) break;
+    }
 
-       sprintf(vel, "%1.2f", (double)data2/100.0);
-       //cJSON_AddNumberToObject(root,"data2",123.5);
-       cJSON_AddStringToObject(root,"data2",vel);
-       
-       payload = cJSON_Print(root);
-	mqtt_msg_publish(&con, MQTT_TOPIC, payload, strlen(payload), 1, 0, &msgid);
-	cJSON_Delete(root);
-	free(payload);
-	
-	printf("msgid : %d\n", msgid);
-	ret = net_send(&server_fd, con.message.data, con.message.length);
-	FD_ZERO(&pending_data);
-       FD_SET(server_fd, &pending_data);
-       if (select(server_fd + 1, &pending_data, NULL, NULL, &block_time) > 0){
-        	ret = net_recv(&server_fd, recvbuf, 100);
-        	print_recv_data(recvbuf, ret);
-        	if ((ret == 4)&&(recvbuf[0] == 0x40)){
-        	    result = 1;
-        	}
-	}
-	else {
-	    printf("net_recv timeout\n", ret, recvbuf);
-	}
-	
 exit:
-    if(server_fd != -1)
+    free(buf);
+    if (server_fd != -1)
     {
         printf("close fd!\n");
         net_close(server_fd);
     }
-    return result;
+    return done;
+}
+
+int report_hisdata_to_iot(uint8_t data1, uint8_t data2, struct tm timeinfo)
+{
+    hisdata_sample sample;
+
+    sample.year = timeinfo.tm_year % 100;
+    sample.mon = timeinfo.tm_mon;
+    sample.day = timeinfo.tm_mday;
+    sample.slot = timeinfo.tm_hour*4 + timeinfo.tm_min/15;
+    sample.quantity[0] = data1;
+    sample.quantity[1] = data2;
+    return (report_hisbatch_to_iot(&sample, 1) == 1) ? 1 : -1;
 }
 
 extern outlet_state outletstateA;
@@ -29,6 +29,13 @@ enum {
   FLASH_ERROR_2 = 1,
 };
 
+typedef struct flash_cache_stats_s {
+  uint32_t hit;             // lines served from RAM
+  uint32_t miss;            // lines read from flash
+  uint32_t bypass;          // reads too long to be cached
+  uint32_t invalidate;      // lines dropped by a write or erase
+} flash_cache_stats_t;
+
 //void flash_init         		(flash_t *obj);
 void flash_erase_sector			(flash_t *obj, uint32_t address);
 void flash_erase_block(flash_t * obj, uint32_t address);
@@ -36,11 +43,19 @@ int  flash_read_word			(flash_t *obj, uint32_t address, uint32_t * data);
 int  flash_write_word			(flash_t *obj, uint32_t address, uint32_t data);
 int  flash_stream_read          (flash_t *obj, uint32_t address, uint32_t len, uint8_t * data);
 int  flash_stream_write         (flash_t *obj, uint32_t address, uint32_t len, uint8_t * data);
+int  flash_burst_write          (flash_t *obj, uint32_t address, uint32_t len, uint8_t * data);
 void flash_write_protect        (flash_t *obj, uint32_t protect);
 int flash_get_status(flash_t * obj);
 int flash_set_status(flash_t * obj, uint32_t data);
 void flash_reset_status(flash_t * obj);
 
+/* Read through a small RAM cache of FLASH_CACHE_LINES lines, meant for hot metadata.
+ * Every write and erase drops the lines it overlaps before and after it runs, so the cache never
+ * returns stale data. */
+int  flash_cached_read          (flash_t *obj, uint32_t address, uint32_t len, uint8_t * data);
+void flash_cache_invalidate     (uint32_t address, uint32_t len);
+void flash_cache_get_stats      (flash_cache_stats_t *stats);
+
 #ifdef __cplusplus
 }
 #endif
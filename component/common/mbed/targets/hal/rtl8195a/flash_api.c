@@ -22,6 +22,12 @@
 #include "hal_api.h"
 #include "flash_api.h"
 
+#define FLASH_PAGE_SIZE     256
+#define FLASH_STAGE_SIZE    32      //program size when the source is not word aligned
+#define FLASH_CACHE_LINES   8
+#define FLASH_CACHE_LINE    64
+#define FLASH_CACHE_MAX     (2*FLASH_CACHE_LINE)    //longer reads go straight to flash
+
 extern u32 ConfigDebugInfo;
 extern SPIC_INIT_PARA SpicInitParaAllClk[3][CPU_CLK_TYPE_NO];
 
@@ -33,6 +39,17 @@ extern VOID SpicWaitBusyDoneRtl8195A(VOID);
   */   
 flash_t	        flash;
 
+typedef struct {
+    u32 addr;
+    u32 stamp;              //last use, 0: empty
+    u8  data[FLASH_CACHE_LINE];
+} flash_cache_line_t;
+
+static flash_cache_line_t flash_cache[FLASH_CACHE_LINES];
+static u32 flash_cache_clock;
+static u32 flash_cache_gen;     //bumped by every invalidate, a fill racing with a write is dropped
+static flash_cache_stats_t flash_cache_stats;
+
 static void flash_init(flash_t *obj);
 
 /**
@@ -80,16 +97,20 @@ static void flash_init(flash_t *obj)
   */
 void flash_erase_sector(flash_t *obj, uint32_t address)
 {
+    flash_cache_invalidate(address & ~0xFFF, 0x1000);
     flash_init(obj);
     SpicSectorEraseFlashRtl8195A(SPI_FLASH_BASE + address);
     SpicDisableRtl8195A();
+    flash_cache_invalidate(address & ~0xFFF, 0x1000);
 }
 
 void flash_erase_block(flash_t *obj, uint32_t address)
 {
+    flash_cache_invalidate(address & ~0xFFFF, 0x10000);
     flash_init(obj);
     SpicBlockEraseFlashRtl8195A(SPI_FLASH_BASE + address);
     SpicDisableRtl8195A();
+    flash_cache_invalidate(address & ~0xFFFF, 0x10000);
 }
 
 
@@ -128,6 +149,7 @@ int  flash_write_word(flash_t *obj, uint32_t address, uint32_t data)
 {
     // Disable write protection
     u8 flashtype = 0;
+    flash_cache_invalidate(address, 4);
     flash_init(obj);
 
     flashtype = obj->SpicInitPara.flashtype;
@@ -146,6 +168,7 @@ int  flash_write_word(flash_t *obj, uint32_t address, uint32_t data)
 	    SpicWaitWipDoneRefinedRtl8195A(obj->SpicInitPara);
     
     SpicDisableRtl8195A();
+    flash_cache_invalidate(address, 4);
     // Enable write protection
 	return 1;
 }
@@ -224,6 +247,181 @@ int  flash_stream_read(flash_t *obj, uint32_t address, uint32_t len, uint8_t * d
     return 1;
 }
 
+static flash_cache_line_t *flash_cache_find(u32 addr)
+{
+    u32 i;
+
+    for (i = 0; i < FLASH_CACHE_LINES; i++) {
+        if (flash_cache[i].stamp && (flash_cache[i].addr == addr))
+            return &flash_cache[i];
+    }
+    return NULL;
+}
+
+/**
+  * @brief  Read through the RAM cache, a hit does not touch the SPI controller
+  * @param  obj: Specifies the parameter of flash object.
+  * @param  address: Specifies the address to be read.
+  * @param  len: Specifies the length of the data to read.
+  * @param  data: Specified the address to save the readback data.
+  * @retval   status: Success:1 or Failure: Others.
+  */
+int  flash_cached_read(flash_t *obj, uint32_t address, uint32_t len, uint8_t * data)
+{
+    u8 buf[FLASH_CACHE_LINE];
+    flash_cache_line_t *line;
+    u32 line_addr, offset, n, gen, i;
+    u32 primask;
+
+    if (len > FLASH_CACHE_MAX) {
+        flash_cache_stats.bypass++;
+        return flash_stream_read(obj, address, len, data);
+    }
+
+    while (len > 0) {
+        line_addr = address & ~(FLASH_CACHE_LINE - 1);
+        offset = address - line_addr;
+        n = FLASH_CACHE_LINE - offset;
+        if (n > len)
+            n = len;
+
+        primask = __get_PRIMASK();
+        __disable_irq();
+        line = flash_cache_find(line_addr);
+        if (line) {
+            _memcpy(data, line->data + offset, n);
+            line->stamp = ++flash_cache_clock;
+            flash_cache_stats.hit++;
+        }
+        gen = flash_cache_gen;
+        __set_PRIMASK(primask);
+
+        if (line == NULL) {
+            flash_stream_read(obj, line_addr, FLASH_CACHE_LINE, buf);
+            _memcpy(data, buf + offset, n);
+
+            primask = __get_PRIMASK();
+            __disable_irq();
+            flash_cache_stats.miss++;
+            if (gen == flash_cache_gen) {
+                // replace the least recently used line
+                line = &flash_cache[0];
+                for (i = 1; i < FLASH_CACHE_LINES; i++) {
+                    if (flash_cache[i].stamp < line->stamp)
+                        line = &flash_cache[i];
+                }
+                _memcpy(line->data, buf, FLASH_CACHE_LINE);
+                line->addr = line_addr;
+                line->stamp = ++flash_cache_clock;
+            }
+            __set_PRIMASK(primask);
+        }
+
+        address += n;
+        data += n;
+        len -= n;
+    }
+    return 1;
+}
+
+/**
+  * @brief  Drop the cached lines overlapping a range, called before and after it is programmed
+  *         or erased, so no reader is served the old content while the flash changes
+  * @param  address: start of the range.
+  * @param  len: length of the range.
+  * @retval   none
+  */
+void flash_cache_invalidate(uint32_t address, uint32_t len)
+{
+    u32 i;
+    u32 primask;
+
+    if (len == 0)
+        return;
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    flash_cache_gen++;
+    for (i = 0; i < FLASH_CACHE_LINES; i++) {
+        if (flash_cache[i].stamp && (flash_cache[i].addr < address + len) &&
+            (address < flash_cache[i].addr + FLASH_CACHE_LINE)) {
+            flash_cache[i].stamp = 0;
+            flash_cache_stats.invalidate++;
+        }
+    }
+    __set_PRIMASK(primask);
+}
+
+void flash_cache_get_stats(flash_cache_stats_t *stats)
+{
+    u32 primask;
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    *stats = flash_cache_stats;
+    __set_PRIMASK(primask);
+}
+
+/**
+  * @brief  Wait until the last program or erase has completed
+  * @param  obj: Specifies the parameter of flash object.
+  * @param  flashtype: flash type read by flash_init.
+  * @retval   none
+  */
+static void flash_wait_program(flash_t *obj, u8 flashtype)
+{
+    // Wait spic busy done
+    SpicWaitBusyDoneRtl8195A();
+    // Wait flash busy done (wip=0)
+    if(flashtype == FLASH_MICRON){
+        SpicWaitOperationDoneRtl8195A(obj->SpicInitPara);
+    }
+    else
+        SpicWaitWipDoneRefinedRtl8195A(obj->SpicInitPara);
+}
+
+/**
+  * @brief  Program whole words with page program commands
+  * @param  obj: Specifies the parameter of flash object, already initialized.
+  * @param  address: 4-bytes aligned start address.
+  * @param  len: multiple of 4.
+  * @param  data: source, staged through a word aligned buffer when it is not aligned.
+  * @retval   none
+  */
+static void flash_page_program(flash_t *obj, uint32_t address, uint32_t len, uint8_t * data)
+{
+    u32 stage[FLASH_STAGE_SIZE/4];
+    u32 size;
+    u32 max;
+    u8 flashtype = obj->SpicInitPara.flashtype;
+    uint8_t *src;
+
+    while (len > 0) {
+        // one program never crosses a page
+        size = FLASH_PAGE_SIZE - (address & (FLASH_PAGE_SIZE - 1));
+        if ((u32)data & 0x03) {
+            max = FLASH_STAGE_SIZE - (address & (FLASH_STAGE_SIZE - 1));
+            if (size > max)
+                size = max;
+        }
+        if (size > len)
+            size = len;
+
+        src = data;
+        if ((u32)data & 0x03) {
+            _memcpy(stage, data, size);
+            src = (uint8_t *)stage;
+        }
+        obj->Length = size;
+        SpicUserProgramRtl8195A(src, obj->SpicInitPara, address, &(obj->Length));
+        flash_wait_program(obj, flashtype);
+
+        address += size;
+        data += size;
+        len -= size;
+    }
+}
+
 /**
   * @brief  Write a stream of data to specified address
   * @param  obj: Specifies the parameter of flash object.
@@ -231,6 +429,9 @@ int  flash_stream_read(flash_t *obj, uint32_t address, uint32_t len, uint8_t * d
   * @param  len: Specifies the length of the data to write.
   * @param  data: Specified the pointer of the data to be written.
   * @retval   status: Success:1 or Failure: Others.
+  *
+  * An unaligned head or tail is merged into the word it shares with the old content,
+  * everything between goes out in page programs of up to FLASH_PAGE_SIZE bytes.
   */
 int  flash_stream_write(flash_t *obj, uint32_t address, uint32_t len, uint8_t * data)
 {
@@ -241,6 +442,8 @@ int  flash_stream_write(flash_t *obj, uint32_t address, uint32_t len, uint8_t *
     uint8_t *ptr;
     uint8_t *pbuf;
     u8 flashtype = 0; 
+    u32 start = address, total = len;
+    flash_cache_invalidate(start, total);
     flash_init(obj);
     
     flashtype = obj->SpicInitPara.flashtype;
@@ -262,56 +465,16 @@ int  flash_stream_write(flash_t *obj, uint32_t address, uint32_t len, uint8_t *
         }
         //Write word
         HAL_WRITE32(SPI_FLASH_BASE, align_addr, write_word);
-        // Wait spic busy done
-        SpicWaitBusyDoneRtl8195A();
-        // Wait flash busy done (wip=0)
-        if(flashtype == FLASH_MICRON){
-            SpicWaitOperationDoneRtl8195A(obj->SpicInitPara);
-        }
-        else
-            SpicWaitWipDoneRefinedRtl8195A(obj->SpicInitPara);
-        
-
+        flash_wait_program(obj, flashtype);
     }
 
     address = (((address-1) >> 2) + 1) << 2;    // address = next 4-bytes aligned
 
-    if ((u32)pbuf & 0x03) {
-        while (len >= 4) {
-            write_word = (u32)(*pbuf) | ((u32)(*(pbuf+1)) << 8) | ((u32)(*(pbuf+2)) << 16) | ((u32)(*(pbuf+3)) << 24);
-            //Write word
-            HAL_WRITE32(SPI_FLASH_BASE, address, write_word);
-            // Wait spic busy done
-            SpicWaitBusyDoneRtl8195A();
-            // Wait flash busy done (wip=0)
-            if(flashtype == FLASH_MICRON){
-                SpicWaitOperationDoneRtl8195A(obj->SpicInitPara);
-            }
-            else
-                SpicWaitWipDoneRefinedRtl8195A(obj->SpicInitPara);
-
-            pbuf += 4;
-            address += 4;
-            len -= 4;
-        }
-    }
-    else {
-        while (len >= 4) {
-            //Write word
-            HAL_WRITE32(SPI_FLASH_BASE, address, (u32)*((u32 *)pbuf));
-            // Wait spic busy done
-            SpicWaitBusyDoneRtl8195A();
-            // Wait flash busy done (wip=0)
-            if(flashtype == FLASH_MICRON){
-                SpicWaitOperationDoneRtl8195A(obj->SpicInitPara);
-            }
-            else
-                SpicWaitWipDoneRefinedRtl8195A(obj->SpicInitPara);
-
-            pbuf += 4;
-            address += 4;
-            len -= 4;
-        }
+    if (len >= 4) {
+        flash_page_program(obj, address, len & ~0x03, pbuf);
+        pbuf += len & ~0x03;
+        address += len & ~0x03;
+        len &= 0x03;
     }
 
     if (len > 0) {
@@ -323,27 +486,19 @@ int  flash_stream_write(flash_t *obj, uint32_t address, uint32_t len, uint8_t *
         }
         //Write word
         HAL_WRITE32(SPI_FLASH_BASE, address, write_word);
-        // Wait spic busy done
-        SpicWaitBusyDoneRtl8195A();
-        // Wait flash busy done (wip=0)
-        if(flashtype == FLASH_MICRON){
-            SpicWaitOperationDoneRtl8195A(obj->SpicInitPara);
-        }
-        else
-            SpicWaitWipDoneRefinedRtl8195A(obj->SpicInitPara);
-
+        flash_wait_program(obj, flashtype);
     }
 
     SpicDisableRtl8195A();
+    flash_cache_invalidate(start, total);
     return 1;
 }
 
 
 /*
 Function Description:
-This function performans the same functionality as the function flash_stream_write.
-It enhances write performance by reducing overheads.
-Users can use either of functions depending on their needs.
+Kept for the callers written against the older SDK, flash_stream_write now does the
+page programming itself.
 
 * @brief  Write a stream of data to specified address
 * @param  obj: Specifies the parameter of flash object.
@@ -356,79 +511,7 @@ Users can use either of functions depending on their needs.
 
 int flash_burst_write(flash_t *obj, uint32_t address ,uint32_t Length, uint8_t * data)
 {
-
-    u32 OccuSize;
-    u32 ProgramSize;
-    u32 PageSize;
-    u8 flashtype = 0;
-
-    PageSize = 256;
-
-    flash_init(obj);
-
-    flashtype = obj->SpicInitPara.flashtype;
-    
-    OccuSize = address & 0xFF;
-    if((Length >= PageSize) ||((Length + OccuSize) >= PageSize))
-        ProgramSize = PageSize - OccuSize;
-    else
-        ProgramSize = Length;
-
-    obj->Length = Length;
-    while(Length > 0){
-        if(OccuSize){
-            SpicUserProgramRtl8195A(data, obj->SpicInitPara, address, &(obj->Length));
-                // Wait spic busy done
-            SpicWaitBusyDoneRtl8195A();
-            // Wait flash busy done (wip=0)
-            if(flashtype == FLASH_MICRON){
-                SpicWaitOperationDoneRtl8195A(obj->SpicInitPara);
-            }
-            else
-                SpicWaitWipDoneRefinedRtl8195A(obj->SpicInitPara);
-
-            address += ProgramSize;
-            data+= ProgramSize;   
-            Length -= ProgramSize;
-            OccuSize = 0;
-        }
-        else{
-            while((obj->Length) >= PageSize){
-                SpicUserProgramRtl8195A(data, obj->SpicInitPara, address, &(obj->Length));
-                    // Wait spic busy done
-                SpicWaitBusyDoneRtl8195A();
-                // Wait flash busy done (wip=0)
-                if(flashtype == FLASH_MICRON){
-                    SpicWaitOperationDoneRtl8195A(obj->SpicInitPara);
-                }
-                else
-                    SpicWaitWipDoneRefinedRtl8195A(obj->SpicInitPara);
-
-                address += PageSize;
-                data+=PageSize;
-                Length -= PageSize;
-            }
-            obj->Length = Length;
-            if((obj->Length)  > 0){
-                SpicUserProgramRtl8195A(data, obj->SpicInitPara, address, &(obj->Length));
-                    // Wait spic busy done
-                SpicWaitBusyDoneRtl8195A();
-                // Wait flash busy done (wip=0)
-                if(flashtype == FLASH_MICRON){
-                    SpicWaitOperationDoneRtl8195A(obj->SpicInitPara);
-                }
-                else
-                    SpicWaitWipDoneRefinedRtl8195A(obj->SpicInitPara);
-
-                break;
-            }
-        }
-        obj->Length = Length;
-    }
-    
-    SpicDisableRtl8195A();
-    return 1;
-
+    return flash_stream_write(obj, address, Length, data);
 }
 
 
@@ -18,13 +18,27 @@
 #define OTA_SECTOR                0x00100000
 #define FLASH_LOG_ADDR            0x001A0000	//0x001A0000 ~ 0x001EFFF
 #define LOG_DATA_LEN              	0x00050000
-                                  //0x001F000 ~ 0x001F9FFF
+#define FLASH_KV_ADDR             0x001F0000	//0x001F0000 ~ 0x001F3FFF, kv_store.h
+                                  //0x001F4000 ~ 0x001F9FFF
 #define FLASH_USER_ADDR           0x001FA000
 #define FLASH_CLOCK_ADDR          0x001FB000
 #define WEB_SECTOR                0x001FC000
 #define FLASH_EX_ADDR             0x001FE000
 #define FLASH_DATA_ADDR           0x001FF000
 
+//WAC/HAP data moved from FLASH_DATA_ADDR to the kv store, keys of its records
+#define KV_WAC_CONFIG             0x0001
+#define KV_HAP_KEYPAIR            0x0002
+#define KV_SETUPCODE              0x0003
+#define KV_HAP_CONFIG             0x0004	//c# and the database hash it belongs to
+#define KV_HAP_STATE              0x0005	//s#
+#define KV_LEGACY                 0x0006	//the old sector is imported and whether its mark holds
+#define KV_HAP_PAIRING            0x0100	//+ index of the pairing
+//programmed into the old sector once it is imported, a reset erasing that sector clears it and
+//the keys imported from there are dropped
+#define FLASH_KV_MARK_OFFSET      (FLASH_DATA_LEN - 4)
+#define FLASH_KV_MARK             0x4D564B46
+
 typedef struct{
     uint8_t firmware[16];
     uint8_t software[16];
@@ -50,6 +64,16 @@ void phytrex_wifi_manager(int times, int interval);
 /* type - 4 : Reboot system																			*/
 void phytrex_reset(int type);
 
+/* FlashKVOpen																					*/
+/* Mount the kv store holding the WAC/HAP data, imports the old FLASH_DATA_ADDR sector once		*/
+void FlashKVOpen(void);
+/* FlashKVRead - a key that is not in the store reads as 0xFF, like the erased sector did			*/
+void FlashKVRead(uint16_t key, void *buf, uint32_t len);
+/* FlashKVWrite - 0 stored, -1 when the store is full or the value too long, failures are logged	*/
+int FlashKVWrite(uint16_t key, const void *buf, uint32_t len);
+/* FlashKVErased - call after erasing FLASH_DATA_ADDR at run time, drops the keys imported from it	*/
+void FlashKVErased(void);
+
 /* phytrex_is_auth																					*/
 /* return Auth Flag																					*/
 BOOL phytrex_is_auth();
@@ -0,0 +1,93 @@
+#ifndef _HOST_H_
+#define _HOST_H_
+
+/*
+ * What the host stand-ins (host_sdk.c, host_app.c) let a test see and drive. The firmware sources
+ * are built unchanged against the headers in stub/, these are the knobs behind them.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include "FreeRTOS.h"
+
+extern int host_failed;
+
+#define CHECK(c) \
+do{\
+	if(!(c)){\
+		printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #c);\
+		host_failed++;\
+	}\
+}while(0)
+
+/* 0 when every CHECK held, prints the verdict */
+int host_result(const char *name);
+
+/* monotonic time for the benchmarks */
+double host_now_us(void);
+
+/* deterministic random numbers, so a failure can be replayed */
+void host_srand(uint32_t seed);
+uint32_t host_rand(void);
+
+/*
+ * Serial line of uart_socket. Sent bytes wait in the UART FIFO until an rx DMA transfer is armed,
+ * fill it as they arrive and a full transfer calls the completion handler like the GDMA interrupt
+ * does. The FIFO here never overflows, the ring behind it does.
+ */
+typedef struct _host_serial_stats
+{
+	uint32_t arms;			//rx DMA transfers started
+	uint32_t completions;	//transfers done, one interrupt each
+	uint32_t aborts;		//transfers cut short by serial_recv_stream_abort()
+}host_serial_stats;
+
+extern host_serial_stats host_serial;
+
+void host_line_send(const void *data, uint32_t len);
+uint32_t host_line_pending(void);		//bytes still in the FIFO
+uint32_t host_line_armed(void);			//length of the armed transfer, 0 when none
+
+/*
+ * NOR flash behind the SPIC ROM calls and HAL_READ32/HAL_WRITE32 on SPI_FLASH_BASE. Programming
+ * can only clear bits, erasing sets a sector or block back to 0xFF. Every program leaves the chip
+ * busy until a WIP wait, reading or programming a busy chip is counted as a fault.
+ */
+#define HOST_FLASH_SIZE		(1 << 20)
+
+typedef struct _host_flash_stats
+{
+	uint32_t word_programs;		//HAL_WRITE32 to the flash, one program command each
+	uint32_t page_programs;		//SpicUserProgramRtl8195A calls
+	uint32_t program_bytes;		//bytes carried by both
+	uint32_t page_crossings;	//page programs running past a 256 byte page
+	uint32_t unaligned;			//page programs from an unaligned source or to an unaligned address
+	uint32_t waits;				//WIP waits, either kind
+	uint32_t micron_waits;		//the flag status waits of FLASH_MICRON parts
+	uint32_t erases;			//sectors and blocks
+	uint32_t busy_faults;		//flash touched while a program was still running
+	uint32_t sessions;			//SpicFlashInitRtl8195A .. SpicDisableRtl8195A
+}host_flash_stats;
+
+extern uint8_t host_flash[HOST_FLASH_SIZE];
+extern host_flash_stats host_flash_ops;
+
+void host_flash_reset(uint8_t flashtype);	//all 0xFF, counters cleared
+
+/* application side, what protocol.c handed over */
+#define HOST_NOTIFY_MAX		64
+
+typedef struct _host_notify
+{
+	uint8_t channel;
+	int id;
+}host_notify;
+
+extern host_notify host_notify_log[HOST_NOTIFY_MAX];
+extern int host_notify_num;
+extern int host_events;			//outlet_post_event() calls
+extern int host_resets;			//phytrex_reset() calls
+extern int host_hisdata_num;	//wirte_hisdata2flash() calls
+
+void host_app_reset(void);
+
+#endif
@@ -0,0 +1,86 @@
+#include <string.h>
+#include "other/outlet/outlet.h"
+#include "protocol.h"
+#include "host.h"
+
+/* application side stand-ins for the host tests, they record what protocol.c handed over */
+
+outlet_state outletstateA;
+outlet_state outletstateB;
+struct EEP_PARAM eep_param;
+uint8 g_frame_buffer[MAX_BUFFER_SZ];
+
+host_notify host_notify_log[HOST_NOTIFY_MAX];
+int host_notify_num;
+int host_events;
+int host_resets;
+int host_hisdata_num;
+
+void host_app_reset(void)
+{
+	memset(&outletstateA, 0, sizeof(outletstateA));
+	memset(&outletstateB, 0, sizeof(outletstateB));
+	host_notify_num = 0;
+	host_events = 0;
+	host_resets = 0;
+	host_hisdata_num = 0;
+}
+
+void outlet_notify(uint8 channel, int id)
+{
+	if(host_notify_num < HOST_NOTIFY_MAX){
+		host_notify_log[host_notify_num].channel = channel;
+		host_notify_log[host_notify_num].id = id;
+	}
+	host_notify_num++;
+}
+
+void outlet_post_event(uint8 type, uint8 channel)
+{
+	host_events++;
+}
+
+void wirte_hisdata2flash(hisdata_state report_hisdata)
+{
+	host_hisdata_num++;
+}
+
+void phytrex_reset(int type)
+{
+	host_resets++;
+}
+
+void FlashKVErased(void)
+{
+}
+
+uint8 app_handle(uint8 code, void *args)
+{
+	return 0;
+}
+
+uint8 frame_handle(uint8 init, void *args)
+{
+	return 0;
+}
+
+void HAPNotifyHandle(void *param)
+{
+}
+
+int outlet_task_idle(void)
+{
+	return 1;
+}
+
+void mcu_cmd_init(void)
+{
+}
+
+void mcu_cmd_poll(void)
+{
+}
+
+void mcu_ota_poll(void)
+{
+}
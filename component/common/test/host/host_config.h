@@ -0,0 +1,19 @@
+#ifndef _HOST_CONFIG_H_
+#define _HOST_CONFIG_H_
+
+/*
+ * Forced into every unit of the host tests (-include). config.h types uint32 and int32 as long,
+ * which is 64 bits on the host, so it is pulled in here once with those two names moved aside
+ * and they are typed to the 32 bits the MCU has. Its include guard keeps the firmware sources
+ * from seeing the original typedefs again.
+ */
+#define uint32 config_uint32
+#define int32 config_int32
+#include "config.h"
+#undef uint32
+#undef int32
+
+typedef unsigned int        uint32;
+typedef signed int          int32;
+
+#endif
@@ -0,0 +1,140 @@
+#include <string.h>
+#include "rtl8195a.h"
+#include "host.h"
+
+/* SPI flash stand-ins for the host tests: a NOR array behind the SPIC ROM calls flash_api.c makes */
+
+#define HOST_FLASH_PAGE		256
+
+u32 ConfigDebugInfo;
+SPIC_INIT_PARA SpicInitParaAllClk[3][CPU_CLK_TYPE_NO];
+
+uint8_t host_flash[HOST_FLASH_SIZE];
+host_flash_stats host_flash_ops;
+
+static int flash_busy;
+
+void host_flash_reset(uint8_t flashtype)
+{
+	memset(host_flash, 0xFF, sizeof(host_flash));
+	memset(&host_flash_ops, 0, sizeof(host_flash_ops));
+	memset(SpicInitParaAllClk, 0, sizeof(SpicInitParaAllClk));
+	SpicInitParaAllClk[SpicOneBitMode][0].flashtype = flashtype;
+	flash_busy = 0;
+}
+
+/* a program only clears bits */
+static void flash_program(u32 addr, const u8 *data, u32 len)
+{
+	u32 i;
+
+	if(flash_busy)
+		host_flash_ops.busy_faults++;
+	CHECK(addr + len <= HOST_FLASH_SIZE);
+	for(i = 0; i < len; i++)
+		host_flash[addr + i] &= data[i];
+	host_flash_ops.program_bytes += len;
+	flash_busy = 1;
+}
+
+u32 host_hal_read32(u32 base, u32 addr)
+{
+	u32 v;
+
+	if(base != SPI_FLASH_BASE)
+		return 0;
+	if(flash_busy)
+		host_flash_ops.busy_faults++;
+	CHECK(!(addr & 3) && addr + 4 <= HOST_FLASH_SIZE);
+	memcpy(&v, &host_flash[addr], 4);
+	return v;
+}
+
+void host_hal_write32(u32 base, u32 addr, u32 value32)
+{
+	if(base != SPI_FLASH_BASE)
+		return;
+	CHECK(!(addr & 3));
+	host_flash_ops.word_programs++;
+	flash_program(addr, (const u8 *)&value32, 4);
+}
+
+BOOLEAN SpicFlashInitRtl8195A(u8 SpicBitMode)
+{
+	host_flash_ops.sessions++;
+	return 1;
+}
+
+VOID SpicWaitBusyDoneRtl8195A(VOID)
+{
+}
+
+VOID SpicWaitWipDoneRefinedRtl8195A(IN SPIC_INIT_PARA SpicInitPara)
+{
+	host_flash_ops.waits++;
+	flash_busy = 0;
+}
+
+VOID SpicWaitOperationDoneRtl8195A(IN SPIC_INIT_PARA SpicInitPara)
+{
+	host_flash_ops.waits++;
+	host_flash_ops.micron_waits++;
+	flash_busy = 0;
+}
+
+/* the ROM erase calls take the mapped address and wait for the erase themselves */
+VOID SpicSectorEraseFlashRtl8195A(IN u32 Address)
+{
+	Address = (Address - SPI_FLASH_BASE) & ~0xFFF;
+	CHECK(Address < HOST_FLASH_SIZE);
+	if(flash_busy)
+		host_flash_ops.busy_faults++;
+	memset(&host_flash[Address], 0xFF, 0x1000);
+	host_flash_ops.erases++;
+}
+
+VOID SpicBlockEraseFlashRtl8195A(IN u32 Address)
+{
+	Address = (Address - SPI_FLASH_BASE) & ~0xFFFF;
+	CHECK(Address < HOST_FLASH_SIZE);
+	if(flash_busy)
+		host_flash_ops.busy_faults++;
+	memset(&host_flash[Address], 0xFF, 0x10000);
+	host_flash_ops.erases++;
+}
+
+VOID SpicWriteProtectFlashRtl8195A(IN u32 Protect)
+{
+}
+
+u8 SpicGetFlashStatusRefinedRtl8195A(IN SPIC_INIT_PARA SpicInitPara)
+{
+	return 0;
+}
+
+VOID SpicSetFlashStatusRefinedRtl8195A(IN u32 data, IN SPIC_INIT_PARA SpicInitPara)
+{
+}
+
+/* the SPIC has to be left idle, whatever was programmed has to be done by now */
+VOID SpicDisableRtl8195A(VOID)
+{
+	if(flash_busy)
+		host_flash_ops.busy_faults++;
+}
+
+/*
+ * One page program command. The chip wraps inside the page when the data runs past its end, the
+ * model counts that instead, and the SPIC moves whole words from a word aligned source.
+ */
+VOID SpicUserProgramRtl8195A(IN u8 * data, IN SPIC_INIT_PARA SpicInitPara, IN u32 addr, IN u32 * LengthInfo)
+{
+	u32 len = *LengthInfo;
+
+	host_flash_ops.page_programs++;
+	if((addr & (HOST_FLASH_PAGE - 1)) + len > HOST_FLASH_PAGE)
+		host_flash_ops.page_crossings++;
+	if(((uintptr_t)data & 3) || (addr & 3) || (len & 3) || !len)
+		host_flash_ops.unaligned++;
+	flash_program(addr, data, len);
+}
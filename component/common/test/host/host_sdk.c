@@ -0,0 +1,233 @@
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <time.h>
+#include "osdep_api.h"
+#include "serial_api.h"
+#include "serial_ex_api.h"
+#include "lwip/api.h"
+#include "cmsis.h"
+#include "host.h"
+
+/* SDK, RTOS and lwip stand-ins for the host tests */
+
+#define HOST_FIFO_LEN		(1 << 20)
+
+int host_failed;
+TickType_t host_ticks;
+uint32_t host_primask;
+host_serial_stats host_serial;
+
+static uint32_t host_seed = 1;
+
+static struct
+{
+	void (*recv_done)(uint32_t id);
+	uint32_t recv_id;
+	char *dma_buf;			//armed rx transfer, NULL when none
+	uint32_t dma_len;
+	uint32_t dma_got;
+	uint32_t fifo_head;
+	uint32_t fifo_tail;
+	uint8_t fifo[HOST_FIFO_LEN];
+}line;
+
+int host_result(const char *name)
+{
+	printf("%s: %s\n", name, host_failed ? "FAILED" : "ok");
+	return host_failed ? 1 : 0;
+}
+
+double host_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+void host_srand(uint32_t seed)
+{
+	host_seed = seed ? seed : 1;
+}
+
+/* xorshift32 */
+uint32_t host_rand(void)
+{
+	host_seed ^= host_seed << 13;
+	host_seed ^= host_seed >> 17;
+	host_seed ^= host_seed << 5;
+	return host_seed;
+}
+
+/*
+ * The ISR callbacks get the socket back from a u32 id, so it has to live in the low 4 GB.
+ */
+u8 *RtlZmalloc(u32 sz)
+{
+	void *p;
+
+	p = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+	return (p == MAP_FAILED) ? NULL : (u8 *)p;
+}
+
+void RtlMfree(u8 *pbuf, u32 sz)
+{
+	munmap(pbuf, sz);
+}
+
+void RtlInitSema(_Sema *sema, u32 init_val)
+{
+	*sema = NULL;
+}
+
+void RtlFreeSema(_Sema *sema)
+{
+}
+
+void RtlUpSema(_Sema *sema)
+{
+}
+
+void RtlUpSemaFromISR(_Sema *sema)
+{
+}
+
+u32 RtlDownSema(_Sema *sema)
+{
+	return pdTRUE;
+}
+
+void RtlMsleepOS(u32 ms)
+{
+	host_ticks += ms;
+}
+
+void wait(float s)
+{
+}
+
+void wait_ms(int ms)
+{
+	host_ticks += ms;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint16_t stack, void *param,
+                       UBaseType_t prio, TaskHandle_t *handle)
+{
+	return pdPASS;
+}
+
+int lwip_allocsocketsd(void)
+{
+	return 3;
+}
+
+int lwip_close(int s)
+{
+	return 0;
+}
+
+void lwip_selectevindicate(int fd)
+{
+}
+
+void lwip_setsockrcvevent(int fd, int rcvevent)
+{
+}
+
+void serial_init(serial_t *obj, PinName tx, PinName rx)
+{
+	memset(&line, 0, sizeof(line));
+	memset(&host_serial, 0, sizeof(host_serial));
+}
+
+void serial_free(serial_t *obj)
+{
+	line.dma_buf = NULL;
+}
+
+void serial_baud(serial_t *obj, int baudrate)
+{
+}
+
+void serial_format(serial_t *obj, int data_bits, SerialParity parity, int stop_bits)
+{
+}
+
+void serial_irq_handler(serial_t *obj, uart_irq_handler handler, uint32_t id)
+{
+}
+
+void serial_irq_set(serial_t *obj, SerialIrq irq, uint32_t enable)
+{
+}
+
+int serial_getc(serial_t *obj)
+{
+	return 0;
+}
+
+void serial_putc(serial_t *obj, int c)
+{
+}
+
+void serial_recv_comp_handler(serial_t *obj, void *handler, uint32_t id)
+{
+	line.recv_done = (void (*)(uint32_t))handler;
+	line.recv_id = id;
+}
+
+int32_t serial_recv_stream_dma(serial_t *obj, char *prxbuf, uint32_t len)
+{
+	if(line.dma_buf || !len)
+		return HAL_BUSY;
+	line.dma_buf = prxbuf;
+	line.dma_len = len;
+	line.dma_got = 0;
+	host_serial.arms++;
+	return HAL_OK;
+}
+
+int32_t serial_recv_stream_abort(serial_t *obj)
+{
+	int32_t n = line.dma_got;
+
+	if(!line.dma_buf)
+		return 0;
+	line.dma_buf = NULL;
+	host_serial.aborts++;
+	return n;
+}
+
+/* move FIFO bytes into the armed transfer, completing it calls the driver back, which re-arms */
+static void host_line_run(void)
+{
+	while(line.dma_buf && (line.fifo_tail != line.fifo_head)){
+		line.dma_buf[line.dma_got++] = line.fifo[line.fifo_tail++ % HOST_FIFO_LEN];
+		if(line.dma_got == line.dma_len){
+			line.dma_buf = NULL;
+			host_serial.completions++;
+			if(line.recv_done)
+				line.recv_done(line.recv_id);
+		}
+	}
+}
+
+void host_line_send(const void *data, uint32_t len)
+{
+	const uint8_t *p = (const uint8_t *)data;
+
+	while(len--)
+		line.fifo[line.fifo_head++ % HOST_FIFO_LEN] = *p++;
+	host_line_run();
+}
+
+uint32_t host_line_pending(void)
+{
+	return line.fifo_head - line.fifo_tail;
+}
+
+uint32_t host_line_armed(void)
+{
+	return line.dma_buf ? line.dma_len : 0;
+}
@@ -0,0 +1,44 @@
+#ifndef INC_FREERTOS_H
+#define INC_FREERTOS_H
+
+/* host stand-in for FreeRTOS: a tick counter the tests move by hand, tasks are never run */
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef void *TaskHandle_t;
+typedef void *xSemaphoreHandle;
+typedef void *SemaphoreHandle_t;
+typedef void (*TaskFunction_t)(void *);
+typedef enum { eRunning = 0, eReady, eBlocked, eSuspended, eDeleted } eTaskState;
+
+#define pdFALSE                 0
+#define pdTRUE                  1
+#define pdPASS                  pdTRUE
+#define pdFAIL                  pdFALSE
+#define portTICK_RATE_MS        1
+#define portTICK_PERIOD_MS      1
+#define portMAX_DELAY           0xFFFFFFFFu
+
+extern TickType_t host_ticks;
+
+#define xTaskGetTickCount()             (host_ticks)
+#define xTaskGetTickCountFromISR()      (host_ticks)
+#define taskENTER_CRITICAL()            do { } while (0)
+#define taskEXIT_CRITICAL()             do { } while (0)
+#define vTaskDelay(t)                   (host_ticks += (t))
+#define vTaskDelete(h)                  do { (void)(h); } while (0)
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint16_t stack, void *param,
+                       UBaseType_t prio, TaskHandle_t *handle);
+
+#define vSemaphoreCreateBinary(s)       ((s) = (void *)1)
+#define xSemaphoreTake(s, t)            pdTRUE
+#define xSemaphoreGive(s)               pdTRUE
+
+#define pvPortMalloc                    malloc
+#define vPortFree                       free
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef _CMSIS_H_
+#define _CMSIS_H_
+
+/* host stand-in for the Cortex-M3 intrinsics, one thread so masking interrupts is a flag */
+#include <stdint.h>
+#include "basic_types.h"
+#include "hal_spi_flash.h"		//the SDK one has it through rtl8195a.h, objects.h needs SPIC_INIT_PARA
+
+extern uint32_t host_primask;
+
+#define __DMB()                 __sync_synchronize()
+#define __get_PRIMASK()         (host_primask)
+#define __set_PRIMASK(x)        (host_primask = (x))
+#define __disable_irq()         (host_primask = 1)
+#define __enable_irq()          (host_primask = 0)
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef MBED_DEVICE_H
+#define MBED_DEVICE_H
+
+/* host stand-in for the RTL8195A device.h: only the HAL objects the tested sources touch */
+#include <stdint.h>
+#include "basic_types.h"
+#include "PinNames.h"
+#include "objects.h"
+
+#define DEVICE_SERIAL           1
+#define DEVICE_RTC              1
+
+typedef enum {
+    HAL_OK = 0,
+    HAL_BUSY = 1,
+    HAL_ERR_PARA = 2,
+} HAL_Status;
+
+struct serial_s {
+    int port;
+};
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef _HAL_API_H_
+#define _HAL_API_H_
+
+/* host stand-in for hal_api.h: register access goes to the flash model in host_flash.c */
+#include "basic_types.h"
+
+u32 host_hal_read32(u32 base, u32 addr);
+void host_hal_write32(u32 base, u32 addr, u32 value32);
+
+#define HAL_READ32(base, addr)              host_hal_read32((base), (addr))
+#define HAL_WRITE32(base, addr, value32)    host_hal_write32((base), (addr), (value32))
+
+#endif
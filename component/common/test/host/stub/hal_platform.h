@@ -0,0 +1,12 @@
+#ifndef _HAL_PLATFORM_
+#define _HAL_PLATFORM_
+
+/* host stand-in for hal_platform.h: the bases flash_api.c addresses, pin control does nothing */
+#define SYSTEM_CTRL_BASE            0x40000000
+#define SPI_FLASH_BASE              0x98000000
+#define REG_SYS_DSTBY_INFO3         0x00FC
+#define CPU_CLK_TYPE_NO             6
+
+#define SPI_FLASH_PIN_FCTRL(ctrl)   do { } while (0)
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef _HAL_SPIFLASH__
+#define _HAL_SPIFLASH__
+
+/* host stand-in for hal_spi_flash.h: the SPIC ROM calls, backed by the flash model in host_flash.c */
+#include "basic_types.h"
+
+typedef struct _SPIC_INIT_PARA_ {
+    u8  BaudRate;
+    u8  RdDummyCyle;
+    u8  DelayLine;
+    u8  Valid;
+    u8  id[3];
+    u8  flashtype;
+}SPIC_INIT_PARA, *PSPIC_INIT_PARA;
+
+enum _SPIC_BIT_MODE_ {
+    SpicOneBitMode = 0,
+    SpicDualBitMode = 1,
+    SpicQuadBitMode = 2,
+};
+
+#define FLASH_MICRON 3
+
+BOOLEAN SpicFlashInitRtl8195A(u8 SpicBitMode);
+VOID SpicWaitBusyDoneRtl8195A(VOID);
+VOID SpicBlockEraseFlashRtl8195A(IN u32 Address);
+VOID SpicSectorEraseFlashRtl8195A(IN u32 Address);
+VOID SpicWriteProtectFlashRtl8195A(IN u32 Protect);
+VOID SpicWaitWipDoneRefinedRtl8195A(IN  SPIC_INIT_PARA SpicInitPara);
+VOID SpicWaitOperationDoneRtl8195A(IN SPIC_INIT_PARA SpicInitPara);
+u8 SpicGetFlashStatusRefinedRtl8195A(IN  SPIC_INIT_PARA SpicInitPara);
+VOID SpicSetFlashStatusRefinedRtl8195A(IN u32 data, IN SPIC_INIT_PARA SpicInitPara);
+VOID SpicDisableRtl8195A(VOID);
+VOID SpicUserProgramRtl8195A(IN u8 * data, IN SPIC_INIT_PARA SpicInitPara, IN u32 addr, IN u32 * LengthInfo);
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef __LWIP_API_H__
+#define __LWIP_API_H__
+
+/* host stand-in, the uart socket only raises and clears its receive event */
+#include <sys/select.h>
+#include <sys/time.h>
+
+int lwip_close(int s);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef __OSDEP_API_H_
+#define __OSDEP_API_H_
+
+/* host stand-in for the osdep layer, semaphores always succeed */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "basic_types.h"
+#include "FreeRTOS.h"
+
+typedef void *_Sema;
+
+u8 *RtlZmalloc(u32 sz);
+void RtlMfree(u8 *pbuf, u32 sz);
+void RtlInitSema(_Sema *sema, u32 init_val);
+void RtlFreeSema(_Sema *sema);
+void RtlUpSema(_Sema *sema);
+void RtlUpSemaFromISR(_Sema *sema);
+u32 RtlDownSema(_Sema *sema);
+void RtlMsleepOS(u32 ms);
+
+void wait(float s);
+void wait_ms(int ms);
+
+#endif
@@ -0,0 +1,7 @@
+#ifndef MBED_PINMAP_H
+#define MBED_PINMAP_H
+
+/* host stand-in for pinmap.h, nothing the tested sources use */
+#include "PinNames.h"
+
+#endif
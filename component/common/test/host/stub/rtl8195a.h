@@ -0,0 +1,16 @@
+#ifndef _HAL_8195A_H_
+#define _HAL_8195A_H_
+
+/* host stand-in for rtl8195a.h: the platform pieces flash_api.c pulls in through it */
+#include <stdio.h>
+#include <string.h>
+#include "basic_types.h"
+#include "cmsis.h"
+#include "hal_platform.h"
+#include "hal_api.h"
+#include "hal_spi_flash.h"
+
+#define DBG_8195A(...)      printf(__VA_ARGS__)
+#define _memcpy             memcpy
+
+#endif
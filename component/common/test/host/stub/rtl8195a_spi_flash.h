@@ -0,0 +1 @@
+#include "hal_spi_flash.h"
@@ -0,0 +1,256 @@
+#include <math.h>
+#include <string.h>
+#include "other/outlet/outlet.h"
+#include "protocol.h"
+#include "host.h"
+
+extern outlet_state outletstateA;
+extern outlet_state outletstateB;
+
+/*
+ * build_read_batch() and scatter_parameter(): the request layout for any set of dids and
+ * channels, canned multi-did replies landing in outletstateA/B, and the one pass over a reply
+ * leaving the same state and notifications behind as the same items one frame each.
+ */
+
+static const uint16 all_dids[] = {DID_ONOFF, DID_METER, DID_THRPOW, DID_THRCUR, DID_THRVOL, DID_METQUA};
+
+/* what getMCU_onoff_meter() used to send, spelled out by hand */
+static const uint8 onoff_meter_req[61] = {0x02,
+	0x12,0xC0,0x02,0x01,0x00,0x12,0xC0,0x02,0x02,0x00,
+	0x3F,0xB5,0x02,0x01,0x00,0x3F,0xB5,0x02,0x02,0x00,
+	0x30,0xB5,0x02,0x01,0x00,0x30,0xB5,0x02,0x02,0x00,
+	0x21,0xB5,0x02,0x01,0x00,0x21,0xB5,0x02,0x02,0x00,
+	0x11,0xB5,0x02,0x01,0x00,0x11,0xB5,0x02,0x02,0x00,
+	0x10,0x90,0x02,0x01,0x00,0x10,0x90,0x02,0x02,0x00,
+};
+
+/* MCU answers per did, data after the channel byte, channel A then B */
+typedef struct _canned
+{
+	uint16 did;
+	uint8 len;
+	uint8 data[2][9];
+}canned;
+
+static const canned answers[] = {
+	{DID_ONOFF,  1, {{0x01}, {0x00}}},
+	/* alarm, voltage 220.5 / 231.0, current 1.234 / 0.056, power 710 W / 10 W */
+	{DID_METER,  9, {{0x00, 0x05, 0x22, 0x34, 0x12, 0x00, 0x00, 0x71, 0x00},
+	                 {0x04, 0x10, 0x23, 0x56, 0x00, 0x00, 0x00, 0x01, 0x00}}},
+	{DID_THRPOW, 3, {{0x00, 0x00, 0x02}, {0x00, 0x50, 0x01}}},
+	{DID_THRCUR, 3, {{0x00, 0x00, 0x01}, {0x00, 0x50, 0x00}}},
+	{DID_THRVOL, 4, {{0x00, 0x25, 0x00, 0x18}, {0x05, 0x24, 0x05, 0x19}}},
+	{DID_METQUA, 4, {{0x25, 0x34, 0x12, 0x00}, {0x00, 0x01, 0x00, 0x00}}},
+};
+
+typedef struct _snapshot
+{
+	outlet_state a;
+	outlet_state b;
+	int events;
+	int notify_num;
+	host_notify notify[HOST_NOTIFY_MAX];
+}snapshot;
+
+static void take(snapshot *s)
+{
+	memset(s, 0, sizeof(*s));
+	memcpy(&s->a, &outletstateA, sizeof(s->a));
+	memcpy(&s->b, &outletstateB, sizeof(s->b));
+	s->events = host_events;
+	s->notify_num = host_notify_num;
+	memcpy(s->notify, host_notify_log, sizeof(s->notify));
+}
+
+static int same(const snapshot *x, const snapshot *y)
+{
+	return !memcmp(&x->a, &y->a, sizeof(x->a)) && !memcmp(&x->b, &y->b, sizeof(x->b)) &&
+	       (x->events == y->events) && (x->notify_num == y->notify_num) &&
+	       !memcmp(x->notify, y->notify, sizeof(x->notify));
+}
+
+static const canned *find_answer(uint16 did)
+{
+	uint32 i;
+
+	for(i = 0; i < ARRAY_SIZE(answers); i++)
+		if(answers[i].did == did)
+			return &answers[i];
+	return NULL;
+}
+
+/* the MCU side: answer every item of a read request, returns the length of the reply infor */
+static uint8 mcu_answer(const uint8 *req, uint8 len, uint8 *reply)
+{
+	const canned *c;
+	uint8 i, n = 0, cc;
+	uint16 did;
+
+	reply[n++] = CMD_READ;
+	for(i = 1; i + FBD_FRAME_HEAD + 2 <= len; i += FBD_FRAME_HEAD + 2){
+		did = req[i] | (req[i + 1] << 8);
+		cc = req[i + 3];
+		c = find_answer(did);
+		reply[n++] = (uint8)did;
+		reply[n++] = (uint8)(did >> 8);
+		reply[n++] = 1 + c->len;
+		reply[n++] = cc;
+		memcpy(&reply[n], c->data[cc - 1], c->len);
+		n += c->len;
+	}
+	return n;
+}
+
+static int near(float x, float y)
+{
+	return fabsf(x - y) < 0.001f * (1.0f + fabsf(y));
+}
+
+/* every did subset in every channel mask comes out did-major, channel-minor */
+static void check_layout(void)
+{
+	uint16 dids[ARRAY_SIZE(all_dids)];
+	uint8 buff[255];
+	uint32 set, i, k, num;
+	uint8 ch, cc, len, want;
+
+	for(set = 0; set < (1u << ARRAY_SIZE(all_dids)); set++){
+		for(num = 0, i = 0; i < ARRAY_SIZE(all_dids); i++)
+			if(set & (1u << i))
+				dids[num++] = all_dids[i];
+		for(ch = 0; ch <= CHANNEL_ALL; ch++){
+			want = 1 + num * ((ch & 1) + (ch >> 1)) * (FBD_FRAME_HEAD + 2);
+			len = build_read_batch(buff, sizeof(buff), dids, num, ch);
+			CHECK(len == want);
+			CHECK(buff[0] == CMD_READ);
+			k = 1;
+			for(i = 0; i < num; i++){
+				for(cc = 1; cc <= OUTLET_CHANNELS; cc++){
+					if(!(ch & (1 << (cc - 1))))
+						continue;
+					CHECK(buff[k] == (uint8)dids[i] && buff[k + 1] == (dids[i] >> 8));
+					CHECK(buff[k + 2] == 0x02 && buff[k + 3] == cc && buff[k + 4] == 0x00);
+					k += FBD_FRAME_HEAD + 2;
+				}
+			}
+			/* exactly enough room is fine, one byte less is refused */
+			CHECK(build_read_batch(buff, want, dids, num, ch) == want);
+			if(want > 1)
+				CHECK(build_read_batch(buff, want - 1, dids, num, ch) == 0);
+		}
+	}
+	CHECK(build_read_batch(buff, 0, all_dids, 1, CHANNEL_ALL) == 0);
+
+	len = build_read_batch(buff, sizeof(buff), all_dids, ARRAY_SIZE(all_dids), CHANNEL_ALL);
+	CHECK(len == sizeof(onoff_meter_req) && !memcmp(buff, onoff_meter_req, len));
+	printf("  all dids, both channels: 1 frame of %u bytes on the line instead of %u frames of %u\n",
+	       SHS_FRAME_HEAD + len + 1, (unsigned)(2 * ARRAY_SIZE(all_dids)), SHS_FRAME_HEAD + FBD_FRAME_HEAD + 2 + 1 + 1);
+}
+
+/* the reply to the full request lands in both channels */
+static void check_scatter(void)
+{
+	uint8 req[255], reply[255];
+	uint8 len;
+	int i;
+
+	host_app_reset();
+	len = build_read_batch(req, sizeof(req), all_dids, ARRAY_SIZE(all_dids), CHANNEL_ALL);
+	len = mcu_answer(req, len, reply);
+	CHECK(scatter_parameter(&reply[1], len - 1) == 2 * ARRAY_SIZE(all_dids));
+
+	CHECK(outletstateA.on == 1 && outletstateB.on == 0);
+	CHECK(near(outletstateA.metvol, 220.5f) && near(outletstateB.metvol, 231.0f));
+	CHECK(near(outletstateA.metcur, 1.234f) && near(outletstateB.metcur, 0.056f));
+	CHECK(near(outletstateA.metpow, 710.0f) && near(outletstateB.metpow, 10.0f));
+	CHECK(outletstateA.alarm == 0x00 && outletstateB.alarm == 0x04);
+	CHECK(near(outletstateA.thrpow, 2.0f) && near(outletstateB.thrpow, 1.5f));
+	CHECK(near(outletstateA.thrcur, 10.0f) && near(outletstateB.thrcur, 5.0f));
+	CHECK(near(outletstateA.thrvol_over, 250.0f) && near(outletstateA.thrvol_under, 180.0f));
+	CHECK(near(outletstateB.thrvol_over, 240.5f) && near(outletstateB.thrvol_under, 190.5f));
+	CHECK(near(outletstateA.metqua, 1234.25f) && near(outletstateB.metqua, 1.0f));
+	CHECK(host_events == 1);		//channel B raised an alarm
+
+	/* on/off, three meter values, power, current, two voltage limits and the quantity per channel */
+	CHECK(host_notify_num == 2 * 9);
+	CHECK(host_notify_log[0].channel == 1 && host_notify_log[0].id == OUTLET_CHA_ON);
+	CHECK(host_notify_log[1].channel == 2 && host_notify_log[1].id == OUTLET_CHA_ON);
+	CHECK(host_notify_log[2].channel == 1 && host_notify_log[2].id == OUTLET_CHA_METVOL);
+	CHECK(host_notify_log[4].channel == 1 && host_notify_log[4].id == OUTLET_CHA_METPOW);
+	CHECK(host_notify_log[5].channel == 2 && host_notify_log[5].id == OUTLET_CHA_METVOL);
+	CHECK(host_notify_log[17].channel == 2 && host_notify_log[17].id == OUTLET_CHA_METQUA);
+	for(i = 0; i < host_notify_num; i++)
+		CHECK(host_notify_log[i].channel == 1 || host_notify_log[i].channel == 2);
+}
+
+/* one pass over a batch reply does what the same items did one frame each through set_parameter() */
+static void check_batch_equals_single(void)
+{
+	uint16 dids[ARRAY_SIZE(all_dids)];
+	uint8 req[255], reply[255], one[64];
+	snapshot batch, single;
+	uint32 set, i, num;
+	uint8 ch, len, off, item;
+
+	for(set = 1; set < (1u << ARRAY_SIZE(all_dids)); set++){
+		for(num = 0, i = 0; i < ARRAY_SIZE(all_dids); i++)
+			if(set & (1u << i))
+				dids[num++] = all_dids[i];
+		for(ch = 1; ch <= CHANNEL_ALL; ch++){
+			len = build_read_batch(req, sizeof(req), dids, num, ch);
+			len = mcu_answer(req, len, reply);
+
+			host_app_reset();
+			scatter_parameter(&reply[1], len - 1);
+			take(&batch);
+
+			host_app_reset();
+			for(off = 1; off < len; off += item){
+				item = FBD_FRAME_HEAD + (reply[off + 2] & 0x7F);
+				memcpy(one, &reply[off], item);
+				set_parameter(one, item);
+			}
+			take(&single);
+			CHECK(same(&batch, &single));
+		}
+	}
+}
+
+/* unknown, read-only, mis-sized and cut off items are passed over, the rest still lands */
+static void check_bad_items(void)
+{
+	uint8 reply[] = {
+		0x34, 0x12, 0x02, 0x01, 0x00,					//no such did
+		0x12, 0xC0, 0x02, 0x01, 0x01,					//on/off A
+		0x01, 0x00, 0x00,								//device type, no write
+		0x30, 0xB5, 0x03, 0x02, 0x00, 0x02,				//threshold power one byte short
+		0x30, 0xB5, 0x04, 0x02, 0x00, 0x00, 0x03,		//threshold power B
+		0x3F, 0xB5, 0x0A, 0x02, 0x00, 0x00,				//meter cut off by the frame end
+	};
+
+	host_app_reset();
+	CHECK(scatter_parameter(reply, sizeof(reply)) == 2);
+	CHECK(outletstateA.on == 1);
+	CHECK(near(outletstateB.thrpow, 3.0f));
+	CHECK(outletstateB.metvol == 0.0f && outletstateB.metpow == 0.0f);
+	CHECK(host_notify_num == 2);
+
+	/* what is left after an item is too short for another one */
+	host_app_reset();
+	CHECK(scatter_parameter(reply + 5, 5 + FBD_FRAME_HEAD - 1) == 1);
+	CHECK(scatter_parameter(reply, 0) == 0);
+	CHECK(scatter_parameter(reply, FBD_FRAME_HEAD - 1) == 0);
+	CHECK(host_notify_num == 1);
+}
+
+int main(void)
+{
+	printf("batched MCU reads:\n");
+	check_layout();
+	check_scatter();
+	check_batch_equals_single();
+	check_bad_items();
+
+	return host_result("test_batch");
+}
@@ -0,0 +1,408 @@
+#include <string.h>
+#include "comfunc.h"
+#include "host.h"
+
+/*
+ * comfunc.c against the byte loops it replaced. The ref_ functions are the old bodies as they
+ * were, uint8 lengths included. Every length 0..255 at every alignment of both buffers, every
+ * BCD input, then lengths past 255 against the old functions chained over 255 byte pieces.
+ */
+
+#define BUF_LEN		4096
+
+static uint8 ref_checksum(uint8 *data, uint8 len)
+{
+	uint8 cs = 0;
+
+	while(len-- > 0)
+		cs += *data++;
+	return(cs);
+}
+
+static void ref_mymemcpy(void *dst, void *src, uint8 len)
+{
+	while(len--)
+	{
+		*(char *)dst = *(char *)src;
+		dst = (char *)dst + 1;
+		src = (char *)src + 1;
+	}
+}
+
+static uint8 ref_memcmp_my(const void *s1, const void *s2, uint8 n)
+{
+	while (n && *(char*)s1 == *(char*)s2)
+	{
+		s1 = (char*)s1 + 1;
+		s2 = (char*)s2 + 1;
+		n--;
+	}
+
+	if(n > 0)
+	{
+		return(1);
+	}
+	return(0);
+}
+
+static uint8 ref_is_all_xx(const void *s1, uint8 value, uint8 n)
+{
+	while(n && *(char*)s1 == value)
+	{
+		s1 = (char*)s1 + 1;
+		n--;
+	}
+	return(!n);
+}
+
+/* n == 0 ran the loop 256 times, the new one writes nothing, so only 1..255 are compared */
+static void ref_memset_my(void *s1, uint8 value, uint8 n)
+{
+	do
+	{
+		*(char*)s1 = value;
+		s1 = (char *)s1 + 1;
+	}
+	while(--n);
+}
+
+static void* ref_memmove_my(void* dest, void* source, uint16 n)
+{
+	int8* ret = (int8*)dest;
+
+	if (ret <= (int8*)source || ret >= (int8*)source + n)
+	{
+		while (n --)
+		{
+			*ret++ = *(int8*)source;
+			source = (int8 *)source + 1;
+		}
+	}
+	else
+	{
+		ret += n - 1;
+		source = (int8*)source + n - 1;
+		while (n--)
+		{
+			*ret-- = *(int8*)source;
+			source = (int8*)source -1;
+		}
+	}
+	return dest;
+}
+
+static uint16 ref_sp_crc16_with_init(uint16 crc, const uint8 *buf, uint8 size)
+{
+	unsigned char i;
+
+	while(size--!=0)
+	{
+		for(i = 0x80; i != 0; i>>=1)
+		{
+			if((crc&0x8000) != 0)
+			{
+				crc <<= 1;
+				crc ^= 0x1021;
+			}
+			else
+			{
+				crc <<= 1;
+			}
+			if(((*buf)&i)!=0)
+			{
+				crc ^= 0x1021;
+			}
+		}
+		buf++;
+	}
+	return(crc);
+}
+
+static uint8 ref_bcd2bin(uint8 val)
+{
+	uint8 bin = 0;
+	while(val >= 0x10)
+	{
+		val -= 0x10;
+		bin += 10;
+	}
+	bin += val;
+	return(bin);
+}
+
+static uint8 ref_bin2bcd(uint8 val)
+{
+	uint8 bcd = 0 ;
+	while(val >= 10)
+	{
+		val -= 10;
+		bcd+= 0x10;
+	}
+	bcd += val;
+	return(bcd);
+}
+
+static void ref_numeric2bcd(uint32 value, uint8 *bcd, uint8 bytes)
+{
+	uint8 x;
+	if(bytes > 5)
+	{
+		bytes = 5;
+	}
+	while(bytes--)
+	{
+		x = value % 100u;
+		*bcd = ((x/10u)<<4) + (x%10u);
+		bcd++;
+		value /= 100u;
+	}
+}
+
+static uint32 ref_bcd2numeric(uint8 *bcd, uint8 bytes)
+{
+	uint32 ret = 0;
+	if(bytes > 4)
+	{
+		bytes = 4;
+	}
+	while (bytes-- > 0)
+	{
+		ret *= 100u;
+		ret += ref_bcd2bin(bcd[bytes]);
+	}
+	return ret;
+}
+
+static uint8 src[BUF_LEN + 16], a[BUF_LEN + 16], b[BUF_LEN + 16];
+
+static void fill(uint8 *p, uint32 n)
+{
+	while(n--)
+		*p++ = (uint8)host_rand();
+}
+
+/* sums, crc and compares over every length and start alignment */
+static void check_scan(void)
+{
+	uint32 len, off, pos;
+	uint8 v;
+
+	fill(src, sizeof(src));
+	for(off = 0; off < 8; off++){
+		for(len = 0; len < 256; len++){
+			CHECK(checksum(src + off, len) == ref_checksum(src + off, len));
+			CHECK(sum(src + off, len) == ref_checksum(src + off, len));
+			CHECK(sp_crc16_with_init(0x0000, src + off, len) == ref_sp_crc16_with_init(0x0000, src + off, len));
+			CHECK(sp_crc16_with_init(0xFFFF, src + off, len) == ref_sp_crc16_with_init(0xFFFF, src + off, len));
+
+			memcpy(a, src, sizeof(a));
+			CHECK(memcmp_my(a + off, src + off, len) == ref_memcmp_my(a + off, src + off, len));
+			if(len){
+				pos = off + host_rand() % len;
+				a[pos] ^= 1 + host_rand() % 255;
+				CHECK(memcmp_my(a + off, src + off, len) == 1);
+				CHECK(ref_memcmp_my(a + off, src + off, len) == 1);
+			}
+
+			v = (uint8)host_rand();
+			memset(a, v, sizeof(a));
+			CHECK(is_all_xx(a + off, v, len) == 1);
+			if(len){
+				a[off + host_rand() % len] = v ^ 0x80;
+				CHECK(is_all_xx(a + off, v, len) == ref_is_all_xx(a + off, v, len));
+				CHECK(is_all_xx(a + off, v, len) == 0);
+			}
+		}
+	}
+	/* all ones, so a word-wise sum has every carry to get right */
+	memset(a, 0xFF, sizeof(a));
+	for(len = 0; len < 256; len++)
+		CHECK(sum(a + 1, len) == ref_checksum(a + 1, len));
+}
+
+/* copies, moves and fills for every length and every pair of alignments, nothing else touched */
+static void check_copy(void)
+{
+	uint32 len, so, d;
+
+	fill(src, sizeof(src));
+	for(so = 0; so < 8; so++){
+		for(d = 0; d < 8; d++){
+			for(len = 0; len < 256; len++){
+				memset(a, 0x5A, sizeof(a));
+				memset(b, 0x5A, sizeof(b));
+				mymemcpy(a + d, src + so, len);
+				ref_mymemcpy(b + d, src + so, len);
+				CHECK(!memcmp(a, b, sizeof(a)));
+
+				memset(a, 0x5A, sizeof(a));
+				memset(b, 0x5A, sizeof(b));
+				CHECK(memmove_my(a + d, src + so, len) == a + d);
+				ref_memmove_my(b + d, src + so, len);
+				CHECK(!memcmp(a, b, sizeof(a)));
+
+				if(len){
+					memset(a, 0x5A, sizeof(a));
+					memset(b, 0x5A, sizeof(b));
+					memset_my(a + d, (uint8)len, len);
+					ref_memset_my(b + d, (uint8)len, len);
+					CHECK(!memcmp(a, b, sizeof(a)));
+				}
+			}
+		}
+	}
+	memset(a, 0x5A, sizeof(a));
+	memset_my(a + 1, 0x00, 0);
+	CHECK(is_all_xx(a, 0x5A, sizeof(a)));
+}
+
+/* overlapping moves both ways, as set_parameter() and read_parameter() do inside g_frame_buffer */
+static void check_overlap(void)
+{
+	uint32 len, shift, so;
+
+	for(so = 16; so < 24; so++){
+		for(shift = 1; shift < 16; shift++){
+			for(len = 0; len < 256; len += 1 + (len >> 4)){
+				fill(a, sizeof(a));
+				memcpy(b, a, sizeof(a));
+				memmove_my(a + so + shift, a + so, len);
+				ref_memmove_my(b + so + shift, b + so, len);
+				CHECK(!memcmp(a, b, sizeof(a)));
+				memmove_my(a + so - shift, a + so, len);
+				ref_memmove_my(b + so - shift, b + so, len);
+				CHECK(!memcmp(a, b, sizeof(a)));
+
+				/* the old mymemcpy() was right only copying down, now it is right both ways */
+				fill(a, sizeof(a));
+				memcpy(b, a, sizeof(a));
+				mymemcpy(a + so - shift, a + so, len);
+				ref_mymemcpy(b + so - shift, b + so, len);
+				CHECK(!memcmp(a, b, sizeof(a)));
+				memcpy(b, a, sizeof(a));
+				mymemcpy(a + so + shift, a + so, len);
+				memmove(b + so + shift, b + so, len);
+				CHECK(!memcmp(a, b, sizeof(a)));
+			}
+		}
+	}
+}
+
+/* lengths the uint8 versions could not take, against them chained over 255 byte pieces */
+static void check_long(void)
+{
+	uint32 len, off, done, n;
+	uint16 crc;
+	uint8 cs;
+
+	fill(src, sizeof(src));
+	for(len = 256; len <= BUF_LEN; len += 1 + host_rand() % 97){
+		off = host_rand() % 8;
+		cs = 0;
+		crc = 0xFFFF;
+		for(done = 0; done < len; done += n){
+			n = (len - done > 255) ? 255 : len - done;
+			cs += ref_checksum(src + off + done, n);
+			crc = ref_sp_crc16_with_init(crc, src + off + done, n);
+		}
+		CHECK(sum(src + off, len) == cs);
+		CHECK(checksum(src + off, len) == cs);
+		CHECK(sp_crc16_with_init(0xFFFF, src + off, len) == crc);
+
+		memset(a, 0x5A, sizeof(a));
+		memset_my(a + off, 0xC3, len);
+		CHECK(is_all_xx(a + off, 0xC3, len) && !is_all_xx(a + off, 0xC3, len + 1));
+		CHECK(a[off + len] == 0x5A && (!off || a[off - 1] == 0x5A));
+		mymemcpy(a + off, src + off, len);
+		CHECK(!memcmp_my(a + off, src + off, len));
+	}
+	/* all ones again, long enough for the word-wise sum to fill its lanes */
+	memset(a, 0xFF, sizeof(a));
+	for(len = 256; len <= BUF_LEN; len++)
+		CHECK(sum(a + (len & 3), len) == (uint8)(0 - len));
+}
+
+static void check_bcd(void)
+{
+	uint32 v, i, n;
+	uint8 x[8], y[8];
+
+	for(v = 0; v < 256; v++){
+		CHECK(bcd2bin((uint8)v) == ref_bcd2bin((uint8)v));
+		CHECK(bin2bcd((uint8)v) == ref_bin2bcd((uint8)v));
+	}
+	for(i = 0; i < 200000; i++){
+		switch(i % 4){
+		case 0: v = host_rand(); break;
+		case 1: v = host_rand() % 100000000u; break;
+		case 2: v = i; break;
+		default: v = 0xFFFFFFFFu - i; break;
+		}
+		n = i % 8;
+		memset(x, 0xEE, sizeof(x));
+		memset(y, 0xEE, sizeof(y));
+		numeric2bcd(v, x, (uint8)n);
+		ref_numeric2bcd(v, y, (uint8)n);
+		CHECK(!memcmp(x, y, sizeof(x)));
+		CHECK(bcd2numeric(x, (uint8)n) == ref_bcd2numeric(y, (uint8)n));
+
+		fill(x, sizeof(x));			//not even BCD
+		CHECK(bcd2numeric(x, (uint8)n) == ref_bcd2numeric(x, (uint8)n));
+	}
+}
+
+static volatile uint32 sink;
+
+static void bench(uint32 len)
+{
+	uint32 i, rounds = 4000000 / len;
+	double t[8];
+
+	fill(src, len + 8);
+	t[0] = host_now_us();
+	for(i = 0; i < rounds; i++)
+		sink += ref_checksum(src + (i & 3), len);
+	t[1] = host_now_us();
+	for(i = 0; i < rounds; i++)
+		sink += sum(src + (i & 3), len);
+	t[2] = host_now_us();
+	for(i = 0; i < rounds; i++)
+		sink += ref_sp_crc16_with_init(0xFFFF, src + (i & 3), len);
+	t[3] = host_now_us();
+	for(i = 0; i < rounds; i++)
+		sink += sp_crc16_with_init(0xFFFF, src + (i & 3), len);
+	t[4] = host_now_us();
+	for(i = 0; i < rounds; i++){
+		ref_mymemcpy(a + (i & 3), src, len);
+		sink += a[len >> 1];
+	}
+	t[5] = host_now_us();
+	for(i = 0; i < rounds; i++){
+		mymemcpy(a + (i & 3), src, len);
+		sink += a[len >> 1];
+	}
+	t[6] = host_now_us();
+
+#define NS(k)	((t[k + 1] - t[k]) * 1e3 / rounds / len)
+	printf("  %3u bytes  sum %5.2f -> %5.2f  crc16 %5.2f -> %5.2f  copy %5.2f -> %5.2f ns/byte\n",
+	       len, NS(0), NS(1), NS(2), NS(3), NS(4), NS(5));
+#undef NS
+}
+
+int main(void)
+{
+	printf("comfunc against the old byte loops:\n");
+	host_srand(31);
+	check_scan();
+	check_copy();
+	check_overlap();
+	check_long();
+	check_bcd();
+
+	printf("old -> new on this host:\n");
+	bench(12);			//SHS header and a short infor
+	bench(40);			//OTA_BLK_SZ
+	bench(255);
+
+	return host_result("test_comfunc");
+}
@@ -0,0 +1,285 @@
+#include <string.h>
+#include "device.h"
+#include "rtl8195a.h"
+#include "flash_api.h"
+#include "host.h"
+
+extern SPIC_INIT_PARA SpicInitParaAllClk[3][CPU_CLK_TYPE_NO];
+
+/*
+ * flash_api.c against the NOR model in host_flash.c: flash_stream_write() leaves the same flash
+ * behind as the word at a time loop it replaced, for any head, tail, length and source alignment,
+ * no page program runs past a page or starts before the last one is done, reads and the RAM cache
+ * see every write and erase, and what the page programs save for the sizes the callers write.
+ */
+
+#define AREA		0x10000			//where the random writes land
+#define MAX_LEN		1100
+
+static u8 before[AREA + 8];
+static u8 want[AREA + 8];
+
+/* flash_stream_write() as the SDK had it, one word program and WIP wait at a time */
+static void ref_wait(flash_t *obj, u8 flashtype)
+{
+	SpicWaitBusyDoneRtl8195A();
+	if(flashtype == FLASH_MICRON)
+		SpicWaitOperationDoneRtl8195A(obj->SpicInitPara);
+	else
+		SpicWaitWipDoneRefinedRtl8195A(obj->SpicInitPara);
+}
+
+static void ref_stream_write(flash_t *obj, u32 address, u32 len, u8 *data)
+{
+	u32 offset_to_align, align_addr, i, write_word;
+	u8 *ptr, *pbuf = data;
+	u8 flashtype;
+
+	SpicFlashInitRtl8195A(SpicOneBitMode);
+	obj->SpicInitPara.flashtype = SpicInitParaAllClk[SpicOneBitMode][0].flashtype;
+	flashtype = obj->SpicInitPara.flashtype;
+	offset_to_align = address & 0x03;
+	if(offset_to_align != 0){
+		align_addr = address - offset_to_align;
+		write_word = HAL_READ32(SPI_FLASH_BASE, align_addr);
+		ptr = (u8 *)&write_word + offset_to_align;
+		offset_to_align = 4 - offset_to_align;
+		for(i = 0; i < offset_to_align; i++){
+			*(ptr + i) = *pbuf++;
+			if(--len == 0)
+				break;
+		}
+		HAL_WRITE32(SPI_FLASH_BASE, align_addr, write_word);
+		ref_wait(obj, flashtype);
+	}
+	address = (((address - 1) >> 2) + 1) << 2;
+	while(len >= 4){
+		write_word = pbuf[0] | (pbuf[1] << 8) | (pbuf[2] << 16) | ((u32)pbuf[3] << 24);
+		HAL_WRITE32(SPI_FLASH_BASE, address, write_word);
+		ref_wait(obj, flashtype);
+		pbuf += 4;
+		address += 4;
+		len -= 4;
+	}
+	if(len > 0){
+		write_word = HAL_READ32(SPI_FLASH_BASE, address);
+		ptr = (u8 *)&write_word;
+		for(i = 0; i < len; i++)
+			*(ptr + i) = *pbuf++;
+		HAL_WRITE32(SPI_FLASH_BASE, address, write_word);
+		ref_wait(obj, flashtype);
+	}
+	SpicDisableRtl8195A();
+}
+
+/* units of size unit that [start, end) touches */
+static u32 spans(u32 start, u32 end, u32 unit)
+{
+	return (end > start) ? (end - 1) / unit - start / unit + 1 : 0;
+}
+
+/* some bits already programmed, the way a record area looks between erases */
+static void scribble(void)
+{
+	u32 i;
+
+	for(i = 0; i < AREA + 8; i++)
+		host_flash[i] = (host_rand() & 3) ? 0xFF : (u8)host_rand();
+}
+
+static void check_stream_write(u8 flashtype)
+{
+	static u8 src[MAX_LEN + 8], sector[0x1000];
+	u32 i, k, addr, len, skew, head, mid, tail, pages, unit;
+
+	host_flash_reset(flashtype);
+	for(i = 0; i < 3000; i++){
+		addr = host_rand() % (AREA - MAX_LEN);
+		switch(host_rand() % 3){
+		case 0:  len = 1 + host_rand() % 12; break;
+		case 1:  len = 1 + host_rand() % 300; break;
+		default: len = 1 + host_rand() % MAX_LEN; break;
+		}
+		skew = host_rand() % 4;
+		for(k = 0; k < len; k++)
+			src[skew + k] = (u8)host_rand();
+		if(!(i % 64))
+			scribble();
+
+		/* the reference run */
+		memcpy(before, host_flash, sizeof(before));
+		ref_stream_write(&flash, addr, len, src + skew);
+		memcpy(want, host_flash, sizeof(want));
+		for(k = 0; k < len; k++)
+			CHECK(want[addr + k] == (before[addr + k] & src[skew + k]));
+
+		memcpy(host_flash, before, sizeof(before));
+		memset(&host_flash_ops, 0, sizeof(host_flash_ops));
+		CHECK(flash_stream_write(&flash, addr, len, src + skew) == 1);
+		CHECK(!memcmp(host_flash, want, sizeof(want)));
+
+		/* a word program each for a split head and tail, page programs in between */
+		head = (addr & 3) ? 4 - (addr & 3) : 0;
+		if(head > len)
+			head = len;
+		mid = (len - head) & ~3;
+		tail = (len - head) & 3;
+		unit = ((uintptr_t)(src + skew + head) & 3) ? 32 : 256;
+		pages = spans(addr + head, addr + head + mid, unit);
+		CHECK(host_flash_ops.word_programs == (head != 0) + (tail != 0));
+		CHECK(host_flash_ops.page_programs == pages);
+		CHECK(host_flash_ops.program_bytes == (head ? 4 : 0) + mid + (tail ? 4 : 0));
+		CHECK(host_flash_ops.page_crossings == 0 && host_flash_ops.unaligned == 0);
+		CHECK(host_flash_ops.busy_faults == 0);
+		CHECK(host_flash_ops.waits == host_flash_ops.word_programs + host_flash_ops.page_programs);
+		CHECK(host_flash_ops.micron_waits == ((flashtype == FLASH_MICRON) ? host_flash_ops.waits : 0));
+	}
+
+	/* the alias the older callers use, a whole aligned page at once and a whole sector */
+	memcpy(before, host_flash, sizeof(before));
+	memset(&host_flash_ops, 0, sizeof(host_flash_ops));
+	CHECK(flash_burst_write(&flash, 0x200, 256, src + 4) == 1);
+	CHECK(host_flash_ops.page_programs == 1 && host_flash_ops.word_programs == 0);
+	for(k = 0; k < 256; k++)
+		CHECK(host_flash[0x200 + k] == (before[0x200 + k] & src[4 + k]));
+
+	flash_erase_sector(&flash, 0x3000);
+	memset(&host_flash_ops, 0, sizeof(host_flash_ops));
+	memset(sector, 0x5A, sizeof(sector));
+	flash_stream_write(&flash, 0x3000, sizeof(sector), sector);
+	CHECK(host_flash_ops.page_programs == 0x1000 / 256 && host_flash_ops.busy_faults == 0);
+	for(k = 0; k < 0x1000; k++)
+		CHECK(host_flash[0x3000 + k] == 0x5A);
+}
+
+/* reads and the word calls against the array itself */
+static void check_read(void)
+{
+	u8 dst[MAX_LEN + 8];
+	u32 i, addr, len, skew, word;
+
+	host_flash_reset(0);
+	scribble();
+	for(i = 0; i < 3000; i++){
+		addr = host_rand() % (AREA - MAX_LEN);
+		len = 1 + host_rand() % ((i & 1) ? 16 : MAX_LEN);
+		skew = host_rand() % 4;
+		memset(dst, 0xEE, sizeof(dst));
+		CHECK(flash_stream_read(&flash, addr, len, dst + skew) == 1);
+		CHECK(!memcmp(dst + skew, &host_flash[addr], len));
+		CHECK(dst[skew + len] == 0xEE && (!skew || dst[skew - 1] == 0xEE));
+	}
+
+	flash_erase_sector(&flash, 0x1234);
+	CHECK(flash_write_word(&flash, 0x1230, 0x12345678) == 1);
+	CHECK(flash_read_word(&flash, 0x1230, &word) == 1 && word == 0x12345678);
+	CHECK(flash_read_word(&flash, 0x1000, &word) == 1 && word == 0xFFFFFFFF);
+	CHECK(host_flash_ops.busy_faults == 0);
+}
+
+/* the RAM cache has to hand out what the flash holds after every write and erase */
+static void check_cache(void)
+{
+	flash_cache_stats_t st0, st1;
+	u8 a[200], b[200], src[128];
+	u32 i;
+
+	host_flash_reset(0);
+	scribble();
+	flash_cache_invalidate(0, HOST_FLASH_SIZE);
+	flash_cache_get_stats(&st0);
+
+	CHECK(flash_cached_read(&flash, 0x2010, 40, a) == 1);
+	CHECK(flash_cached_read(&flash, 0x2010, 40, b) == 1);
+	CHECK(!memcmp(a, &host_flash[0x2010], 40) && !memcmp(b, a, 40));
+	flash_cache_get_stats(&st1);
+	CHECK(st1.miss - st0.miss == 1 && st1.hit - st0.hit == 1);
+
+	/* a write over the cached line */
+	for(i = 0; i < sizeof(src); i++)
+		src[i] = (u8)host_rand();
+	flash_stream_write(&flash, 0x2021, 7, src);
+	CHECK(flash_cached_read(&flash, 0x2010, 40, a) == 1);
+	CHECK(!memcmp(a, &host_flash[0x2010], 40));
+
+	/* a word write, then an erase of the whole sector */
+	flash_cached_read(&flash, 0x2040, 8, a);
+	flash_write_word(&flash, 0x2044, 0);
+	flash_cached_read(&flash, 0x2040, 8, a);
+	CHECK(!memcmp(a, &host_flash[0x2040], 8) && a[4] == 0);
+	flash_erase_sector(&flash, 0x2000);
+	flash_cached_read(&flash, 0x2010, 40, a);
+	flash_cached_read(&flash, 0x2040, 8, b);
+	for(i = 0; i < 40; i++)
+		CHECK(a[i] == 0xFF);
+	for(i = 0; i < 8; i++)
+		CHECK(b[i] == 0xFF);
+
+	/* long reads go past the cache */
+	flash_cache_get_stats(&st0);
+	CHECK(flash_cached_read(&flash, 0x4000, sizeof(a), a) == 1);
+	CHECK(!memcmp(a, &host_flash[0x4000], sizeof(a)));
+	flash_cache_get_stats(&st1);
+	CHECK(st1.bypass - st0.bypass == 1 && st1.miss == st0.miss);
+	CHECK(host_flash_ops.busy_faults == 0);
+	CHECK(host_primask == 0);
+}
+
+/*
+ * Program commands and WIP waits per KB for the sizes the callers write, and the chip time they
+ * cost with W25Q32 typicals: 30 us for the first byte of a program, 2.5 us for every one after.
+ */
+static double program_us(u32 commands, u32 bytes)
+{
+	return commands * 30.0 + (bytes - commands) * 2.5;
+}
+
+static void bench(void)
+{
+	static u8 src[4096];
+	static const struct { const char *what; u32 len; } sizes[] = {
+		{"kv record", 12}, {"history record", 40}, {"timer table", 256},
+		{"OTA chunk", 1460}, {"sector", 4096},
+	};
+	host_flash_stats ref, now;
+	u32 i, k, n, addr, rounds = 64;
+
+	for(i = 0; i < sizeof(src); i++)
+		src[i] = (u8)host_rand();
+	printf("  %-14s %5s  %16s  %16s  %s\n", "", "bytes", "word path /KB", "page path /KB", "program time");
+	for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++){
+		host_flash_reset(0);
+		for(addr = 0, k = 0; k < rounds; k++, addr += sizes[i].len)
+			ref_stream_write(&flash, addr, sizes[i].len, src);
+		ref = host_flash_ops;
+
+		host_flash_reset(0);
+		for(addr = 0, k = 0; k < rounds; k++, addr += sizes[i].len)
+			flash_stream_write(&flash, addr, sizes[i].len, src);
+		now = host_flash_ops;
+
+		n = ref.word_programs;
+		k = now.word_programs + now.page_programs;
+		CHECK(now.waits == k && ref.waits == n && now.busy_faults == 0);
+		printf("  %-14s %5u  %6.0f commands  %6.1f commands  %.1f ms -> %.1f ms per KB\n",
+		       sizes[i].what, sizes[i].len, n * 1024.0 / (rounds * sizes[i].len),
+		       k * 1024.0 / (rounds * sizes[i].len),
+		       program_us(n, ref.program_bytes) / 1e3 * 1024 / (rounds * sizes[i].len),
+		       program_us(k, now.program_bytes) / 1e3 * 1024 / (rounds * sizes[i].len));
+		if(sizes[i].len >= 256)
+			CHECK(k * 16 < n);
+	}
+}
+
+int main(void)
+{
+	printf("flash page program:\n");
+	host_srand(23);
+	check_stream_write(0);
+	check_stream_write(FLASH_MICRON);
+	check_read();
+	check_cache();
+	bench();
+
+	return host_result("test_flash");
+}
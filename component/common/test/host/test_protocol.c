@@ -0,0 +1,242 @@
+#include <string.h>
+#include "other/outlet/outlet.h"
+#include "protocol.h"
+#include "host.h"
+
+extern outlet_state outletstateA;
+
+/*
+ * The func_items[] dispatch of set_parameter(), read_parameter() and set_group_parameter().
+ * Every 16 bit did goes through both and the outcome is held against a linear walk of the
+ * table, then the per-item acks of mixed frames, group frames and the cost of a lookup.
+ * The frames sit in g_frame_buffer as they do on the device, read_parameter() sizes its
+ * replies against it.
+ */
+
+/* every did the outlet firmware answers, in the order func_items[] has to keep them */
+static const uint16 outlet_dids[] = {
+	0x0001, 0x0002, 0x0003, 0x0005, 0x0006, 0x0007,
+	DID_METQUA, 0x9400, DID_THRVOL, DID_THRCUR, DID_THRPOW, DID_METER,
+	0xB624, 0xC005, 0xC011, DID_ONOFF,
+};
+#define ITEMS		ARRAY_SIZE(outlet_dids)
+
+#define INFOR		(&g_frame_buffer[SHS_FRAME_HEAD + 1])
+
+static const struct func_ops *ref_find(uint16 did)
+{
+	uint32 i;
+
+	for(i = 0; i < ITEMS; i++)
+		if(func_items[i].did == did)
+			return &func_items[i];
+	return NULL;
+}
+
+static uint8 put_item(uint8 *p, uint16 did, uint8 len, uint8 fill)
+{
+	p[0] = (uint8)did;
+	p[1] = (uint8)(did >> 8);
+	p[2] = len;
+	memset(&p[FBD_FRAME_HEAD], fill, len);
+	if(len)
+		p[FBD_FRAME_HEAD] = 0x01;		//channel A for the outlet items
+	return FBD_FRAME_HEAD + len;
+}
+
+/* did, 0x82, code, 0x00 */
+static int is_err(const uint8 *p, uint16 did, uint8 code)
+{
+	return (p[0] == (uint8)did) && (p[1] == (uint8)(did >> 8)) && (p[2] == 0x82) &&
+	       (p[3] == code) && (p[4] == 0x00);
+}
+
+static void check_table(void)
+{
+	uint32 i;
+
+	for(i = 0; i < ITEMS; i++){
+		CHECK(func_items[i].did == outlet_dids[i]);
+		if(i)
+			CHECK(func_items[i - 1].did < func_items[i].did);
+		CHECK(func_items[i].min_len <= func_items[i].max_len);
+		CHECK(func_items[i].max_len <= 0x7F);
+		CHECK(func_items[i].read || func_items[i].write);
+	}
+}
+
+/* one item frames for all 65536 dids, the ack has to say what the table says */
+static void check_every_did(void)
+{
+	const struct func_ops *item;
+	uint32 did, handled = 0, refused = 0;
+	uint8 len, n;
+
+	for(did = 0; did <= 0xFFFF; did++){
+		item = ref_find((uint16)did);
+
+		len = (item && item->write) ? item->min_len : 0;
+		n = set_parameter(INFOR, put_item(INFOR, (uint16)did, len, 0x00));
+		if(item && item->write){
+			CHECK((n == FBD_FRAME_HEAD + len) && (INFOR[2] == len));
+			handled++;
+		} else {
+			CHECK((n == 5) && is_err(INFOR, (uint16)did, DID_ERR));
+			refused++;
+		}
+
+		memset(INFOR, 0xEE, 16);
+		n = read_parameter(INFOR, put_item(INFOR, (uint16)did, 0, 0x00));
+		if(item && item->read)
+			CHECK((n == 0) || !is_err(INFOR, (uint16)did, DID_ERR));
+		else
+			CHECK((n == 5) && is_err(INFOR, (uint16)did, DID_ERR));
+	}
+	printf("  65536 dids: %u written, %u refused with DID_ERR\n", handled, refused);
+	CHECK(handled == 10);
+	CHECK(host_resets == 1);		//0xC005 went through once
+}
+
+/* write data outside min_len..max_len never reaches the handler */
+static void check_lengths(void)
+{
+	const struct func_ops *item;
+	uint32 i;
+	uint8 n;
+
+	for(i = 0; i < ITEMS; i++){
+		item = &func_items[i];
+		if(!item->write)
+			continue;
+		host_app_reset();
+		if(item->min_len){
+			n = set_parameter(INFOR, put_item(INFOR, item->did, item->min_len - 1, 0x00));
+			CHECK((n == 5) && is_err(INFOR, item->did, DATA_ERR));
+		}
+		if(item->max_len < 0x7F){
+			n = set_parameter(INFOR, put_item(INFOR, item->did, item->max_len + 1, 0x00));
+			CHECK((n == 5) && is_err(INFOR, item->did, DATA_ERR));
+		}
+		CHECK(host_notify_num == 0 && host_resets == 0 && host_hisdata_num == 0);
+	}
+}
+
+/* several items in one frame get one ack each, in order, a cut off one ends the frame with LEN_ERR */
+static void check_mixed_frame(void)
+{
+	uint8 *p = INFOR;
+	uint8 len = 0, n;
+	const uint8 want[] = {
+		0x12, 0xC0, 0x02, 0x01, 0x01,					//on/off echoed
+		0x34, 0x12, 0x82, DID_ERR, 0x00,
+		0x3F, 0xB5, 0x82, DATA_ERR, 0x00,
+		0x01, 0x00, 0x82, DID_ERR, 0x00,				//read only
+		0x30, 0xB5, 0x82, LEN_ERR, 0x00,
+	};
+
+	host_app_reset();
+	len += put_item(p + len, DID_ONOFF, 2, 0x01);
+	len += put_item(p + len, 0x1234, 1, 0x00);
+	len += put_item(p + len, DID_METER, 9, 0x00);
+	len += put_item(p + len, 0x0001, 0, 0x00);
+	len += put_item(p + len, DID_THRPOW, 4, 0x00) - 2;	//two bytes short
+	n = set_parameter(p, len);
+	CHECK(n == sizeof(want) && !memcmp(p, want, n));
+	CHECK(outletstateA.on == 1);
+	CHECK(host_notify_num == 1);
+
+	/* the same for reads: device type and soft version answered, the rest refused */
+	len = 0;
+	len += put_item(p + len, 0x0001, 0, 0x00);
+	len += put_item(p + len, DID_ONOFF, 0, 0x00);
+	len += put_item(p + len, 0x0002, 0, 0x00);
+	len += put_item(p + len, 0x0003, 2, 0x00) - 2;
+	n = read_parameter(p, len);
+	CHECK(n == (FBD_FRAME_HEAD + 8) + 5 + (FBD_FRAME_HEAD + 14) + 5);
+	CHECK(p[0] == 0x01 && p[1] == 0x00 && p[2] == 8);
+	CHECK(is_err(p + FBD_FRAME_HEAD + 8, DID_ONOFF, DID_ERR));
+	p += FBD_FRAME_HEAD + 8 + 5;
+	CHECK(p[0] == 0x02 && p[1] == 0x00 && p[2] == 14 && !memcmp(&p[3], "EASTSOFT(v1.0)", 14));
+	CHECK(is_err(p + FBD_FRAME_HEAD + 14, 0x0003, LEN_ERR));
+}
+
+/* group frames: every group item runs once, unless the table keeps it out of groups */
+static void check_group(void)
+{
+	uint8 *p = INFOR;
+	uint8 len = 0;
+
+	host_app_reset();
+	eep_param.sid[0] = 0x05;
+	eep_param.sid[1] = 0x00;
+
+	p[len++] = 0x41;				//one byte group ids, one of them
+	p[len++] = 0x00;				//everyone
+	len += put_item(p + len, 0xC005, 0, 0x00);
+	p[len++] = 0x41;
+	p[len++] = 0x05;
+	len += put_item(p + len, DID_ONOFF, 2, 0x01);
+	p[len++] = 0x41;
+	p[len++] = 0x06;				//someone else
+	len += put_item(p + len, DID_THRPOW, 4, 0x00);
+	p[len++] = 0x41;
+	p[len++] = 0x00;
+	len += put_item(p + len, DID_METER, 3, 0x00);	//wrong length
+
+	set_group_parameter(p, len);
+	CHECK(host_resets == 0);
+	CHECK(outletstateA.on == 1);
+	CHECK(host_notify_num == 1);
+	CHECK(host_hisdata_num == 0);
+}
+
+/*
+ * Lookups only: reads of unknown dids and of write-only items, so no handler runs. A refusal
+ * is longer than the request, the frame is kept small enough for the ack to fit in front of it.
+ */
+static void bench(void)
+{
+	uint8 frame[20 * FBD_FRAME_HEAD];
+	uint8 len = 0, n = 0;
+	uint32 i, k, rounds = 200000, hits = 0;
+	uint16 did;
+	double t0, t1, t2;
+
+	while(len < sizeof(frame)){
+		did = outlet_dids[host_rand() % ITEMS];
+		if((host_rand() & 1) || ref_find(did)->read)
+			did = (uint16)host_rand();
+		len += put_item(frame + len, did, 0, 0x00);
+		n++;
+	}
+
+	t0 = host_now_us();
+	for(i = 0; i < rounds; i++){
+		memcpy(INFOR, frame, len);
+		read_parameter(INFOR, len);
+	}
+	t1 = host_now_us();
+	for(i = 0; i < rounds; i++)
+		for(k = 0; k < n; k++)
+			hits += ref_find(frame[k * FBD_FRAME_HEAD] | (frame[k * FBD_FRAME_HEAD + 1] << 8)) != NULL;
+	t2 = host_now_us();
+
+	printf("  read_parameter: %.1f ns per item, %u items a frame\n", (t1 - t0) * 1e3 / rounds / n, n);
+	printf("  linear walk of the table for comparison: %.1f ns per lookup (%u hits)\n",
+	       (t2 - t1) * 1e3 / rounds / n, hits / rounds);
+}
+
+int main(void)
+{
+	printf("did dispatch:\n");
+	host_srand(21);
+	check_table();
+	host_app_reset();
+	check_every_did();
+	check_lengths();
+	check_mixed_frame();
+	check_group();
+	bench();
+
+	return host_result("test_protocol");
+}
@@ -0,0 +1,268 @@
+#include <stdlib.h>
+#include <string.h>
+#include "rx_ring.h"
+#include "uart_socket.h"
+#include "protocol.h"
+#include "host.h"
+
+/*
+ * rx_ring on its own, then the rx DMA side of uart_socket on top of it: how many transfers a
+ * frame costs, a header that stops halfway, a transfer left in rx_spill, and a full ring.
+ */
+
+#define FRAME_LEN(len)		(SHS_FRAME_HEAD + (len) + 1)
+#define RING_LEN			64
+
+static uart_socket_t *u;
+
+static u32 make_frame(u8 *f, u8 seq, u8 len)
+{
+	u32 i;
+
+	f[0] = STC;
+	for(i = 1; i < SHS_FRAME_HEAD - 2; i++)
+		f[i] = (u8)(0x10 + i);
+	f[SHS_FRAME_HEAD - 2] = seq;
+	f[SHS_FRAME_HEAD - 1] = len;
+	for(i = 0; i < len; i++)
+		f[SHS_FRAME_HEAD + i] = (u8)(seq + i);
+	f[FRAME_LEN(len) - 1] = sum(f, FRAME_LEN(len) - 1);
+	return FRAME_LEN(len);
+}
+
+/* the ring against a plain FIFO, from counters just short of wrapping, by bytes and by spans */
+static void check_ring_model(u32 start)
+{
+	static u8 model[1 << 16];
+	rx_ring_t r;
+	u8 buf[RING_LEN], tmp[RING_LEN], *p;
+	u32 in = 0, out = 0, lost = 0, i, n, m;
+
+	rx_ring_init(&r, buf, sizeof(buf));
+	r.head = r.tail = r.gap = start;
+
+	for(i = 0; i < 20000; i++){
+		switch(host_rand() % 4){
+		case 0:
+			n = host_rand() % 8;
+			while(n--){
+				model[in % sizeof(model)] = (u8)host_rand();
+				if(rx_ring_put(&r, model[in % sizeof(model)]))
+					in++;
+				else
+					lost++;
+				CHECK(in - out <= RING_LEN);
+			}
+			break;
+		case 1:
+			n = rx_ring_write_span(&r, &p);
+			CHECK(n <= RING_LEN - (in - out));
+			CHECK(p + n <= buf + RING_LEN);
+			n = n ? host_rand() % (n + 1) : 0;
+			for(m = 0; m < n; m++){
+				model[in % sizeof(model)] = (u8)host_rand();
+				p[m] = model[in++ % sizeof(model)];
+			}
+			rx_ring_produce(&r, n);
+			break;
+		case 2:
+			m = host_rand() % (RING_LEN + 1);
+			n = rx_ring_peek_span(&r, m, &p);
+			CHECK(p + n <= buf + RING_LEN || !n);
+			CHECK((m >= in - out) ? !n : (n && n <= in - out - m));
+			for(; n; n--, m++)
+				CHECK(*p++ == model[(out + m) % sizeof(model)]);
+			break;
+		default:
+			n = rx_ring_read(&r, tmp, host_rand() % 16);
+			for(m = 0; m < n; m++)
+				CHECK(tmp[m] == model[out++ % sizeof(model)]);
+			break;
+		}
+		CHECK(rx_ring_count(&r) == in - out);
+		CHECK(r.head == start + in);
+	}
+	CHECK(r.dropped == lost);
+}
+
+static void check_ring_overrun(void)
+{
+	rx_ring_t r;
+	rx_ring_stats st;
+	u8 buf[RING_LEN], *p;
+	u32 i;
+
+	rx_ring_init(&r, buf, sizeof(buf));
+	r.head = r.tail = 0xFFFFFFF0;
+	for(i = 0; i < RING_LEN + 5; i++)
+		rx_ring_put(&r, (u8)i);
+	CHECK(rx_ring_count(&r) == RING_LEN);
+	CHECK(r.dropped == 5);
+	CHECK(r.gap == r.head);
+	CHECK(rx_ring_write_span(&r, &p) == 0);
+
+	rx_ring_drop(&r, 16);
+	rx_ring_get_stats(&r, &st);
+	CHECK(st.size == RING_LEN && st.count == RING_LEN && st.dropped == 21 && st.peak == RING_LEN);
+	CHECK(st.written == 0xFFFFFFF0 + RING_LEN);
+
+	rx_ring_consume(&r, 10);
+	CHECK(rx_ring_byte(&r, 0) == 10);
+	rx_ring_reset_stats(&r);
+	rx_ring_get_stats(&r, &st);
+	CHECK(st.dropped == 0 && st.peak == RING_LEN - 10);
+	CHECK(host_primask == 0);
+	CHECK(rx_ring_put(&r, 0xEE));
+	CHECK(r.gap != r.head);
+}
+
+static uart_socket_t *open_uart(void)
+{
+	uart_set_str set;
+
+	memset(&set, 0, sizeof(set));
+	set.BaudRate = 9600;
+	set.number = 8;
+	set.StopBits = 1;
+	return uart_open(&set);
+}
+
+/* parse everything waiting, returns the frames; each has to check out */
+static u32 drain(void)
+{
+	struct SHS_frame *f;
+	u32 n = 0, len;
+
+	while((f = uart_get_frame(u)) != NULL){
+		len = FRAME_LEN(f->length);
+		CHECK(sum((u8 *)f, len - 1) == ((u8 *)f)[len - 1]);
+		n++;
+	}
+	return n;
+}
+
+/* back to back frames cost a header and a body transfer each, plus one where the ring wraps */
+static void check_completions(void)
+{
+	u8 f[FRAME_LEN(255)];
+	u32 i, n, frames = 0, bytes = 0, got = 0;
+
+	u = open_uart();
+	for(i = 0; i < 2000; i++){
+		n = make_frame(f, (u8)i, (u8)(1 + host_rand() % 120));
+		host_line_send(f, n);
+		bytes += n;
+		frames++;
+		if(!(i % 4))
+			got += drain();
+	}
+	got += drain();
+
+	printf("  %u frames, %u bytes: %u completions, %.2f per frame, %u aborts\n", frames, bytes,
+	       host_serial.completions, (double)host_serial.completions / frames, host_serial.aborts);
+	CHECK(got == frames);
+	CHECK(host_serial.completions >= 2 * frames);
+	CHECK(host_serial.completions <= 2 * frames + bytes / UART_RECV_BUFFER_LEN + 1);
+	CHECK(host_serial.aborts == 0);
+	CHECK(u->rx.dropped == 0);
+	uart_close(u);
+}
+
+/* a header cut short by the sender is flushed once the line has been quiet, the next frame parses */
+static void check_partial_header(void)
+{
+	u8 f[FRAME_LEN(255)];
+	u32 n;
+
+	u = open_uart();
+	n = make_frame(f, 1, 30);
+	host_line_send(f, 5);
+	CHECK(drain() == 0);
+	CHECK(rx_ring_count(&u->rx) == 0);		//still in the header transfer
+
+	host_ticks += UART_RX_IDLE_POLL + 1000;
+	CHECK(drain() == 0);
+	CHECK(host_serial.aborts >= 1);
+	host_ticks += 1000;
+	CHECK(drain() == 0);
+	CHECK(!u->rx_frame_off && !u->frame.open);
+	CHECK(u->frame.rejected == 1);
+
+	host_line_send(f, n);
+	CHECK(drain() == 1);
+	CHECK(u->rx.dropped == 0);
+	uart_close(u);
+}
+
+/* the ring fills up exactly at a frame end, the header transfer goes to rx_spill and has to come back */
+static void check_spill_rearm(void)
+{
+	u8 f[FRAME_LEN(255)];
+	u32 i, n = 0;
+
+	u = open_uart();
+	for(i = 0; i < UART_RECV_BUFFER_LEN / 64; i++){
+		n = make_frame(f, (u8)i, 64 - FRAME_LEN(0));
+		host_line_send(f, n);
+	}
+	CHECK(rx_ring_count(&u->rx) == UART_RECV_BUFFER_LEN);
+	CHECK(u->rx_dma_buf == u->rx_spill);
+
+	CHECK(drain() == UART_RECV_BUFFER_LEN / 64);
+	CHECK(u->rx_dma_buf != u->rx_spill);
+	n = make_frame(f, 0x40, 20);
+	host_line_send(f, n);
+	CHECK(drain() == 1);
+	CHECK(u->rx.dropped == 0);
+	uart_close(u);
+}
+
+/*
+ * A burst far bigger than the ring while the task is busy: what comes out has to check out, and
+ * once the task keeps up again not a single frame goes missing.
+ */
+static void check_overrun_recovery(void)
+{
+	u8 f[FRAME_LEN(255)];
+	u32 i, n, got;
+
+	u = open_uart();
+	for(i = 0; i < 200; i++){
+		n = make_frame(f, (u8)i, (u8)(host_rand() % 200));
+		host_line_send(f, n);
+	}
+	got = drain();
+	host_ticks += 1000;
+	got += drain();
+	printf("  overrun: %u frames out of 200, %u bytes dropped\n", got, u->rx.dropped);
+	CHECK(u->rx.dropped > 0);
+	CHECK(got > 0 && got < 200);
+
+	got = 0;
+	for(i = 0; i < 50; i++){
+		n = make_frame(f, (u8)i, (u8)(host_rand() % 200));
+		host_line_send(f, n);
+		got += drain();
+	}
+	CHECK(got == 50);
+	uart_close(u);
+}
+
+int main(void)
+{
+	printf("rx ring:\n");
+	host_srand(11);
+	check_ring_model(0);
+	check_ring_model(0xFFFFFFF0);
+	check_ring_model(0x7FFFFFF8);
+	check_ring_overrun();
+
+	printf("uart_socket rx DMA:\n");
+	host_srand(12);
+	check_completions();
+	check_partial_header();
+	check_spill_rearm();
+	check_overrun_recovery();
+
+	return host_result("test_rx_ring");
+}
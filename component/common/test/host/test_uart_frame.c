@@ -0,0 +1,372 @@
+#include <stdlib.h>
+#include <string.h>
+#include "uart_socket.h"
+#include "protocol.h"
+#include "host.h"
+
+/*
+ * uart_get_frame() against a reference scanner over the same byte stream. The reference is the
+ * old get_smart_frame() walk: try every STC, take the frame when its length and checksum fit,
+ * otherwise start again one byte later. The stream reaches the parser through the rx DMA line
+ * model in random pieces, so candidates are split across calls, transfers and the ring end.
+ */
+
+#define FRAME_LEN(len)		(SHS_FRAME_HEAD + (len) + 1)
+
+typedef struct _stream
+{
+	u8 *buf;
+	u32 len;
+	u32 size;
+}stream;
+
+typedef struct _frame_list
+{
+	u8 *buf;
+	u32 used;
+	u32 *end;			//end offset of each frame in buf
+	u32 num;
+	u32 max;
+}frame_list;
+
+static uart_socket_t *u;
+
+static void stream_put(stream *s, const u8 *p, u32 n)
+{
+	if(s->len + n > s->size){
+		s->size = (s->len + n) * 2;
+		s->buf = realloc(s->buf, s->size);
+	}
+	memcpy(s->buf + s->len, p, n);
+	s->len += n;
+}
+
+static void list_add(frame_list *l, const u8 *p, u32 n)
+{
+	if(l->num == l->max){
+		l->max = l->max ? l->max * 2 : 1024;
+		l->end = realloc(l->end, l->max * sizeof(u32));
+		l->buf = realloc(l->buf, l->max * FRAME_LEN(255));
+	}
+	memcpy(l->buf + l->used, p, n);
+	l->used += n;
+	l->end[l->num++] = l->used;
+}
+
+static void list_free(frame_list *l)
+{
+	free(l->buf);
+	free(l->end);
+	memset(l, 0, sizeof(*l));
+}
+
+static int list_equal(const frame_list *a, const frame_list *b)
+{
+	return (a->num == b->num) && (a->used == b->used) && !memcmp(a->buf, b->buf, a->used);
+}
+
+static u32 make_frame(u8 *f, u8 seq, const u8 *infor, u8 len)
+{
+	u32 i;
+
+	f[0] = STC;
+	for(i = 1; i < SHS_FRAME_HEAD - 2; i++)
+		f[i] = (u8)(0x10 + i);
+	f[SHS_FRAME_HEAD - 2] = seq;
+	f[SHS_FRAME_HEAD - 1] = len;
+	memcpy(&f[SHS_FRAME_HEAD], infor, len);
+	f[FRAME_LEN(len) - 1] = sum(f, FRAME_LEN(len) - 1);
+	return FRAME_LEN(len);
+}
+
+static const u8 onoff_meter[] = {
+	CMD_READ,
+	0x12, 0xC0, 0x02, 0x01, 0x01,
+	0x12, 0xC0, 0x02, 0x02, 0x00,
+	0x3F, 0xB5, 0x0A, 0x01, 0x00, 0x00, 0x22, 0x00, 0x50, 0x01, 0x00, 0x75, 0x03, 0x00,
+	0x3F, 0xB5, 0x0A, 0x02, 0x00, 0x00, 0x22, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+static const u8 thrpow[] = {CMD_READ, 0x30, 0xB5, 0x04, 0x01, 0x00, 0x00, 0x22};
+static const u8 hisdata[] = {CMD_NOTIFY, 0x00, 0x94, 0x07, 0x01, 0x16, 0x03, 0x01, 0x12, 0x45, 0x07};
+static const u8 ack[] = {CMD_ACK};
+
+/*
+ * MCU traffic shaped like what smart_plc.c gets back: the batched on/off and meter read of
+ * both channels, one-DID replies, 15 minute history reports and the odd long frame.
+ */
+static u32 mcu_frame(u8 *f, u8 seq)
+{
+	u8 infor[255];
+	u32 i, len;
+
+	switch(host_rand() % 8){
+	case 0: case 1: case 2:
+		return make_frame(f, seq, onoff_meter, sizeof(onoff_meter));
+	case 3:
+		return make_frame(f, seq, thrpow, sizeof(thrpow));
+	case 4:
+		return make_frame(f, seq, hisdata, sizeof(hisdata));
+	case 5:
+		return make_frame(f, seq, ack, sizeof(ack));
+	default:
+		len = host_rand() % 256;
+		for(i = 0; i < len; i++)
+			infor[i] = (u8)host_rand();
+		return make_frame(f, seq, infor, (u8)len);
+	}
+}
+
+/* line noise, STC shows up far more often than on a real line so resync gets exercised */
+static void put_noise(stream *s, u32 n)
+{
+	u8 c;
+
+	while(n--){
+		c = (host_rand() % 6) ? (u8)host_rand() : STC;
+		stream_put(s, &c, 1);
+	}
+}
+
+static void make_traffic(stream *s, u32 frames, int noisy)
+{
+	u8 f[FRAME_LEN(255)];
+	u32 i, n;
+
+	for(i = 0; i < frames; i++){
+		n = mcu_frame(f, (u8)i);
+		if(noisy && !(host_rand() % 10))
+			f[host_rand() % n] ^= (u8)(1 + host_rand() % 255);	//corrupted on the line
+		stream_put(s, f, n);
+		if(noisy && !(host_rand() % 3))
+			put_noise(s, host_rand() % 40);
+	}
+}
+
+/* the old walk, every frame it accepts at the end of the stream is complete */
+static void ref_scan(const stream *s, frame_list *out)
+{
+	u32 i = 0, need;
+
+	while(i < s->len){
+		if((s->buf[i] == STC) && (s->len - i >= SHS_FRAME_HEAD)){
+			need = FRAME_LEN(s->buf[i + SHS_FRAME_HEAD - 1]);
+			if((s->len - i >= need) && (sum(&s->buf[i], need - 1) == s->buf[i + need - 1])){
+				list_add(out, &s->buf[i], need);
+				i += need;
+				continue;
+			}
+		}
+		i++;
+	}
+}
+
+static uart_socket_t *open_uart(void)
+{
+	uart_set_str set;
+
+	memset(&set, 0, sizeof(set));
+	set.BaudRate = 9600;
+	set.number = 8;
+	set.StopBits = 1;
+	return uart_open(&set);
+}
+
+static void drain(frame_list *out)
+{
+	struct SHS_frame *f;
+
+	while((f = uart_get_frame(u)) != NULL)
+		list_add(out, (u8 *)f, FRAME_LEN(f->length));
+}
+
+/* the line went quiet: let every pending transfer and candidate run out of time */
+static void drain_idle(frame_list *out)
+{
+	int i;
+
+	for(i = 0; i < 1000; i++){
+		drain(out);
+		if(!rx_ring_count(&u->rx) && !u->rx_frame_off && !u->frame.open)
+			break;
+		host_ticks += 1000;
+	}
+}
+
+/* feed s in random pieces of 1..max bytes, parsing after each */
+static void feed(const stream *s, u32 max, frame_list *out)
+{
+	u32 off = 0, n;
+
+	while(off < s->len){
+		n = 1 + host_rand() % max;
+		if(n > s->len - off)
+			n = s->len - off;
+		host_line_send(s->buf + off, n);
+		off += n;
+		drain(out);
+	}
+	drain_idle(out);
+}
+
+static void check_against_ref(const char *what, u32 frames, int noisy, u32 max)
+{
+	stream s = {0};
+	frame_list got = {0}, ref = {0};
+
+	u = open_uart();
+	make_traffic(&s, frames, noisy);
+	ref_scan(&s, &ref);
+	feed(&s, max, &got);
+
+	printf("  %-24s %6u bytes  %5u frames  skipped %5u  rejected %4u  copied %4u\n", what,
+	       s.len, got.num, u->frame.skipped, u->frame.rejected, u->frame.copied);
+	CHECK(ref.num > 0);
+	CHECK(list_equal(&got, &ref));
+	CHECK(u->frame.frames == ref.num);
+	CHECK(u->rx.dropped == 0);
+	if(!noisy)
+		CHECK(ref.num == frames && !u->frame.skipped && !u->frame.rejected);
+
+	uart_close(u);
+	list_free(&got);
+	list_free(&ref);
+	free(s.buf);
+}
+
+/* a frame that stops halfway is dropped once its transfer is overdue, the next one still parses */
+static void check_idle_timeout(void)
+{
+	u8 f[FRAME_LEN(255)], g[FRAME_LEN(255)];
+	u32 n, m;
+	frame_list got = {0};
+
+	u = open_uart();
+	n = make_frame(f, 1, onoff_meter, sizeof(onoff_meter));
+	m = make_frame(g, 2, thrpow, sizeof(thrpow));
+
+	host_line_send(f, n / 2);
+	drain(&got);
+	host_ticks += 1;
+	drain(&got);
+	CHECK(got.num == 0);		//still within the transfer's line time
+	CHECK(u->frame.rejected == 0);
+
+	host_ticks += 1000;
+	drain(&got);
+	host_ticks += 1000;
+	drain(&got);
+	CHECK(got.num == 0);
+	CHECK(host_serial.aborts >= 1);
+	CHECK(u->frame.rejected == 1);
+	CHECK(rx_ring_count(&u->rx) == 0);
+
+	host_line_send(g, m);
+	drain(&got);
+	CHECK((got.num == 1) && (got.used == m) && !memcmp(got.buf, g, m));
+
+	uart_close(u);
+	list_free(&got);
+}
+
+/*
+ * The ring fills up while a frame is half in, the bytes after it are thrown away and the rest of
+ * the frame comes in after the gap. Stitched together the two halves still check out, the
+ * parser has to refuse them because they run across rx.gap. The bytes are put into the ring
+ * directly, as the rx interrupt would, and the clock stands still so the line is not idle.
+ */
+static void check_ring_gap(void)
+{
+	u8 f[FRAME_LEN(255)], g[FRAME_LEN(255)];
+	u32 n, m, k, i;
+	frame_list got = {0};
+
+	u = open_uart();
+	n = make_frame(f, 1, onoff_meter, sizeof(onoff_meter));
+	m = make_frame(g, 2, thrpow, sizeof(thrpow));
+	k = n / 2;
+
+	for(i = 0; i < UART_RECV_BUFFER_LEN - k; i++)
+		rx_ring_put(&u->rx, 0x55);
+	for(i = 0; i < k; i++)
+		rx_ring_put(&u->rx, f[i]);
+	for(i = 0; i < 8; i++)
+		CHECK(!rx_ring_put(&u->rx, 0xAA));
+	drain(&got);
+	CHECK(got.num == 0);
+	CHECK(u->frame.open && (rx_ring_count(&u->rx) == k));
+
+	for(i = k; i < n; i++)
+		rx_ring_put(&u->rx, f[i]);
+	for(i = 0; i < m; i++)
+		rx_ring_put(&u->rx, g[i]);
+	drain(&got);
+	CHECK((got.num == 1) && (got.used == m) && !memcmp(got.buf, g, m));
+	CHECK(u->frame.rejected == 1);
+	CHECK(u->rx.dropped == 8);
+
+	uart_close(u);
+	list_free(&got);
+}
+
+static void bench(const char *what, const stream *s)
+{
+	frame_list got = {0}, ref = {0};
+	double t0, t1, t2;
+	u32 off, n;
+
+	u = open_uart();
+	t0 = host_now_us();
+	for(off = 0; off < s->len; off += n){
+		n = (s->len - off > 256) ? 256 : s->len - off;
+		host_line_send(s->buf + off, n);
+		drain(&got);
+	}
+	drain_idle(&got);
+	t1 = host_now_us();
+	ref_scan(s, &ref);
+	t2 = host_now_us();
+
+	CHECK(list_equal(&got, &ref));
+	printf("  %-24s %7.1f MB/s %9.0f frames/s  %6.2f ns/byte  ref scan %6.2f ns/byte\n", what,
+	       s->len / (t1 - t0), got.num * 1e6 / (t1 - t0), (t1 - t0) * 1e3 / s->len,
+	       (t2 - t1) * 1e3 / s->len);
+
+	uart_close(u);
+	list_free(&got);
+	list_free(&ref);
+}
+
+int main(void)
+{
+	stream s = {0};
+	u8 c[2] = {STC, 0xFF};
+	u32 i;
+
+	printf("frame parser against the reference scan:\n");
+	host_srand(1);
+	check_against_ref("clean, 1..300 byte reads", 2000, 0, 300);
+	host_srand(2);
+	check_against_ref("noisy, 1..300 byte reads", 4000, 1, 300);
+	host_srand(3);
+	check_against_ref("noisy, 1..16 byte reads", 1000, 1, 16);
+	host_srand(4);
+	check_against_ref("noisy, byte by byte", 300, 1, 1);
+	check_idle_timeout();
+	check_ring_gap();
+
+	printf("throughput, including the rx DMA line model:\n");
+	host_srand(5);
+	make_traffic(&s, 20000, 0);
+	bench("clean traffic", &s);
+	s.len = 0;
+	make_traffic(&s, 20000, 1);
+	bench("noisy traffic", &s);
+	/* resync worst case: every STC claims a 255 byte frame that never checks out */
+	s.len = 0;
+	for(i = 0; i < 200000; i++)
+		stream_put(&s, c, 2);
+	bench("STC + 0xFF garbage", &s);
+	free(s.buf);
+
+	return host_result("test_uart_frame");
+}
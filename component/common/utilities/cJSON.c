@@ -30,6 +30,7 @@
 #include <float.h>
 #include <limits.h>
 #include <ctype.h>
+#include "FreeRTOS.h"
 #include "cJSON.h"
 
 static const char *ep;
@@ -46,13 +47,31 @@ static int cJSON_strcasecmp(const char *s1,const char *s2)
 static void *(*cJSON_malloc)(size_t sz) = malloc;
 static void (*cJSON_free)(void *ptr) = free;
 
+/* Optional fixed block allocator for items, see cJSON_SetItemPool(). The address range stays known
+   after the pool is closed, so its blocks are never handed to the hooks' free. */
+static const cJSON_ItemPool *item_pool;
+static void (*item_pool_put)(void *ptr);
+static const char *item_pool_start, *item_pool_end;
+
+static void *item_malloc(size_t sz)
+{
+	void *ptr = item_pool ? item_pool->get_fn(sz) : 0;
+	return ptr ? ptr : cJSON_malloc(sz);
+}
+
+static void item_free(void *ptr)
+{
+	if (item_pool_put && (const char *)ptr >= item_pool_start && (const char *)ptr < item_pool_end) item_pool_put(ptr);
+	else cJSON_free(ptr);
+}
+
 static char* cJSON_strdup(const char* str)
 {
       size_t len;
       char* copy;
 
       len = strlen(str) + 1;
-      if (!(copy = (char*)cJSON_malloc(len))) return 0;
+      if (!(copy = (char*)item_malloc(len))) return 0;
       memcpy(copy,str,len);
       return copy;
 }
@@ -69,10 +88,32 @@ void cJSON_InitHooks(cJSON_Hooks* hooks)
 	cJSON_free	 = (hooks->free_fn)?hooks->free_fn:free;
 }
 
+void cJSON_SetItemPool(const cJSON_ItemPool *pool)
+{
+	item_pool = pool;
+	if (pool) {
+		item_pool_put = pool->put_fn;
+		item_pool_start = (const char *)pool->start;
+		item_pool_end = (const char *)pool->end;
+	}
+}
+
+/* Rendered text is handed back to the caller, who releases it with free(), which platform_stdlib.h
+   maps to vPortFree, so the print path takes the FreeRTOS heap whatever the hooks installed. */
+#define print_malloc	pvPortMalloc
+#define print_free		vPortFree
+static char* print_strdup(const char* str)
+{
+      size_t len=strlen(str)+1;
+      char* copy=(char*)print_malloc(len);
+      if (copy) memcpy(copy,str,len);
+      return copy;
+}
+
 /* Internal constructor. */
 static cJSON *cJSON_New_Item(void)
 {
-	cJSON* node = (cJSON*)cJSON_malloc(sizeof(cJSON));
+	cJSON* node = (cJSON*)item_malloc(sizeof(cJSON));
 	if (node) memset(node,0,sizeof(cJSON));
 	return node;
 }
@@ -85,9 +126,9 @@ void cJSON_Delete(cJSON *c)
 	{
 		next=c->next;
 		if (!(c->type&cJSON_IsReference) && c->child) cJSON_Delete(c->child);
-		if (!(c->type&cJSON_IsReference) && c->valuestring) cJSON_free(c->valuestring);
-		if (c->string) cJSON_free(c->string);
-		cJSON_free(c);
+		if (!(c->type&cJSON_IsReference) && c->valuestring) item_free(c->valuestring);
+		if (c->string) item_free(c->string);
+		item_free(c);
 		c=next;
 	}
 }
@@ -121,12 +162,12 @@ static char *print_number(cJSON *item)
 	double d=item->valuedouble;
 	if (fabs(((double)item->valueint)-d)<=DBL_EPSILON && d<=INT_MAX && d>=INT_MIN)
 	{
-		str=(char*)cJSON_malloc(21);	/* 2^64+1 can be represented in 21 chars. */
+		str=(char*)print_malloc(21);	/* 2^64+1 can be represented in 21 chars. */
 		if (str) sprintf(str,"%d",item->valueint);
 	}
 	else
 	{
-		str=(char*)cJSON_malloc(64);	/* This is a nice tradeoff. */
+		str=(char*)print_malloc(64);	/* This is a nice tradeoff. */
 		if (str)
 		{
 			if (fabs(floor(d)-d)<=DBL_EPSILON && fabs(d)<1.0e60)sprintf(str,"%.0f",d);
@@ -159,7 +200,7 @@ static const char *parse_string(cJSON *item,const char *str)
 	
 	while (*ptr!='\"' && *ptr && ++len) if (*ptr++ == '\\') ptr++;	/* Skip escaped quotes. */
 	
-	out=(char*)cJSON_malloc(len+1);	/* This is how long we need for the string, roughly. */
+	out=(char*)item_malloc(len+1);	/* This is how long we need for the string, roughly. */
 	if (!out) return 0;
 	
 	ptr=str+1;ptr2=out;
@@ -216,10 +257,10 @@ static char *print_string_ptr(const char *str)
 {
 	const char *ptr;char *ptr2,*out;int len=0;unsigned char token;
 	
-	if (!str) return cJSON_strdup("");
+	if (!str) return print_strdup("");
 	ptr=str;while ((token=*ptr) && ++len) {if (strchr("\"\\\b\f\n\r\t",token)) len++; else if (token<32) len+=5;ptr++;}
 	
-	out=(char*)cJSON_malloc(len+3);
+	out=(char*)print_malloc(len+3);
 	if (!out) return 0;
 
 	ptr2=out;ptr=str;
@@ -305,9 +346,9 @@ static char *print_value(cJSON *item,int depth,int fmt)
 	if (!item) return 0;
 	switch ((item->type)&255)
 	{
-		case cJSON_NULL:	out=cJSON_strdup("null");	break;
-		case cJSON_False:	out=cJSON_strdup("false");break;
-		case cJSON_True:	out=cJSON_strdup("true"); break;
+		case cJSON_NULL:	out=print_strdup("null");	break;
+		case cJSON_False:	out=print_strdup("false");break;
+		case cJSON_True:	out=print_strdup("true"); break;
 		case cJSON_Number:	out=print_number(item);break;
 		case cJSON_String:	out=print_string(item);break;
 		case cJSON_Array:	out=print_array(item,depth,fmt);break;
@@ -357,12 +398,12 @@ static char *print_array(cJSON *item,int depth,int fmt)
 	/* Explicitly handle numentries==0 */
 	if (!numentries)
 	{
-		out=(char*)cJSON_malloc(3);
+		out=(char*)print_malloc(3);
 		if (out) strcpy(out,"[]");
 		return out;
 	}
 	/* Allocate an array to hold the values for each */
-	entries=(char**)cJSON_malloc(numentries*sizeof(char*));
+	entries=(char**)print_malloc(numentries*sizeof(char*));
 	if (!entries) return 0;
 	memset(entries,0,numentries*sizeof(char*));
 	/* Retrieve all the results: */
@@ -376,15 +417,15 @@ static char *print_array(cJSON *item,int depth,int fmt)
 	}
 	
 	/* If we didn't fail, try to malloc the output string */
-	if (!fail) out=(char*)cJSON_malloc(len);
+	if (!fail) out=(char*)print_malloc(len);
 	/* If that fails, we fail. */
 	if (!out) fail=1;
 
 	/* Handle failure. */
 	if (fail)
 	{
-		for (i=0;i<numentries;i++) if (entries[i]) cJSON_free(entries[i]);
-		cJSON_free(entries);
+		for (i=0;i<numentries;i++) if (entries[i]) print_free(entries[i]);
+		print_free(entries);
 		return 0;
 	}
 	
@@ -395,9 +436,9 @@ static char *print_array(cJSON *item,int depth,int fmt)
 	{
 		strcpy(ptr,entries[i]);ptr+=strlen(entries[i]);
 		if (i!=numentries-1) {*ptr++=',';if(fmt)*ptr++=' ';*ptr=0;}
-		cJSON_free(entries[i]);
+		print_free(entries[i]);
 	}
-	cJSON_free(entries);
+	print_free(entries);
 	*ptr++=']';*ptr++=0;
 	return out;	
 }
@@ -450,7 +491,7 @@ static char *print_object(cJSON *item,int depth,int fmt)
 	/* Explicitly handle empty object case */
 	if (!numentries)
 	{
-		out=(char*)cJSON_malloc(fmt?depth+4:3);
+		out=(char*)print_malloc(fmt?depth+4:3);
 		if (!out)	return 0;
 		ptr=out;*ptr++='{';
 		if (fmt) {*ptr++='\n';for (i=0;i<depth-1;i++) *ptr++='\t';}
@@ -458,10 +499,10 @@ static char *print_object(cJSON *item,int depth,int fmt)
 		return out;
 	}
 	/* Allocate space for the names and the objects */
-	entries=(char**)cJSON_malloc(numentries*sizeof(char*));
+	entries=(char**)print_malloc(numentries*sizeof(char*));
 	if (!entries) return 0;
-	names=(char**)cJSON_malloc(numentries*sizeof(char*));
-	if (!names) {cJSON_free(entries);return 0;}
+	names=(char**)print_malloc(numentries*sizeof(char*));
+	if (!names) {print_free(entries);return 0;}
 	memset(entries,0,sizeof(char*)*numentries);
 	memset(names,0,sizeof(char*)*numentries);
 
@@ -476,14 +517,14 @@ static char *print_object(cJSON *item,int depth,int fmt)
 	}
 	
 	/* Try to allocate the output string */
-	if (!fail) out=(char*)cJSON_malloc(len);
+	if (!fail) out=(char*)print_malloc(len);
 	if (!out) fail=1;
 
 	/* Handle failure */
 	if (fail)
 	{
-		for (i=0;i<numentries;i++) {if (names[i]) cJSON_free(names[i]);if (entries[i]) cJSON_free(entries[i]);}
-		cJSON_free(names);cJSON_free(entries);
+		for (i=0;i<numentries;i++) {if (names[i]) print_free(names[i]);if (entries[i]) print_free(entries[i]);}
+		print_free(names);print_free(entries);
 		return 0;
 	}
 	
@@ -497,15 +538,145 @@ static char *print_object(cJSON *item,int depth,int fmt)
 		strcpy(ptr,entries[i]);ptr+=strlen(entries[i]);
 		if (i!=numentries-1) *ptr++=',';
 		if (fmt) *ptr++='\n';*ptr=0;
-		cJSON_free(names[i]);cJSON_free(entries[i]);
+		print_free(names[i]);print_free(entries[i]);
 	}
 	
-	cJSON_free(names);cJSON_free(entries);
+	print_free(names);print_free(entries);
 	if (fmt) for (i=0;i<depth-1;i++) *ptr++='\t';
 	*ptr++='}';*ptr++=0;
 	return out;	
 }
 
+/* Streaming writer: render straight into a caller supplied window, handing each full window to the write callback. */
+void cJSON_StreamInit(cJSON_Stream *s,char *buf,int size,cJSON_WriteFn write,void *ctx)
+{
+	s->buf=buf;s->size=(buf && size>0)?size:0;s->len=0;s->total=0;s->error=0;s->write=write;s->ctx=ctx;
+}
+
+int cJSON_StreamFlush(cJSON_Stream *s)
+{
+	if (s->error) return -1;
+	if (s->len && s->write && s->write(s->ctx,s->buf,s->len)<0) s->error=1;
+	s->len=0;
+	return s->error?-1:0;
+}
+
+static void stream_out(cJSON_Stream *s,const char *str,int len)
+{
+	int n;
+	s->total+=len;
+	if (!s->size) return;	/* Length only. */
+	while (len>0 && !s->error)
+	{
+		if (s->len==s->size) cJSON_StreamFlush(s);
+		n=s->size-s->len;if (n>len) n=len;
+		memcpy(s->buf+s->len,str,n);s->len+=n;str+=n;len-=n;
+	}
+}
+static void stream_char(cJSON_Stream *s,char c)				{stream_out(s,&c,1);}
+static void stream_tabs(cJSON_Stream *s,int n)				{while (n-- > 0) stream_char(s,'\t');}
+
+/* Same rendering as print_number, through a stack buffer. */
+static void stream_number(cJSON *item,cJSON_Stream *s)
+{
+	char str[64];
+	double d=item->valuedouble;
+	if (fabs(((double)item->valueint)-d)<=DBL_EPSILON && d<=INT_MAX && d>=INT_MIN)	sprintf(str,"%d",item->valueint);
+	else if (fabs(floor(d)-d)<=DBL_EPSILON && fabs(d)<1.0e60)						sprintf(str,"%.0f",d);
+	else if (fabs(d)<1.0e-6 || fabs(d)>1.0e9)										sprintf(str,"%e",d);
+	else																			sprintf(str,"%f",d);
+	stream_out(s,str,strlen(str));
+}
+
+/* Same escaping as print_string_ptr; runs of plain characters are copied in one go.
+   A NULL string prints nothing, as print_string_ptr does. */
+static void stream_string_ptr(const char *str,cJSON_Stream *s)
+{
+	const char *run;char esc[7];unsigned char token;
+	if (!str) return;
+	stream_char(s,'\"');
+	while (*str)
+	{
+		run=str;
+		while ((unsigned char)*str>31 && *str!='\"' && *str!='\\') str++;
+		if (str!=run) stream_out(s,run,str-run);
+		if (!*str) break;
+		switch (token=*str++)
+		{
+			case '\\':	stream_out(s,"\\\\",2);	break;
+			case '\"':	stream_out(s,"\\\"",2);	break;
+			case '\b':	stream_out(s,"\\b",2);	break;
+			case '\f':	stream_out(s,"\\f",2);	break;
+			case '\n':	stream_out(s,"\\n",2);	break;
+			case '\r':	stream_out(s,"\\r",2);	break;
+			case '\t':	stream_out(s,"\\t",2);	break;
+			default: sprintf(esc,"\\u%04x",token);stream_out(s,esc,6);	break;
+		}
+	}
+	stream_char(s,'\"');
+}
+
+/* Mirrors print_value/print_array/print_object byte for byte. */
+static void stream_value(cJSON *item,int depth,int fmt,cJSON_Stream *s)
+{
+	cJSON *child;
+	switch ((item->type)&255)
+	{
+		case cJSON_NULL:	stream_out(s,"null",4);	break;
+		case cJSON_False:	stream_out(s,"false",5);break;
+		case cJSON_True:	stream_out(s,"true",4);	break;
+		case cJSON_Number:	stream_number(item,s);	break;
+		case cJSON_String:	stream_string_ptr(item->valuestring,s);break;
+		case cJSON_Array:
+			stream_char(s,'[');
+			for (child=item->child;child;child=child->next)
+			{
+				stream_value(child,depth+1,fmt,s);
+				if (child->next) {stream_char(s,',');if (fmt) stream_char(s,' ');}
+			}
+			stream_char(s,']');
+			break;
+		case cJSON_Object:
+			stream_char(s,'{');
+			if (!item->child)
+			{
+				if (fmt) {stream_char(s,'\n');stream_tabs(s,depth-1);}
+				stream_char(s,'}');
+				break;
+			}
+			depth++;if (fmt) stream_char(s,'\n');
+			for (child=item->child;child;child=child->next)
+			{
+				if (fmt) stream_tabs(s,depth);
+				stream_string_ptr(child->string,s);
+				stream_char(s,':');if (fmt) stream_char(s,'\t');
+				stream_value(child,depth,fmt,s);
+				if (child->next) stream_char(s,',');
+				if (fmt) stream_char(s,'\n');
+			}
+			if (fmt) stream_tabs(s,depth-1);
+			stream_char(s,'}');
+			break;
+		default:	s->error=1;	break;
+	}
+}
+
+int cJSON_StreamPrint(cJSON *item,int fmt,cJSON_Stream *s)
+{
+	int start=s->total;
+	if (!item) return -1;
+	stream_value(item,0,fmt,s);
+	if (cJSON_StreamFlush(s)<0) return -1;
+	return s->total-start;
+}
+
+int cJSON_PrintLength(cJSON *item,int fmt)
+{
+	cJSON_Stream s;
+	cJSON_StreamInit(&s,0,0,0,0);
+	return cJSON_StreamPrint(item,fmt,&s);
+}
+
 /* Get Array size/item / object item. */
 int    cJSON_GetArraySize(cJSON *array)							{cJSON *c=array->child;int i=0;while(c)i++,c=c->next;return i;}
 cJSON *cJSON_GetArrayItem(cJSON *array,int item)				{cJSON *c=array->child;  while (c && item>0) item--,c=c->next; return c;}
@@ -518,7 +689,7 @@ static cJSON *create_reference(cJSON *item) {cJSON *ref=cJSON_New_Item();if (!re
 
 /* Add item to array/object. */
 void   cJSON_AddItemToArray(cJSON *array, cJSON *item)						{cJSON *c=array->child;if (!item) return; if (!c) {array->child=item;} else {while (c && c->next) c=c->next; suffix_object(c,item);}}
-void   cJSON_AddItemToObject(cJSON *object,const char *string,cJSON *item)	{if (!item) return; if (item->string) cJSON_free(item->string);item->string=cJSON_strdup(string);cJSON_AddItemToArray(object,item);}
+void   cJSON_AddItemToObject(cJSON *object,const char *string,cJSON *item)	{if (!item) return; if (item->string) item_free(item->string);item->string=cJSON_strdup(string);cJSON_AddItemToArray(object,item);}
 void	cJSON_AddItemReferenceToArray(cJSON *array, cJSON *item)						{cJSON_AddItemToArray(array,create_reference(item));}
 void	cJSON_AddItemReferenceToObject(cJSON *object,const char *string,cJSON *item)	{cJSON_AddItemToObject(object,string,create_reference(item));}
 
@@ -532,7 +703,7 @@ void   cJSON_DeleteItemFromObject(cJSON *object,const char *string) {cJSON_Delet
 void   cJSON_ReplaceItemInArray(cJSON *array,int which,cJSON *newitem)		{cJSON *c=array->child;while (c && which>0) c=c->next,which--;if (!c) return;
 	newitem->next=c->next;newitem->prev=c->prev;if (newitem->next) newitem->next->prev=newitem;
 	if (c==array->child) array->child=newitem; else newitem->prev->next=newitem;c->next=c->prev=0;cJSON_Delete(c);}
-void   cJSON_ReplaceItemInObject(cJSON *object,const char *string,cJSON *newitem){int i=0;cJSON *c=object->child;while(c && cJSON_strcasecmp(c->string,string))i++,c=c->next;if(c){if(newitem->string) cJSON_free(newitem->string);newitem->string=cJSON_strdup(string);cJSON_ReplaceItemInArray(object,i,newitem);}}
+void   cJSON_ReplaceItemInObject(cJSON *object,const char *string,cJSON *newitem){int i=0;cJSON *c=object->child;while(c && cJSON_strcasecmp(c->string,string))i++,c=c->next;if(c){if(newitem->string) item_free(newitem->string);newitem->string=cJSON_strdup(string);cJSON_ReplaceItemInArray(object,i,newitem);}}
 
 /* Create basic types: */
 cJSON *cJSON_CreateNull(void)					{cJSON *item=cJSON_New_Item();if(item)item->type=cJSON_NULL;return item;}
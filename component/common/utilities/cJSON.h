@@ -63,6 +63,17 @@ typedef struct cJSON_Hooks {
 /* Supply malloc, realloc and free functions to cJSON */
 extern void cJSON_InitHooks(cJSON_Hooks* hooks);
 
+/* Fixed block allocator for the items and their strings, used before the hooks. get_fn returns NULL
+   for a request it does not take. Blocks inside [start, end) go back to put_fn whatever free the hooks
+   hold, also after the pool is closed with NULL. Rendered text never comes from it. */
+typedef struct cJSON_ItemPool {
+      void *(*get_fn)(size_t sz);
+      void (*put_fn)(void *ptr);
+      const void *start;
+      const void *end;
+} cJSON_ItemPool;
+extern void cJSON_SetItemPool(const cJSON_ItemPool *pool);
+
 
 /* Supply a block of JSON, and this returns a cJSON object you can interrogate. Call cJSON_Delete when finished. */
 extern cJSON *cJSON_Parse(const char *value);
@@ -70,6 +81,25 @@ extern cJSON *cJSON_Parse(const char *value);
 extern char  *cJSON_Print(cJSON *item);
 /* Render a cJSON entity to text for transfer/storage without any formatting. Free the char* when finished. */
 extern char  *cJSON_PrintUnformatted(cJSON *item);
+/* Streaming output. Rendering goes into a fixed window which is handed to write() each time it fills, so peak memory is
+the window rather than the whole document. write() returns <0 to abort. A stream with no window only counts bytes. */
+typedef int (*cJSON_WriteFn)(void *ctx,const char *buf,int len);
+typedef struct cJSON_Stream {
+	char *buf;					/* Window. */
+	int size;					/* Window size, 0 to count only. */
+	int len;					/* Bytes pending in the window. */
+	int total;					/* Bytes rendered since init. */
+	int error;					/* Set once write() failed. */
+	cJSON_WriteFn write;
+	void *ctx;
+} cJSON_Stream;
+extern void   cJSON_StreamInit(cJSON_Stream *s,char *buf,int size,cJSON_WriteFn write,void *ctx);
+/* Render item (formatted when fmt!=0, same bytes as cJSON_Print/cJSON_PrintUnformatted) and flush. Returns bytes written or -1. */
+extern int    cJSON_StreamPrint(cJSON *item,int fmt,cJSON_Stream *s);
+/* Hand any pending window bytes to write(). */
+extern int    cJSON_StreamFlush(cJSON_Stream *s);
+/* Length cJSON_StreamPrint would produce, for a Content-Length header ahead of the body. */
+extern int    cJSON_PrintLength(cJSON *item,int fmt);
 /* Delete a cJSON entity and all subentities. */
 extern void   cJSON_Delete(cJSON *c);
 
@@ -0,0 +1,135 @@
+/* cJSON pool allocator, see cJSON_pool.h */
+
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "cJSON_pool.h"
+
+#define NODE_SIZE	((sizeof(cJSON) + 7) & ~7)
+
+typedef union pool_block {
+	union pool_block *next;
+	double align;
+} pool_block;
+
+typedef struct pool {
+	unsigned char *mem;
+	unsigned int block;
+	unsigned int count;
+	pool_block *free_list;
+	cJSON_PoolCounters *ctr;
+} pool;
+
+/* One region for both pools, so cJSON.c can recognise their blocks by a single address range */
+static struct {
+	double node[(CJSON_POOL_NODES * NODE_SIZE) / sizeof(double)];
+	double string[(CJSON_POOL_STRINGS * CJSON_POOL_STRING_SIZE) / sizeof(double)];
+} pool_mem;
+
+static cJSON_AllocStats stats;
+static pool nodes = {(unsigned char *) pool_mem.node, NODE_SIZE, CJSON_POOL_NODES, 0, &stats.node};
+static pool strings = {(unsigned char *) pool_mem.string, CJSON_POOL_STRING_SIZE, CJSON_POOL_STRINGS, 0, &stats.string};
+static xTaskHandle pool_owner;
+static int pool_ready;
+
+static void counter_take(cJSON_PoolCounters *ctr, unsigned int n)
+{
+	ctr->alloc++;
+	ctr->used += n;
+	if(ctr->used > ctr->peak) ctr->peak = ctr->used;
+}
+
+static int pool_owns(pool *p, void *ptr)
+{
+	return ((unsigned char *) ptr >= p->mem) && ((unsigned char *) ptr < p->mem + p->block * p->count);
+}
+
+static void *pool_get(pool *p)
+{
+	pool_block *b = p->free_list;
+
+	if(b) {
+		p->free_list = b->next;
+		counter_take(p->ctr, 1);
+	}
+	else
+		p->ctr->miss++;
+	return b;
+}
+
+static void pool_put(pool *p, void *ptr)
+{
+	pool_block *b = (pool_block *) ptr;
+
+	b->next = p->free_list;
+	p->free_list = b;
+	p->ctr->free++;
+	p->ctr->used--;
+}
+
+static void pool_build(pool *p)
+{
+	unsigned int i;
+
+	p->free_list = 0;
+	for(i = p->count; i > 0; i--)
+		pool_put(p, p->mem + (i - 1) * p->block);
+	memset(p->ctr, 0, sizeof(cJSON_PoolCounters));
+}
+
+static void *cJSON_pool_get(size_t sz)
+{
+	void *ptr = 0;
+
+	if(pool_owner != xTaskGetCurrentTaskHandle())
+		return 0;
+
+	taskENTER_CRITICAL();
+	if(sz <= CJSON_POOL_STRING_SIZE)
+		ptr = pool_get(&strings);
+	if(!ptr && (sz <= NODE_SIZE))
+		ptr = pool_get(&nodes);
+	taskEXIT_CRITICAL();
+	return ptr;
+}
+
+static void cJSON_pool_put(void *ptr)
+{
+	taskENTER_CRITICAL();
+	if(pool_owns(&nodes, ptr))
+		pool_put(&nodes, ptr);
+	else
+		pool_put(&strings, ptr);
+	taskEXIT_CRITICAL();
+}
+
+static const cJSON_ItemPool item_pool = {cJSON_pool_get, cJSON_pool_put, &pool_mem, (unsigned char *) &pool_mem + sizeof(pool_mem)};
+
+void cJSON_PoolBegin(void)
+{
+	if(pool_owner)
+		return;
+	if(!pool_ready) {
+		pool_build(&nodes);
+		pool_build(&strings);
+		pool_ready = 1;
+	}
+
+	pool_owner = xTaskGetCurrentTaskHandle();
+	cJSON_SetItemPool(&item_pool);
+}
+
+void cJSON_PoolEnd(void)
+{
+	if(!pool_owner)
+		return;
+	cJSON_SetItemPool(NULL);
+	pool_owner = 0;
+}
+
+void cJSON_PoolGetStats(cJSON_AllocStats *out)
+{
+	taskENTER_CRITICAL();
+	memcpy(out, &stats, sizeof(cJSON_AllocStats));
+	taskEXIT_CRITICAL();
+}
@@ -0,0 +1,52 @@
+#ifndef cJSON_pool__h
+#define cJSON_pool__h
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "cJSON.h"
+
+/* Fixed block allocator for cJSON items, plugged in through cJSON_SetItemPool while the accessory
+ * database is built. The hooks are left alone, so lib_homekit's allocator stays in place.
+ *
+ * - node pool   : fixed blocks sized for a cJSON item, used by the long lived database nodes
+ * - string pool : 16 byte blocks for the short type/perm/format strings
+ *
+ * Only the task that opened the scope is served from the pools, anything else and anything that
+ * does not fit goes to the hooks. cJSON.c hands blocks of the pools back here by address, also
+ * after cJSON_PoolEnd(), so the library may replace or delete database items at any time. */
+
+#ifndef CJSON_POOL_NODES
+#define CJSON_POOL_NODES		128
+#endif
+#ifndef CJSON_POOL_STRINGS
+#define CJSON_POOL_STRINGS		64
+#endif
+#define CJSON_POOL_STRING_SIZE	16
+
+typedef struct cJSON_PoolCounters {
+	unsigned int alloc;			/* Successful allocations. */
+	unsigned int free;			/* Frees routed here. */
+	unsigned int used;			/* Blocks currently in use. */
+	unsigned int peak;			/* High water mark of used. */
+	unsigned int miss;			/* Requests that had to fall back to the hooks. */
+} cJSON_PoolCounters;
+
+typedef struct cJSON_AllocStats {
+	cJSON_PoolCounters node;
+	cJSON_PoolCounters string;
+} cJSON_AllocStats;
+
+/* Serve the calling task's items from the pools, the free lists are built on first use. */
+extern void cJSON_PoolBegin(void);
+/* Stop serving new items, the blocks in use stay valid. */
+extern void cJSON_PoolEnd(void);
+extern void cJSON_PoolGetStats(cJSON_AllocStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,364 @@
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include "flash_api.h"
+#include "comfunc.h"
+#include "kv_store.h"
+
+#define KV_ALIGN(len)		(((len) + 3) & ~3)
+#define KV_REC_SIZE(len)	(sizeof(kv_rec_hdr) + KV_ALIGN(len))
+#define KV_CHUNK			64
+
+static struct
+{
+	u32 seq;
+	u32 erases;
+	u32 skipped;
+	u16 next;					//offset of the next record in the active sector
+	u8 active;
+	u8 dirty;					//the space after next is not blank, switch before appending
+	u16 keys;
+	u16 key[KV_MAX_KEYS];
+	u16 off[KV_MAX_KEYS];		//newest record of key[i] in the active sector
+	u16 erase[KV_SECTORS];
+}kv;
+static xSemaphoreHandle kv_mutex = NULL;
+
+static void kv_lock(void)
+{
+	if(kv_mutex != NULL)
+		xSemaphoreTake(kv_mutex, portMAX_DELAY);
+}
+
+static void kv_unlock(void)
+{
+	if(kv_mutex != NULL)
+		xSemaphoreGive(kv_mutex);
+}
+
+static u32 sector_addr(u8 s)
+{
+	return KV_ADDR + s * KV_SECTOR_SIZE;
+}
+
+static u32 rec_addr(u16 off)
+{
+	return sector_addr(kv.active) + off;
+}
+
+//crc of key and len, the data is added on top
+static u16 hdr_crc(const kv_rec_hdr *hdr)
+{
+	return sp_crc16_with_init(0xFFFF, (const u8 *)hdr, 2*sizeof(u16));
+}
+
+static u16 flash_crc(u16 crc, u32 addr, u16 len)
+{
+	flash_t flash;
+	u8 buf[KV_CHUNK];
+	u16 n;
+
+	while(len){
+		n = (len > KV_CHUNK) ? KV_CHUNK : len;
+		flash_stream_read(&flash, addr, n, buf);
+		crc = sp_crc16_with_init(crc, buf, n);
+		addr += n;
+		len -= n;
+	}
+	return crc;
+}
+
+static int flash_blank(u32 addr, u32 len)
+{
+	flash_t flash;
+	u8 buf[KV_CHUNK];
+	u32 n, i;
+
+	while(len){
+		n = (len > KV_CHUNK) ? KV_CHUNK : len;
+		flash_stream_read(&flash, addr, n, buf);
+		for(i = 0; i < n; i++){
+			if(buf[i] != 0xFF)
+				return 0;
+		}
+		addr += n;
+		len -= n;
+	}
+	return 1;
+}
+
+static int flash_same(u32 addr, const u8 *data, u16 len)
+{
+	flash_t flash;
+	u8 buf[KV_CHUNK];
+	u16 n;
+
+	while(len){
+		n = (len > KV_CHUNK) ? KV_CHUNK : len;
+		flash_cached_read(&flash, addr, n, buf);
+		if(memcmp(buf, data, n))
+			return 0;
+		addr += n;
+		data += n;
+		len -= n;
+	}
+	return 1;
+}
+
+static int kv_find(u16 key)
+{
+	int i;
+
+	for(i = 0; i < kv.keys; i++){
+		if(kv.key[i] == key)
+			return i;
+	}
+	return -1;
+}
+
+static int index_set(u16 key, u16 off)
+{
+	int i = kv_find(key);
+
+	if(i < 0){
+		if(kv.keys >= KV_MAX_KEYS)
+			return -1;
+		i = kv.keys++;
+		kv.key[i] = key;
+	}
+	kv.off[i] = off;
+	return 0;
+}
+
+static void index_del(u16 key)
+{
+	int i = kv_find(key);
+
+	if(i < 0)
+		return;
+	kv.keys--;
+	kv.key[i] = kv.key[kv.keys];
+	kv.off[i] = kv.off[kv.keys];
+}
+
+static u16 rec_len(u16 off)
+{
+	flash_t flash;
+	kv_rec_hdr hdr;
+
+	flash_cached_read(&flash, rec_addr(off), sizeof(hdr), (u8 *)&hdr);
+	return hdr.len;
+}
+
+//bytes the live records take
+static u32 live_size(void)
+{
+	u32 size = 0;
+	int i;
+
+	for(i = 0; i < kv.keys; i++)
+		size += KV_REC_SIZE(rec_len(kv.off[i]));
+	return size;
+}
+
+/* Erase the next sector of the ring, copy the live records over and make it the active one.
+ * Its magic is programmed last, so a switch cut short leaves the old sector active. */
+static void kv_switch(void)
+{
+	flash_t flash;
+	kv_sector_hdr hdr;
+	u8 buf[KV_CHUNK];
+	u32 src, dst;
+	u16 off = sizeof(hdr), len, n;
+	u8 s = (kv.active + 1) % KV_SECTORS;
+	int i;
+
+	dst = sector_addr(s);
+	flash_erase_sector(&flash, dst);
+	kv.erase[s]++;
+	kv.erases++;
+	for(i = 0; i < kv.keys; i++){
+		src = rec_addr(kv.off[i]);
+		len = KV_REC_SIZE(rec_len(kv.off[i]));
+		kv.off[i] = off;
+		while(len){
+			n = (len > KV_CHUNK) ? KV_CHUNK : len;
+			flash_stream_read(&flash, src, n, buf);
+			flash_stream_write(&flash, dst + off, n, buf);
+			src += n;
+			off += n;
+			len -= n;
+		}
+	}
+	hdr.magic = KV_MAGIC;
+	hdr.erase = kv.erase[s];
+	hdr.seq = kv.seq + 1;
+	flash_stream_write(&flash, dst + sizeof(u16), sizeof(hdr) - sizeof(u16), (u8 *)&hdr + sizeof(u16));
+	flash_stream_write(&flash, dst, sizeof(u16), (u8 *)&hdr);
+
+	kv.active = s;
+	kv.seq = hdr.seq;
+	kv.next = off;
+	kv.dirty = 0;
+}
+
+//index the active sector, the newest valid record of a key wins
+static void kv_scan(void)
+{
+	kv_rec_hdr hdr;
+	flash_t flash;
+	u16 off = sizeof(kv_sector_hdr);
+
+	kv.keys = 0;
+	while(off + sizeof(hdr) <= KV_SECTOR_SIZE){
+		flash_stream_read(&flash, rec_addr(off), sizeof(hdr), (u8 *)&hdr);
+		if((hdr.key == 0xFFFF) && (hdr.len == 0xFFFF))
+			break;
+		if((hdr.len > KV_MAX_LEN) || (off + KV_REC_SIZE(hdr.len) > KV_SECTOR_SIZE)){
+			//a torn header, nothing after it can be trusted
+			kv.skipped++;
+			kv.dirty = 1;
+			break;
+		}
+		if((hdr.key == 0xFFFF) || (flash_crc(hdr_crc(&hdr), rec_addr(off + sizeof(hdr)), hdr.len) != hdr.crc))
+			kv.skipped++;
+		else if(hdr.len == 0)
+			index_del(hdr.key);
+		else if(index_set(hdr.key, off) < 0)
+			kv.skipped++;
+		off += KV_REC_SIZE(hdr.len);
+	}
+	kv.next = off;
+	//data of a record whose header never made it
+	if(!kv.dirty && !flash_blank(rec_addr(off), KV_SECTOR_SIZE - off))
+		kv.dirty = 1;
+}
+
+void kv_init(void)
+{
+	flash_t flash;
+	kv_sector_hdr hdr;
+	int i, found = 0;
+
+	memset(&kv, 0, sizeof(kv));
+	for(i = 0; i < KV_SECTORS; i++){
+		flash_stream_read(&flash, sector_addr(i), sizeof(hdr), (u8 *)&hdr);
+		if((hdr.magic != KV_MAGIC) || (hdr.seq == 0xFFFFFFFF))
+			continue;
+		kv.erase[i] = hdr.erase;
+		if(!found || (hdr.seq > kv.seq)){
+			kv.seq = hdr.seq;
+			kv.active = i;
+			found = 1;
+		}
+	}
+	if(!found){
+		printf("[%s] format\n", __FUNCTION__);
+		kv_switch();
+	}else{
+		kv_scan();
+	}
+
+	if(kv_mutex == NULL)
+		kv_mutex = xSemaphoreCreateMutex();
+	printf("[%s] sector %d seq %lu, %d keys, %d bytes used\n", __FUNCTION__, kv.active, kv.seq, kv.keys, kv.next);
+}
+
+void kv_format(void)
+{
+	kv_lock();
+	kv.keys = 0;
+	kv_switch();
+	kv_unlock();
+}
+
+int kv_get(u16 key, void *buf, u16 len)
+{
+	flash_t flash;
+	kv_rec_hdr hdr;
+	int i;
+
+	kv_lock();
+	i = kv_find(key);
+	if(i < 0){
+		kv_unlock();
+		return -1;
+	}
+	flash_cached_read(&flash, rec_addr(kv.off[i]), sizeof(hdr), (u8 *)&hdr);
+	if(len > hdr.len)
+		len = hdr.len;
+	flash_cached_read(&flash, rec_addr(kv.off[i] + sizeof(hdr)), len, (u8 *)buf);
+	kv_unlock();
+	return hdr.len;
+}
+
+int kv_set(u16 key, const void *buf, u16 len)
+{
+	flash_t flash;
+	kv_rec_hdr hdr;
+	int i;
+
+	if((key == 0xFFFF) || (len > KV_MAX_LEN) || (len && (buf == NULL)))
+		return -1;
+
+	kv_lock();
+	i = kv_find(key);
+	//nothing to write when the value is already there
+	if((i < 0) ? (len == 0) : (len && (rec_len(kv.off[i]) == len) &&
+		flash_same(rec_addr(kv.off[i] + sizeof(hdr)), (const u8 *)buf, len))){
+		kv_unlock();
+		return 0;
+	}
+	if((i < 0) && (kv.keys >= KV_MAX_KEYS)){
+		kv_unlock();
+		return -1;
+	}
+	if(kv.dirty || (kv.next + KV_REC_SIZE(len) > KV_SECTOR_SIZE)){
+		//the old value moves along, so it is still there if the new one never lands
+		if(sizeof(kv_sector_hdr) + live_size() + KV_REC_SIZE(len) > KV_SECTOR_SIZE){
+			kv_unlock();
+			return -1;
+		}
+		kv_switch();
+	}
+
+	hdr.key = key;
+	hdr.len = len;
+	hdr.rsvd = 0xFFFF;
+	hdr.crc = sp_crc16_with_init(hdr_crc(&hdr), (const u8 *)buf, len);
+	//data first, the header makes the record valid
+	if(len)
+		flash_stream_write(&flash, rec_addr(kv.next + sizeof(hdr)), len, (u8 *)buf);
+	flash_stream_write(&flash, rec_addr(kv.next), sizeof(hdr), (u8 *)&hdr);
+	if(len)
+		index_set(key, kv.next);
+	else
+		index_del(key);
+	kv.next += KV_REC_SIZE(len);
+	kv_unlock();
+	return 0;
+}
+
+int kv_delete(u16 key)
+{
+	return kv_set(key, NULL, 0);
+}
+
+void kv_get_stats(kv_stats *stats)
+{
+	int i;
+
+	kv_lock();
+	stats->seq = kv.seq;
+	stats->erases = kv.erases;
+	stats->skipped = kv.skipped;
+	stats->keys = kv.keys;
+	stats->used = kv.next;
+	stats->erase_min = stats->erase_max = kv.erase[0];
+	for(i = 1; i < KV_SECTORS; i++){
+		if(kv.erase[i] < stats->erase_min)
+			stats->erase_min = kv.erase[i];
+		if(kv.erase[i] > stats->erase_max)
+			stats->erase_max = kv.erase[i];
+	}
+	kv_unlock();
+}
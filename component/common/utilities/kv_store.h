@@ -0,0 +1,62 @@
+#ifndef __KV_STORE_H_
+#define __KV_STORE_H_
+
+#include "basic_types.h"
+#include "phytrex_model.h"
+
+/*
+ * Small log-structured key-value store for the persistent HomeKit and WAC state.
+ *
+ * Every set appends one record, the newest valid record of a key is its value. A record is
+ * {key, len, crc, 0xFFFF} followed by the data padded to 4 bytes, the crc covers key, len and
+ * data, so a record cut short by a power loss is skipped and the previous value stays.
+ * All live records are kept in the active sector. When it is full the next sector of the ring
+ * is erased, the live records are copied over and its header is written last with seq + 1, so
+ * until that moment the old sector is still the active one.
+ */
+#define KV_ADDR				FLASH_KV_ADDR
+#define KV_SECTORS			4
+#define KV_SECTOR_SIZE		0x1000
+#define KV_MAGIC			0x564B		//"KV"
+#define KV_MAX_KEYS			32
+#define KV_MAX_LEN			(KV_SECTOR_SIZE/4)
+
+typedef struct _kv_sector_hdr
+{
+	u16 magic;
+	u16 erase;		//times this sector has been erased
+	u32 seq;		//bumped on every sector switch, the highest valid one is active
+}kv_sector_hdr;
+
+typedef struct _kv_rec_hdr
+{
+	u16 key;		//0xFFFF: blank
+	u16 len;		//0: the key was deleted
+	u16 crc;
+	u16 rsvd;
+}kv_rec_hdr;
+
+typedef struct _kv_stats
+{
+	u32 seq;
+	u32 erases;		//sector erases since boot
+	u32 skipped;	//damaged records found at mount
+	u16 keys;
+	u16 used;		//bytes of the active sector in use
+	u16 erase_min;
+	u16 erase_max;
+}kv_stats;
+
+// Mount the store, formatting it when no valid sector is found
+void kv_init(void);
+// Drop every key
+void kv_format(void);
+// Stored length of the value, -1 when the key is not set. At most len bytes are copied to buf,
+// so callers compare the result with len to catch a value of another size
+int kv_get(u16 key, void *buf, u16 len);
+// 0 stored or unchanged, -1 no room or bad argument
+int kv_set(u16 key, const void *buf, u16 len);
+int kv_delete(u16 key);
+void kv_get_stats(kv_stats *stats);
+
+#endif //__KV_STORE_H_
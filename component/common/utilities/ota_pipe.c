@@ -0,0 +1,240 @@
+#include <platform_stdlib.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "semphr.h"
+#include "flash_api.h"
+#include "ota_pipe.h"
+
+#define OTA_PIPE_END		0xFF		//slot number that stops the writer
+#define OTA_SECTOR_SIZE		0x1000
+
+static struct
+{
+	u8 *buf;
+	xQueueHandle free;			//slots the receiver can fill
+	xQueueHandle full;			//slots waiting for the writer
+	xSemaphoreHandle done;
+	u32 len[OTA_PIPE_SLOTS];
+	u32 addr;
+	u32 max_len;
+	u32 cursor;					//offset of the next byte to program
+	u32 erased;					//offset up to which the region is erased
+	u32 crc;
+	u32 sum;
+	u32 tail;
+	u32 report;					//offset of the next progress line
+	u32 start;
+	u8 error;
+	u8 running;
+	ota_pipe_stats stats;
+}ota;
+
+//CRC32 (0xEDB88320), one nibble at a time
+static const u32 crc32_nibble[16] =
+{
+	0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+	0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+static u32 ota_now(void)
+{
+	return xTaskGetTickCount() * portTICK_RATE_MS;
+}
+
+static void ota_report(void)
+{
+	printf("\n\r[%s] %d KB, erase %d ms, program %d ms, recv wait %d ms, write wait %d ms", __FUNCTION__,
+		ota.cursor / 1024, ota.stats.erase_ms, ota.stats.program_ms, ota.stats.recv_wait_ms, ota.stats.write_wait_ms);
+}
+
+static void ota_erase_to(u32 end)
+{
+	flash_t flash;
+	u32 t = ota_now();
+
+	if(end > ota.max_len)
+		end = ota.max_len;
+	while(ota.erased < end){
+		flash_erase_sector(&flash, ota.addr + ota.erased);
+		ota.erased += OTA_SECTOR_SIZE;
+	}
+	ota.stats.erase_ms += ota_now() - t;
+}
+
+static void ota_program(u8 slot)
+{
+	flash_t flash;
+	u8 *p = ota.buf + slot * OTA_PIPE_SLOT_SIZE;
+	u32 len = ota.len[slot];
+	u32 crc = ota.crc, sum = ota.sum;
+	u32 i, t;
+
+	if(ota.error || (ota.cursor + len > ota.max_len)){
+		ota.error = 1;
+		return;
+	}
+
+	ota_erase_to(ota.cursor + len);
+	t = ota_now();
+	flash_stream_write(&flash, ota.addr + ota.cursor, len, p);
+	ota.stats.program_ms += ota_now() - t;
+
+	for(i = 0; i < len; i++){
+		sum += p[i];
+		crc ^= p[i];
+		crc = (crc >> 4) ^ crc32_nibble[crc & 0x0F];
+		crc = (crc >> 4) ^ crc32_nibble[crc & 0x0F];
+	}
+	for(i = (len > 4) ? (len - 4) : 0; i < len; i++)
+		ota.tail = (ota.tail >> 8) | ((u32)p[i] << 24);
+	ota.crc = crc;
+	ota.sum = sum;
+	ota.cursor += len;
+
+	if(ota.cursor >= ota.report){
+		ota.report += OTA_PIPE_REPORT;
+		ota_report();
+	}
+}
+
+static void ota_pipe_task(void *param)
+{
+	u8 slot;
+	u32 t;
+
+	(void)param;
+	while(1){
+		if(xQueueReceive(ota.full, &slot, 0) != pdTRUE){
+			//nothing to program, get the next sectors ready
+			if((ota.erased < ota.cursor + OTA_PIPE_ERASE_AHEAD) && (ota.erased < ota.max_len)){
+				ota_erase_to(ota.erased + OTA_SECTOR_SIZE);
+				continue;
+			}
+			t = ota_now();
+			while(xQueueReceive(ota.full, &slot, portMAX_DELAY) != pdTRUE);
+			ota.stats.write_wait_ms += ota_now() - t;
+		}
+		if(slot == OTA_PIPE_END)
+			break;
+		if(ota.len[slot])
+			ota_program(slot);
+		xQueueSend(ota.free, &slot, portMAX_DELAY);
+	}
+
+	xSemaphoreGive(ota.done);
+	vTaskDelete(NULL);
+}
+
+static void ota_pipe_free(void)
+{
+	if(ota.buf)
+		vPortFree(ota.buf);
+	if(ota.free)
+		vQueueDelete(ota.free);
+	if(ota.full)
+		vQueueDelete(ota.full);
+	if(ota.done)
+		vSemaphoreDelete(ota.done);
+	ota.buf = NULL;
+	ota.free = ota.full = NULL;
+	ota.done = NULL;
+	ota.running = 0;
+}
+
+int ota_pipe_start(u32 addr, u32 max_len)
+{
+	u8 i;
+
+	if(ota.running || (addr & (OTA_SECTOR_SIZE - 1)))
+		return -1;
+
+	memset(&ota, 0, sizeof(ota));
+	ota.buf = pvPortMalloc(OTA_PIPE_SLOTS * OTA_PIPE_SLOT_SIZE);
+	ota.free = xQueueCreate(OTA_PIPE_SLOTS, sizeof(u8));
+	ota.full = xQueueCreate(OTA_PIPE_SLOTS + 1, sizeof(u8));
+	vSemaphoreCreateBinary(ota.done);
+	if(!ota.buf || !ota.free || !ota.full || !ota.done){
+		printf("\n\r[%s] out of memory", __FUNCTION__);
+		ota_pipe_free();
+		return -1;
+	}
+	xSemaphoreTake(ota.done, 0);
+	for(i = 0; i < OTA_PIPE_SLOTS; i++)
+		xQueueSend(ota.free, &i, 0);
+
+	ota.addr = addr;
+	ota.max_len = max_len;
+	ota.crc = 0xFFFFFFFF;
+	ota.report = OTA_PIPE_REPORT;
+	ota.start = ota_now();
+	ota.running = 1;
+	if(xTaskCreate(ota_pipe_task, "ota_pipe", OTA_PIPE_STACK_SIZE, NULL, OTA_PIPE_PRIORITY, NULL) != pdPASS){
+		printf("\n\r[%s] xTaskCreate failed", __FUNCTION__);
+		ota_pipe_free();
+		return -1;
+	}
+	return 0;
+}
+
+u8 *ota_pipe_acquire(void)
+{
+	u8 slot;
+	u32 t;
+
+	if(!ota.running)
+		return NULL;
+	t = ota_now();
+	while(xQueueReceive(ota.free, &slot, portMAX_DELAY) != pdTRUE);
+	ota.stats.recv_wait_ms += ota_now() - t;
+	return ota.buf + slot * OTA_PIPE_SLOT_SIZE;
+}
+
+void ota_pipe_submit(u8 *buf, u32 len)
+{
+	u8 slot;
+
+	if(!ota.running || (buf == NULL))
+		return;
+	//only a slot handed out by ota_pipe_acquire() can be queued
+	if((buf < ota.buf) || (buf >= ota.buf + OTA_PIPE_SLOTS * OTA_PIPE_SLOT_SIZE) ||
+		((buf - ota.buf) % OTA_PIPE_SLOT_SIZE)){
+		printf("\n\r[%s] %p is not a pipe slot", __FUNCTION__, buf);
+		ota.error = 1;
+		return;
+	}
+	slot = (buf - ota.buf) / OTA_PIPE_SLOT_SIZE;
+	if(len > OTA_PIPE_SLOT_SIZE){
+		printf("\n\r[%s] %d bytes do not fit a slot", __FUNCTION__, len);
+		ota.error = 1;
+		len = 0;
+	}
+	ota.len[slot] = len;
+	xQueueSend(ota.full, &slot, portMAX_DELAY);
+}
+
+int ota_pipe_finish(ota_pipe_stats *stats)
+{
+	u8 slot = OTA_PIPE_END;
+	int ret;
+
+	if(!ota.running)
+		return -1;
+	xQueueSend(ota.full, &slot, portMAX_DELAY);
+	while(xSemaphoreTake(ota.done, portMAX_DELAY) != pdTRUE);
+
+	ota.stats.bytes = ota.cursor;
+	ota.stats.crc32 = ~ota.crc;
+	ota.stats.tail = ota.tail;
+	ota.stats.sum = ota.sum - (ota.tail & 0xFF) - ((ota.tail >> 8) & 0xFF) - ((ota.tail >> 16) & 0xFF) - (ota.tail >> 24);
+	ota.stats.total_ms = ota_now() - ota.start;
+	ota_report();
+	printf("\n\r[%s] %d bytes in %d ms, crc32 0x%08x%s", __FUNCTION__,
+		ota.stats.bytes, ota.stats.total_ms, ota.stats.crc32, ota.error ? ", failed" : "");
+
+	ret = ota.error ? -1 : 0;
+	if(stats)
+		*stats = ota.stats;
+	ota_pipe_free();
+	return ret;
+}
@@ -0,0 +1,48 @@
+#ifndef __OTA_PIPE_H_
+#define __OTA_PIPE_H_
+
+#include "basic_types.h"
+
+/*
+ * Receive/program pipeline for firmware downloads.
+ *
+ * The receiving task takes a free slot, fills it and submits it; a writer task programs the
+ * submitted slots in order and hands them back. With OTA_PIPE_SLOTS slots the socket read of
+ * one chunk runs while the previous one is being programmed, so a download takes about as long
+ * as the slower of network and flash instead of their sum.
+ *
+ * Sectors are erased by the writer just before the cursor reaches them, and up to
+ * OTA_PIPE_ERASE_AHEAD bytes beyond it while it has nothing to program. The byte sum and CRC32
+ * of the image are kept on the way, so nothing has to be read back to check it.
+ */
+#define OTA_PIPE_SLOTS			3
+#define OTA_PIPE_SLOT_SIZE		1536		//one decoded cloud chunk (1500 bytes) or socket read
+#define OTA_PIPE_ERASE_AHEAD	0x2000
+#define OTA_PIPE_REPORT			0x10000		//print the stage timings every 64 KB
+#define OTA_PIPE_STACK_SIZE		512
+#define OTA_PIPE_PRIORITY		(tskIDLE_PRIORITY + 1)		//same as the OTA task, the flash waits spin
+
+typedef struct _ota_pipe_stats
+{
+	u32 bytes;			//programmed
+	u32 crc32;			//of all the bytes
+	u32 sum;			//byte sum without the last 4 bytes
+	u32 tail;			//last 4 bytes, little endian (checksum attached by the local OTA tool)
+	u32 erase_ms;
+	u32 program_ms;
+	u32 recv_wait_ms;	//receiver waited for a free slot: flash bound
+	u32 write_wait_ms;	//writer waited for data: network bound
+	u32 total_ms;
+}ota_pipe_stats;
+
+// 0 started, -1 already running or out of memory
+int ota_pipe_start(u32 addr, u32 max_len);
+// Blocks until a slot is free, NULL when no pipe is running
+u8 *ota_pipe_acquire(void);
+// Queue len bytes of an acquired slot for programming, len 0 just gives the slot back.
+// A buffer that is not a slot, or len over OTA_PIPE_SLOT_SIZE, fails the image
+void ota_pipe_submit(u8 *buf, u32 len);
+// Program what is queued and stop the writer. 0 ok, -1 the image failed or no pipe
+int ota_pipe_finish(ota_pipe_stats *stats);
+
+#endif //__OTA_PIPE_H_
@@ -0,0 +1,111 @@
+#include <string.h>
+#include "rx_ring.h"
+
+void rx_ring_init(rx_ring_t *r, u8 *buf, u32 size)
+{
+	r->buf = buf;
+	r->mask = size - 1;
+	r->head = 0;
+	r->tail = 0;
+	r->dropped = 0;
+	r->gap = 0;
+	r->peak = 0;
+}
+
+u32 rx_ring_write_span(rx_ring_t *r, u8 **p)
+{
+	u32 head = r->head;
+	u32 space = r->mask + 1 - (head - r->tail);
+	u32 off = head & r->mask;
+
+	if(space > r->mask + 1 - off)
+		space = r->mask + 1 - off;
+	*p = &r->buf[off];
+	return space;
+}
+
+void rx_ring_produce(rx_ring_t *r, u32 n)
+{
+	u32 used;
+
+	rx_ring_barrier();
+	r->head += n;
+	used = r->head - r->tail;
+	if(used > r->peak)
+		r->peak = used;
+}
+
+void rx_ring_drop(rx_ring_t *r, u32 n)
+{
+	r->dropped += n;
+	r->gap = r->head;
+}
+
+u32 rx_ring_peek_span(rx_ring_t *r, u32 offset, u8 **p)
+{
+	u32 count = r->head - r->tail;
+	u32 off;
+
+	rx_ring_barrier();
+	if(offset >= count)
+		return 0;
+	count -= offset;
+	off = (r->tail + offset) & r->mask;
+	if(count > r->mask + 1 - off)
+		count = r->mask + 1 - off;
+	*p = &r->buf[off];
+	return count;
+}
+
+u32 rx_ring_peek(rx_ring_t *r, u32 offset, void *dst, u32 n)
+{
+	u8 *d = (u8 *)dst;
+	u8 *p;
+	u32 done = 0, len;
+
+	while(done < n){
+		len = rx_ring_peek_span(r, offset + done, &p);
+		if(!len)
+			break;
+		if(len > n - done)
+			len = n - done;
+		memcpy(d + done, p, len);
+		done += len;
+	}
+	return done;
+}
+
+u32 rx_ring_read(rx_ring_t *r, void *dst, u32 n)
+{
+	n = rx_ring_peek(r, 0, dst, n);
+	rx_ring_consume(r, n);
+	return n;
+}
+
+void rx_ring_consume(rx_ring_t *r, u32 n)
+{
+	rx_ring_barrier();
+	r->tail += n;
+}
+
+void rx_ring_get_stats(rx_ring_t *r, rx_ring_stats *stats)
+{
+	u32 head = r->head;
+
+	stats->size = r->mask + 1;
+	stats->count = head - r->tail;
+	stats->written = head;
+	stats->dropped = r->dropped;
+	stats->peak = r->peak;
+}
+
+void rx_ring_reset_stats(rx_ring_t *r)
+{
+	u32 primask;
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+	r->dropped = 0;
+	r->peak = r->head - r->tail;
+	__set_PRIMASK(primask);
+}
@@ -0,0 +1,82 @@
+#ifndef __RX_RING_H_
+#define __RX_RING_H_
+
+#include "osdep_api.h"
+#include "cmsis.h"
+
+/*
+ * Single producer, single consumer byte ring between a UART ISR (or its DMA completion) and one
+ * task. head and tail are free running byte counts, only the producer moves head and only the
+ * consumer moves tail, so neither side needs a critical section. The size must be a power of two.
+ *
+ * The producer fills the bytes before it publishes head and the consumer reads them before it
+ * releases tail; rx_ring_barrier() orders the two steps on each side.
+ *
+ * A full ring drops the incoming bytes, the consumer's unread data is never overwritten. gap keeps
+ * the ring position of the last drop, so the consumer can tell data that runs across it.
+ */
+#define rx_ring_barrier()	__DMB()
+
+typedef struct _rx_ring_t
+{
+	u8 *buf;
+	u32 mask;				//size - 1
+	volatile u32 head;		//bytes ever written
+	volatile u32 tail;		//bytes ever consumed
+	volatile u32 dropped;	//bytes thrown away because the ring was full
+	volatile u32 gap;		//head when bytes were last thrown away
+	u32 peak;				//most bytes ever waiting
+}rx_ring_t;
+
+typedef struct _rx_ring_stats
+{
+	u32 size;
+	u32 count;		//bytes waiting now
+	u32 written;	//bytes accepted since init
+	u32 dropped;
+	u32 peak;
+}rx_ring_stats;
+
+void rx_ring_init(rx_ring_t *r, u8 *buf, u32 size);
+
+static __inline u32 rx_ring_count(rx_ring_t *r)
+{
+	return r->head - r->tail;
+}
+
+/* producer side */
+static __inline int rx_ring_put(rx_ring_t *r, u8 c)
+{
+	u32 head = r->head;
+	u32 used = head - r->tail;
+
+	if(used > r->mask){
+		r->dropped++;
+		r->gap = head;
+		return 0;
+	}
+	r->buf[head & r->mask] = c;
+	rx_ring_barrier();
+	r->head = head + 1;
+	if(used + 1 > r->peak)
+		r->peak = used + 1;
+	return 1;
+}
+u32 rx_ring_write_span(rx_ring_t *r, u8 **p);	//contiguous free space at head
+void rx_ring_produce(rx_ring_t *r, u32 n);		//publish n bytes written into that span
+void rx_ring_drop(rx_ring_t *r, u32 n);			//count n bytes that found no room
+
+/* consumer side */
+u32 rx_ring_peek_span(rx_ring_t *r, u32 offset, u8 **p);	//contiguous waiting bytes from tail+offset
+u32 rx_ring_peek(rx_ring_t *r, u32 offset, void *dst, u32 n);
+u32 rx_ring_read(rx_ring_t *r, void *dst, u32 n);
+void rx_ring_consume(rx_ring_t *r, u32 n);
+static __inline u8 rx_ring_byte(rx_ring_t *r, u32 offset)
+{
+	return r->buf[(r->tail + offset) & r->mask];
+}
+
+void rx_ring_get_stats(rx_ring_t *r, rx_ring_stats *stats);
+void rx_ring_reset_stats(rx_ring_t *r);		//dropped and peak belong to the producer, masks interrupts
+
+#endif //__RX_RING_H_
@@ -9,6 +9,7 @@
 #include "other/outlet/outlet.h"
 
 #define UART_SOCKET_USE_DMA_TX 0
+#define UART_SOCKET_USE_DMA_RX 1
 uart_socket_t *uart_socket = NULL;
 uart_socket_t *uart_socket_send = NULL;
 /***********************************************************************
@@ -43,14 +44,7 @@ static void uart_irq(uint32_t id, SerialIrq event)
 			RtlUpSemaFromISR(&u->action_sema);	//up action semaphore 
 			u->rx_start = 1; // set this flag in uart_irq to indicate data recved
 		}
-		u->recv_buf[u->prxwrite++] = serial_getc(&u->sobj);
-		if(u->prxwrite > (UART_RECV_BUFFER_LEN -1)){	//restart from  head if  reach tail
-			u->prxwrite = 0;
-			u->rxoverlap = 1;							//set overlap indicated that overlaped 
-		}
-		if(u->rxoverlap && (u->prxwrite + 1) > u->prxread ){
-			u->prxread = u->prxwrite;		//if pwrite overhead pread ,pread is always flow rwrite 
-		}
+		rx_ring_put(&u->rx, serial_getc(&u->sobj));	//dropped and counted when full
 		u->last_update =  xTaskGetTickCountFromISR();	// update tick everytime recved data
 	}
 
@@ -58,6 +52,144 @@ static void uart_irq(uint32_t id, SerialIrq event)
 	}
 }
 
+#if UART_SOCKET_USE_DMA_RX
+/*
+ * RX by GDMA straight into the rx ring. Each transfer is sized to end on a frame boundary: the
+ * header first, then the rest of the frame once its length byte is in. So a frame costs about
+ * two completions and the consumer is woken as soon as its last byte lands, without waiting
+ * for the line to go quiet. Between two transfers the bytes wait in the UART FIFO.
+ * Each transfer gets a deadline from its length and the line speed, a frame that is still
+ * short of it after that is flushed by uart_rx_idle(). A header transfer armed between frames
+ * may sit on part of a header that never completes, it is looked at every UART_RX_IDLE_POLL.
+ * The transfer never goes past the free space of the ring, when it is full the bytes are taken
+ * into rx_spill and counted as dropped, so the frame tracking stays in step with the line.
+ */
+static void uart_rx_arm(uart_socket_t *u, u32 now)
+{
+	u32 len, space;
+	u8 *p;
+
+	if(u->rx_frame_need)
+		len = u->rx_frame_need - u->rx_frame_off;
+	else
+		len = SHS_FRAME_HEAD - u->rx_frame_off;
+	space = rx_ring_write_span(&u->rx, &p);
+	if(!space){
+		p = u->rx_spill;
+		space = sizeof(u->rx_spill);
+	}
+	if(len > space)
+		len = space;
+
+	u->rx_dma_buf = p;
+	u->rx_dma_len = len;
+	u->rx_deadline = now + ((len + UART_RX_MARGIN) * u->rx_byte_us / 1000 + UART_MAX_DELAY_TIME) / portTICK_RATE_MS;
+	if(serial_recv_stream_dma(&u->sobj, (char *)p, len) != HAL_OK)
+		u->rx_dma_len = 0;
+}
+
+/* publish n bytes of the last transfer, returns 1 when they complete a frame */
+static int uart_rx_commit(uart_socket_t *u, u32 n)
+{
+	u8 *p = u->rx_dma_buf;
+	int frame = 0;
+
+	if(p == u->rx_spill)
+		rx_ring_drop(&u->rx, n);
+	else
+		rx_ring_produce(&u->rx, n);
+
+	while(n--){
+		if((u->rx_frame_off == 0) && (*p != STC)){
+			p++;
+			continue;
+		}
+		if(++u->rx_frame_off == SHS_FRAME_HEAD)
+			u->rx_frame_need = SHS_FRAME_HEAD + *p + 1;
+		p++;
+		if(u->rx_frame_off == u->rx_frame_need){
+			u->rx_frame_off = 0;
+			u->rx_frame_need = 0;
+			frame = 1;
+		}
+	}
+	return frame;
+}
+
+static void uart_recv_stream_done(uint32_t id)
+{
+	uart_socket_t *u = (uart_socket_t *)id;
+	int frame;
+
+	frame = uart_rx_commit(u, u->rx_dma_len);
+	u->last_update = xTaskGetTickCountFromISR();
+	uart_rx_arm(u, u->last_update);
+	if(frame && (u->rx_start == 0)){
+		u->rx_start = 1;
+		RtlUpSemaFromISR(&u->action_sema);
+	}
+}
+
+/* the transfer in flight has to be cut short: it is overdue, or it spills while the ring has room */
+static int uart_rx_stale(uart_socket_t *u)
+{
+	u32 now = xTaskGetTickCount();
+
+	if(!u->rx_dma_len)
+		return 0;
+	if((u->rx_dma_buf == u->rx_spill) && (rx_ring_count(&u->rx) <= u->rx.mask))
+		return 1;
+	if(!u->rx_frame_off)	//between frames, a header may have stopped short in it
+		return (now - u->last_update) >= UART_RX_IDLE_POLL / portTICK_RATE_MS;
+	return (s32)(now - u->rx_deadline) >= 0;
+}
+
+/*
+ * A frame stalled halfway: its transfer is past the deadline, take what it got so far and let
+ * the parser drop it. A transfer that was armed into rx_spill while the ring was full is moved
+ * back to the ring as soon as the consumer made room, the frame tracking carries on across it.
+ * The rx interrupt is the ring's producer, so this runs with interrupts masked: a completion
+ * can not land between the abort and the re-arm, and the ring never sees two producers at once.
+ */
+static void uart_rx_idle(uart_socket_t *u)
+{
+	u32 now, deadline;
+	s32 n;
+
+	if(!uart_rx_stale(u))
+		return;
+
+	taskENTER_CRITICAL();
+	if(uart_rx_stale(u)){
+		now = xTaskGetTickCount();
+		deadline = u->rx_deadline;
+		if((s32)(now - deadline) >= 0){
+			u->rx_frame_off = 0;
+			u->rx_frame_need = 0;
+		}
+		n = serial_recv_stream_abort(&u->sobj);
+		if(n > 0)
+			uart_rx_commit(u, n);
+		u->last_update = now;
+		uart_rx_arm(u, now);
+		if(n <= 0)
+			u->rx_deadline = deadline;	//nothing came in, so there is nothing more to wait for
+	}
+	taskEXIT_CRITICAL();
+}
+
+/* the bytes of the current frame may still be on the line */
+static int uart_rx_waiting(uart_socket_t *u)
+{
+	return (s32)(xTaskGetTickCount() - u->rx_deadline) < 0;
+}
+#else
+static int uart_rx_waiting(uart_socket_t *u)
+{
+	return (xTaskGetTickCount() - u->last_update) < UART_MAX_DELAY_TIME;
+}
+#endif
+
 static void uart_send_stream_done(uint32_t id)
 {
 	uart_socket_t *u = (uart_socket_t *)id;
@@ -119,8 +251,10 @@ static void uart_action_handler(void* param)
 		if(u->fd == -1)
 			goto Exit;
 		if(u->rx_start){
+#if !UART_SOCKET_USE_DMA_RX
 			/* Blocked here to wait uart rx data completed */
 			uart_wait_rx_complete(u);
+#endif
 
 			/* As we did not register netconn callback function.,so call lwip_selectevindicate unblocking select */
 			lwip_setsockrcvevent(u->fd, 1);
@@ -157,6 +291,9 @@ uart_socket_t* uart_open(uart_set_str *puartpara)
 		uart_printf("%s(): Alloc memory for uart_socket failed!\n", __func__);
 		return NULL;
 	}
+	rx_ring_init(&u->rx, u->recv_buf, UART_RECV_BUFFER_LEN);
+	//start bit, data bits, parity, stop bits
+	u->rx_byte_us = (1 + puartpara->number + (puartpara->parity ? 1 : 0) + (puartpara->StopBits ? puartpara->StopBits : 1)) * 1000000 / puartpara->BaudRate;
 	
 	/*initial uart */
 	serial_init(&u->sobj, uart_tx,uart_rx);
@@ -165,7 +302,11 @@ uart_socket_t* uart_open(uart_set_str *puartpara)
 
 	/*uart irq handle*/
 	serial_irq_handler(&u->sobj, uart_irq, (int)u);
+#if UART_SOCKET_USE_DMA_RX
+	serial_recv_comp_handler(&u->sobj, (void*)uart_recv_stream_done, (uint32_t)u);
+#else
 	serial_irq_set(&u->sobj, RxIrq, 1);
+#endif
 	serial_irq_set(&u->sobj, TxIrq, 1);
 
 #if UART_SOCKET_USE_DMA_TX
@@ -192,6 +333,11 @@ uart_socket_t* uart_open(uart_set_str *puartpara)
 			goto Exit1;
 		}
 	}
+#if UART_SOCKET_USE_DMA_RX
+	uart_rx_arm(u, xTaskGetTickCount());
+	if(!u->rx_dma_len)
+		uart_printf("%s(): start rx DMA failed!\n", __func__);
+#endif
 	return u;
 Exit1:
 	/* Free uart related semaphore */
@@ -224,6 +370,9 @@ int uart_close(uart_socket_t *u)
 	RtlFreeSema(&u->dma_tx_sema);
 	
 	/* Free serial */
+#if UART_SOCKET_USE_DMA_RX
+	serial_recv_stream_abort(&u->sobj);
+#endif
 	serial_free(&u->sobj);
 	
 	RtlMfree((u8 *)u, sizeof(uart_socket_t));
@@ -235,8 +384,6 @@ int uart_read(uart_socket_t *u, void *read_buf, size_t size)
 {
 	/*the same as socket*/
 	int read_bytes = 0;
-	int pread_local,pwrite_local;
-	char *ptr = (char *)read_buf;
 
 	//uart_printf("==>uart_read()\n");
 	if(!size || !read_buf || !u){
@@ -244,45 +391,132 @@ int uart_read(uart_socket_t *u, void *read_buf, size_t size)
 		return -1;
 	}
 	
-	pread_local = u->prxread;
-	pwrite_local = u->prxwrite;
-	/*calculate how much data not read */
-	if(!u->rxoverlap){
-		read_bytes = pwrite_local - pread_local;
-	} else {
-		read_bytes = (UART_RECV_BUFFER_LEN - pread_local) + pwrite_local;
-	}
-	/*decide how much data shoule copy to application*/
-	if(size < read_bytes)
-		read_bytes = size;
-	
-	if(!u->rxoverlap){
-		memcpy(ptr, (u->recv_buf+ pread_local), read_bytes );
-	} else {
-		uart_printf("uart recv buf is write through!!\n");
-		if((pread_local + read_bytes) > UART_RECV_BUFFER_LEN){
-			memcpy(ptr,(u->recv_buf+ pread_local), (UART_RECV_BUFFER_LEN-pread_local));
-			memcpy(ptr+(UART_RECV_BUFFER_LEN-pread_local), u->recv_buf, read_bytes-(UART_RECV_BUFFER_LEN- pread_local));
-		} else
-			memcpy(ptr,(u->recv_buf+ pread_local), read_bytes);
-	}
+	read_bytes = rx_ring_read(&u->rx, read_buf, size);
 	lwip_setsockrcvevent(u->fd, 0);
 	
-	if((pread_local + read_bytes) >= UART_RECV_BUFFER_LEN){		//update pread
-		u->prxread = (pread_local + read_bytes) - UART_RECV_BUFFER_LEN;
-		u->rxoverlap = 0;		//clean overlap flags
-	} else
-		u->prxread = pread_local + read_bytes;
-	
 	return read_bytes;
 
 }
 
+/*
+ * Byte sum of the first n waiting bytes. The running sum before each ring position is kept, so
+ * every byte is added once however often the candidate start moves on, and checking a candidate
+ * costs the same whatever it shares with the one before.
+ */
+static u8 uart_frame_sum(uart_socket_t *u, u32 n)
+{
+	uart_frame_parser *p = &u->frame;
+	u32 tail = u->rx.tail;
+	u8 s;
+
+	if((s32)(p->sum_pos - tail) < 0){
+		/* everything summed is consumed, start over from the tail */
+		p->sum_pos = tail;
+		p->sums[tail & (UART_FRAME_SUMS - 1)] = 0;
+	}
+	while(p->sum_pos - tail < n){
+		s = p->sums[p->sum_pos & (UART_FRAME_SUMS - 1)] + rx_ring_byte(&u->rx, p->sum_pos - tail);
+		p->sum_pos++;
+		p->sums[p->sum_pos & (UART_FRAME_SUMS - 1)] = s;
+	}
+	return p->sums[(tail + n) & (UART_FRAME_SUMS - 1)] - p->sums[tail & (UART_FRAME_SUMS - 1)];
+}
+
+/*
+ * Take the next complete SHS frame out of the rx ring, NULL when there is none yet.
+ *
+ * The candidate stays in the rx ring until it is accepted or dropped. Its checksum comes from
+ * the running sums of uart_frame_sum(), so a partly received frame is picked up where the last
+ * call stopped, and a dropped candidate hands over to the next STC without summing the bytes
+ * again: resync stays linear even in garbage full of STCs. A candidate that is still incomplete
+ * once its rx transfer is overdue (the line has been idle for UART_MAX_DELAY_TIME without DMA)
+ * is dropped the same way, so is one that runs across the place where the full ring last threw
+ * bytes away (rx.gap): its two halves may still check out by chance.
+ * The frame is returned in place, only a frame that wraps the ring end is copied to the parser
+ * buffer. Its bytes are released at the start of the next call, so the ISR can not reuse them
+ * before then: it stays valid until the next call and must not be grown in place.
+ */
+void *uart_get_frame(uart_socket_t *u)
+{
+	uart_frame_parser *p = &u->frame;
+	u32 avail, need;
+	u8 *frame;
+
+	if(p->done){
+		rx_ring_consume(&u->rx, p->done);
+		p->done = 0;
+	}
+#if UART_SOCKET_USE_DMA_RX
+	uart_rx_idle(u);
+#endif
+	avail = rx_ring_count(&u->rx);
+
+	while(avail){
+		if(!p->open){
+			while(avail && (rx_ring_byte(&u->rx, 0) != STC)){
+				rx_ring_consume(&u->rx, 1);
+				avail--;
+				p->skipped++;
+			}
+			if(!avail)
+				break;
+			p->open = 1;
+		}
+
+		need = 0;
+		if(avail >= SHS_FRAME_HEAD)
+			need = SHS_FRAME_HEAD + rx_ring_byte(&u->rx, SHS_FRAME_HEAD - 1) + 1;	//after the length byte
+
+		if(need && (avail >= need)){
+			if((u->rx.gap - u->rx.tail - 1 >= need - 1) &&
+			   (uart_frame_sum(u, need - 1) == rx_ring_byte(&u->rx, need - 1))){
+				if(rx_ring_peek_span(&u->rx, 0, &frame) < need){
+					rx_ring_peek(&u->rx, 0, p->buf, need);
+					p->copied++;
+					frame = p->buf;
+				}
+				p->done = need;		//still owned by the caller
+				p->open = 0;
+				p->frames++;
+				return frame;
+			}
+		} else if(uart_rx_waiting(u)){
+			return NULL;		//wait for the rest of the frame
+		}
+
+		/* bad checksum or the rest never came, the next candidate is the next STC */
+		rx_ring_consume(&u->rx, 1);
+		avail--;
+		p->skipped++;
+		p->rejected++;
+		p->open = 0;
+	}
+
+	lwip_setsockrcvevent(u->fd, 0);
+	return NULL;
+}
 
 int uart_write(uart_socket_t *u, void *pbuf, size_t size)
 {
-    int i = 0;
-	if(!size || !pbuf || !u){
+	uart_iovec iov;
+
+	iov.base = pbuf;
+	iov.len = size;
+	return uart_writev(u, &iov, 1);
+}
+
+/* gather the pieces into send_buf, so they go out back to back in one tx DMA transfer */
+int uart_writev(uart_socket_t *u, const uart_iovec *iov, int iovcnt)
+{
+    int i = 0, n;
+    size_t size = 0;
+
+	for(n = 0; iov && (n < iovcnt); n++){
+		if(!iov[n].base)
+			break;
+		size += iov[n].len;
+	}
+	if(!size || !u || (n < iovcnt) || (size > UART_SEND_BUFFER_LEN)){
 		uart_printf("input error,please check!");
 		return -1;
 	}
@@ -298,8 +532,10 @@ int uart_write(uart_socket_t *u, void *pbuf, size_t size)
 		if (u->tx_start == 0)
 		{
 		//uart_print_data("uart_write:", (uint8 *)pbuf, size);
-		//memcpy(u->send_buf, pbuf, size);
-		mymemcpy(u->send_buf, pbuf, size);
+		for(n = 0, size = 0; n < iovcnt; n++){
+			mymemcpy(&u->send_buf[size], iov[n].base, iov[n].len);
+			size += iov[n].len;
+		}
 		u->tx_bytes = size;
 		u->tx_start = 1;	//set uart tx start 
 		RtlUpSema(&u->action_sema);	// let uart_handle_run through
@@ -407,9 +643,8 @@ void uart_socket_example(void *param)
 	uart_set_str uartset;
 	struct timeval tv;
 	fd_set readfds;
-	int read_len = 0, count = 0;
+	int count = 0;
 	int ret = 0;
-	char rxbuf[512];
 	int uart_fd;
 	struct SHS_frame *pframe;
 	xSemaphoreHandle *uart_socket_sema = param;
@@ -446,44 +681,14 @@ void uart_socket_example(void *param)
 		//}
 		ret = select(uart_fd + 1, &readfds, NULL, NULL, &tv);
 		//uart_printf("[%d] select ret = %x count=%d\n", xTaskGetTickCount(), ret, count);	
-		if(ret > 0)
+		/* also runs on timeout, so a stale partial frame gets dropped */
+		while((pframe = uart_get_frame(uart_socket)) != NULL)
 		{
-			if(FD_ISSET(uart_fd, &readfds))
-			{
-			      int frame_len = 0;
-				read_len = uart_read(uart_socket, rxbuf, sizeof(rxbuf));
-				while (read_len > frame_len)
-				{
-					uart_print_data("RX:", rxbuf+frame_len, read_len-frame_len);
-					pframe = get_smart_frame(rxbuf+frame_len, read_len-frame_len);
-					if (pframe != NULL)
-					{
-					    frame_len += pframe->length +1+SHS_FRAME_HEAD;
-					    frame_handle(0, pframe);
-					}
-					else
-					{
-					    break;
-					}
-					if(rtl_strncmp(rxbuf, "close", 5) == 0)
-						break;
-				}
-				/*
-				if(read_len > 0)
-				{
-					uart_print_data("RX:", rxbuf, read_len);
-					pframe = get_smart_frame(rxbuf, read_len);
-					if (pframe != NULL)
-					{
-					    frame_handle(0, pframe);
-					}
-					if(rtl_strncmp(rxbuf, "close", 5) == 0)
-						break;
-				}
-				*/
-			}
-			//else for other sockets
+			uart_print_data("RX:", (uint8 *)pframe, pframe->length+1+SHS_FRAME_HEAD);
+			frame_handle(0, pframe);
 		}
+		mcu_cmd_poll();
+		mcu_ota_poll();
 	}
 	uart_printf("Exit uart socket example!\n");
 	uart_close(uart_socket);
@@ -541,6 +746,7 @@ void uart_start_h()
     //printf("uart start\n");
     vSemaphoreCreateBinary(uart_socket_sema);
     vSemaphoreCreateBinary(HAPNotifyHandle_sema);
+    mcu_cmd_init();
 	if(xTaskCreate(uart_socket_example, "uart_socket", UART_SOCKET_STACK_SIZE*2, &uart_socket_sema, UART_SOCKET_PRIORITY, &uart_socket_handle) != pdPASS)
 		uart_printf("%s xTaskCreate failed", __FUNCTION__);
 	if(xTaskCreate(HAPNotifyHandle, "HAPNotifyHandle", HAPNotifyHandle_STACK_SIZE, &HAPNotifyHandle_sema, UART_SOCKET_PRIORITY, &HAPNotifyHandle_handle) != pdPASS)
@@ -570,7 +776,8 @@ void uart_start_h()
 	            uart_printf("%s xTaskCreate failed", __FUNCTION__);
 	    }
 
-	    if (xSemaphoreTake(HAPNotifyHandle_sema, ( TickType_t ) 4000) != pdTRUE)
+	    // HAPNotifyHandle may sleep longer than this loop while it waits for events
+	    if ((xSemaphoreTake(HAPNotifyHandle_sema, ( TickType_t ) 4000) != pdTRUE) && !outlet_task_idle())
 	    {
 	        uart_printf("========HAPNotifyHandle reset=========\n");
 	        vTaskDelete(HAPNotifyHandle_handle);
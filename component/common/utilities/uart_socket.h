@@ -4,10 +4,37 @@
 #include "osdep_api.h"
 #include "serial_api.h"
 #include "serial_ex_api.h"
+#include "rx_ring.h"
 
 #define UART_SEND_BUFFER_LEN	256
-#define UART_RECV_BUFFER_LEN	1024
+#define UART_RECV_BUFFER_LEN	1024		//power of two, see rx_ring.h
 #define UART_MAX_DELAY_TIME   20
+#define UART_RX_MARGIN        4            //bytes of slack on top of an rx DMA transfer's line time
+#define UART_RX_IDLE_POLL     100          //ms between looks at a header transfer while no frame is coming in
+#define UART_FRAME_MAX        (11+255+1)   //SHS frame: header, up to 255 bytes infor, cs
+#define UART_FRAME_SUMS       512          //power of two above UART_FRAME_MAX
+
+/* state of the SHS frame parser, the candidate frame always starts at the ring tail */
+typedef struct _uart_frame_parser
+{
+	u8 open;		//the STC at the ring tail is a candidate
+	u16 done;		//length of the frame handed out last, consumed on the next call
+	u32 sum_pos;	//ring position the running byte sum has reached
+	u8 sums[UART_FRAME_SUMS];	//running byte sum before each ring position, from any base
+
+	u32 frames;		//frames handed out
+	u32 copied;		//frames copied to buf because they wrapped the ring end
+	u32 rejected;	//candidates dropped on a bad checksum, idle timeout or a ring gap
+	u32 skipped;	//garbage bytes dropped while hunting for STC
+	u8 buf[UART_FRAME_MAX];
+}uart_frame_parser;
+
+/* one piece of a frame for uart_writev() */
+typedef struct _uart_iovec
+{
+	const void *base;
+	u32 len;
+}uart_iovec;
 
 typedef struct _uart_set_str 
 { 
@@ -27,11 +54,17 @@ typedef struct _uart_socket_t
 	/* Used for UART RX */
 	u32 rx_start;
 	//u32 rx_bytes;
-	u32 prxread;
-	u32 prxwrite;
-	u32 rxoverlap;
+	rx_ring_t rx;
 	u32 last_update;  //tick count when rx byte
+	u32 rx_frame_off;	//bytes of the frame being received, counted from its STC
+	u32 rx_frame_need;	//whole length of that frame once its header is in, 0 before
+	u32 rx_dma_len;		//length of the rx DMA transfer in flight, 0 when none
+	u32 rx_deadline;	//tick by which that transfer should be done, it stalled after that
+	u32 rx_byte_us;		//line time of one character
+	u8 *rx_dma_buf;		//where it lands, rx_spill when the ring was full
+	u8 rx_spill[16];	//sink for bytes that find the ring full
 	u8 recv_buf[UART_RECV_BUFFER_LEN];
+	uart_frame_parser frame;
 
 	u32 tx_start;
 	u32 tx_bytes;
@@ -46,5 +79,7 @@ uart_socket_t* uart_open(uart_set_str *puartpara);
 int uart_close(uart_socket_t *u);
 int uart_read(uart_socket_t *u, void *read_buf, size_t size);
 int uart_write(uart_socket_t *u, void *pbuf, size_t size);
+int uart_writev(uart_socket_t *u, const uart_iovec *iov, int iovcnt);
+void *uart_get_frame(uart_socket_t *u);
 
 #endif //__UART_SOCKET_H_
@@ -7,6 +7,7 @@
 #include "phytrex_update.h"
 #include "flash_api.h"
 #include "update.h"
+#include "ota_pipe.h"
 #include "other/outlet/outlet.h"
 
 #define OFFSET_DATA		FLASH_SYSTEM_DATA_ADDR
@@ -14,6 +15,7 @@
 #define WRITE_OTA_ADDR		1
 #define CONFIG_CUSTOM_SIGNATURE 1
 #define SWAP_UPDATE 0
+#define CLOUD_OTA_CHECKSUM	0	//1: cloud images end with the byte sum the local OTA tool attaches, a mismatch is rejected
 
 #if WRITE_OTA_ADDR
 #define BACKUP_SECTOR	(FLASH_SYSTEM_DATA_ADDR - 0x1000)
@@ -21,7 +23,6 @@
 
 #define STACK_SIZE		1024
 #define TASK_PRIORITY	tskIDLE_PRIORITY + 1
-#define BUF_SIZE		512
 #define ETH_ALEN	6
 
 typedef struct
@@ -74,6 +75,7 @@ void ota_platform_reset(void)
 int write_ota_addr_to_system_data(flash_t *flash, uint32_t ota_addr)
 {
 	uint32_t data, i = 0;
+	uint32_t buf[32];
 	//Get upgraded image 2 addr from offset
 	flash_read_word(flash, OFFSET_DATA, &data);
 	printf("\n\r[%s] data 0x%x ota_addr 0x%x", __FUNCTION__, data, ota_addr);
@@ -83,18 +85,18 @@ int write_ota_addr_to_system_data(flash_t *flash, uint32_t ota_addr)
 		//erase backup sector
 		flash_erase_sector(flash, BACKUP_SECTOR);
 		//backup system data to backup sector
-		for(i = 0; i < 0x1000; i+= 4){
-			flash_read_word(flash, OFFSET_DATA + i, &data);
+		for(i = 0; i < 0x1000; i+= sizeof(buf)){
+			flash_stream_read(flash, OFFSET_DATA + i, sizeof(buf), (uint8_t *)buf);
 			if(i == 0)
-				data = ota_addr;
-			flash_write_word(flash, BACKUP_SECTOR + i,data);
+				buf[0] = ota_addr;
+			flash_stream_write(flash, BACKUP_SECTOR + i, sizeof(buf), (uint8_t *)buf);
 		}
 		//erase system data
 		flash_erase_sector(flash, OFFSET_DATA);
 		//write data back to system data
-		for(i = 0; i < 0x1000; i+= 4){
-			flash_read_word(flash, BACKUP_SECTOR + i, &data);
-			flash_write_word(flash, OFFSET_DATA + i,data);
+		for(i = 0; i < 0x1000; i+= sizeof(buf)){
+			flash_stream_read(flash, BACKUP_SECTOR + i, sizeof(buf), (uint8_t *)buf);
+			flash_stream_write(flash, OFFSET_DATA + i, sizeof(buf), (uint8_t *)buf);
 		}
 		//erase backup sector
 		flash_erase_sector(flash, BACKUP_SECTOR);
@@ -110,9 +112,10 @@ static void update_ota_local_task(void *param)
         union { uint32_t u; unsigned char c[4]; } file_checksum;
 	int read_bytes = 0, size = 0, i = 0;
 	update_cfg_local_t *cfg = (update_cfg_local_t *)param;
-	uint32_t address, checksum = 0;
+	uint32_t checksum = 0;
 	flash_t	flash;
-	uint32_t NewImg2BlkSize = 0, NewImg2Len = 0, NewImg2Addr = 0, file_info[3];
+	ota_pipe_stats stats;
+	uint32_t NewImg2Len = 0, NewImg2Addr = 0, file_info[3];
 	uint32_t Img2Len = 0;
 	int ret = -1 ;
 	//uint8_t signature[8] = {0x38,0x31,0x39,0x35,0x38,0x37,0x31,0x31};
@@ -125,11 +128,6 @@ static void update_ota_local_task(void *param)
 	uint32_t read_custom_sig[8];
 #endif
 	printf("\n\r[%s] Update task start", __FUNCTION__);
-	buf = update_malloc(BUF_SIZE);
-	if(!buf){
-		printf("\n\r[%s] Alloc buffer failed", __FUNCTION__);
-		goto update_ota_exit;
-	}
 	// Connect socket
 	server_socket = socket(AF_INET, SOCK_STREAM, 0);
 	if(server_socket < 0){
@@ -249,16 +247,11 @@ static void update_ota_local_task(void *param)
 		
 #endif
 
-	//Erase upgraded image 2 region
+	//The upgraded image 2 region is erased by the OTA pipe ahead of the writes
 	if(NewImg2Len == 0){
 		NewImg2Len = file_info[2];
 		printf("\n\r[%s] NewImg2Len %d  ", __FUNCTION__, NewImg2Len);
-		if((int)NewImg2Len > 0){
-			NewImg2BlkSize = ((NewImg2Len - 1)/4096) + 1;
-			printf("\n\r[%s] NewImg2BlkSize %d  0x%8x", __FUNCTION__, NewImg2BlkSize, NewImg2BlkSize);
-			for( i = 0; i < NewImg2BlkSize; i++)
-				flash_erase_sector(&flash, NewImg2Addr + i * 4096);
-		}else{
+		if((int)NewImg2Len <= 0){
 			printf("\n\r[%s] Size INVALID", __FUNCTION__);
 			goto update_ota_exit;
 		}
@@ -266,49 +259,32 @@ static void update_ota_local_task(void *param)
 	
 	printf("\n\r[%s] NewImg2Addr 0x%x", __FUNCTION__, NewImg2Addr);
         
-        // reset
-        file_checksum.u = 0;
-	// Write New Image 2 sector
+	// Write New Image 2 sector, socket reads overlap with programming
 	if(NewImg2Addr != ~0x0){
-		address = NewImg2Addr;
+		if(ota_pipe_start(NewImg2Addr, NewImg2Len) < 0){
+			printf("\n\r[%s] Start OTA pipe failed", __FUNCTION__);
+			goto update_ota_exit;
+		}
 		printf("\n\r");
 		while(1){
-			memset(buf, 0, BUF_SIZE);
-			read_bytes = read(server_socket, buf, BUF_SIZE);
-			if(read_bytes == 0) break; // Read end
-			if(read_bytes < 0){
+			buf = ota_pipe_acquire();
+			read_bytes = read(server_socket, buf, OTA_PIPE_SLOT_SIZE);
+			if(read_bytes <= 0){
+				ota_pipe_submit(buf, 0);
+				if(read_bytes == 0) break; // Read end
 				printf("\n\r[%s] Read socket failed", __FUNCTION__);
+				ota_pipe_finish(NULL);
 				goto update_ota_exit;
 			}
-				checksum += file_checksum.c[0];              // not read end, this is not attached checksum
-				checksum += file_checksum.c[1];
-				checksum += file_checksum.c[2];
-				checksum += file_checksum.c[3];
-			//printf("\n\r[%s] read_bytes %d", __FUNCTION__, read_bytes);
-			
-			#if 1
-			if(flash_stream_write(&flash, address + size, read_bytes, buf) < 0){
-				printf("\n\r[%s] Write sector failed", __FUNCTION__);
-				goto update_ota_exit;
-			}
-			size += read_bytes;
-			for(i = 0; i < read_bytes-4; i ++)
-				checksum += buf[i];
-			file_checksum.c[0] = buf[read_bytes-4];      // checksum attached at file end
-			file_checksum.c[1] = buf[read_bytes-3];
-			file_checksum.c[2] = buf[read_bytes-2];
-			file_checksum.c[3] = buf[read_bytes-1];
-			#else
-			size += read_bytes;
-			for(i = 0; i < read_bytes-4; i ++){
-				checksum += buf[i];				
-			}	
-			file_checksum.c[0] = buf[read_bytes-4];      // checksum attached at file end
-			file_checksum.c[1] = buf[read_bytes-3];
-			file_checksum.c[2] = buf[read_bytes-2];
-			file_checksum.c[3] = buf[read_bytes-1];
-			#endif			
+			ota_pipe_submit(buf, read_bytes);
 		}
+		if(ota_pipe_finish(&stats) < 0){
+			printf("\n\r[%s] Write sector failed", __FUNCTION__);
+			goto update_ota_exit;
+		}
+		size = stats.bytes;
+		checksum = stats.sum;                        // checksum attached at file end is not counted
+		file_checksum.u = stats.tail;
 		printf("\n\r");
 		printf("\n\rUpdate file size = %d  checksum 0x%x  attached checksum 0x%x", size, checksum, file_checksum.u);
 #if CONFIG_WRITE_MAC_TO_FLASH
@@ -357,8 +333,6 @@ static void update_ota_local_task(void *param)
 		}
 	}
 update_ota_exit:
-	if(buf)
-		update_free(buf);
 	if(server_socket >= 0)
 		close(server_socket);
 	if(param)
@@ -427,6 +401,8 @@ void ES_phytrex_update_ota_amazon_cloud_task(char *param, int len)
             *crc32_pos = NULL,
             *content_len_pos = NULL;
     char *header = NULL;
+    unsigned char *buf;
+    ota_pipe_stats stats;
 
 
     int k = 0;
@@ -452,19 +428,41 @@ void ES_phytrex_update_ota_amazon_cloud_task(char *param, int len)
         //printf("\r\nNewImg2Addr: 0x%x\n", NewImg2Addr);
         content_len = 500000;
         phytrex_ReadSwapAddr(&NewImg2Addr, &OldImg2Addr);
-        phytrex_FlashUpdateErase(NewImg2Addr, content_len);
+        // the OTA pipe erases the sectors just ahead of the writes
+        ota_pipe_finish(NULL);  // a download that never ended
+        resource_size = 0;
+        if(ota_pipe_start(NewImg2Addr, content_len) < 0) {
+        ret = 4;
+        goto update_ota_exit_1;
+        }
         //printf("\r\nNewImg2Addr: 0x%x\n", NewImg2Addr);
         //printf("\r\nOldImg2Addr: 0x%x\n", OldImg2Addr);
     }
     else if (3 == outlen)
     {
-        //CRC32 checksum
-        _crc32 = phytrex_CRC32_checksum(NewImg2Addr, resource_size);
+        //CRC32 checksum, kept by the OTA pipe while programming
+        if(ota_pipe_finish(&stats) < 0) {
+        ret = 4;
+        goto update_ota_exit_1;
+        }
+        _crc32 = stats.crc32;
+        printf("\n\rhttp content-length:    %d bytes", content_len);
+        printf("\n\rcrc32 checksum:         0x%08x", _crc32);
+        // the cloud sends no checksum of its own, only an image built with the trailer can be checked
+        printf("\n\rattached checksum:      0x%08x (0x%08x)", stats.tail, stats.sum);
+        if((stats.bytes != resource_size) || (stats.bytes <= 4)) {
+        ret = 5;
+        goto update_ota_exit_1;
+        }
+#if CLOUD_OTA_CHECKSUM
+        if(stats.tail != stats.sum) {
+        ret = 5;
+        goto update_ota_exit_1;
+        }
+#endif
         phytrex_read_version(&read_ver);
         phytrex_WriteSwapSig(NewImg2Addr, OldImg2Addr);
 
-        printf("\n\rhttp content-length:    %d bytes", content_len);
-        printf("\n\rcrc32 checksum:         0x%08x", _crc32);
         printf("\n\rfirmware revision:      %s", cur_ver.firmware);
         printf("\n\rsoftware revision:      %s", cur_ver.software);
         printf("\n\rdownload resource size: %d bytes", resource_size);
@@ -477,9 +475,19 @@ void ES_phytrex_update_ota_amazon_cloud_task(char *param, int len)
     }  
     else
     {
+        if((outlen <= 2) || (outlen-2 > OTA_PIPE_SLOT_SIZE)) {
+        ota_pipe_finish(NULL);  // an image with a gap fails anyway
+        ret = 6;
+        goto update_ota_exit_1;
+        }
         read_size = outlen-2;
-        // Write data to ota sectors
-        phytrex_FlashUpdateWrite(NewImg2Addr, resource_size, read_size, &valbuf[2]);
+        // Queue data for the ota sectors, programmed while the next chunk arrives
+        if((buf = ota_pipe_acquire()) == NULL) {
+        ret = 4;
+        goto update_ota_exit_1;
+        }
+        memcpy(buf, &valbuf[2], read_size);
+        ota_pipe_submit(buf, read_size);
         resource_size += read_size;
         printf("\rUpdate file size = %d/%d bytes  %3.1f %%",
                resource_size, content_len, (float)resource_size/(float)content_len*100.0f);
@@ -495,6 +503,15 @@ update_ota_exit_1:
     else if(ret == 3) {
     printf("\nphytrex_write_ota_addr_to_system_data ERROE\n");
     }
+    else if(ret == 4) {
+    printf("\nota_pipe ERROR\n");
+    }
+    else if(ret == 5) {
+    printf("\nota checksum ERROR, update aborted\n");
+    }
+    else if(ret == 6) {
+    printf("\nota chunk length %d ERROR, update aborted\n", outlen);
+    }
     else {
     }
     return;
@@ -513,10 +530,11 @@ void ES_mcu_ota_task(char *param, int len)
 
     if (7 == outlen)
     {
-        for(i=0;i<8;i++)
+        for(i=0;i<MCU_OTA_SIZE/0x1000;i++)
         {
             flash_erase_sector(&flash, MCU_OTA_ADDR+i*0x1000);
         }
+        size = 0;
         printf("\n\r[%s] mcu_ota_task begin\n", __FUNCTION__);
     }
     else if (3 == outlen)
@@ -398,6 +398,8 @@ error:
  */
 #define FLASH_DATA_ADDR             0xFF000
 
+extern void FlashKVErased(void);
+
 void cmd_factory_reset(int argc, char **argv)
 {
 	// Read setupcode
@@ -405,6 +407,7 @@ void cmd_factory_reset(int argc, char **argv)
 	FlashSetupcodeRead(setup_code);
 
 	flash_erase_sector(&flash, FLASH_DATA_ADDR);
+	FlashKVErased();
 
 	// Restore setupcode
 	if(strlen(setup_code) == 10)
@@ -16,16 +16,20 @@ enum RXTX_STATUS
     PLC_RX=0x00,PLC_TX=0x01,RS485_RX=0x02,RS485_TX=0x03,NO_STATUS
 };
 
-uint8 checksum (uint8 *data,uint8 len);
-void mymemcpy(void *dst,void *src,uint8 len);
+uint8 checksum (uint8 *data,uint16 len);
+uint8 sum (unsigned char *data,uint16 len);
+void mymemcpy(void *dst,const void *src,uint16 len);
 //void push_rxtx_status(enum RXTX_STATUS status);
 //uint8 get_rxtx_status(void);
-uint8 memcmp_my(const void *s1, const void *s2, uint8 n);
-void memset_my(void *s1, uint8 value, uint8 n);
-void* memmove_my(void* dest, void* source, uint16 n);
-uint8 is_all_xx(const void *s1, uint8 value, uint8 n);
+uint8 memcmp_my(const void *s1, const void *s2, uint16 n);
+void memset_my(void *s1, uint8 value, uint16 n);
+void* memmove_my(void* dest, const void* source, uint16 n);
+uint8 is_all_xx(const void *s1, uint8 value, uint16 n);
 uint8 find_max(uint8 buf[], uint8 n);
 //uint16 sp_crc16(const uint8 *buf, uint8 size);
-uint16 sp_crc16_with_init(uint16 crc, const uint8 *buf, uint8 size);
+uint16 sp_crc16_with_init(uint16 crc, const uint8 *buf, uint16 size);
+uint8 bcd2bin(uint8 val);
+uint8 bin2bcd(uint8 val);
 void numeric2bcd(uint32 value,uint8 *bcd, uint8 bytes);
+uint32 bcd2numeric(uint8 *bcd, uint8 bytes);
 #endif
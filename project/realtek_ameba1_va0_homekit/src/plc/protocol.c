@@ -8,46 +8,6 @@ extern outlet_state outletstateB;
 
 //DATA_SEG struct RAM;                  //ڴ15ֽ
 
-/**************************************
-    жǷܵһ֡
-    output:		_TRUE, _FALSE
- 
- 7e 7e 00 00 00 01 00 00 00 02 72 04 02 02 02 02 cs
-**************************************/
-struct SHS_frame *get_smart_frame(uint8 rxframe_raw[],uint8 rxlen)
-{
-	struct SHS_frame *pframe;
-    uint8 i=0;
-    uint8 len;
-
-start_lbl:
-    while(i < rxlen)
-    {
-        if(STC == rxframe_raw[i]) break;
-        i++;
-    }
-//   if(i >= rxlen) return(NULL);
-    if(rxlen-i < SHS_FRAME_HEAD) return(NULL);//յȴlength
-    pframe = (struct SHS_frame*)&rxframe_raw[i];
-    len = pframe->length;
-
-    if(i+SHS_FRAME_HEAD+len+1 > rxlen)    
-    {
-        i++;
-        goto start_lbl;
-    }
-
-    if(pframe->infor[len] != checksum((uint8 *)pframe, len+SHS_FRAME_HEAD))
-    {
-        i++;
-        goto start_lbl;
-    }
-//    uart_read(rxframe_raw, i+SHS_FRAME_HEAD+len+1);
-//    mymemcpy(&rxframe_raw[0], &rxframe_raw[i], SHS_FRAME_HEAD+len+1);
-    pframe = (struct SHS_frame*)&rxframe_raw[i];
-	return(pframe);
-}
-
 /*************************************************
                 ȡ豸
 *************************************************/
@@ -446,9 +406,6 @@ static uint8 set_password(uint8 *buff, uint8 w_len)
 
 static uint8 set_onoff(uint8 *buff, uint8 w_len)
 {
-    if (w_len != 0x02) {
-        return(DATA_ERR);
-    }
     
     if (0x01 == buff[0]) {
         outletstateA.on = buff[1];
@@ -456,7 +413,7 @@ static uint8 set_onoff(uint8 *buff, uint8 w_len)
         outletstateB.on = buff[1];
     }
     
-    //HAPoutletNotify((int)buff[0],(int)buff[1]);
+    outlet_notify(buff[0], OUTLET_CHA_ON);
     return(0);
 }
 
@@ -472,6 +429,7 @@ static uint8 set_resetdefault(uint8 *buff, uint8 w_len)
 {
     wait(2);
     phytrex_reset(2);
+    FlashKVErased();     //in case the reset returns without a reboot
     return(0);
 }
 
@@ -480,10 +438,8 @@ static uint8 set_meter(uint8 *buff, uint8 w_len)
     float voltage = 0;
     float current = 0;
     float power = 0;
+    uint8 alarm = buff[1];
 
-    if (w_len != 10) {
-        return(DATA_ERR);
-    }
     voltage = bcd2bin(buff[2])/10.0+bcd2bin(buff[3])*10.0;
     current = bcd2bin(buff[4])/1000.0+bcd2bin(buff[5])/10.0+bcd2bin(buff[6])*10.0;
     power = bcd2bin(buff[7])/10000.0+bcd2bin(buff[8])/100.0+bcd2bin(buff[9]);
@@ -493,17 +449,22 @@ static uint8 set_meter(uint8 *buff, uint8 w_len)
         outletstateA.metvol = voltage;
         outletstateA.metcur = current;
         outletstateA.metpow = power;
+        alarm = outletstateA.alarm;
         outletstateA.alarm = buff[1];
     }else if (0x02 == buff[0]) {
         outletstateB.metvol = voltage;
         outletstateB.metcur = current;
         outletstateB.metpow = power;
+        alarm = outletstateB.alarm;
         outletstateB.alarm = buff[1];
     }
 
-    //HAPmetvolNotify((int)buff[0], (double)voltage);
-    //HAPmetcurNotify((int)buff[0], (double)current);
-    //HAPmetpowNotify((int)buff[0], (double)power);
+    // HAPNotifyHandle pushes and reports an alarm as it arrives
+    if (alarm != buff[1]) outlet_post_event(OUTLET_EVT_ALARM, buff[0]);
+
+    outlet_notify(buff[0], OUTLET_CHA_METVOL);
+    outlet_notify(buff[0], OUTLET_CHA_METCUR);
+    outlet_notify(buff[0], OUTLET_CHA_METPOW);
     
     return(0);
 }
@@ -513,9 +474,6 @@ static uint8 set_hisdata(uint8 *buff, uint8 w_len)
 {
     hisdata_state reporthisdata;
     
-    if (w_len != 0x07) {
-        return(DATA_ERR);
-    }
     reporthisdata.channel = buff[0];
     reporthisdata.year = bcd2bin(buff[1]);
     reporthisdata.mon = bcd2bin(buff[2]);
@@ -531,9 +489,6 @@ static uint8 set_hisdata(uint8 *buff, uint8 w_len)
 {
     hisdata_state reporthisdata;
     
-    if (w_len != 0x06) {
-        return(DATA_ERR);
-    }
     reporthisdata.channel = buff[0];
     reporthisdata.year = bcd2bin(buff[1]);
     reporthisdata.mon = bcd2bin(buff[2]);
@@ -549,9 +504,6 @@ static uint8 set_thrvol(uint8 *buff, uint8 w_len)
     float overvoltage = 0;
     float undervoltage = 0;
     
-    if (w_len != 0x05) {
-        return(DATA_ERR);
-    }
     overvoltage = bcd2bin(buff[1])/10.0+bcd2bin(buff[2])*10.0;
     undervoltage = bcd2bin(buff[3])/10.0+bcd2bin(buff[4])*10.0;
 
@@ -563,16 +515,14 @@ static uint8 set_thrvol(uint8 *buff, uint8 w_len)
         outletstateB.thrvol_under = undervoltage;
     }
     
-    //HAPthrvolNotify((int)buff[0], (double)overvoltage, (double)undervoltage);
+    outlet_notify(buff[0], OUTLET_CHA_THRVOL_OVER);
+    outlet_notify(buff[0], OUTLET_CHA_THRVOL_UNDER);
     return(0);
 }
 
 static uint8 set_thrcur(uint8 *buff, uint8 w_len)
 {
     float current = 0;
-    if (w_len != 0x04) {
-        return(DATA_ERR);
-    }
     current = bcd2bin(buff[1])/1000.0+bcd2bin(buff[2])/10.0+bcd2bin(buff[3])*10.0;
 
     if (0x01 == buff[0]) {
@@ -580,16 +530,13 @@ static uint8 set_thrcur(uint8 *buff, uint8 w_len)
     }else if (0x02 == buff[0]) {
         outletstateB.thrcur = current;
     }
-    //HAPthrcurNotify((int)buff[0], (double)current);
+    outlet_notify(buff[0], OUTLET_CHA_THRCUR);
     return(0);
 }
 
 static uint8 set_thrpow(uint8 *buff, uint8 w_len)
 {
     float power = 0;
-    if (w_len != 0x04) {
-        return(DATA_ERR);
-    }
     power = bcd2bin(buff[1])/10000.0+bcd2bin(buff[2])/100.0+bcd2bin(buff[3]);
 
     if (0x01 == buff[0]) {
@@ -598,16 +545,13 @@ static uint8 set_thrpow(uint8 *buff, uint8 w_len)
         outletstateB.thrpow = power;
     }
     
-    //HAPthrpowNotify((int)buff[0], (double)power);
+    outlet_notify(buff[0], OUTLET_CHA_THRPOW);
     return(0);
 }
 
 static uint8 set_metqua(uint8 *buff, uint8 w_len)
 {
     float tatalquan = 0;
-    if (w_len != 0x05) {
-        return(DATA_ERR);
-    }
     tatalquan = bcd2bin(buff[1])/100.0+bcd2bin(buff[2])+bcd2bin(buff[3])*100+bcd2bin(buff[4])*10000;
 
     if (0x01 == buff[0]) {
@@ -616,7 +560,7 @@ static uint8 set_metqua(uint8 *buff, uint8 w_len)
         outletstateB.metqua = tatalquan;
     }
     
-    //HAPmetquaNotify((int)buff[0], (double)tatalquan);
+    outlet_notify(buff[0], OUTLET_CHA_METQUA);
     return(0);
 }
 
@@ -625,37 +569,67 @@ static uint8 set_alarmenable(uint8 *buff, uint8 max_len)
     return(0);
 }
 
-#define scat_flag(f) {(uint8)(f), (uint8)(f>>8)}
+#if HISDATA_15_MIN
+#define HISDATA_LEN     0x07
+#else
+#define HISDATA_LEN     0x06
+#endif
+/**************************************
+    sorted by did, find_item() bisects it,
+    write data outside min_len..max_len is answered with DATA_ERR before the handler runs
+**************************************/
 const struct func_ops func_items[]=
 {
-	//di,r_len,w_len, read, write
-    {scat_flag(0x0001), get_device_type, NULL},
-    {scat_flag(0x0002), get_soft_ver,    NULL},
-    {scat_flag(0x0003), get_dev_infor,   NULL},
-    {scat_flag(0x0005), get_dkey,        NULL},
-    {scat_flag(0x0006), get_device_attribute,   NULL},
-    {scat_flag(0x0007), get_sn,          NULL},
-    {scat_flag(0x9010), NULL,          set_metqua},
-    {scat_flag(0x9400), NULL,          set_hisdata},
-    {scat_flag(0xB511), NULL,          set_thrvol},
-    {scat_flag(0xB521), NULL,          set_thrcur},
-    {scat_flag(0xB530), NULL,          set_thrpow},
-    {scat_flag(0xB53F), NULL,          set_meter},
-    {scat_flag(0xC011), NULL,          get_time},
-    {scat_flag(0xC012), NULL,          set_onoff},
-    {scat_flag(0xC003), NULL,          NULL},
-    {scat_flag(0xC004), NULL,          NULL},
-    {scat_flag(0xC005), NULL,          set_resetdefault},    
-    {scat_flag(0xB624), NULL,          set_alarmenable}, 
+    //did,  min_len, max_len, flags,  read, write
+    {0x0001, 0, 0,    0,  get_device_type,      NULL},
+    {0x0002, 0, 0,    0,  get_soft_ver,         NULL},
+    {0x0003, 0, 0,    0,  get_dev_infor,        NULL},
+    {0x0005, 0, 0,    0,  get_dkey,             NULL},
+    {0x0006, 0, 0,    0,  get_device_attribute, NULL},
+    {0x0007, 0, 0,    0,  get_sn,               NULL},
+    {DID_METQUA, 5, 5,    0,  NULL,   set_metqua},
+    {0x9400, HISDATA_LEN, HISDATA_LEN,    0,  NULL,   set_hisdata},
+    {DID_THRVOL, 5, 5,    0,  NULL,   set_thrvol},
+    {DID_THRCUR, 4, 4,    0,  NULL,   set_thrcur},
+    {DID_THRPOW, 4, 4,    0,  NULL,   set_thrpow},
+    {DID_METER, 10, 10,   0,  NULL,   set_meter},
+    {0xB624, 0, 0x7F, 0,  NULL,   set_alarmenable},
+    {0xC005, 0, 0x7F, FUNC_NO_GROUP,  NULL,   set_resetdefault},
+    {0xC011, 0, 0x7F, 0,  NULL,   get_time},
+    {DID_ONOFF, 2, 2,     0,  NULL,   set_onoff},
 };
 #define	METER_ITEM_MAX		ARRAY_SIZE(func_items)
+
+static const struct func_ops *find_item(const uint8 did[2])
+{
+    uint16 key = did[0] | ((uint16)did[1] << 8);
+    uint8 lo = 0, hi = METER_ITEM_MAX, mid;
+
+    while (lo < hi)
+    {
+        mid = (lo + hi) >> 1;
+        if (func_items[mid].did == key) return(&func_items[mid]);
+        if (func_items[mid].did < key) lo = mid + 1;
+        else hi = mid;
+    }
+    return(NULL);
+}
+
+/* NO_ERR, CHG_DID|len or the error code of the item */
+static uint8 write_item(const struct func_ops *item, uint8 *buff, uint8 w_len)
+{
+    if ((NULL == item) || (NULL == item->write)) return(DID_ERR);
+    if ((w_len < item->min_len) || (w_len > item->max_len)) return(DATA_ERR);
+    return(item->write(buff, w_len));
+}
+
 /**************************************
 ݱ־ִӦĹ
 **************************************/
 #define DATA_LEN(pframe)    (pframe->ctrl&0x7F)
 uint8 set_parameter(uint8 data[], uint8 len)
 {
-	uint8 i,ret;
+	uint8 ret;
     struct FBD_Frame *pframe;
     uint8 *pw,*pr;
 
@@ -682,43 +656,78 @@ uint8 set_parameter(uint8 data[], uint8 len)
         len -=FBD_FRAME_HEAD + DATA_LEN(pframe);
         pr += FBD_FRAME_HEAD + DATA_LEN(pframe);
         
-        for(i=0; i< METER_ITEM_MAX; i++)
-        {
-            if(memcmp_my(pframe->did,func_items[i].di,2) == 0) break;
+        ret = write_item(find_item(pframe->did), pframe->data, DATA_LEN(pframe));//úָ(ֿ)
+        if(CHG_DID & ret)
+        {//޸did
+            ret &= 0x7f;
+            mymemcpy(pframe, pframe->data, ret);
+            ret -= 2;
+            pw += ret;            
         }
-        //printf("id : %d  did : 0x%02x%02x\n",i,pframe->did[1],pframe->did[0]);
-        if((i >= METER_ITEM_MAX) || (NULL == func_items[i].write ))
+        else if(NO_ERR != ret)
         {
             *(pw++) = 0x82;
-            *(pw++) = DID_ERR;
+            *(pw++) = ret;
             *(pw++) = 0x00;
         }
         else
-        {//úָ(ֿ)
-            ret = func_items[i].write(pframe->data, DATA_LEN(pframe));
-            if(CHG_DID & ret)
-            {//޸did
-                ret &= 0x7f;
-                mymemcpy(pframe, pframe->data, ret);
-                ret -= 2;
-                pw += ret;            
-            }
-            else if(NO_ERR != ret)
-            {
-                *(pw++) = 0x82;
-                *(pw++) = ret;
-                *(pw++) = 0x00;
-            }
-            else
-            {
-                ret = DATA_LEN(pframe)+1;//ݳ
-                pw += ret;
-            }
+        {
+            ret = DATA_LEN(pframe)+1;//ݳ
+            pw += ret;
         }
     } 
     return(pw-data);
 }
 
+/**************************************
+    batched read of several dids for several channels in one frame,
+    the items go did-major, channel-minor like getMCU_onoff_meter()
+    output: length of the infor part, 0 when it does not fit
+**************************************/
+uint8 build_read_batch(uint8 buff[], uint8 max_len, const uint16 dids[], uint8 did_num, uint8 channels)
+{
+    uint8 i, cc, len = 0;
+
+    if (max_len < 1) return(0);
+    buff[len++] = CMD_READ;
+    for (i = 0; i < did_num; i++)
+    {
+        for (cc = 1; cc <= OUTLET_CHANNELS; cc++)
+        {
+            if (!(channels & (0x01 << (cc-1)))) continue;
+            if (len + FBD_FRAME_HEAD + 2 > max_len) return(0);
+            buff[len++] = (uint8)dids[i];
+            buff[len++] = (uint8)(dids[i] >> 8);
+            buff[len++] = 0x02;
+            buff[len++] = cc;
+            buff[len++] = 0x00;
+        }
+    }
+    return(len);
+}
+
+/**************************************
+    hand every did of a reply to its write function in one pass,
+    no reply is built, so the frame is left untouched
+    output: number of items handled
+**************************************/
+uint8 scatter_parameter(uint8 data[], uint8 len)
+{
+    uint8 n = 0;
+    struct FBD_Frame *pframe;
+
+    while (len >= FBD_FRAME_HEAD)
+    {
+        pframe = (struct FBD_Frame *)data;
+        if (len < FBD_FRAME_HEAD + DATA_LEN(pframe)) break;
+
+        if (NO_ERR == write_item(find_item(pframe->did), pframe->data, DATA_LEN(pframe))) n++;
+        data += FBD_FRAME_HEAD + DATA_LEN(pframe);
+        len -= FBD_FRAME_HEAD + DATA_LEN(pframe);
+    }
+    return(n);
+}
+
 #define GROUP_LEN       0x3F
 static uint8 is_gid_equal(uint8 data[])
 {
@@ -760,7 +769,8 @@ static uint8 is_gid_equal(uint8 data[])
 
 uint8 set_group_parameter(uint8 data[], uint8 len)
 {
-    uint8 i,j,gid_len,fbd_len;
+    uint8 j,gid_len,fbd_len;
+    const struct func_ops *item;
     struct FBD_Frame *pframe;
 
     j = 0;
@@ -773,13 +783,10 @@ uint8 set_group_parameter(uint8 data[], uint8 len)
 
         if (is_gid_equal(&data[j]))
         {
-            for (i=0; i< METER_ITEM_MAX; i++)
-            {
-                if (memcmp_my(pframe->did,func_items[i].di,2) == 0) break;
-            }
-            if ((i < METER_ITEM_MAX) && (NULL != func_items[i].write ))
+            item = find_item(pframe->did);
+            if ((NULL != item) && !(item->flags & FUNC_NO_GROUP))
             {//úָ(ֿ)
-                func_items[i].write(pframe->data, DATA_LEN(pframe));
+                write_item(item, pframe->data, DATA_LEN(pframe));
             }
         }
 
@@ -795,7 +802,8 @@ uint8 set_group_parameter(uint8 data[], uint8 len)
 **************************************/
 uint8 read_parameter(uint8 data[], uint8 len)
 {
-    uint8 i, ret;
+    uint8 ret;
+    const struct func_ops *item;
     struct FBD_Frame *pframe;
     uint8 *pw,*pr;
 
@@ -822,11 +830,8 @@ uint8 read_parameter(uint8 data[], uint8 len)
         len -=FBD_FRAME_HEAD + DATA_LEN(pframe);
         pr += FBD_FRAME_HEAD + DATA_LEN(pframe);
 
-        for(i=0; i<METER_ITEM_MAX; i++)
-        {
-            if(memcmp_my(pframe->did,func_items[i].di,2) == 0) break;
-        }
-        if((i >= METER_ITEM_MAX) || (func_items[i].read == NULL))
+        item = find_item(pframe->did);
+        if((NULL == item) || (item->read == NULL))
         {
             *(pw++) = 0x82;
             *(pw++) = DID_ERR;
@@ -834,7 +839,7 @@ uint8 read_parameter(uint8 data[], uint8 len)
         }
         else
         {
-            ret= func_items[i].read(pw, (uint8)(pr-(pw+1)));
+            ret= item->read(pw, (uint8)(pr-(pw+1)));
             if(0x00 == ret) //ݷ0ܵ¶ȡûݱʶݳΪ1ı!?
             {
                 pw -= 2;
@@ -880,7 +885,7 @@ uint8 _get_dev_infor(uint8* buff)
 
 static uint8 get_device_attribute(uint8 *buff, uint8 max_len)
 {
-    uint8 len;
+    uint8 len = 0;     //nothing to report while the EEPROM read is out
 #if 0
     EEP_Read(ENCODE_PARAM_ADDR+ENCODE_LEN,(uint8 *)&len, 1);
     //if((len < 1) || (len > max_len)) return(0);
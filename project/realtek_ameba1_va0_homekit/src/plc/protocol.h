@@ -20,10 +20,14 @@ struct EEP_PARAM
 
 struct func_ops
 {
-    uint8	di[2];                       //ݱ־
+    uint16  did;                         //func_items[] is sorted by it
+    uint8   min_len;                     //write data length accepted
+    uint8   max_len;
+    uint8   flags;
 	uint8	(*read)(uint8 *buff, uint8 max_len);//ִк
     uint8	(*write)(uint8 *buff, uint8 w_len);//дִк
 };
+#define FUNC_NO_GROUP   0x01        //not taken from group frames
 
 struct FBD_Frame
 {
@@ -70,6 +74,17 @@ struct SHS_frame
 };
 
 #define SHS_FRAME_HEAD       offset_of(struct SHS_frame, infor)
+
+//dids of the metering MCU
+#define DID_ONOFF       0xC012
+#define DID_METER       0xB53F      //voltage, current and power
+#define DID_THRPOW      0xB530
+#define DID_THRCUR      0xB521
+#define DID_THRVOL      0xB511
+#define DID_METQUA      0x9010
+
+#define OUTLET_CHANNELS     2
+#define CHANNEL_ALL         0x03
 extern const struct func_ops func_items[];
 //extern DATA_SEG struct RAM  ram;
 
@@ -85,9 +100,10 @@ void dimmer_100ms_hook(void);
 #if COLOR_DIMMER 
 void clour_dimmer_hook(void);
 #endif
-struct SHS_frame *get_smart_frame(uint8 rxframe_raw[],uint8 rxlen);
 uint8 set_group_parameter(uint8 data[], uint8 len);
 uint8 set_parameter(uint8 data[], uint8 len);
+uint8 build_read_batch(uint8 buff[], uint8 max_len, const uint16 dids[], uint8 did_num, uint8 channels);
+uint8 scatter_parameter(uint8 data[], uint8 len);
 uint8 read_parameter(uint8 data[], uint8 len);
 void _get_dev_type(uint8 *buff);
 #endif
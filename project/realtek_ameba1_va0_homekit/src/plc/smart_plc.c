@@ -1,13 +1,10 @@
 #include "config.h"
 #include "protocol.h"
 #include "uart_socket.h"
+#include "semphr.h"
 #include "rtc_api.h"
 #include <time.h>
 #include "other/outlet/outlet.h"
-/*
-бжϺʹ32λʱstm8Ƭ⣡
-*/
-uint16 task_monitor = 0;
 /* 
         bit0~bit6: event type   bit0:      relay status change
                                 bit1:      adjust light 
@@ -23,6 +20,12 @@ struct PLC_MACHINE  plc_state;
 extern uart_socket_t *uart_socket;
 
 static uint8 rst_plc_t = 0;
+static xQueueHandle plc_evt_queue = NULL;
+static uint32 plc_state_t0;         //tick (ms) the current state was entered at
+static void plc_event_thread(void *param);
+#define PLC_EVENT_STACK_SIZE    512
+#define PLC_EVENT_PRIORITY      1
+#define PLC_MIN_PERIOD          60000   //ms, chk_plc_alive()
 #define clear_rst_time(pframe)        do{if(CMD_ACK_EID == pframe->infor[0]) rst_plc_t = 0;}while(0)
 
 #define MAX_OVERTIME    (plc_state.trycnt+5)
@@ -72,31 +75,289 @@ static uint8 reset_plc(uint8 init, void *args)
     {
         SET_PIN_H(PLC_RESET_PORT, PLC_RESET_PIN);
     }
+#endif
     if(plc_state.wait_t >= MIN_PLC_RUN)
     {
         next_state();
     }
-#endif
     return(0);
 }
-void init_frame_head(struct SHS_frame * pframe)
+/**************************************************************** 
+    local frames
+    the head of every frame to the MCU is the same apart from seq and
+    length, it is copied from a const template and patched in place.
+    The checksum starts from the template's and adds the patched
+    fields and the infor, the infor never has to be moved behind a
+    head, the pieces are gathered by uart_writev().
+****************************************************************/
+static const uint8 local_frame_tpl[] =
 {
-    pframe->stc = STC;
-    memset_my(pframe->said, 0x00, ADDRESS_LEN);
-    memset_my(pframe->taid, 0x11, ADDRESS_LEN);
-    pframe->seq = 0;
+    STC,
+    0x00, 0x00, 0x00, 0x00,     //said
+    0x11, 0x11, 0x11, 0x11,     //taid
+    0x00,                       //seq
+    0x00                        //length
+};
+#define LOCAL_FRAME_SUM     ((uint8)(STC+4*0x11))   //checksum of the template
+
+//head with seq and length patched, returns the frame checksum for infor_sum
+static uint8 local_frame_head(uint8 head[], uint8 seq, uint8 len, uint8 infor_sum)
+{
+    memcpy(head, local_frame_tpl, SHS_FRAME_HEAD);
+    head[offset_of(struct SHS_frame, seq)] = seq;
+    head[offset_of(struct SHS_frame, length)] = len;
+    return((uint8)(LOCAL_FRAME_SUM + seq + len + infor_sum));
+}
+
+static void write_local_frame(const uint8 head[], const uint8 infor[], uint8 len, const uint8 *cs)
+{
+    uart_iovec iov[3];
+
+    iov[0].base = head;
+    iov[0].len = SHS_FRAME_HEAD;
+    iov[1].base = infor;
+    iov[1].len = len;
+    iov[2].base = cs;
+    iov[2].len = 1;
+    if (uart_socket != NULL) uart_writev(uart_socket, iov, 3);
 }
 
+//buffer holds the infor part
 static void send_local_frame(uint8 buffer[], uint8 len)
 {
-    struct SHS_frame *pframe = (struct SHS_frame *)buffer;
+    uint8 head[SHS_FRAME_HEAD], cs;
 
-    memmove_my(&buffer[offset_of(struct SHS_frame, infor)], buffer, len);
-    init_frame_head(pframe);
-    pframe->length = len;
-    pframe->infor[len] = checksum((uint8 *)pframe, SHS_FRAME_HEAD+len);
+    cs = local_frame_head(head, 0, len, checksum(buffer, len));
+    write_local_frame(head, buffer, len, &cs);
+}
+
+/**************************************************************** 
+    metering MCU commands
+    every request is tagged with its own seq and kept in a slot until the
+    reply comes back, so several can be in flight and are retried on timeout
+****************************************************************/
+#define MCU_CMD_SLOTS       4
+#define MCU_CMD_LEN         (61+SHS_FRAME_HEAD+1)   //longest request, getMCU_onoff_meter
+#define MCU_CMD_TIMEOUT     300                     //ms per try
+#define MCU_CMD_RETRY       3
+
+#define MCU_CMD_PENDING     0
+#define MCU_CMD_REPLIED     1
+#define MCU_CMD_FAILED      2
+#define MCU_CMD_HELD        3       //waits for mcu_cmd_flush()
+#define MCU_CMD_FLUSHING    4       //being copied into a burst
+
+struct MCU_CMD
+{
+    uint8 seq;              //0: slot free
+    uint8 wait;             //a caller collects the result with mcu_cmd_wait()
+    uint8 state;
+    uint8 retry;
+    uint8 len;
+    uint32 due;             //ms
+    xSemaphoreHandle done;
+    uint8 frame[MCU_CMD_LEN];
+};
+
+static struct MCU_CMD mcu_cmd[MCU_CMD_SLOTS];
+static uint8 mcu_seq = 0;
+
+#define mcu_now()       (xTaskGetTickCount() * portTICK_RATE_MS)
 
-    uart_write(uart_socket, buffer, SHS_FRAME_HEAD+len+1);
+void mcu_cmd_init(void)
+{
+    uint8 i;
+
+    for (i = 0; i < MCU_CMD_SLOTS; i++)
+    {
+        if (mcu_cmd[i].done == NULL) mcu_cmd[i].done = xSemaphoreCreateBinary();
+    }
+}
+
+//called with the scheduler locked, returns the semaphore to give
+static xSemaphoreHandle mcu_cmd_finish(struct MCU_CMD *pcmd, uint8 state)
+{
+    pcmd->state = state;
+    if (pcmd->wait) return(pcmd->done);
+    pcmd->seq = 0;
+    return(NULL);
+}
+
+/*
+ * Send a request, buffer holds the infor part.
+ * With MCU_WAIT the return value is the handle for mcu_cmd_wait(), -1 when no slot was free
+ * and the request went out untracked.
+ * With MCU_HOLD the request only takes its slot, the next mcu_cmd_flush() sends all held
+ * requests back to back in one uart write.
+ */
+int mcu_cmd_send(uint8 buffer[], uint8 len, uint8 wait)
+{
+    struct MCU_CMD *pcmd = NULL;
+    uint8 head[SHS_FRAME_HEAD], sum, cs = 0;
+    uint8 i;
+
+    sum = checksum(buffer, len);
+
+    taskENTER_CRITICAL();
+    for (i = 0; (len+SHS_FRAME_HEAD+1 <= MCU_CMD_LEN) && (i < MCU_CMD_SLOTS); i++)
+    {
+        if ((0 == mcu_cmd[i].seq) && (mcu_cmd[i].done != NULL))
+        {
+            pcmd = &mcu_cmd[i];
+            break;
+        }
+    }
+    if (pcmd != NULL)
+    {
+        if (++mcu_seq > 0x7F) mcu_seq = 1;
+        cs = local_frame_head(pcmd->frame, mcu_seq, len, sum);
+        memcpy(&pcmd->frame[SHS_FRAME_HEAD], buffer, len);
+        pcmd->frame[SHS_FRAME_HEAD+len] = cs;
+        pcmd->seq = mcu_seq;
+        pcmd->wait = wait & MCU_WAIT;
+        pcmd->state = (wait & MCU_HOLD) ? MCU_CMD_HELD : MCU_CMD_PENDING;
+        pcmd->retry = 0;
+        pcmd->len = SHS_FRAME_HEAD+len+1;
+        pcmd->due = mcu_now() + MCU_CMD_TIMEOUT;
+        xSemaphoreTake(pcmd->done, 0);
+        if (MCU_CMD_PENDING == pcmd->state) memcpy(head, pcmd->frame, SHS_FRAME_HEAD);
+    }
+    taskEXIT_CRITICAL();
+
+    if (pcmd == NULL)
+    {
+        cs = local_frame_head(head, 0, len, sum);
+        write_local_frame(head, buffer, len, &cs);
+        return(-1);
+    }
+    //before the uart is open the slot is sent by mcu_cmd_poll()
+    if (MCU_CMD_PENDING == pcmd->state) write_local_frame(head, buffer, len, &cs);
+    return((wait & MCU_WAIT) ? (pcmd - mcu_cmd) : 0);
+}
+
+//send the held requests, as many as fit the uart send buffer go out in one write
+void mcu_cmd_flush(void)
+{
+    uart_iovec iov[MCU_CMD_SLOTS];
+    uint8 slot[MCU_CMD_SLOTS];
+    uint32 now;
+    uint16 size = 0;
+    uint8 i, n = 0;
+
+    if (uart_socket == NULL) return;
+
+    //a flushing slot is neither matched to replies nor retried, so it stays put while it is copied
+    taskENTER_CRITICAL();
+    for (i = 0; i < MCU_CMD_SLOTS; i++)
+    {
+        if (!mcu_cmd[i].seq || (mcu_cmd[i].state != MCU_CMD_HELD)) continue;
+        if (size + mcu_cmd[i].len > UART_SEND_BUFFER_LEN) break;
+        mcu_cmd[i].state = MCU_CMD_FLUSHING;
+        iov[n].base = mcu_cmd[i].frame;
+        iov[n].len = mcu_cmd[i].len;
+        size += mcu_cmd[i].len;
+        slot[n++] = i;
+    }
+    taskEXIT_CRITICAL();
+    if (0 == n) return;
+
+    uart_writev(uart_socket, iov, n);
+
+    now = mcu_now();
+    taskENTER_CRITICAL();
+    for (i = 0; i < n; i++)
+    {
+        mcu_cmd[slot[i]].state = MCU_CMD_PENDING;
+        mcu_cmd[slot[i]].due = now + MCU_CMD_TIMEOUT;
+    }
+    taskEXIT_CRITICAL();
+}
+
+//0 replied, -1 no reply after all retries
+int mcu_cmd_wait(int handle)
+{
+    struct MCU_CMD *pcmd;
+    int ret = -1;
+
+    if ((handle < 0) || (handle >= MCU_CMD_SLOTS) || !mcu_cmd[handle].wait) return(-1);
+    pcmd = &mcu_cmd[handle];
+    xSemaphoreTake(pcmd->done, MCU_CMD_TIMEOUT*(MCU_CMD_RETRY+2)/portTICK_RATE_MS);
+
+    taskENTER_CRITICAL();
+    if (MCU_CMD_REPLIED == pcmd->state) ret = 0;
+    pcmd->seq = 0;
+    taskEXIT_CRITICAL();
+    return(ret);
+}
+
+//match a frame from the MCU to the request it answers
+void mcu_cmd_reply(struct SHS_frame *pframe)
+{
+    struct MCU_CMD *pcmd = NULL;
+    struct SHS_frame *preq;
+    xSemaphoreHandle done = NULL;
+    uint8 i;
+
+    if (pframe->length < 3) return;
+
+    taskENTER_CRITICAL();
+    for (i = 0; i < MCU_CMD_SLOTS; i++)
+    {
+        preq = (struct SHS_frame *)mcu_cmd[i].frame;
+        if ((0 == mcu_cmd[i].seq) || (mcu_cmd[i].state != MCU_CMD_PENDING)) continue;
+        if ((preq->infor[0] & 0x07) != (pframe->infor[0] & 0x07)) continue;
+        if (mcu_cmd[i].seq == (pframe->seq & 0x7F))
+        {
+            pcmd = &mcu_cmd[i];
+            break;
+        }
+        //a reply that does not echo the seq goes to the oldest request of the same did
+        if ((preq->infor[1] == pframe->infor[1]) && (preq->infor[2] == pframe->infor[2]) &&
+            ((NULL == pcmd) || ((int32)(mcu_cmd[i].due - pcmd->due) < 0)))
+        {
+            pcmd = &mcu_cmd[i];
+        }
+    }
+    if (pcmd != NULL) done = mcu_cmd_finish(pcmd, MCU_CMD_REPLIED);
+    taskEXIT_CRITICAL();
+
+    if (done != NULL) xSemaphoreGive(done);
+}
+
+//send the held requests, retry or give up those whose reply is late, run from the uart task
+void mcu_cmd_poll(void)
+{
+    uint8 frame[MCU_CMD_LEN];
+    xSemaphoreHandle done;
+    uint32 now;
+    uint8 i, len;
+
+    mcu_cmd_flush();
+    now = mcu_now();
+    for (i = 0; i < MCU_CMD_SLOTS; i++)
+    {
+        done = NULL;
+        len = 0;
+        taskENTER_CRITICAL();
+        if (mcu_cmd[i].seq && (MCU_CMD_PENDING == mcu_cmd[i].state) && ((int32)(now - mcu_cmd[i].due) >= 0))
+        {
+            if (mcu_cmd[i].retry >= MCU_CMD_RETRY)
+            {
+                done = mcu_cmd_finish(&mcu_cmd[i], MCU_CMD_FAILED);
+            }
+            else
+            {
+                mcu_cmd[i].retry++;
+                mcu_cmd[i].due = now + MCU_CMD_TIMEOUT;
+                len = mcu_cmd[i].len;
+                memcpy(frame, mcu_cmd[i].frame, len);
+            }
+        }
+        taskEXIT_CRITICAL();
+
+        if (done != NULL) xSemaphoreGive(done);
+        if (len && (uart_socket != NULL)) uart_write(uart_socket, frame, len);
+    }
 }
 #if 0
 /************************************************* 
@@ -462,9 +723,12 @@ void plc_machine_opt(void *args)
 {
     struct PLC_STATE *pstate = plc_state.pstate;
     uint8 init;
+    uint32 elapsed;
 
     init = plc_state.init;
-    if(init) plc_state.wait_t=0;
+    //the actions count in seconds since the state was entered
+    elapsed = (mcu_now() - plc_state_t0) / 1000;
+    plc_state.wait_t = (elapsed > 0xFF) ? 0xFF : elapsed;
     plc_state.init = 0;
     if(NULL != pstate)
     {
@@ -519,8 +783,27 @@ void local_frame_opt(struct SHS_frame *pframe)
 
 /**************************************************************** 
                         MCU Update
+    The MCU pulls the image, it asks for block seq and gets it back.
+    An empty request is answered with one OTA_BLK_SZ block, stop-and-wait.
+    A request carrying struct UPDATE_REQ gets window blocks of blk_sz
+    from seq on, one per pass of the uart task (mcu_ota_poll), so rx
+    and commands are served in between. The crc field of each holds
+    the CRC16 of the window up to that block, so the MCU checks the
+    window once at its last block and asks again from the first block
+    it is missing. The image header is reloaded from flash when the
+    first request after a restart is not for the header, so the MCU
+    can resume from the block it had reached. Blocks stop at file_sz,
+    the last one may be short.
 ****************************************************************/
 struct UPDATE_FILE mcu_ota_tmp;
+static uint8 mcu_ota_ready;
+static struct
+{
+    uint16 seq;         //next block of the window
+    uint8 left;         //blocks still to send
+    uint8 blk_sz;
+    uint16 crc;         //CRC16 of the window so far
+} mcu_ota_win;
 void initOtaTmp(struct UPDATE_FILE *updatefile)
 {
     mymemcpy(mcu_ota_tmp.file_sz, updatefile->file_sz, 4);
@@ -529,29 +812,66 @@ void initOtaTmp(struct UPDATE_FILE *updatefile)
     mcu_ota_tmp.ver[1] = updatefile->ver[0];
     mcu_ota_tmp.blk_sz = updatefile->blk_sz;
     mymemcpy(mcu_ota_tmp.type, updatefile->type, 8);
+    mcu_ota_ready = 1;
 }
 
-uint8 creatDataPacket(uint16 seq)
+static void mcu_ota_load(void)
+{
+    flash_t flash;
+    struct UPDATE_FILE updatefile;
+
+    flash_stream_read(&flash, MCU_OTA_ADDR, UPDATE_FILE_LEN, (uint8 *)&updatefile);
+    initOtaTmp(&updatefile);
+}
+
+//end of the image data, file_sz is little endian like the other fields
+static uint32 mcu_ota_end(void)
+{
+    uint32 size = mcu_ota_tmp.file_sz[0] | ((uint32)mcu_ota_tmp.file_sz[1]<<8) |
+                  ((uint32)mcu_ota_tmp.file_sz[2]<<16) | ((uint32)mcu_ota_tmp.file_sz[3]<<24);
+
+    if (size > MCU_OTA_ADDR+MCU_OTA_SIZE-(MCU_OTA_DATA_ADDR)) size = MCU_OTA_ADDR+MCU_OTA_SIZE-(MCU_OTA_DATA_ADDR);
+    return(MCU_OTA_DATA_ADDR+size);
+}
+
+//crc NULL: stop-and-wait block, the crc field carries the version
+static uint8 send_data_packet(uint16 seq, uint8 blk_sz, uint16 *crc)
 {
     flash_t flash;
     struct UPDATE *update;
     uint8 *data;
-    int blk_sz;
-    uint8 pac[SHS_FRAME_HEAD+DATA_PAC_LEN+1];
+    uint32 addr, end;
+    uint8 pac[DATA_PAC_MAX];
+
+    addr = MCU_OTA_DATA_ADDR+(uint32)(seq-1)*blk_sz;
+    end = mcu_ota_end();
+    if ((seq == 0) || (addr >= end)) return(0);
+    if (blk_sz > end-addr) blk_sz = end-addr;
 
     pac[0] = CMD_UPDATE;
     update = (struct UPDATE *)&pac[1];
     data = &pac[1+UPDATE_LEN];
-    
-    //blk_sz = mcu_ota_tmp.blk_sz;
-    blk_sz = OTA_BLK_SZ;
+
     mymemcpy(update->seq, &seq, 2);
     update->ack = 1;
-    mymemcpy(update->crc, mcu_ota_tmp.ver, 2);
     update->len = blk_sz;
+    flash_stream_read(&flash, addr, blk_sz, data);
+    if (NULL == crc)
+    {
+        mymemcpy(update->crc, mcu_ota_tmp.ver, 2);
+    }
+    else
+    {
+        *crc = sp_crc16_with_init(*crc, data, blk_sz);
+        word_to_little_bytes(*crc, update->crc);
+    }
+    send_local_frame(pac, 1+UPDATE_LEN+blk_sz);
+    return(1);
+}
 
-    flash_stream_read(&flash, MCU_OTA_DATA_ADDR+(seq-1)*blk_sz, blk_sz, data);
-    send_local_frame(pac, DATA_PAC_LEN);
+uint8 creatDataPacket(uint16 seq)
+{
+    return(send_data_packet(seq, OTA_BLK_SZ, NULL));
 }
 
 uint8 creatFristPacket()
@@ -559,7 +879,7 @@ uint8 creatFristPacket()
     flash_t flash;
     struct UPDATE *update;
     struct UPDATE_FILE *updatefile;
-    uint8 pac[SHS_FRAME_HEAD+FIRST_PAC_LEN+1];
+    uint8 pac[FIRST_PAC_LEN];
 
     pac[0] = CMD_UPDATE;
     update = (struct UPDATE *)&pac[1];
@@ -576,28 +896,62 @@ uint8 creatFristPacket()
     mymemcpy(updatefile->ver, mcu_ota_tmp.ver, 2);
     updatefile->blk_sz = OTA_BLK_SZ;
     send_local_frame(pac, FIRST_PAC_LEN);
+    return(1);
 }
+
+//one block of the pending window per call, from the uart task loop
+void mcu_ota_poll(void)
+{
+    if (mcu_ota_win.left == 0) return;
+    if ((mcu_ota_win.seq == 0xFFFF) || !send_data_packet(mcu_ota_win.seq, mcu_ota_win.blk_sz, &mcu_ota_win.crc))
+    {
+        mcu_ota_win.left = 0;
+        return;
+    }
+    mcu_ota_win.seq++;
+    mcu_ota_win.left--;
+}
+
+//output: number of blocks sent now, the rest of a window follows from mcu_ota_poll()
 uint8 update_frame_opt(uint8 data[], uint8 len)
 {
-    uint8 ret = 0;
+    uint8 blk_sz, window;
     uint16 seq;
     struct UPDATE *pupdate;
+    struct UPDATE_REQ *req;
     pupdate = (struct UPDATE *)&data[0];
     
-    if(len != pupdate->len+sizeof(struct UPDATE)) return(ret);
+    if(len != pupdate->len+sizeof(struct UPDATE)) return(0);
+    //a new request replaces the window the MCU gave up on
+    mcu_ota_win.left = 0;
     seq = little_bytes_to_word(pupdate->seq);
     if (seq == 0)
     {
         return creatFristPacket();
     }
-    else if (seq > 0 && seq != 0xFFFF)
+    else if(seq == 0xFFFF)
     {
-        return creatDataPacket(seq);
+        return(0);
     }
-    else if(seq == 0xFFFF)
+
+    if (!mcu_ota_ready) mcu_ota_load();
+    if (pupdate->len < sizeof(struct UPDATE_REQ))
     {
-        return ret;
+        return creatDataPacket(seq);
     }
+
+    req = (struct UPDATE_REQ *)&data[UPDATE_LEN];
+    blk_sz = req->blk_sz ? req->blk_sz : OTA_BLK_SZ;
+    if (blk_sz > OTA_BLK_MAX) blk_sz = OTA_BLK_MAX;
+    window = req->window ? req->window : 1;
+    if (window > OTA_WIN_MAX) window = OTA_WIN_MAX;
+
+    mcu_ota_win.seq = seq;
+    mcu_ota_win.left = window;
+    mcu_ota_win.blk_sz = blk_sz;
+    mcu_ota_win.crc = 0xFFFF;
+    mcu_ota_poll();
+    return(mcu_ota_win.seq != seq);
 }
 
 /**************************************************************** 
@@ -622,7 +976,8 @@ uint8 remote_frame_opt(struct SHS_frame *pframe)
     else if (CMD_READ == (pframe->infor[0] & 0x07))
     {
         //ret = read_parameter(&pframe->infor[1], pframe->length-1)+1;
-        ret = set_parameter(&pframe->infor[1], pframe->length-1)+1;
+        //replies to our reads, possibly many dids for both channels
+        scatter_parameter(&pframe->infor[1], pframe->length-1);
     }
     else if (CMD_UPDATE == (pframe->infor[0] & 0x07))
     {
@@ -654,6 +1009,13 @@ uint8 frame_handle(uint8 init, void *args)
     struct SHS_frame *pframe = (struct SHS_frame *)args;
 
     if(pframe == NULL) return(0);
+    //the reply is built over the request, so take it off the uart rx ring first
+    if ((uint8 *)pframe != g_frame_buffer)
+    {
+        memcpy(g_frame_buffer, pframe, pframe->length+SHS_FRAME_HEAD+1);
+        pframe = (struct SHS_frame *)g_frame_buffer;
+    }
+    mcu_cmd_reply(pframe);
 
     ret = remote_frame_opt(pframe);
     if (ret > 1)
@@ -667,19 +1029,14 @@ uint8 frame_handle(uint8 init, void *args)
 
 void setOutlet_onoff(uint8 cc, uint8 xx)
 {
-    uint8 buffer[6+SHS_FRAME_HEAD+1] = 
-    {0x7e, 0x00, 0x00 , 0x00, 0x00 , 0x11, 0x11, 
-    0x11 ,0x11 ,0x01 ,0x06, 0x07, 0x12, 0xC0, 0x02, 0x00, 0x00};
-    buffer[15] = cc;
-    buffer[16] = xx;
-    buffer[6+SHS_FRAME_HEAD] = checksum((uint8 *)buffer, SHS_FRAME_HEAD+6);
-    //send_local_frame(buffer, 6);
-    //uart_write_my(buffer, SHS_FRAME_HEAD+6+1);
-    uart_write(uart_socket, buffer, SHS_FRAME_HEAD+6+1);
+    uint8 buffer[6] = {0x07,0x12,0xC0,0x02,0x00,0x00};
+    buffer[4] = cc;
+    buffer[5] = xx;
+    mcu_cmd_send(buffer, 6, MCU_NOWAIT);
 }
 void setMUC_date()
 {
-     uint8 buffer[11+SHS_FRAME_HEAD+1] = {0x07,0x11,0xC0,0x07,0x00,0x00,0x00,0x00,0x00,0x00,0x00};
+     uint8 buffer[11] = {0x07,0x11,0xC0,0x07,0x00,0x00,0x00,0x00,0x00,0x00,0x00};
      struct tm timeinfo;
      
      if (!rtc_isenabled()) return;
@@ -692,12 +1049,12 @@ void setMUC_date()
      buffer[6] = bin2bcd(timeinfo.tm_mday);
      buffer[5] = bin2bcd(timeinfo.tm_mon);
      buffer[4] = bin2bcd(timeinfo.tm_year-2000);
-     send_local_frame(buffer, 11);
+     mcu_cmd_send(buffer, 11, MCU_NOWAIT);
 }
 
 void setOutlet_overvol(uint8 cc, void *args)
 {
-    uint8 buffer[9+SHS_FRAME_HEAD+1] = {0x07,0x11,0xB5,0x05,0x00,0x00,0x00,0x00,0x00};
+    uint8 buffer[9] = {0x07,0x11,0xB5,0x05,0x00,0x00,0x00,0x00,0x00};
     double overvol = *((double *)args);
     float undervol = (cc == 0x01)?(outletstateA.thrvol_under):(outletstateB.thrvol_under);
     
@@ -711,110 +1068,115 @@ void setOutlet_overvol(uint8 cc, void *args)
     numeric2bcd((uint32)(undervol*10), &buffer[7], 2);
 
     //printf("setOutlet_overvol: %f  %d  0x%02x\n",overvol,a,b);
-    send_local_frame(buffer, 9);
+    mcu_cmd_send(buffer, 9, MCU_NOWAIT|MCU_HOLD);
 }
 
 void setOutlet_undervol(uint8 cc, void *args)
 {
-    uint8 buffer[9+SHS_FRAME_HEAD+1] = {0x07,0x11,0xB5,0x05,0x00,0x00,0x00,0x00,0x00};
+    uint8 buffer[9] = {0x07,0x11,0xB5,0x05,0x00,0x00,0x00,0x00,0x00};
     double undervol = *((double *)args);
     float overvol = (cc == 0x01)?(outletstateA.thrvol_over):(outletstateB.thrvol_over);
     
     buffer[4] = cc;
     numeric2bcd((uint32)(overvol*10), &buffer[5], 2);
     numeric2bcd((uint32)(undervol*10), &buffer[7], 2);
-    send_local_frame(buffer, 9);
+    mcu_cmd_send(buffer, 9, MCU_NOWAIT|MCU_HOLD);
 }
 
 void setOutlet_current(uint8 cc, void *args)
 {
-    uint8 buffer[8+SHS_FRAME_HEAD+1] = {0x07,0x21,0xB5,0x04,0x00,0x00,0x00,0x00};
+    uint8 buffer[8] = {0x07,0x21,0xB5,0x04,0x00,0x00,0x00,0x00};
     double current = *((double *)args);
     
     buffer[4] = cc;
     numeric2bcd((uint32)(current*1000), &buffer[5], 3);
-    send_local_frame(buffer, 8);
+    mcu_cmd_send(buffer, 8, MCU_NOWAIT|MCU_HOLD);
 }
 
 void setOutlet_power(uint8 cc, void *args)
 {
-    uint8 buffer[8+SHS_FRAME_HEAD+1] = {0x07,0x30,0xB5,0x04,0x00,0x00,0x00,0x00};
+    uint8 buffer[8] = {0x07,0x30,0xB5,0x04,0x00,0x00,0x00,0x00};
     double power = *((double *)args);
     
     buffer[4] = cc;
     numeric2bcd((uint32)(power*10000), &buffer[5], 3);
-    send_local_frame(buffer, 8);
+    mcu_cmd_send(buffer, 8, MCU_NOWAIT|MCU_HOLD);
 }
 
 void setOutlet_calibrate(uint8 cc, void *args)
 {
-    uint8 buffer[5+SHS_FRAME_HEAD+1] = {0x07,0xAA,0xCC,0x01,0x00};
+    uint8 buffer[5] = {0x07,0xAA,0xCC,0x01,0x00};
     
     buffer[4] = cc;
-    send_local_frame(buffer, 8);
+    mcu_cmd_send(buffer, 5, MCU_NOWAIT);
 }
 
 void getMCU_ver()
 {
-    uint8 buffer[4+SHS_FRAME_HEAD+1] = {0x02,0x01,0x00,0x00};
-    send_local_frame(buffer, 4);
+    uint8 buffer[4] = {0x02,0x01,0x00,0x00};
+    mcu_cmd_send(buffer, 4, MCU_NOWAIT);
 }
 
-void getMCU_onoff(uint8 cc)
+int getMCU_onoff(uint8 cc, uint8 wait)
 {
-    uint8 buffer[5+SHS_FRAME_HEAD+1] = {0x02,0x12,0xC0,0x01,0x00};
+    uint8 buffer[5] = {0x02,0x12,0xC0,0x01,0x00};
     buffer[4] = cc;
-    send_local_frame(buffer, 5);
+    return(mcu_cmd_send(buffer, 5, wait));
 }
 
-void getMCU_meterage(uint8 cc)
+int getMCU_meterage(uint8 cc, uint8 wait)
 {
-    uint8 buffer[5+SHS_FRAME_HEAD+1] = {0x02,0x3F,0xB5,0x01,0x00};
+    uint8 buffer[5] = {0x02,0x3F,0xB5,0x01,0x00};
     buffer[4] = cc;
-    send_local_frame(buffer, 5);
+    return(mcu_cmd_send(buffer, 5, wait));
 }
 
-void getMCU_onoff_meter()
+//read any set of dids for the channels in the mask with one frame
+int getMCU_batch(const uint16 dids[], uint8 did_num, uint8 channels, uint8 wait)
 {
-    uint8 buffer[61+SHS_FRAME_HEAD+1] = {0x02,\
-    0x12,0xC0,0x02,0x01,0x00,0x12,0xC0,0x02,0x02,0x00,\
-    0x3F,0xB5,0x02,0x01,0x00,0x3F,0xB5,0x02,0x02,0x00,\
-    0x30,0xB5,0x02,0x01,0x00,0x30,0xB5,0x02,0x02,0x00,\
-    0x21,0xB5,0x02,0x01,0x00,0x21,0xB5,0x02,0x02,0x00,\
-    0x11,0xB5,0x02,0x01,0x00,0x11,0xB5,0x02,0x02,0x00,\
-    0x10,0x90,0x02,0x01,0x00,0x10,0x90,0x02,0x02,0x00,\
-    };
-    send_local_frame(buffer, 61);
+    uint8 buffer[MCU_CMD_LEN];
+    uint8 len;
+
+    len = build_read_batch(buffer, MCU_CMD_LEN-SHS_FRAME_HEAD-1, dids, did_num, channels);
+    if (0 == len) return(-1);
+    return(mcu_cmd_send(buffer, len, wait));
+}
+
+int getMCU_onoff_meter(uint8 wait)
+{
+    static const uint16 dids[] = {DID_ONOFF, DID_METER, DID_THRPOW, DID_THRCUR, DID_THRVOL, DID_METQUA};
+
+    return(getMCU_batch(dids, ARRAY_SIZE(dids), CHANNEL_ALL, wait));
 }
 void setMCU_WAC_on()
 {
-    uint8 buffer[5+SHS_FRAME_HEAD+1] = {0x07,0x06,0xC0,0x01,0x00};
-    send_local_frame(buffer, 5);
+    uint8 buffer[5] = {0x07,0x06,0xC0,0x01,0x00};
+    mcu_cmd_send(buffer, 5, MCU_NOWAIT);
 }
 void setMCU_WAC_off()
 {
-    uint8 buffer[5+SHS_FRAME_HEAD+1] = {0x07,0x06,0xC0,0x01,0x01};
-    send_local_frame(buffer, 5);
+    uint8 buffer[5] = {0x07,0x06,0xC0,0x01,0x01};
+    mcu_cmd_send(buffer, 5, MCU_NOWAIT);
 }
-void getMCU_thrpow(uint8 cc)
+int getMCU_thrpow(uint8 cc, uint8 wait)
 {
-    uint8 buffer[5+SHS_FRAME_HEAD+1] = {0x02,0x30,0xB5,0x01,0x00};
+    uint8 buffer[5] = {0x02,0x30,0xB5,0x01,0x00};
     buffer[4] = cc;
-    send_local_frame(buffer, 5);
+    return(mcu_cmd_send(buffer, 5, wait));
 }
 
-void getMCU_thrcur(uint8 cc)
+int getMCU_thrcur(uint8 cc, uint8 wait)
 {
-    uint8 buffer[5+SHS_FRAME_HEAD+1] = {0x02,0x21,0xB5,0x01,0x00};
+    uint8 buffer[5] = {0x02,0x21,0xB5,0x01,0x00};
     buffer[4] = cc;
-    send_local_frame(buffer, 5);
+    return(mcu_cmd_send(buffer, 5, wait));
 }
 
-void getMCU_thrvol(uint8 cc)
+int getMCU_thrvol(uint8 cc, uint8 wait)
 {
-    uint8 buffer[5+SHS_FRAME_HEAD+1] = {0x02,0x11,0xB5,0x01,0x00};
+    uint8 buffer[5] = {0x02,0x11,0xB5,0x01,0x00};
     buffer[4] = cc;
-    send_local_frame(buffer, 5);
+    return(mcu_cmd_send(buffer, 5, wait));
 }
 
 uint8 app_handle(uint8 code, void *args)
@@ -909,6 +1271,7 @@ void chg_state(uint8 cur_state)
     static uint8 last_state=INVALID;
     
     plc_state.wait_t = 0;
+    plc_state_t0 = mcu_now();
     plc_state.init=1;
     for(i = 0; i < PLC_SLOT_SZ; i++)
     {
@@ -937,7 +1300,7 @@ void chg_state(uint8 cur_state)
       state_logs[state_idx+1]++;
     #endif
     last_state = plc_state.pstate->cur_state;
-    notify(EV_STATE);
+    plc_post_event(EV_STATE);
 }
 /**************************************************** 
                     ͨЭ
@@ -945,22 +1308,14 @@ void chg_state(uint8 cur_state)
 void scan_uart_opt(void *args)
 {
 	struct SHS_frame *pframe;
-	uint8  idx,len;
-    
-    idx = uart_peek_data(g_frame_buffer, sizeof(g_frame_buffer));
 
-    pframe = get_smart_frame(g_frame_buffer,idx);
-
-    if(NULL == pframe) return;
-
-    idx = (uint8 *)pframe-g_frame_buffer;
-    len = pframe->length+SHS_FRAME_HEAD+1;
-    clear_uart(idx + len);
-    memmove_my(&g_frame_buffer[0], &g_frame_buffer[idx], len);
-    pframe = (struct SHS_frame *)g_frame_buffer;
-    //2СʱͨѶλزоƬ
-    clear_rst_time(pframe);
-    plc_machine_opt(pframe);		    //protocol handle (buffer[i] is a complete frame data)
+    //frames are parsed in place in the uart rx ring, see uart_get_frame()
+    while ((pframe = uart_get_frame(uart_socket)) != NULL)
+    {
+        //2СʱͨѶλزоƬ
+        clear_rst_time(pframe);
+        plc_machine_opt(pframe);		    //protocol handle (pframe is a complete frame)
+    }
 }
 
 /****************************************************************** 
@@ -983,11 +1338,19 @@ void system_init(void)
         EEP_Write(OF_MAGIC_NUM, (uint8 *)&magic, OF_MAGIC_NUM_LEN);
     }
     EEP_Read(OF_PLC_PARAM, (uint8 *)&eep_param, sizeof(eep_param));
+#endif
     /*ʼ״̬*/
     memset_my(&plc_state, 0x00, sizeof(plc_state));
     memset_my(&reg, 0x00, sizeof(reg));
     reg.type = PASSWORD_REG;//ϵע
+    if(plc_evt_queue == NULL)
+    {
+        plc_evt_queue = xQueueCreate(PLC_EVT_QUEUE_LEN, sizeof(uint8));
+        if(xTaskCreate(plc_event_thread, "plc_event", PLC_EVENT_STACK_SIZE, NULL, PLC_EVENT_PRIORITY, NULL) != pdPASS)
+            printf("%s xTaskCreate failed\n", __FUNCTION__);
+    }
     chg_state(RST_PLC);
+#if 0
 //    memset_my((uint8 *)&event, 0x00, sizeof(event));     //¼ʼ
 #if COLOR_DIMMER
     ram.color_change_flag=1;
@@ -1099,47 +1462,9 @@ void task_min(void *args)
 #endif        
 }
 #endif
-//
-void task_sec(void *args)
-{
-	//static uint8 cnt=0;
-
-//	if(cnt++ >=5)
-//	{
-	//	cnt = 0;
-//		GPIO_WriteReverse(RELAY_CTRL1_PORT,RELAY_CTRL1_PIN);
-//	}
-    plc_state.wait_t++;
-}
-void task_20ms(void *args)
-{   
-#if COLOR_DIMMER
-  clour_dimmer_hook( );
-#endif
-}
-//100msΪλİٺ
-void task_100ms(void *args)
-{
-    notify(EV_STATE);
-    uart_tick_hook();
-#if KEY_REG
-    chk_key_pressed();
-#endif
-#if DIMMER
-    dimmer_100ms_hook( );
-#endif
-#if CURTAIN_MOTOR
-    curtain_state_fun();
-#endif
-}
-
-void clr_watchdog(void *args)
-{
-    //IWDG->KR = IWDG_KEY_REFRESH; 
-}
 #if KEY_REG
 //עʼ״̬
-void pressed_key(void *args)
+static void pressed_key(void)
 {
     if (PRESSKEY_REG != reg.type)
     {
@@ -1153,46 +1478,76 @@ void pressed_key(void *args)
 }
 #endif
 
-void state_machine(void *args)
+/****************************************************************
+                        PLC event loop
+    Key presses and state changes are posted to the queue and
+    handled as they arrive, frames are parsed by the uart task
+    (frame_handle). In between the task sleeps until
+    the current state times out or the minute job is due, _END
+    never times out.
+****************************************************************/
+// Wake the PLC event loop, -1 when system_init() has not started it
+int plc_post_event(uint8 ev)
 {
-    plc_machine_opt(NULL);
+    if(plc_evt_queue == NULL) return(-1);
+    xQueueSend(plc_evt_queue, &ev, 0);
+    return(0);
 }
 
-void sys_tick(void *args)
+// ms after entering the current state its action gets the timeout, 0 for none
+static uint32 plc_state_timeout(void)
 {
+    struct PLC_STATE *pstate = plc_state.pstate;
+
+    if((NULL == pstate) || (_END == pstate->cur_state)) return(0);
+    if(RST_PLC == pstate->cur_state) return(MIN_PLC_RUN*1000);
+    //the actions give up once wait_t > MAX_OVERTIME
+    return((MAX_OVERTIME+1)*1000);
 }
 
-const struct task tasks[] =
+static void plc_event_thread(void *param)
 {
-    {EV_RXCHAR, 0,            NULL,  scan_uart_opt},
-    {EV_CLRDOG, ALWAYS_ALIVE, NULL,  clr_watchdog},
-//    {EV_REPORT, 0,            NULL,  event_report},
-    {EV_20MS,   0,            NULL,  task_20ms},
-    {EV_100MS,  0,            NULL,  task_100ms},
-    {EV_SEC,    0,            NULL,  task_sec},
+    uint8 ev;
+    uint32 now, wait, timeout, min_due;
+
+    min_due = mcu_now() + PLC_MIN_PERIOD;
+    while(1)
+    {
+        now = mcu_now();
+        wait = PLC_MIN_PERIOD;
+        if((int32)(min_due - now) <= 0) wait = 0;
+        else if(min_due - now < wait) wait = min_due - now;
+        timeout = plc_state_timeout();
+        if(timeout)
+        {
+            if((int32)(plc_state_t0 + timeout - now) <= 0) wait = 0;
+            else if(plc_state_t0 + timeout - now < wait) wait = plc_state_t0 + timeout - now;
+        }
+
+        if(xQueueReceive(plc_evt_queue, &ev, wait / portTICK_RATE_MS) == pdTRUE)
+        {
+            do
+            {
 #if KEY_REG
-    {EV_KEY,    0,            NULL,  pressed_key},
+                if(EV_KEY == ev) pressed_key();
 #endif
-    {EV_TICK,   ALWAYS_ALIVE, NULL,  sys_tick},
-    {EV_MIN,    0,            NULL,  task_min},
-    {EV_STATE,  0,            NULL,  state_machine},
-};
+                //a new state runs its entry action right away
+                if(EV_STATE == ev) plc_machine_opt(NULL);
+            } while(xQueueReceive(plc_evt_queue, &ev, 0) == pdTRUE);
+        }
 
-void task_handle(void)
-{
-    uint8 i;
-#if 0
-    for (i = 0; i < ARRAY_SIZE(tasks); ++i)
-    {
-        if ((is_task_set(tasks[i].id))
-            || (is_task_always_alive(tasks[i].flags)))
+        now = mcu_now();
+        timeout = plc_state_timeout();
+        if(timeout && ((int32)(plc_state_t0 + timeout - now) <= 0))
         {
-            reset_task(tasks[i].id);
-            tasks[i].handle(tasks[i].args);
+            plc_machine_opt(NULL);
+        }
+        if((int32)(min_due - now) <= 0)
+        {
+            min_due = now + PLC_MIN_PERIOD;
+            task_min(NULL);
         }
     }
-   // wfi();
-#endif
 }
 
 
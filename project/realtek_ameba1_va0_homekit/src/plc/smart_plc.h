@@ -124,8 +124,16 @@ struct UPDATE_FILE
 #define UPDATE_LEN    sizeof(struct UPDATE)
 #define UPDATE_FILE_LEN    sizeof(struct UPDATE_FILE)
 #define FIRST_PAC_LEN    1+UPDATE_LEN+UPDATE_FILE_LEN  // 1 : cmd = 0x05
-#define OTA_BLK_SZ    40
+#define OTA_BLK_SZ    40    // stop-and-wait block
 #define DATA_PAC_LEN    1+UPDATE_LEN+OTA_BLK_SZ  // 1 : cmd = 0x05
+#define OTA_BLK_MAX   128   // windowed block, the frame still fits the uart send buffer
+#define OTA_WIN_MAX   8     // blocks sent for one windowed request
+#define DATA_PAC_MAX    (1+UPDATE_LEN+OTA_BLK_MAX)
+struct UPDATE_REQ       // payload of a data request asking for windowed mode
+{
+    uint8 blk_sz;
+    uint8 window;
+};
 
 #define little_bytes_to_word(byte)  ((uint16)(byte[1]<<8)+byte[0])
 #define word_to_little_bytes(word,byte)  byte[0]=word&0xFF; byte[1]=(word>>8);
@@ -135,51 +143,40 @@ struct UPDATE_FILE
 //#define reset_bit(x, bit) 	do{uint8 cpu_sr; OS_ENTER_CRITICAL();(x) &= ~(1 << (bit));OS_EXIT_CRITICAL();}while(0)
 //#define is_bit_set(x, bit) 	((x) & (1 << (bit)))
 
-extern uint16 task_monitor;
-
-#define notify(task_bit)		//set_bit(task_monitor, task_bit)
-#define is_task_set(task_bit)	//is_bit_set(task_monitor, task_bit)
-#define is_task_always_alive(flags)	(flags & ALWAYS_ALIVE)
-#define reset_task(task_bit) 	//reset_bit(task_monitor, task_bit)
-
-enum
-{
-    EV_CLRDOG,
-	EV_RXCHAR,
-    EV_REPORT,
-    EV_20MS,
-    EV_100MS,
-    EV_SEC,
-    EV_MIN,
-    EV_KEY,
-    EV_TICK,
-    EV_STATE
-};
-enum
-{
-	ALWAYS_ALIVE = 0x01
-};
-struct task
+#define PLC_EVT_QUEUE_LEN   8
+enum                    //events of the PLC event loop
 {
-    uint8 id;
-	uint8 flags;
-    void *args;
-    void (*handle)(void *args);
+    EV_KEY = 1,         //registration key pressed
+    EV_STATE            //chg_state() entered a state
 };
 
 extern struct PLC_MACHINE  plc_state;
 extern struct EEP_PARAM   eep_param;
 extern uint8 g_frame_buffer[MAX_BUFFER_SZ];
 
-void task_handle(void);
+//start the PLC registration and its event loop, the uart task keeps parsing the frames
 void system_init(void);
-void clr_watchdog(void *args);
+int plc_post_event(uint8 ev);
 uint8 creatFristPacket();
 void getMCU_ver();
-void getMCU_onoff(uint8 cc);
-void getMCU_meterage(uint8 cc);
-void getMCU_thrpow(uint8 cc);
-void getMCU_thrcur(uint8 cc);
-void getMCU_thrvol(uint8 cc);
+int getMCU_onoff(uint8 cc, uint8 wait);
+int getMCU_meterage(uint8 cc, uint8 wait);
+int getMCU_thrpow(uint8 cc, uint8 wait);
+int getMCU_thrcur(uint8 cc, uint8 wait);
+int getMCU_thrvol(uint8 cc, uint8 wait);
+int getMCU_onoff_meter(uint8 wait);
+int getMCU_batch(const uint16 dids[], uint8 did_num, uint8 channels, uint8 wait);
+
+struct SHS_frame;
+#define MCU_NOWAIT      0
+#define MCU_WAIT        1
+#define MCU_HOLD        2       //queue for the next mcu_cmd_flush(), the uart task flushes every pass
+void mcu_cmd_init(void);
+int mcu_cmd_send(uint8 buffer[], uint8 len, uint8 wait);
+void mcu_cmd_flush(void);
+int mcu_cmd_wait(int handle);
+void mcu_cmd_reply(struct SHS_frame *pframe);
+void mcu_cmd_poll(void);
+void mcu_ota_poll(void);
 //void init_frame_head(struct SHS_frame * pframe);
 #endif